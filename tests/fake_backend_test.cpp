@@ -0,0 +1,154 @@
+/*
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  * GNU General Public License for more details.
+  *
+  * You should have received a copy of the GNU General Public License
+  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+  *
+  * Additional permission under GNU GPL version 3 section 7
+  *
+  * If you modify this Program, or any covered work, by linking or combining
+  * it with OpenSSL (or a modified version of that library), containing parts
+  * covered by the terms of OpenSSL License and SSLeay License, the licensors
+  * of this Program grant you additional permission to convey the resulting work.
+  *
+  */
+
+/* Starts the fake backend through its plugin API table and checks pause, stop,
+ * get_stats and release. Run through ctest, exits non-zero on a failed check.
+ */
+
+#include "xmrstak/backend/fake/minethd.hpp"
+#include "xmrstak/backend/globalStates.hpp"
+#include "xmrstak/backend/pool_data.hpp"
+#include "xmrstak/misc/executor.hpp"
+#include "xmrstak/params.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+using namespace xmrstak;
+
+namespace
+{
+
+int iFailed = 0;
+
+#define CHECK(cond) \
+	do { if(!(cond)) { printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); iFailed++; } } while(0)
+
+constexpr size_t iDevices = 2;
+
+// Fake threads publish their hash count every 100 ms
+void wait_ticks(size_t n)
+{
+	std::this_thread::sleep_for(std::chrono::milliseconds(100 * n + 50));
+}
+
+bool get_device(const xmrstak_backend_api* api, uint32_t iDevice, xmrstak_device_stats& out)
+{
+	xmrstak_device_stats stats[iDevices];
+	size_t n = api->get_stats(stats, iDevices);
+	for(size_t i = 0; i < std::min(n, iDevices); i++)
+	{
+		if(stats[i].iIndex == iDevice)
+		{
+			out = stats[i];
+			return true;
+		}
+	}
+	return false;
+}
+
+} // namespace
+
+int main()
+{
+	params::inst().fakeDevices = iDevices;
+	executor::inst()->isPause = false;
+
+	const xmrstak_backend_api* api = fake::get_backend_api();
+	CHECK(api->iAbiVersion == XMRSTAK_BACKEND_ABI);
+	CHECK(api->iSize == sizeof(xmrstak_backend_api));
+	CHECK(strcmp(api->sName, "fake") == 0);
+	CHECK((api->iCaps & (XMRSTAK_CAP_PAUSE | XMRSTAK_CAP_STOP | XMRSTAK_CAP_STATS)) ==
+		(XMRSTAK_CAP_PAUSE | XMRSTAK_CAP_STOP | XMRSTAK_CAP_STATS));
+
+	miner_work oStall;
+	CHECK(api->start(0, &oStall) == iDevices);
+	globalStates::inst().iThreadCount = iDevices;
+
+	void* pThreads[iDevices];
+	CHECK(api->get_threads(pThreads, iDevices) == iDevices);
+
+	// Same kind of job the benchmark mines
+	uint8_t bWork[84] = {};
+	miner_work oWork("", bWork, sizeof(bWork), 0, false, 0);
+	pool_data dat;
+	globalStates::inst().switch_work(oWork, dat);
+	wait_ticks(3);
+
+	xmrstak_device_stats dev0, dev1;
+	CHECK(get_device(api, 0, dev0) && dev0.iState == XMRSTAK_DEV_RUNNING && dev0.iThreads == 1);
+	CHECK(get_device(api, 1, dev1) && dev1.iState == XMRSTAK_DEV_RUNNING);
+	CHECK(dev0.iHashes > 0 && dev1.iHashes > 0);
+
+	// Paused devices keep their thread but stop counting hashes
+	CHECK(api->pause(0, 1) == 0);
+	wait_ticks(1);
+	CHECK(get_device(api, 0, dev0) && dev0.iState == XMRSTAK_DEV_PAUSED);
+	uint64_t iPaused = dev0.iHashes;
+	wait_ticks(3);
+	CHECK(get_device(api, 0, dev0) && dev0.iHashes == iPaused);
+	CHECK(get_device(api, 1, dev1) && dev1.iState == XMRSTAK_DEV_RUNNING);
+
+	CHECK(api->pause(0, 0) == 0);
+	wait_ticks(3);
+	CHECK(get_device(api, 0, dev0) && dev0.iState == XMRSTAK_DEV_RUNNING && dev0.iHashes > iPaused);
+
+	// A stopped device stays listed with its last hash count
+	CHECK(api->stop(1) == 0);
+	CHECK(get_device(api, 1, dev1) && dev1.iState == XMRSTAK_DEV_STOPPED);
+	uint64_t iStopped = dev1.iHashes;
+	wait_ticks(3);
+	CHECK(get_device(api, 1, dev1) && dev1.iHashes == iStopped);
+	CHECK(get_device(api, 0, dev0) && dev0.iState == XMRSTAK_DEV_RUNNING);
+
+	CHECK(api->pause(iDevices, 1) == -1);
+	CHECK(api->stop(iDevices) == -1);
+
+	// After release the table knows no threads, the host owns and frees them
+	api->release();
+	CHECK(api->get_threads(pThreads, iDevices) == 0);
+	xmrstak_device_stats stats[iDevices];
+	CHECK(api->get_stats(stats, iDevices) == 0);
+	CHECK(api->pause(0, 1) == -1);
+
+	for(void* p : pThreads)
+		static_cast<iBackend*>(p)->request_quit();
+	for(void* p : pThreads)
+	{
+		iBackend* thd = static_cast<iBackend*>(p);
+		if(thd->oWorkThd.joinable())
+			thd->oWorkThd.join();
+		delete thd;
+	}
+
+	if(iFailed != 0)
+	{
+		printf("%d checks failed\n", iFailed);
+		return 1;
+	}
+	printf("All fake backend checks passed\n");
+	return 0;
+}
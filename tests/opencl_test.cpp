@@ -0,0 +1,348 @@
+/*
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  * GNU General Public License for more details.
+  *
+  * You should have received a copy of the GNU General Public License
+  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+  *
+  * Additional permission under GNU GPL version 3 section 7
+  *
+  * If you modify this Program, or any covered work, by linking or combining
+  * it with OpenSSL (or a modified version of that library), containing parts
+  * covered by the terms of OpenSSL License and SSLeay License, the licensors
+  * of this Program grant you additional permission to convey the resulting work.
+  *
+  */
+
+/* Runs the OpenCL backend on an OpenCL CPU device, e.g. POCL. Run through ctest,
+ * exits non-zero on a failed check and 77 (skipped) if there is no such device.
+ */
+
+#include "xmrstak/backend/amd/amd_gpu/gpu.hpp"
+#include "xmrstak/backend/amd/autoAdjust.hpp"
+#include "xmrstak/backend/amd/verifier.hpp"
+#include "xmrstak/backend/cpu/minethd.hpp"
+#include "xmrstak/jconf.hpp"
+#include "xmrstak/misc/executor.hpp"
+#include "xmrstak/params.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <set>
+#include <vector>
+
+using namespace xmrstak;
+
+namespace
+{
+
+int iFailed = 0;
+
+#define CHECK(cond) \
+	do { if(!(cond)) { printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); iFailed++; } } while(0)
+
+constexpr int iSkipped = 77;
+
+const char* sConfigFile = "opencl_test_config.txt";
+const char* sPoolsFile = "opencl_test_pools.txt";
+
+bool write_file(const char* sFilename, const char* sContent)
+{
+	FILE* f = fopen(sFilename, "wb");
+	if(f == nullptr)
+		return false;
+	bool bOk = fputs(sContent, f) >= 0;
+	return fclose(f) == 0 && bOk;
+}
+
+// the kernels are built for the algorithms of the configured coin
+bool load_config()
+{
+	const char* sConfig =
+		"\"call_timeout\" : 10, \"retry_time\" : 30, \"giveup_limit\" : 0, \"pool_standby\" : 1,\n"
+		"\"pool_adaptive_weight\" : 2.0, \"pool_pin\" : \"\", \"share_rate_limit\" : 0,\n"
+		"\"verbose_level\" : 4, \"print_motd\" : false, \"h_print_time\" : 60,\n"
+		"\"watchdog_drop\" : 0.0, \"watchdog_time\" : 60, \"watchdog_action\" : \"log\",\n"
+		"\"aes_override\" : null, \"use_slow_memory\" : \"warn\", \"tls_secure_algo\" : true,\n"
+		"\"daemon_mode\" : false, \"output_file\" : \"\", \"output_format\" : \"text\", \"log_rate_limit\" : 0,\n"
+		"\"httpd_port\" : 0, \"http_login\" : \"\", \"http_pass\" : \"\", \"prefer_ipv4\" : true,\n";
+	const char* sPools =
+		"\"pool_list\" : [ { \"pool_address\" : \"127.0.0.1:1\", \"wallet_address\" : \"w\", \"rig_id\" : \"\", "
+		"\"pool_password\" : \"x\", \"use_nicehash\" : false, \"use_tls\" : false, \"tls_fingerprint\" : \"\", "
+		"\"pool_weight\" : 1 } ],\n"
+		"\"currency\" : \"bittube\",\n";
+
+	return write_file(sConfigFile, sConfig) && write_file(sPoolsFile, sPools) &&
+		jconf::inst()->parse_config(sConfigFile, sPoolsFile);
+}
+
+// a short search keeps the test within a few minutes on a CPU device
+void test_tune(const GpuContext& dev, int platformIdx)
+{
+	amd::autoAdjust adjust;
+	adjust.iTuneMs = 500;
+	adjust.vTuneWorkSizes = { 8 };
+	adjust.vTuneStridedIdx = { 1 };
+
+	amd::autoAdjust::tuneResult res = adjust.tune(dev, platformIdx, 16, 24);
+	printf("tune: intensity %u, worksize %u, strided_index %d: %.1f H/s\n",
+		unsigned(res.intensity), unsigned(res.workSize), res.stridedIndex, res.fHps);
+
+	CHECK(res.fHps > 0.0);
+	CHECK(res.workSize == 8);
+	CHECK(res.stridedIndex == 1);
+	CHECK(res.intensity != 0 && res.intensity % res.workSize == 0);
+	CHECK(res.intensity <= 24);
+}
+
+GpuContext make_ctx(const GpuContext& dev, size_t iIntensity)
+{
+	GpuContext ctx;
+	ctx.deviceIdx = dev.deviceIdx;
+	ctx.rawIntensity = iIntensity;
+	ctx.workSize = 8;
+	ctx.stridedIndex = 1;
+	ctx.memChunk = 2;
+	ctx.compMode = true;
+	ctx.Nonce = 0;
+	return ctx;
+}
+
+void fill_blob(uint8_t* bBlob, size_t iLen)
+{
+	for(size_t i = 0; i < iLen; i++)
+		bBlob[i] = uint8_t(i * 7 + 1);
+}
+
+// all nonces of [iStart, iStart + iCount) whose CPU hash is below the target
+std::set<uint32_t> cpu_hits(uint8_t* bBlob, size_t iLen, uint64_t iTarget, uint32_t iStart, uint32_t iCount, xmrstak_algo algo)
+{
+	std::set<uint32_t> hits;
+	cryptonight_ctx* cpu_ctx = cpu::minethd::minethd_alloc_ctx();
+	if(cpu_ctx == nullptr)
+		return hits;
+
+	cpu::minethd::cn_hash_fun hash_fun = cpu::minethd::func_selector(jconf::inst()->HaveHardwareAes(), true /*bNoPrefetch*/, algo);
+	for(uint32_t iNonce = iStart; iNonce < iStart + iCount; iNonce++)
+	{
+		uint8_t bResult[32];
+		*(uint32_t*)(bBlob + 39) = iNonce;
+		hash_fun(bBlob, iLen, bResult, cpu_ctx);
+		if(*((uint64_t*)(bResult + 24)) < iTarget)
+			hits.insert(iNonce);
+	}
+	cryptonight_free_ctx(cpu_ctx);
+	return hits;
+}
+
+void add_results(std::vector<uint32_t>& vNonces, const cl_uint* results)
+{
+	vNonces.insert(vNonces.end(), results, results + std::min<cl_uint>(results[0xFF], 0xFF));
+}
+
+/* The GPU threads hand their candidates to the verifier, which rehashes them and queues one
+ * batch per round at the executor. A nonce that is not a hit must only be counted.
+ */
+void test_verifier(const uint8_t* bBlob, size_t iLen, uint64_t iTarget, xmrstak_algo algo,
+	const std::vector<uint32_t>& vNonces, const std::set<uint32_t>& cpu)
+{
+	uint32_t iMiss = 0;
+	while(cpu.count(iMiss) != 0)
+		iMiss++;
+
+	amd::verifier::job oJob;
+	memcpy(oJob.bWorkBlob, bBlob, iLen);
+	oJob.iWorkSize = iLen;
+	oJob.iTarget = iTarget;
+	snprintf(oJob.sJobID, sizeof(oJob.sJobID), "test");
+	oJob.iPoolId = 3;
+	oJob.iJobNo = 1;
+	oJob.iThreadNo = 0;
+	oJob.iGpuIdx = 5;
+	oJob.algo = algo;
+	oJob.vNonces = vNonces;
+	oJob.vNonces.push_back(iMiss);
+
+	amd::verifier::inst().start(1);
+	amd::verifier::inst().push(std::move(oJob));
+	amd::verifier::inst().drain();
+
+	size_t iEvents = 0;
+	std::set<uint32_t> found;
+	ex_event ev;
+	while(executor::inst()->try_pop_event(ev))
+	{
+		iEvents++;
+		CHECK(ev.iName == EV_MINER_HAVE_RESULTS);
+		if(ev.iName != EV_MINER_HAVE_RESULTS)
+			continue;
+		CHECK(ev.iPoolId == 3);
+		CHECK(ev.oResults.iGpuIdx == 5);
+		CHECK(ev.oResults.iInvalid == 1);
+		for(const job_result& res : ev.oResults.vResults)
+		{
+			CHECK(*((uint64_t*)(res.bResult + 24)) < iTarget);
+			found.insert(res.iNonce);
+		}
+	}
+	CHECK(iEvents == 1);
+	CHECK(found == cpu);
+}
+
+/* Runs rounds back to back the way the mining loop does, each XMRRunJob hands back the round
+ * before it and XMRFinishJob the last one. Every nonce of the run is rehashed on the CPU,
+ * the GPU must return exactly the ones below the target. Blobs up to 134 bytes fit in the
+ * padded keccak block, the verifier takes pool blobs of at most 112 bytes.
+ */
+void test_rounds(const GpuContext& dev, int platformIdx, xmrstak_algo algo, size_t iBlobLen)
+{
+	constexpr size_t iIntensity = 64;
+	constexpr size_t iRounds = 4;
+
+	GpuContext ctx = make_ctx(dev, iIntensity);
+	if(InitOpenCL(&ctx, 1, platformIdx) != ERR_SUCCESS)
+	{
+		CHECK(!"InitOpenCL failed");
+		ReleaseOpenCL(&ctx, 1);
+		return;
+	}
+
+	uint8_t bBlob[134];
+	fill_blob(bBlob, iBlobLen);
+	// about four hits per round, far below the 0xFF the result buffer holds
+	uint64_t iTarget = ~uint64_t(0) / iIntensity * 4;
+
+	std::vector<uint32_t> vNonces;
+	const cl_uint* results;
+	bool bOk = XMRSetJob(&ctx, bBlob, iBlobLen, iTarget) == ERR_SUCCESS;
+	CHECK(bOk);
+	for(size_t i = 0; i < iRounds && bOk; i++)
+	{
+		bOk = XMRRunJob(&ctx, results, algo) == ERR_SUCCESS;
+		CHECK(bOk);
+		// nothing is finished after the first call
+		if(i == 0)
+			CHECK(results[0xFF] == 0);
+		add_results(vNonces, results);
+	}
+	bOk = bOk && XMRFinishJob(&ctx, results) == ERR_SUCCESS;
+	CHECK(bOk);
+	add_results(vNonces, results);
+
+	std::set<uint32_t> gpu(vNonces.begin(), vNonces.end());
+	std::set<uint32_t> cpu = cpu_hits(bBlob, iBlobLen, iTarget, 0, iIntensity * iRounds, algo);
+	printf("rounds: %u byte blob, %u nonces, GPU found %u, CPU found %u\n",
+		unsigned(iBlobLen), unsigned(iIntensity * iRounds), unsigned(vNonces.size()), unsigned(cpu.size()));
+	CHECK(!cpu.empty());
+	CHECK(gpu.size() == vNonces.size());
+	CHECK(gpu == cpu);
+
+	// a discarded round never shows up, the next job's round is queued behind it
+	bOk = bOk && XMRRunJob(&ctx, results, algo) == ERR_SUCCESS;
+	XMRDiscardJob(&ctx);
+	bOk = bOk && XMRSetJob(&ctx, bBlob, iBlobLen, iTarget) == ERR_SUCCESS;
+	bOk = bOk && XMRRunJob(&ctx, results, algo) == ERR_SUCCESS;
+	CHECK(bOk);
+	CHECK(results[0xFF] == 0);
+	bOk = bOk && XMRFinishJob(&ctx, results) == ERR_SUCCESS;
+	CHECK(bOk);
+
+	ReleaseOpenCL(&ctx, 1);
+
+	if(iBlobLen <= sizeof(amd::verifier::job::bWorkBlob))
+		test_verifier(bBlob, iBlobLen, iTarget, algo, vNonces, cpu);
+}
+
+uint64_t time_us()
+{
+	using namespace std::chrono;
+	return duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+/* Reports the time per round when the host waits for every round before it queues the next
+ * (the loop before the pipeline) and when one round is always in flight, plus the device idle
+ * time between pipelined rounds taken from the profiling events. Nothing is checked, a CPU
+ * device shares its cores with the host, so the numbers are only printed.
+ */
+void report_idle_gap(const GpuContext& dev, int platformIdx, xmrstak_algo algo)
+{
+	constexpr size_t iIntensity = 64;
+	constexpr size_t iRounds = 8;
+
+	GpuContext ctx = make_ctx(dev, iIntensity);
+	if(InitOpenCL(&ctx, 1, platformIdx) != ERR_SUCCESS)
+	{
+		CHECK(!"InitOpenCL failed");
+		ReleaseOpenCL(&ctx, 1);
+		return;
+	}
+
+	uint8_t bBlob[84];
+	fill_blob(bBlob, sizeof(bBlob));
+	const cl_uint* results;
+	// a zero target finds nothing
+	bool bOk = XMRSetJob(&ctx, bBlob, sizeof(bBlob), 0) == ERR_SUCCESS;
+
+	uint64_t iStart = time_us();
+	for(size_t i = 0; i < iRounds && bOk; i++)
+	{
+		bOk = XMRRunJob(&ctx, results, algo) == ERR_SUCCESS;
+		bOk = bOk && XMRFinishJob(&ctx, results) == ERR_SUCCESS;
+	}
+	uint64_t iSerialUs = time_us() - iStart;
+
+	ctx.iIdleNs = 0;
+	iStart = time_us();
+	for(size_t i = 0; i < iRounds && bOk; i++)
+		bOk = XMRRunJob(&ctx, results, algo) == ERR_SUCCESS;
+	bOk = bOk && XMRFinishJob(&ctx, results) == ERR_SUCCESS;
+	uint64_t iPipelinedUs = time_us() - iStart;
+	CHECK(bOk);
+
+	printf("idle gap: serial %.1f ms/round, pipelined %.1f ms/round, device idle %.1f us/round while pipelined\n",
+		double(iSerialUs) / iRounds / 1000.0, double(iPipelinedUs) / iRounds / 1000.0,
+		double(ctx.iIdleNs) / (iRounds - 1) / 1000.0);
+
+	ReleaseOpenCL(&ctx, 1);
+}
+
+} // namespace
+
+int main()
+{
+	if(!load_config())
+	{
+		printf("could not load the test config\n");
+		return 1;
+	}
+
+	params::inst().openCLVendor = "ANY";
+	params::inst().openCLDeviceType = "CPU";
+
+	int platformIdx = getAMDPlatformIdx();
+	std::vector<GpuContext> vDevices;
+	if(platformIdx != -1)
+		vDevices = getAMDDevices(platformIdx);
+	if(vDevices.empty())
+	{
+		printf("no OpenCL CPU device found, skipping\n");
+		return iSkipped;
+	}
+
+	xmrstak_algo algo = jconf::inst()->GetCurrentCoinSelection().GetDescription(1).GetMiningAlgo();
+	// pools usually send up to 84 bytes, longer blobs reach into the padding of the keccak block
+	for(size_t iBlobLen : { 84, 100, 134 })
+		test_rounds(vDevices[0], platformIdx, algo, iBlobLen);
+	report_idle_gap(vDevices[0], platformIdx, algo);
+	test_tune(vDevices[0], platformIdx);
+
+	return iFailed == 0 ? 0 : 1;
+}
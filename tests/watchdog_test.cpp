@@ -0,0 +1,172 @@
+/*
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  * GNU General Public License for more details.
+  *
+  * You should have received a copy of the GNU General Public License
+  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+  *
+  * Additional permission under GNU GPL version 3 section 7
+  *
+  * If you modify this Program, or any covered work, by linking or combining
+  * it with OpenSSL (or a modified version of that library), containing parts
+  * covered by the terms of OpenSSL License and SSLeay License, the licensors
+  * of this Program grant you additional permission to convey the resulting work.
+  *
+  */
+
+/* Feeds synthetic hash rates to the watchdog and checks when it trips.
+ * Run through ctest, exits non-zero on the first failed check.
+ */
+
+#include "xmrstak/misc/watchdog.hpp"
+
+#include <cmath>
+#include <cstdio>
+#include <limits>
+
+using xmrstak::watchdog;
+
+namespace
+{
+
+int iFailed = 0;
+
+#define CHECK(cond) \
+	do { if(!(cond)) { printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); iFailed++; } } while(0)
+
+constexpr double fDrop = 0.5;
+constexpr uint64_t iHoldMs = 60000;
+const double fNaN = std::numeric_limits<double>::quiet_NaN();
+
+// One sample a second like the executor, returns the second of the first trip or 0
+uint64_t feed(watchdog& wd, size_t iThd, double fHps, uint64_t& iNow, uint64_t iSeconds)
+{
+	uint64_t iTrip = 0;
+	for(uint64_t i = 0; i < iSeconds; i++)
+	{
+		iNow += 1000;
+		if(wd.update(iThd, fHps, iNow, fDrop, iHoldMs) && iTrip == 0)
+			iTrip = iNow;
+	}
+	return iTrip;
+}
+
+void test_warmup()
+{
+	watchdog wd(1);
+	uint64_t iNow = 1000;
+
+	// No rate and zero rates during warm-up never trip
+	CHECK(feed(wd, 0, fNaN, iNow, 100) == 0);
+	CHECK(feed(wd, 0, 100.0, iNow, 30) == 0);
+	CHECK(std::abs(wd.get_baseline(0) - 100.0) < 1e-9);
+}
+
+void test_drop_trips_after_hold()
+{
+	watchdog wd(1);
+	uint64_t iNow = 1000;
+	feed(wd, 0, 100.0, iNow, 30);
+
+	uint64_t iStart = iNow;
+	uint64_t iTrip = feed(wd, 0, 40.0, iNow, 120);
+	// The first low sample starts the period, it trips iHoldMs later
+	CHECK(iTrip == iStart + 1000 + iHoldMs);
+	// Low samples stay out of the baseline
+	CHECK(std::abs(wd.get_baseline(0) - 100.0) < 1e-9);
+	CHECK(wd.low_count() == 1);
+}
+
+void test_small_dip_is_ignored()
+{
+	watchdog wd(1);
+	uint64_t iNow = 1000;
+	feed(wd, 0, 100.0, iNow, 30);
+	CHECK(feed(wd, 0, 60.0, iNow, 300) == 0);
+	CHECK(wd.low_count() == 0);
+}
+
+void test_recovery_ends_low_period()
+{
+	watchdog wd(1);
+	uint64_t iNow = 1000;
+	feed(wd, 0, 100.0, iNow, 30);
+
+	feed(wd, 0, 10.0, iNow, 50);
+	feed(wd, 0, 100.0, iNow, 1);
+	CHECK(wd.low_count() == 0);
+	// The hold time starts again
+	CHECK(feed(wd, 0, 10.0, iNow, 50) == 0);
+}
+
+void test_stopped_thread_trips()
+{
+	watchdog wd(1);
+	uint64_t iNow = 1000;
+	feed(wd, 0, 100.0, iNow, 30);
+	// Once warm, no rate means the thread stopped hashing
+	CHECK(feed(wd, 0, fNaN, iNow, 62) != 0);
+}
+
+void test_clear_low()
+{
+	watchdog wd(2);
+	uint64_t iNow = 1000;
+	for(int i = 0; i < 30; i++)
+	{
+		iNow += 1000;
+		wd.update(0, 100.0, iNow, fDrop, iHoldMs);
+		wd.update(1, 100.0, iNow, fDrop, iHoldMs);
+	}
+	for(int i = 0; i < 50; i++)
+	{
+		iNow += 1000;
+		wd.update(0, 0.0, iNow, fDrop, iHoldMs);
+		wd.update(1, 0.0, iNow, fDrop, iHoldMs);
+	}
+	CHECK(wd.low_count() == 2);
+
+	wd.clear_low();
+	CHECK(wd.low_count() == 0);
+	// Without the earlier 50 s the hold time is not reached yet
+	CHECK(feed(wd, 0, 0.0, iNow, 50) == 0);
+}
+
+void test_reset_thread()
+{
+	watchdog wd(1);
+	uint64_t iNow = 1000;
+	feed(wd, 0, 100.0, iNow, 30);
+	wd.reset_thread(0);
+	CHECK(wd.get_baseline(0) == 0.0);
+	// Learns the new, lower rate instead of tripping on it
+	CHECK(feed(wd, 0, 20.0, iNow, 200) == 0);
+}
+
+} // namespace
+
+int main()
+{
+	test_warmup();
+	test_drop_trips_after_hold();
+	test_small_dip_is_ignored();
+	test_recovery_ends_low_period();
+	test_stopped_thread_trips();
+	test_clear_low();
+	test_reset_thread();
+
+	if(iFailed != 0)
+	{
+		printf("%d checks failed\n", iFailed);
+		return 1;
+	}
+	printf("all checks passed\n");
+	return 0;
+}
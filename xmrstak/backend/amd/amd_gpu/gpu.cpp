@@ -33,6 +33,11 @@
 #include <vector>
 #include <string>
 #include <iostream>
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
 
 #if defined _MSC_VER
 #include <direct.h>
@@ -271,305 +276,497 @@ char* LoadTextFile(const char* filename)
 	return out;
 }
 
-size_t InitOpenCLGpu(cl_context opencl_ctx, GpuContext* ctx, const char* source_code)
+/* Binds all arguments of one round's kernels, none of them change after the start.
+ * The job input and target live in InputBuffer and are updated by XMRSetJob.
+ */
+static size_t SetKernelArgs(GpuContext* ctx, GpuRound& round, int kernel_storage, xmrstak_algo miner_algo)
 {
-	size_t MaximumWorkSize;
 	cl_int ret;
+	cl_ulong numThreads = ctx->rawIntensity;
 
-	if((ret = clGetDeviceInfo(ctx->DeviceID, CL_DEVICE_MAX_WORK_GROUP_SIZE, sizeof(size_t), &MaximumWorkSize, NULL)) != CL_SUCCESS)
+	struct kernel_arg
 	{
-		printer::inst()->print_msg(L1,"Error %s when querying a device's max worksize using clGetDeviceInfo.", err_to_str(ret));
-		return ERR_OCL_API;
+		int kernel;
+		cl_uint idx;
+		size_t size;
+		const void* value;
+	};
+
+	std::vector<kernel_arg> args = {
+		// cn0: input, scratchpads, states, threads
+		{ 0, 0, sizeof(cl_mem), &ctx->InputBuffer },
+		{ 0, 1, sizeof(cl_mem), &ctx->ScratchpadBuffer },
+		{ 0, 2, sizeof(cl_mem), &round.States },
+		{ 0, 3, sizeof(cl_ulong), &numThreads },
+		// cn1: scratchpads, states, threads
+		{ 1, 0, sizeof(cl_mem), &ctx->ScratchpadBuffer },
+		{ 1, 1, sizeof(cl_mem), &round.States },
+		{ 1, 2, sizeof(cl_ulong), &numThreads },
+		// cn2: scratchpads, states, branch 0 to 3, threads
+		{ 2, 0, sizeof(cl_mem), &ctx->ScratchpadBuffer },
+		{ 2, 1, sizeof(cl_mem), &round.States },
+		{ 2, 2, sizeof(cl_mem), round.Branches + 0 },
+		{ 2, 3, sizeof(cl_mem), round.Branches + 1 },
+		{ 2, 4, sizeof(cl_mem), round.Branches + 2 },
+		{ 2, 5, sizeof(cl_mem), round.Branches + 3 },
+		{ 2, 6, sizeof(cl_ulong), &numThreads }
+	};
+
+	if(miner_algo == cryptonight_monero || miner_algo == cryptonight_aeon || miner_algo == cryptonight_bittube || miner_algo == cryptonight_stellite || miner_algo == cryptonight_masari || miner_algo == cryptonight_bittube2)
+	{
+		// cn1: input
+		args.push_back({ 1, 3, sizeof(cl_mem), &ctx->InputBuffer });
 	}
 
-	/* Some kernel spawn 8 times more threads than the user is configuring.
-	 * To give the user the correct maximum work size we divide the hardware specific max by 8.
-	 */
-	MaximumWorkSize /= 8;
-	printer::inst()->print_msg(L1,"Device %lu work size %lu / %lu.", ctx->deviceIdx, ctx->workSize, MaximumWorkSize);
-#if defined(CL_VERSION_2_0) && !defined(CONF_ENFORCE_OpenCL_1_2)
-	const cl_queue_properties CommandQueueProperties[] = { 0, 0, 0 };
-	ctx->CommandQueues = clCreateCommandQueueWithProperties(opencl_ctx, ctx->DeviceID, CommandQueueProperties, &ret);
-#else
-	const cl_command_queue_properties CommandQueueProperties = { 0 };
-	ctx->CommandQueues = clCreateCommandQueue(opencl_ctx, ctx->DeviceID, CommandQueueProperties, &ret);
-#endif
+	// The finalizer kernel is shared by both kernel storages
+	if(kernel_storage == 0)
+	{
+		// Finalize: states, branch 0 to 3, output, input (for the target), threads
+		args.push_back({ 3, 0, sizeof(cl_mem), &round.States });
+		args.push_back({ 3, 1, sizeof(cl_mem), round.Branches + 0 });
+		args.push_back({ 3, 2, sizeof(cl_mem), round.Branches + 1 });
+		args.push_back({ 3, 3, sizeof(cl_mem), round.Branches + 2 });
+		args.push_back({ 3, 4, sizeof(cl_mem), round.Branches + 3 });
+		args.push_back({ 3, 5, sizeof(cl_mem), &round.Output });
+		args.push_back({ 3, 6, sizeof(cl_mem), &ctx->InputBuffer });
+		args.push_back({ 3, 7, sizeof(cl_ulong), &numThreads });
+	}
 
-	if(ret != CL_SUCCESS)
+	for(const kernel_arg& arg : args)
 	{
-		printer::inst()->print_msg(L1,"Error %s when calling clCreateCommandQueueWithProperties.", err_to_str(ret));
-		return ERR_OCL_API;
+		if((ret = clSetKernelArg(round.Kernels[kernel_storage][arg.kernel], arg.idx, arg.size, arg.value)) != CL_SUCCESS)
+		{
+			printer::inst()->print_msg(L1,"Error %s when calling clSetKernelArg for kernel %d, argument %d.", err_to_str(ret), arg.kernel, int(arg.idx));
+			return ERR_OCL_API;
+		}
 	}
 
-	ctx->InputBuffer = clCreateBuffer(opencl_ctx, CL_MEM_READ_ONLY, 88, NULL, &ret);
-	if(ret != CL_SUCCESS)
+	return ERR_SUCCESS;
+}
+
+// Binary cache files start with this magic and the SHA-256 of the binary behind it
+static const char cacheMagic[8] = { 'X', 'S', 'C', 'L', 'B', 'I', 'N', '2' };
+
+/* Everything a driver update can change. A new driver gets new cache file names,
+ * so it never sees the binaries of the old one.
+ */
+static std::string GetDeviceKey(cl_device_id device)
+{
+	const cl_device_info deviceInfos[3] = { CL_DEVICE_NAME, CL_DRIVER_VERSION, CL_DEVICE_VERSION };
+	std::vector<char> infoVec(1024);
+	std::string key;
+
+	for(cl_device_info info : deviceInfos)
 	{
-		printer::inst()->print_msg(L1,"Error %s when calling clCreateBuffer to create input buffer.", err_to_str(ret));
-		return ERR_OCL_API;
+		infoVec[0] = '\0';
+		clGetDeviceInfo(device, info, infoVec.size(), infoVec.data(), NULL);
+		key += infoVec.data();
+		key += '\n';
 	}
 
-	size_t scratchPadSize = std::max(
-		cn_select_memory(::jconf::inst()->GetCurrentCoinSelection().GetDescription(1).GetMiningAlgo()),
-		cn_select_memory(::jconf::inst()->GetCurrentCoinSelection().GetDescription(1).GetMiningAlgoRoot())
-	);
+	cl_platform_id platform;
+	if(clGetDeviceInfo(device, CL_DEVICE_PLATFORM, sizeof(platform), &platform, NULL) == CL_SUCCESS)
+	{
+		infoVec[0] = '\0';
+		clGetPlatformInfo(platform, CL_PLATFORM_VERSION, infoVec.size(), infoVec.data(), NULL);
+		key += infoVec.data();
+	}
 
-	size_t g_thd = ctx->rawIntensity;
-	ctx->ExtraBuffers[0] = clCreateBuffer(opencl_ctx, CL_MEM_READ_WRITE, scratchPadSize * g_thd, NULL, &ret);
-	if(ret != CL_SUCCESS)
+	return key;
+}
+
+static std::string GetBuildOptions(xmrstak_algo miner_algo, size_t workSize, int stridedIndex, int memChunk, int compMode)
+{
+	// scratchpad size for the selected mining algorithm
+	size_t hashMemSize = cn_select_memory(miner_algo);
+	int threadMemMask = cn_select_mask(miner_algo);
+	int hashIterations = cn_select_iter(miner_algo);
+
+	char options[512];
+	snprintf(options, sizeof(options),
+		"-DITERATIONS=%d -DMASK=%d -DWORKSIZE=%llu -DSTRIDED_INDEX=%d -DMEM_CHUNK_EXPONENT=%d  -DCOMP_MODE=%d -DMEMORY=%llu -DALGO=%d",
+		hashIterations, threadMemMask, int_port(workSize), stridedIndex, int(1u<<memChunk), compMode ? 1 : 0,
+		int_port(hashMemSize), int(miner_algo));
+	return options;
+}
+
+// One lock per cache file, threads wanting the same program compile it once and the others load the binary
+static std::mutex& GetCacheFileLock(const std::string& hash_hex_str)
+{
+	static std::mutex mtx;
+	static std::map<std::string, std::unique_ptr<std::mutex>> fileLocks;
+
+	std::unique_lock<std::mutex> lck(mtx);
+	std::unique_ptr<std::mutex>& fileLock = fileLocks[hash_hex_str];
+	if(!fileLock)
+		fileLock.reset(new std::mutex);
+	return *fileLock;
+}
+
+// Returns false if there is no usable binary, a broken one is removed so it gets rebuilt
+static bool LoadCachedProgram(cl_context opencl_ctx, cl_device_id device, size_t deviceIdx, const std::string& cache_file,
+	verbosity lvl, cl_program& program)
+{
+	std::ifstream clBinFile(cache_file, std::ifstream::in | std::ifstream::binary);
+	if(!clBinFile.good())
 	{
-		printer::inst()->print_msg(L1,"Error %s when calling clCreateBuffer to create hash scratchpads buffer.", err_to_str(ret));
-		return ERR_OCL_API;
+		printer::inst()->print_msg(lvl,"OpenCL device %u - Precompiled code %s not found. Compiling ...", deviceIdx, cache_file.c_str());
+		return false;
 	}
 
-	ctx->ExtraBuffers[1] = clCreateBuffer(opencl_ctx, CL_MEM_READ_WRITE, 200 * g_thd, NULL, &ret);
-	if(ret != CL_SUCCESS)
+	std::ostringstream ss;
+	ss << clBinFile.rdbuf();
+	clBinFile.close();
+	std::string s = ss.str();
+
+	const size_t headerSize = sizeof(cacheMagic) + picosha2::k_digest_size;
+	const char* reason = nullptr;
+	if(s.size() <= headerSize || memcmp(s.data(), cacheMagic, sizeof(cacheMagic)) != 0)
+		reason = "has an unknown format";
+	else
 	{
-		printer::inst()->print_msg(L1,"Error %s when calling clCreateBuffer to create hash states buffer.", err_to_str(ret));
-		return ERR_OCL_API;
+		uint8_t digest[picosha2::k_digest_size];
+		picosha2::hash256(s.begin() + headerSize, s.end(), digest, digest + sizeof(digest));
+		if(memcmp(s.data() + sizeof(cacheMagic), digest, sizeof(digest)) != 0)
+			reason = "is corrupted";
 	}
 
-	// Blake-256 branches
-	ctx->ExtraBuffers[2] = clCreateBuffer(opencl_ctx, CL_MEM_READ_WRITE, sizeof(cl_uint) * (g_thd + 2), NULL, &ret);
-	if(ret != CL_SUCCESS)
+	if(reason == nullptr)
 	{
-		printer::inst()->print_msg(L1,"Error %s when calling clCreateBuffer to create Branch 0 buffer.", err_to_str(ret));
-		return ERR_OCL_API;
+		size_t bin_size = s.size() - headerSize;
+		const unsigned char* data_ptr = (const unsigned char*)s.data() + headerSize;
+		cl_int clStatus, ret;
+
+		program = clCreateProgramWithBinary(opencl_ctx, 1, &device, &bin_size, &data_ptr, &clStatus, &ret);
+		if(ret != CL_SUCCESS || clStatus != CL_SUCCESS)
+		{
+			if(ret == CL_SUCCESS)
+				clReleaseProgram(program);
+			reason = "was rejected by the driver";
+		}
+		else if((ret = clBuildProgram(program, 1, &device, NULL, NULL, NULL)) != CL_SUCCESS)
+		{
+			clReleaseProgram(program);
+			reason = "does not build";
+		}
 	}
 
-	// Groestl-256 branches
-	ctx->ExtraBuffers[3] = clCreateBuffer(opencl_ctx, CL_MEM_READ_WRITE, sizeof(cl_uint) * (g_thd + 2), NULL, &ret);
-	if(ret != CL_SUCCESS)
+	if(reason != nullptr)
 	{
-		printer::inst()->print_msg(L1,"Error %s when calling clCreateBuffer to create Branch 1 buffer.", err_to_str(ret));
-		return ERR_OCL_API;
+		printer::inst()->print_msg(L1,"OpenCL device %u - Precompiled code %s %s. Compiling ...", deviceIdx, cache_file.c_str(), reason);
+		std::remove(cache_file.c_str());
+		return false;
 	}
 
-	// JH-256 branches
-	ctx->ExtraBuffers[4] = clCreateBuffer(opencl_ctx, CL_MEM_READ_WRITE, sizeof(cl_uint) * (g_thd + 2), NULL, &ret);
-	if(ret != CL_SUCCESS)
+	printer::inst()->print_msg(lvl, "OpenCL device %u - Load precompiled code from file %s", deviceIdx, cache_file.c_str());
+	return true;
+}
+
+// Written to a temporary file first, a miner killed half way never leaves a truncated binary behind
+static void StoreCachedProgram(cl_program program, cl_device_id device, size_t deviceIdx, const std::string& cache_file, verbosity lvl)
+{
+	cl_int ret;
+	cl_uint num_devices;
+	clGetProgramInfo(program, CL_PROGRAM_NUM_DEVICES, sizeof(cl_uint), &num_devices, NULL);
+
+	std::vector<cl_device_id> devices_ids(num_devices);
+	clGetProgramInfo(program, CL_PROGRAM_DEVICES, sizeof(cl_device_id)* devices_ids.size(), devices_ids.data(), NULL);
+	int dev_id = 0;
+	/* Search for the gpu within the program context.
+	 * The id can be different to  ctx->DeviceID.
+	 */
+	for(auto & ocl_device : devices_ids)
 	{
-		printer::inst()->print_msg(L1,"Error %s when calling clCreateBuffer to create Branch 2 buffer.", err_to_str(ret));
-		return ERR_OCL_API;
+		if(ocl_device == device)
+			break;
+		dev_id++;
 	}
 
-	// Skein-512 branches
-	ctx->ExtraBuffers[5] = clCreateBuffer(opencl_ctx, CL_MEM_READ_WRITE, sizeof(cl_uint) * (g_thd + 2), NULL, &ret);
-	if(ret != CL_SUCCESS)
+	std::vector<size_t> binary_sizes(num_devices);
+	clGetProgramInfo(program, CL_PROGRAM_BINARY_SIZES, sizeof(size_t) * binary_sizes.size(), binary_sizes.data(), NULL);
+
+	std::vector<char*> all_programs(num_devices);
+	std::vector<std::vector<char>> program_storage;
+
+	int p_id = 0;
+	// create memory  structure to query all OpenCL program binaries
+	for(auto & p : all_programs)
 	{
-		printer::inst()->print_msg(L1,"Error %s when calling clCreateBuffer to create Branch 3 buffer.", err_to_str(ret));
-		return ERR_OCL_API;
+		program_storage.emplace_back(std::vector<char>(binary_sizes[p_id]));
+		all_programs[p_id] = program_storage[p_id].data();
+		p_id++;
 	}
 
-	// Assume we may find up to 0xFF nonces in one run - it's reasonable
-	ctx->OutputBuffer = clCreateBuffer(opencl_ctx, CL_MEM_READ_WRITE, sizeof(cl_uint) * 0x100, NULL, &ret);
-	if(ret != CL_SUCCESS)
+	if((ret = clGetProgramInfo(program, CL_PROGRAM_BINARIES, num_devices * sizeof(char*), all_programs.data(), NULL)) != CL_SUCCESS)
 	{
-		printer::inst()->print_msg(L1,"Error %s when calling clCreateBuffer to create output buffer.", err_to_str(ret));
-		return ERR_OCL_API;
+		printer::inst()->print_msg(L1,"Error %s when calling clGetProgramInfo.", err_to_str(ret));
+		return;
 	}
 
-	std::vector<char> devNameVec(1024);
-	if((ret = clGetDeviceInfo(ctx->DeviceID, CL_DEVICE_NAME, devNameVec.size(), devNameVec.data(), NULL)) != CL_SUCCESS)
+	uint8_t digest[picosha2::k_digest_size];
+	picosha2::hash256(program_storage[dev_id].begin(), program_storage[dev_id].end(), digest, digest + sizeof(digest));
+
+	std::string tmp_file = cache_file + ".tmp";
+	std::ofstream file_stream;
+	file_stream.open(tmp_file, std::ofstream::out | std::ofstream::binary);
+	file_stream.write(cacheMagic, sizeof(cacheMagic));
+	file_stream.write((const char*)digest, sizeof(digest));
+	file_stream.write(all_programs[dev_id], binary_sizes[dev_id]);
+	file_stream.close();
+
+	std::remove(cache_file.c_str());
+	if(!file_stream.good() || std::rename(tmp_file.c_str(), cache_file.c_str()) != 0)
 	{
-		printer::inst()->print_msg(L1,"WARNING: %s when calling clGetDeviceInfo to get CL_DEVICE_NAME for device %u.", err_to_str(ret),ctx->deviceIdx );
-		return ERR_OCL_API;
+		std::remove(tmp_file.c_str());
+		printer::inst()->print_msg(L1, "WARNING: OpenCL device %u - Precompiled code could not be stored in file %s", deviceIdx, cache_file.c_str());
+		return;
 	}
+	printer::inst()->print_msg(lvl, "OpenCL device %u - Precompiled code stored in file %s", deviceIdx, cache_file.c_str());
+}
 
-	xmrstak_algo miner_algo[2] = {
-		::jconf::inst()->GetCurrentCoinSelection().GetDescription(1).GetMiningAlgo(),
-		::jconf::inst()->GetCurrentCoinSelection().GetDescription(1).GetMiningAlgoRoot()
-	};
-	int num_algos = miner_algo[0] == miner_algo[1] ? 1 : 2;
+/* Loads the program from the binary cache or compiles and stores it.
+ * The key is the SHA-256 of source code, compile parameters, device name and driver and platform version.
+ * Returns NULL on error.
+ */
+static cl_program BuildProgram(cl_context opencl_ctx, cl_device_id device, size_t deviceIdx, const char* source_code,
+	const std::string& options, verbosity lvl)
+{
+	cl_program program = NULL;
+	cl_int ret;
 
-	for(int ii = 0; ii < num_algos; ++ii)
+	std::string src_str(source_code);
+	src_str += options;
+	src_str += GetDeviceKey(device);
+	std::string hash_hex_str;
+	picosha2::hash256_hex_string(src_str, hash_hex_str);
+
+	std::string cache_file = get_home() + "/.openclcache/" + hash_hex_str + ".openclbin";
+	bool useCache = xmrstak::params::inst().AMDCache;
+
+	std::unique_lock<std::mutex> lck(GetCacheFileLock(hash_hex_str));
+	if(useCache && LoadCachedProgram(opencl_ctx, device, deviceIdx, cache_file, lvl, program))
+		return program;
+
+	program = clCreateProgramWithSource(opencl_ctx, 1, (const char**)&source_code, NULL, &ret);
+	if(ret != CL_SUCCESS)
 	{
-		// scratchpad size for the selected mining algorithm
-		size_t hashMemSize = cn_select_memory(miner_algo[ii]);
-		int threadMemMask = cn_select_mask(miner_algo[ii]);
-		int hashIterations = cn_select_iter(miner_algo[ii]);
-
-		char options[512];
-		snprintf(options, sizeof(options),
-			"-DITERATIONS=%d -DMASK=%d -DWORKSIZE=%llu -DSTRIDED_INDEX=%d -DMEM_CHUNK_EXPONENT=%d  -DCOMP_MODE=%d -DMEMORY=%llu -DALGO=%d",
-		hashIterations, threadMemMask, int_port(ctx->workSize), ctx->stridedIndex, int(1u<<ctx->memChunk), ctx->compMode ? 1 : 0,
-			int_port(hashMemSize), int(miner_algo[ii]));
-		/* create a hash for the compile time cache
-		 * used data:
-		 *   - source code
-		 *   - device name
-		 *   - compile parameter
-		 */
-		std::string src_str(source_code);
-		src_str += options;
-		src_str += devNameVec.data();
-		std::string hash_hex_str;
-		picosha2::hash256_hex_string(src_str, hash_hex_str);
-
-		std::string cache_file = get_home() + "/.openclcache/" + hash_hex_str + ".openclbin";
-		std::ifstream clBinFile(cache_file, std::ofstream::in | std::ofstream::binary);
-		if(xmrstak::params::inst().AMDCache == false || !clBinFile.good())
+		printer::inst()->print_msg(L1,"Error %s when calling clCreateProgramWithSource on the OpenCL miner code", err_to_str(ret));
+		return NULL;
+	}
+
+	ret = clBuildProgram(program, 1, &device, options.c_str(), NULL, NULL);
+	if(ret != CL_SUCCESS)
+	{
+		size_t len;
+		printer::inst()->print_msg(L1,"Error %s when calling clBuildProgram.", err_to_str(ret));
+
+		if((ret = clGetProgramBuildInfo(program, device, CL_PROGRAM_BUILD_LOG, 0, NULL, &len)) != CL_SUCCESS)
 		{
-			if(xmrstak::params::inst().AMDCache)
-				printer::inst()->print_msg(L1,"OpenCL device %u - Precompiled code %s not found. Compiling ...",ctx->deviceIdx, cache_file.c_str());
-			ctx->Program[ii] = clCreateProgramWithSource(opencl_ctx, 1, (const char**)&source_code, NULL, &ret);
-			if(ret != CL_SUCCESS)
-			{
-				printer::inst()->print_msg(L1,"Error %s when calling clCreateProgramWithSource on the OpenCL miner code", err_to_str(ret));
-				return ERR_OCL_API;
-			}
+			printer::inst()->print_msg(L1,"Error %s when calling clGetProgramBuildInfo for length of build log output.", err_to_str(ret));
+			clReleaseProgram(program);
+			return NULL;
+		}
 
-			ret = clBuildProgram(ctx->Program[ii], 1, &ctx->DeviceID, options, NULL, NULL);
-			if(ret != CL_SUCCESS)
-			{
-				size_t len;
-				printer::inst()->print_msg(L1,"Error %s when calling clBuildProgram.", err_to_str(ret));
+		char* BuildLog = (char*)malloc(len + 1);
+		BuildLog[0] = '\0';
 
-				if((ret = clGetProgramBuildInfo(ctx->Program[ii], ctx->DeviceID, CL_PROGRAM_BUILD_LOG, 0, NULL, &len)) != CL_SUCCESS)
-				{
-					printer::inst()->print_msg(L1,"Error %s when calling clGetProgramBuildInfo for length of build log output.", err_to_str(ret));
-					return ERR_OCL_API;
-				}
+		if((ret = clGetProgramBuildInfo(program, device, CL_PROGRAM_BUILD_LOG, len, BuildLog, NULL)) != CL_SUCCESS)
+		{
+			free(BuildLog);
+			printer::inst()->print_msg(L1,"Error %s when calling clGetProgramBuildInfo for build log.", err_to_str(ret));
+			clReleaseProgram(program);
+			return NULL;
+		}
 
-				char* BuildLog = (char*)malloc(len + 1);
-				BuildLog[0] = '\0';
+		printer::inst()->print_str("Build log:\n");
+		std::cerr<<BuildLog<<std::endl;
 
-				if((ret = clGetProgramBuildInfo(ctx->Program[ii], ctx->DeviceID, CL_PROGRAM_BUILD_LOG, len, BuildLog, NULL)) != CL_SUCCESS)
-				{
-					free(BuildLog);
-					printer::inst()->print_msg(L1,"Error %s when calling clGetProgramBuildInfo for build log.", err_to_str(ret));
-					return ERR_OCL_API;
-				}
+		free(BuildLog);
+		clReleaseProgram(program);
+		return NULL;
+	}
 
-				printer::inst()->print_str("Build log:\n");
-				std::cerr<<BuildLog<<std::endl;
+	cl_build_status status;
+	do
+	{
+		if((ret = clGetProgramBuildInfo(program, device, CL_PROGRAM_BUILD_STATUS, sizeof(cl_build_status), &status, NULL)) != CL_SUCCESS)
+		{
+			printer::inst()->print_msg(L1,"Error %s when calling clGetProgramBuildInfo for status of build.", err_to_str(ret));
+			clReleaseProgram(program);
+			return NULL;
+		}
+		port_sleep(1);
+	}
+	while(status == CL_BUILD_IN_PROGRESS);
 
-				free(BuildLog);
-				return ERR_OCL_API;
-			}
+	if(useCache)
+		StoreCachedProgram(program, device, deviceIdx, cache_file, lvl);
 
-			cl_uint num_devices;
-			clGetProgramInfo(ctx->Program[ii], CL_PROGRAM_NUM_DEVICES, sizeof(cl_uint), &num_devices,NULL);
+	return program;
+}
 
+size_t InitOpenCLGpu(cl_context opencl_ctx, GpuContext* ctx, const char* source_code)
+{
+	size_t MaximumWorkSize;
+	cl_int ret;
 
-			std::vector<cl_device_id> devices_ids(num_devices);
-			clGetProgramInfo(ctx->Program[ii], CL_PROGRAM_DEVICES, sizeof(cl_device_id)* devices_ids.size(), devices_ids.data(),NULL);
-			int dev_id = 0;
-			/* Search for the gpu within the program context.
-			 * The id can be different to  ctx->DeviceID.
-			 */
-			for(auto & ocl_device : devices_ids)
-			{
-				if(ocl_device == ctx->DeviceID)
-					break;
-				dev_id++;
-			}
+	if((ret = clGetDeviceInfo(ctx->DeviceID, CL_DEVICE_MAX_WORK_GROUP_SIZE, sizeof(size_t), &MaximumWorkSize, NULL)) != CL_SUCCESS)
+	{
+		printer::inst()->print_msg(L1,"Error %s when querying a device's max worksize using clGetDeviceInfo.", err_to_str(ret));
+		return ERR_OCL_API;
+	}
 
-			cl_build_status status;
-			do
-			{
-				if((ret = clGetProgramBuildInfo(ctx->Program[ii], ctx->DeviceID, CL_PROGRAM_BUILD_STATUS, sizeof(cl_build_status), &status, NULL)) != CL_SUCCESS)
-				{
-					printer::inst()->print_msg(L1,"Error %s when calling clGetProgramBuildInfo for status of build.", err_to_str(ret));
-					return ERR_OCL_API;
-				}
-				port_sleep(1);
-			}
-			while(status == CL_BUILD_IN_PROGRESS);
+	/* Some kernel spawn 8 times more threads than the user is configuring.
+	 * To give the user the correct maximum work size we divide the hardware specific max by 8.
+	 */
+	MaximumWorkSize /= 8;
+	printer::inst()->print_msg(L1,"Device %lu work size %lu / %lu.", ctx->deviceIdx, ctx->workSize, MaximumWorkSize);
+	// Profiling is only on for the main loop queue, it gives the idle gap between rounds
+#if defined(CL_VERSION_2_0) && !defined(CONF_ENFORCE_OpenCL_1_2)
+	const cl_queue_properties CommandQueueProperties[] = { CL_QUEUE_PROPERTIES, CL_QUEUE_PROFILING_ENABLE, 0 };
+	const cl_queue_properties FinishQueueProperties[] = { 0, 0, 0 };
+	ctx->CommandQueues = clCreateCommandQueueWithProperties(opencl_ctx, ctx->DeviceID, CommandQueueProperties, &ret);
+	if(ret == CL_SUCCESS)
+		ctx->FinishQueue = clCreateCommandQueueWithProperties(opencl_ctx, ctx->DeviceID, FinishQueueProperties, &ret);
+#else
+	const cl_command_queue_properties CommandQueueProperties = { CL_QUEUE_PROFILING_ENABLE };
+	const cl_command_queue_properties FinishQueueProperties = { 0 };
+	ctx->CommandQueues = clCreateCommandQueue(opencl_ctx, ctx->DeviceID, CommandQueueProperties, &ret);
+	if(ret == CL_SUCCESS)
+		ctx->FinishQueue = clCreateCommandQueue(opencl_ctx, ctx->DeviceID, FinishQueueProperties, &ret);
+#endif
 
-			if(xmrstak::params::inst().AMDCache)
-			{
-				std::vector<size_t> binary_sizes(num_devices);
-				clGetProgramInfo (ctx->Program[ii], CL_PROGRAM_BINARY_SIZES, sizeof(size_t) * binary_sizes.size(), binary_sizes.data(), NULL);
+	if(ret != CL_SUCCESS)
+	{
+		printer::inst()->print_msg(L1,"Error %s when calling clCreateCommandQueueWithProperties.", err_to_str(ret));
+		return ERR_OCL_API;
+	}
 
-				std::vector<char*> all_programs(num_devices);
-				std::vector<std::vector<char>> program_storage;
+	ctx->evInput = NULL;
+	ctx->InputBuffer = clCreateBuffer(opencl_ctx, CL_MEM_READ_ONLY, sizeof(ctx->JobInput), NULL, &ret);
+	if(ret != CL_SUCCESS)
+	{
+		printer::inst()->print_msg(L1,"Error %s when calling clCreateBuffer to create input buffer.", err_to_str(ret));
+		return ERR_OCL_API;
+	}
 
-				int p_id = 0;
-				size_t mem_size = 0;
-				// create memory  structure to query all OpenCL program binaries
-				for(auto & p : all_programs)
-				{
-					program_storage.emplace_back(std::vector<char>(binary_sizes[p_id]));
-					all_programs[p_id] = program_storage[p_id].data();
-					mem_size += binary_sizes[p_id];
-					p_id++;
-				}
+	size_t scratchPadSize = std::max(
+		cn_select_memory(::jconf::inst()->GetCurrentCoinSelection().GetDescription(1).GetMiningAlgo()),
+		cn_select_memory(::jconf::inst()->GetCurrentCoinSelection().GetDescription(1).GetMiningAlgoRoot())
+	);
 
-				if((ret = clGetProgramInfo(ctx->Program[ii], CL_PROGRAM_BINARIES, num_devices * sizeof(char*), all_programs.data(),NULL)) != CL_SUCCESS)
-				{
-					printer::inst()->print_msg(L1,"Error %s when calling clGetProgramInfo.", err_to_str(ret));
-					return ERR_OCL_API;
-				}
+	size_t g_thd = ctx->rawIntensity;
+	ctx->ScratchpadBuffer = clCreateBuffer(opencl_ctx, CL_MEM_READ_WRITE, scratchPadSize * g_thd, NULL, &ret);
+	if(ret != CL_SUCCESS)
+	{
+		printer::inst()->print_msg(L1,"Error %s when calling clCreateBuffer to create hash scratchpads buffer.", err_to_str(ret));
+		return ERR_OCL_API;
+	}
 
-				std::ofstream file_stream;
-				file_stream.open(cache_file, std::ofstream::out | std::ofstream::binary);
-				file_stream.write(all_programs[dev_id], binary_sizes[dev_id]);
-				file_stream.close();
-				printer::inst()->print_msg(L1, "OpenCL device %u - Precompiled code stored in file %s",ctx->deviceIdx, cache_file.c_str());
-			}
+	// Blake-256, Groestl-256, JH-256 and Skein-512 branches
+	const char* branchNames[4] = { "Blake-256", "Groestl-256", "JH-256", "Skein-512" };
+
+	for(int r = 0; r < 2; ++r)
+	{
+		GpuRound& round = ctx->Rounds[r];
+		round.evStart = round.evHashed = round.evDone = NULL;
+		round.bPending = false;
+
+		round.States = clCreateBuffer(opencl_ctx, CL_MEM_READ_WRITE, 200 * g_thd, NULL, &ret);
+		if(ret != CL_SUCCESS)
+		{
+			printer::inst()->print_msg(L1,"Error %s when calling clCreateBuffer to create hash states buffer %d.", err_to_str(ret), r);
+			return ERR_OCL_API;
 		}
-		else
+
+		for(int b = 0; b < 4; ++b)
 		{
-			printer::inst()->print_msg(L1, "OpenCL device %u - Load precompiled code from file %s",ctx->deviceIdx, cache_file.c_str());
-			std::ostringstream ss;
-			ss << clBinFile.rdbuf();
-			std::string s = ss.str();
-
-			size_t bin_size = s.size();
-			auto data_ptr = s.data();
-
-			cl_int clStatus;
-			ctx->Program[ii] = clCreateProgramWithBinary(
-				opencl_ctx, 1, &ctx->DeviceID, &bin_size,
-				(const unsigned char **)&data_ptr, &clStatus, &ret
-			);
+			round.Branches[b] = clCreateBuffer(opencl_ctx, CL_MEM_READ_WRITE, sizeof(cl_uint) * (g_thd + 2), NULL, &ret);
 			if(ret != CL_SUCCESS)
 			{
-				printer::inst()->print_msg(L1,"Error %s when calling clCreateProgramWithBinary. Try to delete file %s", err_to_str(ret), cache_file.c_str());
-				return ERR_OCL_API;
-			}
-			ret = clBuildProgram(ctx->Program[ii], 1, &ctx->DeviceID, NULL, NULL, NULL);
-			if(ret != CL_SUCCESS)
-			{
-				printer::inst()->print_msg(L1,"Error %s when calling clBuildProgram. Try to delete file %s", err_to_str(ret), cache_file.c_str());
+				printer::inst()->print_msg(L1,"Error %s when calling clCreateBuffer to create %s branch buffer %d.", err_to_str(ret), branchNames[b], r);
 				return ERR_OCL_API;
 			}
 		}
 
-		std::vector<std::string> KernelNames = { "cn0", "cn1", "cn2", "Blake", "Groestl", "JH", "Skein" };
+		// Assume we may find up to 0xFF nonces in one run - it's reasonable
+		round.Output = clCreateBuffer(opencl_ctx, CL_MEM_READ_WRITE, sizeof(cl_uint) * 0x100, NULL, &ret);
+		if(ret != CL_SUCCESS)
+		{
+			printer::inst()->print_msg(L1,"Error %s when calling clCreateBuffer to create output buffer %d.", err_to_str(ret), r);
+			return ERR_OCL_API;
+		}
+
+		// The driver DMAs reads into pinned memory directly, pageable memory goes through a staging copy
+		round.HostOutput = clCreateBuffer(opencl_ctx, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, sizeof(cl_uint) * 0x100, NULL, &ret);
+		if(ret != CL_SUCCESS)
+		{
+			printer::inst()->print_msg(L1,"Error %s when calling clCreateBuffer to create pinned output buffer %d.", err_to_str(ret), r);
+			return ERR_OCL_API;
+		}
+
+		round.Results = (cl_uint*)clEnqueueMapBuffer(ctx->FinishQueue, round.HostOutput, CL_TRUE, CL_MAP_READ | CL_MAP_WRITE, 0,
+			sizeof(cl_uint) * 0x100, 0, NULL, NULL, &ret);
+		if(ret != CL_SUCCESS)
+		{
+			printer::inst()->print_msg(L1,"Error %s when calling clEnqueueMapBuffer to map pinned output buffer %d.", err_to_str(ret), r);
+			return ERR_OCL_API;
+		}
+		round.Results[0xFF] = 0;
+	}
+	ctx->iRound = 0;
+
+	xmrstak_algo miner_algo[2] = {
+		::jconf::inst()->GetCurrentCoinSelection().GetDescription(1).GetMiningAlgo(),
+		::jconf::inst()->GetCurrentCoinSelection().GetDescription(1).GetMiningAlgoRoot()
+	};
+	int num_algos = miner_algo[0] == miner_algo[1] ? 1 : 2;
+
+	for(int ii = 0; ii < num_algos; ++ii)
+	{
+		std::string options = GetBuildOptions(miner_algo[ii], ctx->workSize, ctx->stridedIndex, ctx->memChunk, ctx->compMode);
+		ctx->Program[ii] = BuildProgram(opencl_ctx, ctx->DeviceID, ctx->deviceIdx, source_code, options, L1);
+		if(ctx->Program[ii] == NULL)
+			return ERR_OCL_API;
+
+		std::vector<std::string> KernelNames = { "cn0", "cn1", "cn2", "Finalize" };
 		// append algorithm number to kernel name
 		for(int k = 0; k < 3; k++)
 			KernelNames[k] += std::to_string(miner_algo[ii]);
 
-		if(ii == 0)
+		// Every round has its own kernel objects, so all arguments are bound once here
+		for(int r = 0; r < 2; ++r)
 		{
-			for(int i = 0; i < 7; ++i)
+			GpuRound& round = ctx->Rounds[r];
+			if(ii == 0)
 			{
-				ctx->Kernels[ii][i] = clCreateKernel(ctx->Program[ii], KernelNames[i].c_str(), &ret);
-				if(ret != CL_SUCCESS)
+				for(int i = 0; i < 4; ++i)
 				{
-					printer::inst()->print_msg(L1,"Error %s when calling clCreateKernel for kernel_0 %s.", err_to_str(ret), KernelNames[i].c_str());
-					return ERR_OCL_API;
+					round.Kernels[ii][i] = clCreateKernel(ctx->Program[ii], KernelNames[i].c_str(), &ret);
+					if(ret != CL_SUCCESS)
+					{
+						printer::inst()->print_msg(L1,"Error %s when calling clCreateKernel for kernel_0 %s.", err_to_str(ret), KernelNames[i].c_str());
+						return ERR_OCL_API;
+					}
 				}
 			}
-		}
-		else
-		{
-			for(int i = 0; i < 3; ++i)
+			else
 			{
-				ctx->Kernels[ii][i] = clCreateKernel(ctx->Program[ii], KernelNames[i].c_str(), &ret);
-				if(ret != CL_SUCCESS)
+				for(int i = 0; i < 3; ++i)
 				{
-					printer::inst()->print_msg(L1,"Error %s when calling clCreateKernel for kernel_1 %s.", err_to_str(ret), KernelNames[i].c_str());
-					return ERR_OCL_API;
+					round.Kernels[ii][i] = clCreateKernel(ctx->Program[ii], KernelNames[i].c_str(), &ret);
+					if(ret != CL_SUCCESS)
+					{
+						printer::inst()->print_msg(L1,"Error %s when calling clCreateKernel for kernel_1 %s.", err_to_str(ret), KernelNames[i].c_str());
+						return ERR_OCL_API;
+					}
 				}
-			}
-			// move kernel from the main algorithm into the root algorithm kernel space
-			for(int i = 3; i < 7; ++i)
-			{
-				ctx->Kernels[ii][i] = ctx->Kernels[0][i];
+				// move kernel from the main algorithm into the root algorithm kernel space
+				round.Kernels[ii][3] = round.Kernels[0][3];
 			}
 
+			if((ret = SetKernelArgs(ctx, round, ii, miner_algo[ii])) != ERR_SUCCESS)
+				return ret;
 		}
 	}
 	ctx->Nonce = 0;
@@ -632,6 +829,17 @@ uint32_t getNumPlatforms()
 	return num_platforms;
 }
 
+// device type selected with --openCLDevice, GPU unless asked otherwise
+static cl_device_type getOpenCLDeviceType()
+{
+	const std::string& type = xmrstak::params::inst().openCLDeviceType;
+	if(type == "CPU")
+		return CL_DEVICE_TYPE_CPU;
+	if(type == "ALL")
+		return CL_DEVICE_TYPE_ALL;
+	return CL_DEVICE_TYPE_GPU;
+}
+
 std::vector<GpuContext> getAMDDevices(int index)
 {
 	std::vector<GpuContext> ctxVec;
@@ -652,14 +860,14 @@ std::vector<GpuContext> getAMDDevices(int index)
 		return ctxVec;
 	}
 
-	if((clStatus = clGetDeviceIDs( platforms[index], CL_DEVICE_TYPE_GPU, 0, NULL, &num_devices)) != CL_SUCCESS)
+	if((clStatus = clGetDeviceIDs( platforms[index], getOpenCLDeviceType(), 0, NULL, &num_devices)) != CL_SUCCESS)
 	{
 		printer::inst()->print_msg(L1,"WARNING: %s when calling clGetDeviceIDs for of devices.", err_to_str(clStatus));
 		return ctxVec;
 	}
 
 	device_list.resize(num_devices);
-	if((clStatus = clGetDeviceIDs( platforms[index], CL_DEVICE_TYPE_GPU, num_devices, device_list.data(), NULL)) != CL_SUCCESS)
+	if((clStatus = clGetDeviceIDs( platforms[index], getOpenCLDeviceType(), num_devices, device_list.data(), NULL)) != CL_SUCCESS)
 	{
 		printer::inst()->print_msg(L1,"WARNING: %s when calling clGetDeviceIDs for device information.", err_to_str(clStatus));
 		return ctxVec;
@@ -680,7 +888,8 @@ std::vector<GpuContext> getAMDDevices(int index)
 		bool isNVIDIADevice = devVendor.find("NVIDIA Corporation") != std::string::npos || devVendor.find("NVIDIA") != std::string::npos;
 
 		std::string selectedOpenCLVendor = xmrstak::params::inst().openCLVendor;
-		if((isAMDDevice && selectedOpenCLVendor == "AMD") || (isNVIDIADevice && selectedOpenCLVendor == "NVIDIA"))
+		if((isAMDDevice && selectedOpenCLVendor == "AMD") || (isNVIDIADevice && selectedOpenCLVendor == "NVIDIA") ||
+			selectedOpenCLVendor == "ANY")
 		{
 			GpuContext ctx;
 			std::vector<char> devNameVec(1024);
@@ -721,7 +930,7 @@ std::vector<GpuContext> getAMDDevices(int index)
 			ctx.freeMem = std::min(ctx.freeMem, maxMem);
 			ctx.name = std::string(devNameVec.data());
 			ctx.DeviceID = device_list[k];
-			printer::inst()->print_msg(L0,"Found OpenCL GPU %s.",ctx.name.c_str());
+			printer::inst()->print_msg(L0,"Found OpenCL device %s.",ctx.name.c_str());
 			ctxVec.push_back(ctx);
 		}
 	}
@@ -764,7 +973,18 @@ int getAMDPlatformIdx()
 				platformName.find("Mesa") != std::string::npos;
 			bool isNVIDIADevice = platformName.find("NVIDIA Corporation") != std::string::npos || platformName.find("NVIDIA") != std::string::npos;
 			std::string selectedOpenCLVendor = xmrstak::params::inst().openCLVendor;
-			if((isAMDOpenCL && selectedOpenCLVendor == "AMD") || (isNVIDIADevice && selectedOpenCLVendor == "NVIDIA"))
+			if(selectedOpenCLVendor == "ANY")
+			{
+				// take the first platform which has a device of the selected type
+				cl_uint num_devices = 0;
+				if(clGetDeviceIDs(platforms[i], getOpenCLDeviceType(), 0, NULL, &num_devices) == CL_SUCCESS && num_devices != 0)
+				{
+					printer::inst()->print_msg(L0,"Found platform index id = %i, name = %s", i , platformName.c_str());
+					platformIndex = i;
+					break;
+				}
+			}
+			else if((isAMDOpenCL && selectedOpenCLVendor == "AMD") || (isNVIDIADevice && selectedOpenCLVendor == "NVIDIA"))
 			{
 				printer::inst()->print_msg(L0,"Found %s platform index id = %i, name = %s", selectedOpenCLVendor.c_str(), i , platformName.c_str());
 				if(platformName.find("Mesa") != std::string::npos)
@@ -794,10 +1014,8 @@ int getAMDPlatformIdx()
 // RequestedDeviceIdxs is a list of OpenCL device indexes
 // NumDevicesRequested is number of devices in RequestedDeviceIdxs list
 // Returns 0 on success, -1 on stupid params, -2 on OpenCL API error
-size_t InitOpenCL(GpuContext* ctx, size_t num_gpus, size_t platform_idx)
+static size_t CreateOpenCLContext(GpuContext* ctx, size_t num_gpus, size_t platform_idx, cl_context& opencl_ctx)
 {
-
-	cl_context opencl_ctx;
 	cl_int ret;
 	cl_uint entries;
 
@@ -837,7 +1055,7 @@ size_t InitOpenCL(GpuContext* ctx, size_t num_gpus, size_t platform_idx)
 		printer::inst()->print_msg(L1,"WARNING: using non AMD device: %s", platformName.c_str());
 	}
 
-	if((ret = clGetDeviceIDs(PlatformIDList[platform_idx], CL_DEVICE_TYPE_GPU, 0, NULL, &entries)) != CL_SUCCESS)
+	if((ret = clGetDeviceIDs(PlatformIDList[platform_idx], getOpenCLDeviceType(), 0, NULL, &entries)) != CL_SUCCESS)
 	{
 		printer::inst()->print_msg(L1,"Error %s when calling clGetDeviceIDs for number of devices.", err_to_str(ret));
 		return ERR_OCL_API;
@@ -858,7 +1076,7 @@ size_t InitOpenCL(GpuContext* ctx, size_t num_gpus, size_t platform_idx)
 #else
 	cl_device_id* DeviceIDList = (cl_device_id*)_alloca(entries * sizeof(cl_device_id));
 #endif
-	if((ret = clGetDeviceIDs(PlatformIDList[platform_idx], CL_DEVICE_TYPE_GPU, entries, DeviceIDList, NULL)) != CL_SUCCESS)
+	if((ret = clGetDeviceIDs(PlatformIDList[platform_idx], getOpenCLDeviceType(), entries, DeviceIDList, NULL)) != CL_SUCCESS)
 	{
 		printer::inst()->print_msg(L1,"Error %s when calling clGetDeviceIDs for device ID information.", err_to_str(ret));
 		return ERR_OCL_API;
@@ -883,6 +1101,11 @@ size_t InitOpenCL(GpuContext* ctx, size_t num_gpus, size_t platform_idx)
 		return ERR_OCL_API;
 	}
 
+	return ERR_SUCCESS;
+}
+
+static std::string GetSourceCode()
+{
 	//char* source_code = LoadTextFile(sSourcePath);
 
 	const char *cryptonightCL =
@@ -911,6 +1134,106 @@ size_t InitOpenCL(GpuContext* ctx, size_t num_gpus, size_t platform_idx)
 	source_code = std::regex_replace(source_code, std::regex("XMRSTAK_INCLUDE_BLAKE256"), blake256CL);
 	source_code = std::regex_replace(source_code, std::regex("XMRSTAK_INCLUDE_GROESTL256"), groestl256CL);
 
+	return source_code;
+}
+
+struct ProgramVariant
+{
+	cl_device_id device;
+	size_t deviceIdx;
+	std::string options;
+};
+
+/* All variants a config change or a tuning run may ask for: both algorithms of the selected coin
+ * with every worksize up to the device limit and every strided index mode.
+ */
+static std::vector<ProgramVariant> GetProgramVariants(GpuContext* ctx, size_t num_gpus)
+{
+	xmrstak_algo miner_algo[2] = {
+		::jconf::inst()->GetCurrentCoinSelection().GetDescription(1).GetMiningAlgo(),
+		::jconf::inst()->GetCurrentCoinSelection().GetDescription(1).GetMiningAlgoRoot()
+	};
+	int num_algos = miner_algo[0] == miner_algo[1] ? 1 : 2;
+
+	std::vector<ProgramVariant> variants;
+	for(size_t i = 0; i < num_gpus; ++i)
+	{
+		size_t MaximumWorkSize;
+		if(clGetDeviceInfo(ctx[i].DeviceID, CL_DEVICE_MAX_WORK_GROUP_SIZE, sizeof(size_t), &MaximumWorkSize, NULL) != CL_SUCCESS)
+			continue;
+		// same limit as in InitOpenCLGpu
+		MaximumWorkSize /= 8;
+
+		const size_t workSizes[] = { ctx[i].workSize, 8, 16, 32, 64, 128, 256 };
+		for(int ii = 0; ii < num_algos; ++ii)
+		{
+			for(size_t workSize : workSizes)
+			{
+				if(workSize > MaximumWorkSize)
+					continue;
+
+				for(int stridedIndex = 0; stridedIndex <= 2; ++stridedIndex)
+				{
+					ProgramVariant variant = { ctx[i].DeviceID, ctx[i].deviceIdx,
+						GetBuildOptions(miner_algo[ii], workSize, stridedIndex, ctx[i].memChunk, ctx[i].compMode) };
+
+					auto same = [&variant](const ProgramVariant& v) { return v.device == variant.device && v.options == variant.options; };
+					if(std::find_if(variants.begin(), variants.end(), same) == variants.end())
+						variants.push_back(std::move(variant));
+				}
+			}
+		}
+	}
+
+	return variants;
+}
+
+// Returns the number of variants that failed to build
+static size_t CompileVariants(cl_context opencl_ctx, const std::string& source_code, const std::vector<ProgramVariant>& variants,
+	size_t iThreads, verbosity lvl)
+{
+	std::atomic<size_t> iNext(0);
+	std::atomic<size_t> iFailed(0);
+
+	auto work = [&]()
+	{
+		size_t i;
+		while((i = iNext++) < variants.size())
+		{
+			cl_program program = BuildProgram(opencl_ctx, variants[i].device, variants[i].deviceIdx, source_code.c_str(), variants[i].options, lvl);
+			if(program == NULL)
+				iFailed++;
+			else
+				clReleaseProgram(program);
+		}
+	};
+
+	std::vector<std::thread> vWorkers;
+	for(size_t i = 1; i < iThreads && i < variants.size(); ++i)
+		vWorkers.emplace_back(work);
+	work();
+	for(std::thread& thd : vWorkers)
+		thd.join();
+
+	return iFailed;
+}
+
+// RequestedDeviceIdxs is a list of OpenCL device indexes
+// NumDevicesRequested is number of devices in RequestedDeviceIdxs list
+// Returns 0 on success, -1 on stupid params, -2 on OpenCL API error
+size_t InitOpenCL(GpuContext* ctx, size_t num_gpus, size_t platform_idx)
+{
+	cl_context opencl_ctx;
+	size_t ret;
+
+	if((ret = CreateOpenCLContext(ctx, num_gpus, platform_idx, opencl_ctx)) != ERR_SUCCESS)
+		return ret;
+
+	for(size_t i = 0; i < num_gpus; ++i)
+		ctx[i].OpenCLCtx = opencl_ctx;
+
+	std::string source_code = GetSourceCode();
+
 	// create a directory  for the OpenCL compile cache
 	create_directory(get_home() + "/.openclcache");
 
@@ -923,190 +1246,168 @@ size_t InitOpenCL(GpuContext* ctx, size_t num_gpus, size_t platform_idx)
 			const std::string backendName = xmrstak::params::inst().openCLVendor;
 			printer::inst()->print_msg(L0, "WARNING %s: gpu %d intensity is not a multiple of 'worksize', auto reduce intensity to %d", backendName.c_str(), ctx[i].deviceIdx, int(reduced_intensity));
 		}
+	}
 
-		if((ret = InitOpenCLGpu(opencl_ctx, &ctx[i], source_code.c_str())) != ERR_SUCCESS)
-		{
-			return ret;
-		}
+	// The GPUs are set up in parallel, most of the time goes into compiling their kernels
+	std::vector<size_t> vRet(num_gpus, ERR_SUCCESS);
+	std::vector<std::thread> vInit;
+	for(size_t i = 0; i < num_gpus; ++i)
+		vInit.emplace_back([&, i]() { vRet[i] = InitOpenCLGpu(opencl_ctx, &ctx[i], source_code.c_str()); });
+	for(std::thread& thd : vInit)
+		thd.join();
+
+	for(size_t i = 0; i < num_gpus; ++i)
+	{
+		if(vRet[i] != ERR_SUCCESS)
+			return vRet[i];
 	}
 
 	return ERR_SUCCESS;
 }
 
-size_t XMRSetJob(GpuContext* ctx, uint8_t* input, size_t input_len, uint64_t target, xmrstak_algo miner_algo)
+void WarmOpenCLCache(GpuContext* ctx, size_t num_gpus)
 {
-	// switch to the kernel storage 
-	int kernel_storage = miner_algo == ::jconf::inst()->GetCurrentCoinSelection().GetDescription(1).GetMiningAlgo() ? 0 : 1;
+	if(!xmrstak::params::inst().AMDCache || num_gpus == 0)
+		return;
 
-	cl_int ret;
+	/* One variant at a time so the CPU miners hardly notice.
+	 * A miner closed half way through is fine, a binary is only stored once complete.
+	 */
+	cl_context opencl_ctx = ctx[0].OpenCLCtx;
+	clRetainContext(opencl_ctx);
+	std::vector<ProgramVariant> variants = GetProgramVariants(ctx, num_gpus);
+	std::thread([opencl_ctx, variants]() {
+		CompileVariants(opencl_ctx, GetSourceCode(), variants, 1, L3);
+		clReleaseContext(opencl_ctx);
+	}).detach();
+}
 
-	if(input_len > 84)
-		return ERR_STUPID_PARAMS;
+size_t PrecompileOpenCL(GpuContext* ctx, size_t num_gpus, size_t platform_idx)
+{
+	cl_context opencl_ctx;
+	size_t ret;
 
-	input[input_len] = 0x01;
-	memset(input + input_len + 1, 0, 88 - input_len - 1);
+	if((ret = CreateOpenCLContext(ctx, num_gpus, platform_idx, opencl_ctx)) != ERR_SUCCESS)
+		return ret;
 
-	size_t numThreads = ctx->rawIntensity;
+	std::string source_code = GetSourceCode();
+	create_directory(get_home() + "/.openclcache");
 
-	if((ret = clEnqueueWriteBuffer(ctx->CommandQueues, ctx->InputBuffer, CL_TRUE, 0, 88, input, 0, NULL, NULL)) != CL_SUCCESS)
-	{
-		printer::inst()->print_msg(L1,"Error %s when calling clEnqueueWriteBuffer to fill input buffer.", err_to_str(ret));
-		return ERR_OCL_API;
-	}
+	std::vector<ProgramVariant> variants = GetProgramVariants(ctx, num_gpus);
+	size_t iThreads = std::max(std::thread::hardware_concurrency(), 1u);
+	printer::inst()->print_msg(L0, "Precompiling %u OpenCL kernel variants with %u threads ...", unsigned(variants.size()), unsigned(iThreads));
 
-	if((ret = clSetKernelArg(ctx->Kernels[kernel_storage][0], 0, sizeof(cl_mem), &ctx->InputBuffer)) != CL_SUCCESS)
-	{
-		printer::inst()->print_msg(L1,"Error %s when calling clSetKernelArg for kernel 0, argument 0.", err_to_str(ret));
-		return ERR_OCL_API;
-	}
+	size_t iFailed = CompileVariants(opencl_ctx, source_code, variants, iThreads, L1);
+	clReleaseContext(opencl_ctx);
 
-	// Scratchpads
-	if((ret = clSetKernelArg(ctx->Kernels[kernel_storage][0], 1, sizeof(cl_mem), ctx->ExtraBuffers + 0)) != CL_SUCCESS)
+	if(iFailed != 0)
 	{
-		printer::inst()->print_msg(L1,"Error %s when calling clSetKernelArg for kernel 0, argument 1.", err_to_str(ret));
+		printer::inst()->print_msg(L0, "ERROR: %u of %u OpenCL kernel variants failed to build.", unsigned(iFailed), unsigned(variants.size()));
 		return ERR_OCL_API;
 	}
 
-	// States
-	if((ret = clSetKernelArg(ctx->Kernels[kernel_storage][0], 2, sizeof(cl_mem), ctx->ExtraBuffers + 1)) != CL_SUCCESS)
-	{
-		printer::inst()->print_msg(L1,"Error %s when calling clSetKernelArg for kernel 0, argument 2.", err_to_str(ret));
-		return ERR_OCL_API;
-	}
+	printer::inst()->print_msg(L0, "All %u OpenCL kernel variants are in the cache.", unsigned(variants.size()));
+	return ERR_SUCCESS;
+}
 
-	// Threads
-	if((ret = clSetKernelArg(ctx->Kernels[kernel_storage][0], 3, sizeof(cl_ulong), &numThreads)) != CL_SUCCESS)
-	{
-		printer::inst()->print_msg(L1,"Error %s when calling clSetKernelArg for kernel 0, argument 3.", err_to_str(ret));
-		return(ERR_OCL_API);
-	}
+size_t XMRSetJob(GpuContext* ctx, uint8_t* input, size_t input_len, uint64_t target)
+{
+	cl_int ret;
 
-	// CN1 Kernel
+	// The blob and the first padding byte have to fit in front of the last padding bit at byte 135
+	if(input_len > 134)
+		return ERR_STUPID_PARAMS;
 
-	// Scratchpads
-	if((ret = clSetKernelArg(ctx->Kernels[kernel_storage][1], 0, sizeof(cl_mem), ctx->ExtraBuffers + 0)) != CL_SUCCESS)
+	// The write of the last job may still read from JobInput
+	if(ctx->evInput != NULL)
 	{
-		printer::inst()->print_msg(L1,"Error %s when calling clSetKernelArg for kernel 1, argument 0.", err_to_str(ret));
-		return ERR_OCL_API;
+		clWaitForEvents(1, &ctx->evInput);
+		clReleaseEvent(ctx->evInput);
+		ctx->evInput = NULL;
 	}
 
-	// States
-	if((ret = clSetKernelArg(ctx->Kernels[kernel_storage][1], 1, sizeof(cl_mem), ctx->ExtraBuffers + 1)) != CL_SUCCESS)
+	memcpy(ctx->JobInput, input, input_len);
+	ctx->JobInput[input_len] = 0x01;
+	memset(ctx->JobInput + input_len + 1, 0, 136 - input_len - 1);
+	memcpy(ctx->JobInput + 136, &target, sizeof(target));
+
+	// Queued in front of the next cn0, the finalizers read the target after cn2 so they see it too
+	if((ret = clEnqueueWriteBuffer(ctx->CommandQueues, ctx->InputBuffer, CL_FALSE, 0, sizeof(ctx->JobInput), ctx->JobInput, 0, NULL, &ctx->evInput)) != CL_SUCCESS)
 	{
-		printer::inst()->print_msg(L1,"Error %s when calling clSetKernelArg for kernel 1, argument 1.", err_to_str(ret));
+		printer::inst()->print_msg(L1,"Error %s when calling clEnqueueWriteBuffer to fill input buffer.", err_to_str(ret));
 		return ERR_OCL_API;
 	}
 
-	// Threads
-	if((ret = clSetKernelArg(ctx->Kernels[kernel_storage][1], 2, sizeof(cl_ulong), &numThreads)) != CL_SUCCESS)
-	{
-		printer::inst()->print_msg(L1,"Error %s when calling clSetKernelArg for kernel 1, argument 2.", err_to_str(ret));
-		return(ERR_OCL_API);
-	}
+	return ERR_SUCCESS;
+}
 
-	if(miner_algo == cryptonight_monero || miner_algo == cryptonight_aeon || miner_algo == cryptonight_bittube || miner_algo == cryptonight_stellite || miner_algo == cryptonight_masari || miner_algo == cryptonight_bittube2)
+static void ReleaseRoundEvents(GpuRound& round)
+{
+	cl_event* events[3] = { &round.evStart, &round.evHashed, &round.evDone };
+	for(cl_event* ev : events)
 	{
-		// Input
-		if ((ret = clSetKernelArg(ctx->Kernels[kernel_storage][1], 3, sizeof(cl_mem), &ctx->InputBuffer)) != CL_SUCCESS)
+		if(*ev != NULL)
 		{
-			printer::inst()->print_msg(L1, "Error %s when calling clSetKernelArg for kernel 1, arugment 4(input buffer).", err_to_str(ret));
-			return ERR_OCL_API;
+			clReleaseEvent(*ev);
+			*ev = NULL;
 		}
 	}
+}
 
-	// CN3 Kernel
-	// Scratchpads
-	if((ret = clSetKernelArg(ctx->Kernels[kernel_storage][2], 0, sizeof(cl_mem), ctx->ExtraBuffers + 0)) != CL_SUCCESS)
-	{
-		printer::inst()->print_msg(L1,"Error %s when calling clSetKernelArg for kernel 2, argument 0.", err_to_str(ret));
-		return ERR_OCL_API;
-	}
-
-	// States
-	if((ret = clSetKernelArg(ctx->Kernels[kernel_storage][2], 1, sizeof(cl_mem), ctx->ExtraBuffers + 1)) != CL_SUCCESS)
-	{
-		printer::inst()->print_msg(L1,"Error %s when calling clSetKernelArg for kernel 2, argument 1.", err_to_str(ret));
-		return ERR_OCL_API;
-	}
-
-	// Branch 0
-	if((ret = clSetKernelArg(ctx->Kernels[kernel_storage][2], 2, sizeof(cl_mem), ctx->ExtraBuffers + 2)) != CL_SUCCESS)
-	{
-		printer::inst()->print_msg(L1,"Error %s when calling clSetKernelArg for kernel 2, argument 2.", err_to_str(ret));
-		return ERR_OCL_API;
-	}
-
-	// Branch 1
-	if((ret = clSetKernelArg(ctx->Kernels[kernel_storage][2], 3, sizeof(cl_mem), ctx->ExtraBuffers + 3)) != CL_SUCCESS)
-	{
-		printer::inst()->print_msg(L1,"Error %s when calling clSetKernelArg for kernel 2, argument 3.", err_to_str(ret));
-		return ERR_OCL_API;
-	}
+/* Waits for the results of a round, the only point where the host waits for the GPU.
+ * The main loop queue keeps working on the next round meanwhile.
+ */
+static size_t FinishRound(GpuContext* ctx, GpuRound& round, const cl_uint*& HashOutput)
+{
+	cl_int ret;
+	round.bPending = false;
 
-	// Branch 2
-	if((ret = clSetKernelArg(ctx->Kernels[kernel_storage][2], 4, sizeof(cl_mem), ctx->ExtraBuffers + 4)) != CL_SUCCESS)
+	if((ret = clWaitForEvents(1, &round.evDone)) != CL_SUCCESS)
 	{
-		printer::inst()->print_msg(L1,"Error %s when calling clSetKernelArg for kernel 2, argument 4.", err_to_str(ret));
+		printer::inst()->print_msg(L1,"Error %s when calling clWaitForEvents to fetch results.", err_to_str(ret));
+		ReleaseRoundEvents(round);
 		return ERR_OCL_API;
 	}
 
-	// Branch 3
-	if((ret = clSetKernelArg(ctx->Kernels[kernel_storage][2], 5, sizeof(cl_mem), ctx->ExtraBuffers + 5)) != CL_SUCCESS)
+	// cn2 of the round before ended at iLastHashedNs, anything until our cn0 started the device had nothing to do
+	cl_ulong iStart = 0, iEnd = 0;
+	if(clGetEventProfilingInfo(round.evStart, CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &iStart, NULL) == CL_SUCCESS &&
+		clGetEventProfilingInfo(round.evHashed, CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &iEnd, NULL) == CL_SUCCESS)
 	{
-		printer::inst()->print_msg(L1,"Error %s when calling clSetKernelArg for kernel 2, argument 5.", err_to_str(ret));
-		return ERR_OCL_API;
+		if(ctx->iLastHashedNs != 0 && iStart > ctx->iLastHashedNs)
+			ctx->iIdleNs += iStart - ctx->iLastHashedNs;
+		ctx->iLastHashedNs = iEnd;
+		if(round.bStale && iEnd > iStart)
+			ctx->iStaleNs += iEnd - iStart;
 	}
+	ReleaseRoundEvents(round);
 
-	// Threads
-	if((ret = clSetKernelArg(ctx->Kernels[kernel_storage][2], 6, sizeof(cl_ulong), &numThreads)) != CL_SUCCESS)
+	if(round.bStale)
 	{
-		printer::inst()->print_msg(L1,"Error %s when calling clSetKernelArg for kernel 2, argument 6.", err_to_str(ret));
-		return(ERR_OCL_API);
+		round.bStale = false;
+		return ERR_SUCCESS;
 	}
 
-	for(int i = 0; i < 4; ++i)
-	{
-		// States
-		if((ret = clSetKernelArg(ctx->Kernels[kernel_storage][i + 3], 0, sizeof(cl_mem), ctx->ExtraBuffers + 1)) != CL_SUCCESS)
-		{
-			printer::inst()->print_msg(L1,"Error %s when calling clSetKernelArg for kernel %d, argument %d.", err_to_str(ret), i + 3, 0);
-			return ERR_OCL_API;
-		}
-
-		// Nonce buffer
-		if((ret = clSetKernelArg(ctx->Kernels[kernel_storage][i + 3], 1, sizeof(cl_mem), ctx->ExtraBuffers + (i + 2))) != CL_SUCCESS)
-		{
-			printer::inst()->print_msg(L1,"Error %s when calling clSetKernelArg for kernel %d, argument %d.", err_to_str(ret), i + 3, 1);
-			return ERR_OCL_API;
-		}
-
-		// Output
-		if((ret = clSetKernelArg(ctx->Kernels[kernel_storage][i + 3], 2, sizeof(cl_mem), &ctx->OutputBuffer)) != CL_SUCCESS)
-		{
-			printer::inst()->print_msg(L1,"Error %s when calling clSetKernelArg for kernel %d, argument %d.", err_to_str(ret), i + 3, 2);
-			return ERR_OCL_API;
-		}
-
-		// Target
-		if((ret = clSetKernelArg(ctx->Kernels[kernel_storage][i + 3], 3, sizeof(cl_ulong), &target)) != CL_SUCCESS)
-		{
-			printer::inst()->print_msg(L1,"Error %s when calling clSetKernelArg for kernel %d, argument %d.", err_to_str(ret), i + 3, 3);
-			return ERR_OCL_API;
-		}
-	}
+	auto & numHashValues = round.Results[0xFF];
+	// avoid out of memory read, we have only storage for 0xFF results
+	if(numHashValues > 0xFF)
+		numHashValues = 0xFF;
 
+	HashOutput = round.Results;
 	return ERR_SUCCESS;
 }
 
-size_t XMRRunJob(GpuContext* ctx, cl_uint* HashOutput, xmrstak_algo miner_algo)
+// Handed out while there are no results, so the callers never see a null pointer
+static const cl_uint noResults[0x100] = {};
+
+size_t XMRRunJob(GpuContext* ctx, const cl_uint*& HashOutput, xmrstak_algo miner_algo)
 {
 	// switch to the kernel storage
 	int kernel_storage = miner_algo == ::jconf::inst()->GetCurrentCoinSelection().GetDescription(1).GetMiningAlgo() ? 0 : 1;
 	
 	cl_int ret;
-	cl_uint zero = 0;
-	size_t BranchNonces[4];
-	memset(BranchNonces,0,sizeof(size_t)*4);
+	// Source of non blocking writes, has to outlive the call
+	static const cl_uint zero = 0;
 
 	size_t g_intensity = ctx->rawIntensity;
 	size_t w_size = ctx->workSize;
@@ -1120,25 +1421,27 @@ size_t XMRRunJob(GpuContext* ctx, cl_uint* HashOutput, xmrstak_algo miner_algo)
 		assert(g_thd%w_size == 0);
 	}
 
-	for(int i = 2; i < 6; ++i)
+	// This slot's last round was finished by the call before
+	GpuRound& round = ctx->Rounds[ctx->iRound];
+	HashOutput = noResults;
+
+	for(int i = 0; i < 4; ++i)
 	{
-		if((ret = clEnqueueWriteBuffer(ctx->CommandQueues, ctx->ExtraBuffers[i], CL_FALSE, sizeof(cl_uint) * g_intensity, sizeof(cl_uint), &zero, 0, NULL, NULL)) != CL_SUCCESS)
+		if((ret = clEnqueueWriteBuffer(ctx->CommandQueues, round.Branches[i], CL_FALSE, sizeof(cl_uint) * g_intensity, sizeof(cl_uint), &zero, 0, NULL, NULL)) != CL_SUCCESS)
 		{
-			printer::inst()->print_msg(L1,"Error %s when calling clEnqueueWriteBuffer to zero branch buffer counter %d.", err_to_str(ret), i - 2);
+			printer::inst()->print_msg(L1,"Error %s when calling clEnqueueWriteBuffer to zero branch buffer counter %d.", err_to_str(ret), i);
 			return ERR_OCL_API;
 		}
 	}
 
-	if((ret = clEnqueueWriteBuffer(ctx->CommandQueues, ctx->OutputBuffer, CL_FALSE, sizeof(cl_uint) * 0xFF, sizeof(cl_uint), &zero, 0, NULL, NULL)) != CL_SUCCESS)
+	if((ret = clEnqueueWriteBuffer(ctx->CommandQueues, round.Output, CL_FALSE, sizeof(cl_uint) * 0xFF, sizeof(cl_uint), &zero, 0, NULL, NULL)) != CL_SUCCESS)
 	{
-		printer::inst()->print_msg(L1,"Error %s when calling clEnqueueReadBuffer to fetch results.", err_to_str(ret));
+		printer::inst()->print_msg(L1,"Error %s when calling clEnqueueWriteBuffer to zero the result counter.", err_to_str(ret));
 		return ERR_OCL_API;
 	}
 
-	clFinish(ctx->CommandQueues);
-
 	size_t Nonce[2] = {ctx->Nonce, 1}, gthreads[2] = { g_thd, 8 }, lthreads[2] = { w_size, 8 };
-	if((ret = clEnqueueNDRangeKernel(ctx->CommandQueues, ctx->Kernels[kernel_storage][0], 2, Nonce, gthreads, lthreads, 0, NULL, NULL)) != CL_SUCCESS)
+	if((ret = clEnqueueNDRangeKernel(ctx->CommandQueues, round.Kernels[kernel_storage][0], 2, Nonce, gthreads, lthreads, 0, NULL, &round.evStart)) != CL_SUCCESS)
 	{
 		printer::inst()->print_msg(L1,"Error %s when calling clEnqueueNDRangeKernel for kernel %d.", err_to_str(ret), 0);
 		return ERR_OCL_API;
@@ -1146,80 +1449,133 @@ size_t XMRRunJob(GpuContext* ctx, cl_uint* HashOutput, xmrstak_algo miner_algo)
 
 	size_t tmpNonce = ctx->Nonce;
 
-	if((ret = clEnqueueNDRangeKernel(ctx->CommandQueues, ctx->Kernels[kernel_storage][1], 1, &tmpNonce, &g_thd, &w_size, 0, NULL, NULL)) != CL_SUCCESS)
+	if((ret = clEnqueueNDRangeKernel(ctx->CommandQueues, round.Kernels[kernel_storage][1], 1, &tmpNonce, &g_thd, &w_size, 0, NULL, NULL)) != CL_SUCCESS)
 	{
 		printer::inst()->print_msg(L1,"Error %s when calling clEnqueueNDRangeKernel for kernel %d.", err_to_str(ret), 1);
+		ReleaseRoundEvents(round);
 		return ERR_OCL_API;
 	}
 
-	if((ret = clEnqueueNDRangeKernel(ctx->CommandQueues, ctx->Kernels[kernel_storage][2], 2, Nonce, gthreads, lthreads, 0, NULL, NULL)) != CL_SUCCESS)
+	if((ret = clEnqueueNDRangeKernel(ctx->CommandQueues, round.Kernels[kernel_storage][2], 2, Nonce, gthreads, lthreads, 0, NULL, &round.evHashed)) != CL_SUCCESS)
 	{
 		printer::inst()->print_msg(L1,"Error %s when calling clEnqueueNDRangeKernel for kernel %d.", err_to_str(ret), 2);
+		ReleaseRoundEvents(round);
 		return ERR_OCL_API;
 	}
 
-	if((ret = clEnqueueReadBuffer(ctx->CommandQueues, ctx->ExtraBuffers[2], CL_FALSE, sizeof(cl_uint) * g_intensity, sizeof(cl_uint), BranchNonces, 0, NULL, NULL)) != CL_SUCCESS)
+	// Finalizers and read back go to the other queue so the next round's cn0 does not wait for them.
+	// One slice per branch, each big enough for all threads of the round
+	size_t g_slice = ((g_intensity + w_size - 1u) / w_size) * w_size;
+	size_t g_final = g_slice * 4;
+	if((ret = clEnqueueNDRangeKernel(ctx->FinishQueue, round.Kernels[kernel_storage][3], 1, &tmpNonce, &g_final, &w_size, 1, &round.evHashed, NULL)) != CL_SUCCESS)
 	{
-		printer::inst()->print_msg(L1,"Error %s when calling clEnqueueReadBuffer to fetch results.", err_to_str(ret));
+		printer::inst()->print_msg(L1,"Error %s when calling clEnqueueNDRangeKernel for kernel %d.", err_to_str(ret), 3);
+		ReleaseRoundEvents(round);
 		return ERR_OCL_API;
 	}
 
-	if((ret = clEnqueueReadBuffer(ctx->CommandQueues, ctx->ExtraBuffers[3], CL_FALSE, sizeof(cl_uint) * g_intensity, sizeof(cl_uint), BranchNonces + 1, 0, NULL, NULL)) != CL_SUCCESS)
+	if((ret = clEnqueueReadBuffer(ctx->FinishQueue, round.Output, CL_FALSE, 0, sizeof(cl_uint) * 0x100, round.Results, 0, NULL, &round.evDone)) != CL_SUCCESS)
 	{
 		printer::inst()->print_msg(L1,"Error %s when calling clEnqueueReadBuffer to fetch results.", err_to_str(ret));
+		ReleaseRoundEvents(round);
 		return ERR_OCL_API;
 	}
 
-	if((ret = clEnqueueReadBuffer(ctx->CommandQueues, ctx->ExtraBuffers[4], CL_FALSE, sizeof(cl_uint) * g_intensity, sizeof(cl_uint), BranchNonces + 2, 0, NULL, NULL)) != CL_SUCCESS)
-	{
-		printer::inst()->print_msg(L1,"Error %s when calling clEnqueueReadBuffer to fetch results.", err_to_str(ret));
-		return ERR_OCL_API;
-	}
+	clFlush(ctx->CommandQueues);
+	clFlush(ctx->FinishQueue);
 
-	if((ret = clEnqueueReadBuffer(ctx->CommandQueues, ctx->ExtraBuffers[5], CL_FALSE, sizeof(cl_uint) * g_intensity, sizeof(cl_uint), BranchNonces + 3, 0, NULL, NULL)) != CL_SUCCESS)
-	{
-		printer::inst()->print_msg(L1,"Error %s when calling clEnqueueReadBuffer to fetch results.", err_to_str(ret));
-		return ERR_OCL_API;
-	}
+	round.Nonce = ctx->Nonce;
+	round.bPending = true;
+	ctx->Nonce += g_intensity;
+	ctx->iRound ^= 1;
 
-	clFinish(ctx->CommandQueues);
+	GpuRound& prev = ctx->Rounds[ctx->iRound];
+	if(prev.bPending)
+		return FinishRound(ctx, prev, HashOutput);
 
-	for(int i = 0; i < 4; ++i)
+	return ERR_SUCCESS;
+}
+
+size_t XMRFinishJob(GpuContext* ctx, const cl_uint*& HashOutput)
+{
+	size_t ret = ERR_SUCCESS;
+	HashOutput = noResults;
+
+	GpuRound& prev = ctx->Rounds[ctx->iRound ^ 1];
+	if(prev.bPending)
+		ret = FinishRound(ctx, prev, HashOutput);
+
+	// The idle gap is only measured while rounds follow each other
+	ctx->iLastHashedNs = 0;
+	return ret;
+}
+
+void XMRDiscardJob(GpuContext* ctx)
+{
+	// OpenCL can't stop a kernel, the GPU finishes the round but nobody waits for it
+	GpuRound& prev = ctx->Rounds[ctx->iRound ^ 1];
+	if(prev.bPending)
+		prev.bStale = true;
+}
+
+static void ReleaseCL(cl_mem& obj) { if(obj != NULL) { clReleaseMemObject(obj); obj = NULL; } }
+static void ReleaseCL(cl_kernel& obj) { if(obj != NULL) { clReleaseKernel(obj); obj = NULL; } }
+static void ReleaseCL(cl_program& obj) { if(obj != NULL) { clReleaseProgram(obj); obj = NULL; } }
+static void ReleaseCL(cl_command_queue& obj) { if(obj != NULL) { clFinish(obj); clReleaseCommandQueue(obj); obj = NULL; } }
+
+void ReleaseOpenCL(GpuContext* ctx, size_t num_gpus)
+{
+	for(size_t i = 0; i < num_gpus; ++i)
 	{
-		if(BranchNonces[i])
+		for(GpuRound& round : ctx[i].Rounds)
 		{
-			// Threads
-			if((clSetKernelArg(ctx->Kernels[kernel_storage][i + 3], 4, sizeof(cl_ulong), BranchNonces + i)) != CL_SUCCESS)
+			if(round.Results != nullptr)
 			{
-				printer::inst()->print_msg(L1,"Error %s when calling clSetKernelArg for kernel %d, argument %d.", err_to_str(ret), i + 3, 4);
-				return(ERR_OCL_API);
+				clEnqueueUnmapMemObject(ctx[i].FinishQueue, round.HostOutput, round.Results, 0, NULL, NULL);
+				round.Results = nullptr;
 			}
+		}
 
-			// round up to next multiple of w_size
-			BranchNonces[i] = ((BranchNonces[i] + w_size - 1u) / w_size) * w_size;
-			// number of global threads must be a multiple of the work group size (w_size)
-			assert(BranchNonces[i]%w_size == 0);
-			size_t tmpNonce = ctx->Nonce;
-			if((ret = clEnqueueNDRangeKernel(ctx->CommandQueues, ctx->Kernels[kernel_storage][i + 3], 1, &tmpNonce, BranchNonces + i, &w_size, 0, NULL, NULL)) != CL_SUCCESS)
-			{
-				printer::inst()->print_msg(L1,"Error %s when calling clEnqueueNDRangeKernel for kernel %d.", err_to_str(ret), i + 3);
-				return ERR_OCL_API;
-			}
+		// Anything still queued finishes before its buffers go away
+		ReleaseCL(ctx[i].CommandQueues);
+		ReleaseCL(ctx[i].FinishQueue);
+
+		if(ctx[i].evInput != NULL)
+		{
+			clReleaseEvent(ctx[i].evInput);
+			ctx[i].evInput = NULL;
 		}
+
+		for(GpuRound& round : ctx[i].Rounds)
+		{
+			ReleaseRoundEvents(round);
+			round.bPending = false;
+			round.bStale = false;
+
+			// Kernels[1][3] is the finalizer of kernel storage 0
+			round.Kernels[1][3] = NULL;
+			for(int s = 0; s < 2; ++s)
+				for(int k = 0; k < 4; ++k)
+					ReleaseCL(round.Kernels[s][k]);
+
+			ReleaseCL(round.States);
+			for(cl_mem& branch : round.Branches)
+				ReleaseCL(branch);
+			ReleaseCL(round.Output);
+			ReleaseCL(round.HostOutput);
+		}
+
+		for(cl_program& program : ctx[i].Program)
+			ReleaseCL(program);
+		ReleaseCL(ctx[i].InputBuffer);
+		ReleaseCL(ctx[i].ScratchpadBuffer);
 	}
 
-	if((ret = clEnqueueReadBuffer(ctx->CommandQueues, ctx->OutputBuffer, CL_TRUE, 0, sizeof(cl_uint) * 0x100, HashOutput, 0, NULL, NULL)) != CL_SUCCESS)
+	// All contexts of one InitOpenCL call share the OpenCL context
+	if(num_gpus != 0 && ctx[0].OpenCLCtx != NULL)
 	{
-		printer::inst()->print_msg(L1,"Error %s when calling clEnqueueReadBuffer to fetch results.", err_to_str(ret));
-		return ERR_OCL_API;
+		clReleaseContext(ctx[0].OpenCLCtx);
+		for(size_t i = 0; i < num_gpus; ++i)
+			ctx[i].OpenCLCtx = NULL;
 	}
-
-	clFinish(ctx->CommandQueues);
-	auto & numHashValues = HashOutput[0xFF];
-	// avoid out of memory read, we have only storage for 0xFF results
-	if(numHashValues > 0xFF)
-		numHashValues = 0xFF;
-	ctx->Nonce += g_intensity;
-
-	return ERR_SUCCESS;
 }
@@ -17,7 +17,30 @@
 #define ERR_OCL_API (2)
 #define ERR_STUPID_PARAMS (1)
 
+/* Two rounds are in flight per GPU, each one has its own hash states, branch and output buffers.
+ * The scratchpads are shared, so the cn0 of a round still waits for the cn2 of the one before,
+ * but the finalizers and the read back of a round overlap the next round's main loop.
+ */
+struct GpuRound
+{
+	cl_mem States = NULL;
+	cl_mem Branches[4] = {};
+	cl_mem Output = NULL;
+
+	cl_event evStart = NULL;  // cn0, for the idle gap
+	cl_event evHashed = NULL; // cn2, the finalizers may start
+	cl_event evDone = NULL;   // results are on the host
 
+	// [kernel storage][cn0, cn1, cn2, Finalize] with this round's buffers bound
+	cl_kernel Kernels[2][4] = {};
+
+	// Pinned host memory, mapped for the life of the context, the results are read straight into it
+	cl_mem HostOutput = NULL;
+	cl_uint* Results = nullptr;
+	size_t Nonce;
+	bool bPending = false;
+	bool bStale = false; // the job was replaced, the results are dropped
+};
 
 struct GpuContext
 {
@@ -32,18 +55,30 @@ struct GpuContext
 
 	/*Output vars*/
 	cl_device_id DeviceID;
-	cl_command_queue CommandQueues;
-	cl_mem InputBuffer;
-	cl_mem OutputBuffer;
-	cl_mem ExtraBuffers[6];
-	cl_program Program[2];
-	cl_kernel Kernels[2][8];
+	// shared by all contexts set up by the same InitOpenCL call
+	cl_context OpenCLCtx = NULL;
+	cl_command_queue CommandQueues = NULL; // cn0 to cn2
+	cl_command_queue FinishQueue = NULL;   // finalizers and results
+	cl_mem InputBuffer = NULL;
+	cl_mem ScratchpadBuffer = NULL;
+	// Blob padded to the full 136 byte keccak block followed by the target,
+	// source of the non blocking input write
+	uint8_t JobInput[144];
+	cl_event evInput = NULL;
+	GpuRound Rounds[2];
+	size_t iRound;
+	cl_program Program[2] = {};
 	size_t freeMem;
 	int computeUnits;
 	std::string name;
 
 	uint32_t Nonce;
 
+	// Device idle time between the end of one round's cn2 and the start of the next cn0
+	uint64_t iIdleNs = 0;
+	uint64_t iLastHashedNs = 0;
+	// Device time of rounds dropped because their job was replaced by a new block or pool
+	uint64_t iStaleNs = 0;
 };
 
 uint32_t getNumPlatforms();
@@ -51,7 +86,22 @@ int getAMDPlatformIdx();
 std::vector<GpuContext> getAMDDevices(int index);
 
 size_t InitOpenCL(GpuContext* ctx, size_t num_gpus, size_t platform_idx);
-size_t XMRSetJob(GpuContext* ctx, uint8_t* input, size_t input_len, uint64_t target, xmrstak_algo miner_algo);
-size_t XMRRunJob(GpuContext* ctx, cl_uint* HashOutput, xmrstak_algo miner_algo);
+// Compiles the kernel variants not in use into the binary cache on a background thread
+void WarmOpenCLCache(GpuContext* ctx, size_t num_gpus);
+// Frees everything InitOpenCL created, also after a failed InitOpenCL
+void ReleaseOpenCL(GpuContext* ctx, size_t num_gpus);
+// Fills the binary cache with every kernel variant for the configured devices, no buffers are created
+size_t PrecompileOpenCL(GpuContext* ctx, size_t num_gpus, size_t platform_idx);
+// The round still in flight has to be collected by XMRFinishJob or dropped by XMRDiscardJob first
+size_t XMRSetJob(GpuContext* ctx, uint8_t* input, size_t input_len, uint64_t target);
+/* Starts a round at ctx->Nonce and points HashOutput to the results of the round started by the call before,
+ * HashOutput[0xFF] is zero if there was none. The results are only valid until the next XMR*Job call.
+ */
+size_t XMRRunJob(GpuContext* ctx, const cl_uint*& HashOutput, xmrstak_algo miner_algo);
+// Returns the results of the round still in flight, if any
+size_t XMRFinishJob(GpuContext* ctx, const cl_uint*& HashOutput);
+// Drops the results of the round still in flight without waiting for it, the next job's first round
+// is queued right behind it and the host collects it meanwhile
+void XMRDiscardJob(GpuContext* ctx);
 
 
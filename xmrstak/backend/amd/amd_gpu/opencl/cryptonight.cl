@@ -478,20 +478,20 @@ __kernel void JOIN(cn0,ALGO)(__global ulong *input, __global uint4 *Scratchpad,
 		Scratchpad += get_group_id(0) * (MEMORY >> 4) * WORKSIZE + MEM_CHUNK * get_local_id(0);
 #endif
 
+		// The host pads the blob up to the whole keccak block, so its length doesn't matter here
 		((ulong8 *)State)[0] = vload8(0, input);
-		State[8] = input[8];
-		State[9] = input[9];
-		State[10] = input[10];
+		((ulong8 *)State)[1] = vload8(1, input);
+		State[16] = input[16];
 
 		((uint *)State)[9] &= 0x00FFFFFFU;
 		((uint *)State)[9] |= ((get_global_id(0)) & 0xFF) << 24;
 		((uint *)State)[10] &= 0xFF000000U;
 		((uint *)State)[10] |= ((get_global_id(0) >> 8));
 
-		for(int i = 11; i < 25; ++i) State[i] = 0x00UL;
+		for(int i = 17; i < 25; ++i) State[i] = 0x00UL;
 
 		// Last bit of padding
-		State[16] = 0x8000000000000000UL;
+		State[16] |= 0x8000000000000000UL;
 
 		keccakf1600_2(State);
 	}
@@ -905,62 +905,55 @@ R"===(
 
 #define VSWAP4(x)	((((x) >> 24) & 0xFFU) | (((x) >> 8) & 0xFF00U) | (((x) << 8) & 0xFF0000U) | (((x) << 24) & 0xFF000000U))
 
-__kernel void Skein(__global ulong *states, __global uint *BranchBuf, __global uint *output, ulong Target, ulong Threads)
+void SkeinFinal(__global ulong *states, __global uint *BranchBuf, __global uint *output, ulong Target, uint idx)
 {
-	const ulong idx = get_global_id(0) - get_global_offset(0);
+	states += 25 * BranchBuf[idx];
 
-	// do not use early return here
-	if(idx < Threads)
-	{
-		states += 25 * BranchBuf[idx];
+	// skein
+	ulong8 h = vload8(0, SKEIN512_256_IV);
 
-		// skein
-		ulong8 h = vload8(0, SKEIN512_256_IV);
+	// Type field begins with final bit, first bit, then six bits of type; the last 96
+	// bits are input processed (including in the block to be processed with that tweak)
+	// The output transform is only one run of UBI, since we need only 256 bits of output
+	// The tweak for the output transform is Type = Output with the Final bit set
+	// T[0] for the output is 8, and I don't know why - should be message size...
+	ulong t[3] = { 0x00UL, 0x7000000000000000UL, 0x00UL };
+	ulong8 p, m;
 
-		// Type field begins with final bit, first bit, then six bits of type; the last 96
-		// bits are input processed (including in the block to be processed with that tweak)
-		// The output transform is only one run of UBI, since we need only 256 bits of output
-		// The tweak for the output transform is Type = Output with the Final bit set
-		// T[0] for the output is 8, and I don't know why - should be message size...
-		ulong t[3] = { 0x00UL, 0x7000000000000000UL, 0x00UL };
-		ulong8 p, m;
+	for(uint i = 0; i < 4; ++i)
+	{
+		t[0] += i < 3 ? 0x40UL : 0x08UL;
 
-		for(uint i = 0; i < 4; ++i)
-		{
-			t[0] += i < 3 ? 0x40UL : 0x08UL;
+		t[2] = t[0] ^ t[1];
 
-			t[2] = t[0] ^ t[1];
+		m = (i < 3) ? vload8(i, states) : (ulong8)(states[24], 0UL, 0UL, 0UL, 0UL, 0UL, 0UL, 0UL);
+		const ulong h8 = h.s0 ^ h.s1 ^ h.s2 ^ h.s3 ^ h.s4 ^ h.s5 ^ h.s6 ^ h.s7 ^ SKEIN_KS_PARITY;
+		p = Skein512Block(m, h, h8, t);
 
-			m = (i < 3) ? vload8(i, states) : (ulong8)(states[24], 0UL, 0UL, 0UL, 0UL, 0UL, 0UL, 0UL);
-			const ulong h8 = h.s0 ^ h.s1 ^ h.s2 ^ h.s3 ^ h.s4 ^ h.s5 ^ h.s6 ^ h.s7 ^ SKEIN_KS_PARITY;
-			p = Skein512Block(m, h, h8, t);
+		h = m ^ p;
 
-			h = m ^ p;
+		t[1] = i < 2 ? 0x3000000000000000UL : 0xB000000000000000UL;
+	}
 
-			t[1] = i < 2 ? 0x3000000000000000UL : 0xB000000000000000UL;
-		}
+	t[0] = 0x08UL;
+	t[1] = 0xFF00000000000000UL;
+	t[2] = t[0] ^ t[1];
 
-		t[0] = 0x08UL;
-		t[1] = 0xFF00000000000000UL;
-		t[2] = t[0] ^ t[1];
+	p = (ulong8)(0);
+	const ulong h8 = h.s0 ^ h.s1 ^ h.s2 ^ h.s3 ^ h.s4 ^ h.s5 ^ h.s6 ^ h.s7 ^ SKEIN_KS_PARITY;
 
-		p = (ulong8)(0);
-		const ulong h8 = h.s0 ^ h.s1 ^ h.s2 ^ h.s3 ^ h.s4 ^ h.s5 ^ h.s6 ^ h.s7 ^ SKEIN_KS_PARITY;
+	p = Skein512Block(p, h, h8, t);
 
-		p = Skein512Block(p, h, h8, t);
+	//vstore8(p, 0, output);
 
-		//vstore8(p, 0, output);
-
-		// Note that comparison is equivalent to subtraction - we can't just compare 8 32-bit values
-		// and expect an accurate result for target > 32-bit without implementing carries
-		if(p.s3 <= Target)
-		{
-			ulong outIdx = atomic_inc(output + 0xFF);
-			if(outIdx < 0xFF)
-				output[outIdx] = BranchBuf[idx] + get_global_offset(0);
-		}
+	// Note that comparison is equivalent to subtraction - we can't just compare 8 32-bit values
+	// and expect an accurate result for target > 32-bit without implementing carries
+	if(p.s3 <= Target)
+	{
+		ulong outIdx = atomic_inc(output + 0xFF);
+		if(outIdx < 0xFF)
+			output[outIdx] = BranchBuf[idx] + get_global_offset(0);
 	}
-	mem_fence(CLK_GLOBAL_MEM_FENCE);
 }
 
 #define SWAP8(x)	as_ulong(as_uchar8(x).s76543210)
@@ -986,195 +979,214 @@ __kernel void Skein(__global ulong *states, __global uint *BranchBuf, __global u
 	h7h ^= input[6]; \
 	h7l ^= input[7]
 
-__kernel void JH(__global ulong *states, __global uint *BranchBuf, __global uint *output, ulong Target, ulong Threads)
+void JHFinal(__global ulong *states, __global uint *BranchBuf, __global uint *output, ulong Target, uint idx)
 {
-	const uint idx = get_global_id(0) - get_global_offset(0);
+	states += 25 * BranchBuf[idx];
 
-	// do not use early return here
-	if(idx < Threads)
-	{
-		states += 25 * BranchBuf[idx];
+	sph_u64 h0h = 0xEBD3202C41A398EBUL, h0l = 0xC145B29C7BBECD92UL, h1h = 0xFAC7D4609151931CUL, h1l = 0x038A507ED6820026UL, h2h = 0x45B92677269E23A4UL, h2l = 0x77941AD4481AFBE0UL, h3h = 0x7A176B0226ABB5CDUL, h3l = 0xA82FFF0F4224F056UL;
+	sph_u64 h4h = 0x754D2E7F8996A371UL, h4l = 0x62E27DF70849141DUL, h5h = 0x948F2476F7957627UL, h5l = 0x6C29804757B6D587UL, h6h = 0x6C0D8EAC2D275E5CUL, h6l = 0x0F7A0557C6508451UL, h7h = 0xEA12247067D3E47BUL, h7l = 0x69D71CD313ABE389UL;
+	sph_u64 tmp;
 
-		sph_u64 h0h = 0xEBD3202C41A398EBUL, h0l = 0xC145B29C7BBECD92UL, h1h = 0xFAC7D4609151931CUL, h1l = 0x038A507ED6820026UL, h2h = 0x45B92677269E23A4UL, h2l = 0x77941AD4481AFBE0UL, h3h = 0x7A176B0226ABB5CDUL, h3l = 0xA82FFF0F4224F056UL;
-		sph_u64 h4h = 0x754D2E7F8996A371UL, h4l = 0x62E27DF70849141DUL, h5h = 0x948F2476F7957627UL, h5l = 0x6C29804757B6D587UL, h6h = 0x6C0D8EAC2D275E5CUL, h6l = 0x0F7A0557C6508451UL, h7h = 0xEA12247067D3E47BUL, h7l = 0x69D71CD313ABE389UL;
-		sph_u64 tmp;
-
-		for(int i = 0; i < 3; ++i)
-		{
-			ulong input[8];
+	for(int i = 0; i < 3; ++i)
+	{
+		ulong input[8];
 
-			const int shifted = i << 3;
-			for(int x = 0; x < 8; ++x) input[x] = (states[shifted + x]);
-			JHXOR;
-		}
-		{
-			ulong input[8];
-			input[0] = (states[24]);
-			input[1] = 0x80UL;
-			#pragma unroll 6
-			for(int x = 2; x < 8; ++x) input[x] = 0x00UL;
-			JHXOR;
-		}
-		{
-			ulong input[8];
-			for(int x = 0; x < 7; ++x) input[x] = 0x00UL;
-			input[7] = 0x4006000000000000UL;
-			JHXOR;
-		}
+		const int shifted = i << 3;
+		for(int x = 0; x < 8; ++x) input[x] = (states[shifted + x]);
+		JHXOR;
+	}
+	{
+		ulong input[8];
+		input[0] = (states[24]);
+		input[1] = 0x80UL;
+		#pragma unroll 6
+		for(int x = 2; x < 8; ++x) input[x] = 0x00UL;
+		JHXOR;
+	}
+	{
+		ulong input[8];
+		for(int x = 0; x < 7; ++x) input[x] = 0x00UL;
+		input[7] = 0x4006000000000000UL;
+		JHXOR;
+	}
 
-		//output[0] = h6h;
-		//output[1] = h6l;
-		//output[2] = h7h;
-		//output[3] = h7l;
+	//output[0] = h6h;
+	//output[1] = h6l;
+	//output[2] = h7h;
+	//output[3] = h7l;
 
-		// Note that comparison is equivalent to subtraction - we can't just compare 8 32-bit values
-		// and expect an accurate result for target > 32-bit without implementing carries
-		if(h7l <= Target)
-		{
-			ulong outIdx = atomic_inc(output + 0xFF);
-			if(outIdx < 0xFF)
-				output[outIdx] = BranchBuf[idx] + get_global_offset(0);
-		}
+	// Note that comparison is equivalent to subtraction - we can't just compare 8 32-bit values
+	// and expect an accurate result for target > 32-bit without implementing carries
+	if(h7l <= Target)
+	{
+		ulong outIdx = atomic_inc(output + 0xFF);
+		if(outIdx < 0xFF)
+			output[outIdx] = BranchBuf[idx] + get_global_offset(0);
 	}
 }
 
 #define SWAP4(x)	as_uint(as_uchar4(x).s3210)
 
-__kernel void Blake(__global ulong *states, __global uint *BranchBuf, __global uint *output, ulong Target, ulong Threads)
+void BlakeFinal(__global ulong *states, __global uint *BranchBuf, __global uint *output, ulong Target, uint idx)
 {
-	const uint idx = get_global_id(0) - get_global_offset(0);
+	states += 25 * BranchBuf[idx];
 
-	// do not use early return here
-	if(idx < Threads)
-	{
-		states += 25 * BranchBuf[idx];
-
-		unsigned int m[16];
-		unsigned int v[16];
-		uint h[8];
+	unsigned int m[16];
+	unsigned int v[16];
+	uint h[8];
 
-		((uint8 *)h)[0] = vload8(0U, c_IV256);
+	((uint8 *)h)[0] = vload8(0U, c_IV256);
 
-		#pragma unroll 4
-		for(uint i = 0, bitlen = 0; i < 4; ++i)
+	#pragma unroll 4
+	for(uint i = 0, bitlen = 0; i < 4; ++i)
+	{
+		if(i < 3)
 		{
-			if(i < 3)
-			{
-				((uint16 *)m)[0] = vload16(i, (__global uint *)states);
-				for(int i = 0; i < 16; ++i) m[i] = SWAP4(m[i]);
-				bitlen += 512;
-			}
-			else
-			{
-				m[0] = SWAP4(((__global uint *)states)[48]);
-				m[1] = SWAP4(((__global uint *)states)[49]);
-				m[2] = 0x80000000U;
-
-				for(int i = 3; i < 13; ++i) m[i] = 0x00U;
+			((uint16 *)m)[0] = vload16(i, (__global uint *)states);
+			for(int i = 0; i < 16; ++i) m[i] = SWAP4(m[i]);
+			bitlen += 512;
+		}
+		else
+		{
+			m[0] = SWAP4(((__global uint *)states)[48]);
+			m[1] = SWAP4(((__global uint *)states)[49]);
+			m[2] = 0x80000000U;
 
-				m[13] = 1U;
-				m[14] = 0U;
-				m[15] = 0x640;
-				bitlen += 64;
-			}
+			for(int i = 3; i < 13; ++i) m[i] = 0x00U;
 
-			((uint16 *)v)[0].lo = ((uint8 *)h)[0];
-			((uint16 *)v)[0].hi = vload8(0U, c_u256);
+			m[13] = 1U;
+			m[14] = 0U;
+			m[15] = 0x640;
+			bitlen += 64;
+		}
 
-			//v[12] ^= (i < 3) ? (i + 1) << 9 : 1600U;
-			//v[13] ^= (i < 3) ? (i + 1) << 9 : 1600U;
+		((uint16 *)v)[0].lo = ((uint8 *)h)[0];
+		((uint16 *)v)[0].hi = vload8(0U, c_u256);
 
-			v[12] ^= bitlen;
-			v[13] ^= bitlen;
+		//v[12] ^= (i < 3) ? (i + 1) << 9 : 1600U;
+		//v[13] ^= (i < 3) ? (i + 1) << 9 : 1600U;
 
-			for(int r = 0; r < 14; r++)
-			{
-				GS(0, 4, 0x8, 0xC, 0x0);
-				GS(1, 5, 0x9, 0xD, 0x2);
-				GS(2, 6, 0xA, 0xE, 0x4);
-				GS(3, 7, 0xB, 0xF, 0x6);
-				GS(0, 5, 0xA, 0xF, 0x8);
-				GS(1, 6, 0xB, 0xC, 0xA);
-				GS(2, 7, 0x8, 0xD, 0xC);
-				GS(3, 4, 0x9, 0xE, 0xE);
-			}
+		v[12] ^= bitlen;
+		v[13] ^= bitlen;
 
-			((uint8 *)h)[0] ^= ((uint8 *)v)[0] ^ ((uint8 *)v)[1];
+		for(int r = 0; r < 14; r++)
+		{
+			GS(0, 4, 0x8, 0xC, 0x0);
+			GS(1, 5, 0x9, 0xD, 0x2);
+			GS(2, 6, 0xA, 0xE, 0x4);
+			GS(3, 7, 0xB, 0xF, 0x6);
+			GS(0, 5, 0xA, 0xF, 0x8);
+			GS(1, 6, 0xB, 0xC, 0xA);
+			GS(2, 7, 0x8, 0xD, 0xC);
+			GS(3, 4, 0x9, 0xE, 0xE);
 		}
 
-		for(int i = 0; i < 8; ++i) h[i] = SWAP4(h[i]);
+		((uint8 *)h)[0] ^= ((uint8 *)v)[0] ^ ((uint8 *)v)[1];
+	}
 
-		// Note that comparison is equivalent to subtraction - we can't just compare 8 32-bit values
-		// and expect an accurate result for target > 32-bit without implementing carries
-		uint2 t = (uint2)(h[6],h[7]);
-		if( as_ulong(t) <= Target)
-		{
-			ulong outIdx = atomic_inc(output + 0xFF);
-			if(outIdx < 0xFF)
-				output[outIdx] = BranchBuf[idx] + get_global_offset(0);
-		}
+	for(int i = 0; i < 8; ++i) h[i] = SWAP4(h[i]);
+
+	// Note that comparison is equivalent to subtraction - we can't just compare 8 32-bit values
+	// and expect an accurate result for target > 32-bit without implementing carries
+	uint2 t = (uint2)(h[6],h[7]);
+	if( as_ulong(t) <= Target)
+	{
+		ulong outIdx = atomic_inc(output + 0xFF);
+		if(outIdx < 0xFF)
+			output[outIdx] = BranchBuf[idx] + get_global_offset(0);
 	}
 }
 
-__kernel void Groestl(__global ulong *states, __global uint *BranchBuf, __global uint *output, ulong Target, ulong Threads)
+void GroestlFinal(__global ulong *states, __global uint *BranchBuf, __global uint *output, ulong Target, uint idx)
 {
-	const uint idx = get_global_id(0) - get_global_offset(0);
+	states += 25 * BranchBuf[idx];
 
-	// do not use early return here
-	if(idx < Threads)
-	{
-		states += 25 * BranchBuf[idx];
+	ulong State[8];
 
-		ulong State[8];
+	for(int i = 0; i < 7; ++i) State[i] = 0UL;
 
-		for(int i = 0; i < 7; ++i) State[i] = 0UL;
+	State[7] = 0x0001000000000000UL;
 
-		State[7] = 0x0001000000000000UL;
+	#pragma unroll 4
+	for(uint i = 0; i < 4; ++i)
+	{
+		ulong H[8], M[8];
 
-		#pragma unroll 4
-		for(uint i = 0; i < 4; ++i)
+		if(i < 3)
 		{
-			ulong H[8], M[8];
+			((ulong8 *)M)[0] = vload8(i, states);
+		}
+		else
+		{
+			M[0] = states[24];
+			M[1] = 0x80UL;
 
-			if(i < 3)
-			{
-				((ulong8 *)M)[0] = vload8(i, states);
-			}
-			else
-			{
-				M[0] = states[24];
-				M[1] = 0x80UL;
+			for(int x = 2; x < 7; ++x) M[x] = 0UL;
 
-				for(int x = 2; x < 7; ++x) M[x] = 0UL;
+			M[7] = 0x0400000000000000UL;
+		}
 
-				M[7] = 0x0400000000000000UL;
-			}
+		for(int x = 0; x < 8; ++x) H[x] = M[x] ^ State[x];
+
+		PERM_SMALL_P(H);
+		PERM_SMALL_Q(M);
 
-			for(int x = 0; x < 8; ++x) H[x] = M[x] ^ State[x];
+		for(int x = 0; x < 8; ++x) State[x] ^= H[x] ^ M[x];
+	}
 
-			PERM_SMALL_P(H);
-			PERM_SMALL_Q(M);
+	ulong tmp[8];
 
-			for(int x = 0; x < 8; ++x) State[x] ^= H[x] ^ M[x];
-		}
+	for(int i = 0; i < 8; ++i) tmp[i] = State[i];
 
-		ulong tmp[8];
+	PERM_SMALL_P(State);
 
-		for(int i = 0; i < 8; ++i) tmp[i] = State[i];
+	for(int i = 0; i < 8; ++i) State[i] ^= tmp[i];
 
-		PERM_SMALL_P(State);
+	// Note that comparison is equivalent to subtraction - we can't just compare 8 32-bit values
+	// and expect an accurate result for target > 32-bit without implementing carries
+	if(State[7] <= Target)
+	{
+		ulong outIdx = atomic_inc(output + 0xFF);
+		if(outIdx < 0xFF)
+			output[outIdx] = BranchBuf[idx] + get_global_offset(0);
+	}
+}
 
-		for(int i = 0; i < 8; ++i) State[i] ^= tmp[i];
+/* One dispatch for all four finalizers. The global size is four equal slices, one per branch, each
+ * a multiple of the work group size, so a work group never mixes branches. Work items past the
+ * branch counter written by cn2 drop out, the host does not need to read the counters.
+ */
+__kernel void Finalize(__global ulong *states, __global uint *Branch0, __global uint *Branch1, __global uint *Branch2, __global uint *Branch3, __global uint *output, __global ulong *input, ulong Threads)
+{
+	// The host stores the target behind the 136 byte padded keccak block, a job switch is a single buffer write
+	const ulong Target = input[17];
+	const ulong slice = get_global_size(0) / 4;
+	const ulong gIdx = get_global_id(0) - get_global_offset(0);
+	const uint branch = gIdx / slice;
+	const uint idx = gIdx % slice;
 
-		// Note that comparison is equivalent to subtraction - we can't just compare 8 32-bit values
-		// and expect an accurate result for target > 32-bit without implementing carries
-		if(State[7] <= Target)
+	__global uint *BranchBuf = branch == 0 ? Branch0 : (branch == 1 ? Branch1 : (branch == 2 ? Branch2 : Branch3));
+
+	// do not use early return here
+	if(idx < BranchBuf[Threads])
+	{
+		switch(branch)
 		{
-			ulong outIdx = atomic_inc(output + 0xFF);
-			if(outIdx < 0xFF)
-				output[outIdx] = BranchBuf[idx] + get_global_offset(0);
+		case 0:
+			BlakeFinal(states, BranchBuf, output, Target, idx);
+			break;
+		case 1:
+			GroestlFinal(states, BranchBuf, output, Target, idx);
+			break;
+		case 2:
+			JHFinal(states, BranchBuf, output, Target, idx);
+			break;
+		default:
+			SkeinFinal(states, BranchBuf, output, Target, idx);
+			break;
 		}
 	}
+	mem_fence(CLK_GLOBAL_MEM_FENCE);
 }
 
 )==="
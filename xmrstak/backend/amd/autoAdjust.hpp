@@ -10,6 +10,7 @@
 #include "xmrstak/params.hpp"
 #include "xmrstak/backend/cryptonight.hpp"
 #include "xmrstak/jconf.hpp"
+#include "xmrstak/net/msgstruct.hpp"
 
 #include <vector>
 #include <cstdio>
@@ -25,6 +26,7 @@
 #endif
 
 #include <fstream>
+#include <thread>
 
 namespace xmrstak
 {
@@ -70,8 +72,188 @@ public:
 		return true;
 	}
 
+	/** hash rate of a device with the settings of a configured thread
+	 *
+	 * @return 0.0 if the settings do not work on the device, see measure()
+	 */
+	double benchmark(const jconf::thd_cfg& cfg, int platformIndex)
+	{
+		GpuContext dev;
+		dev.deviceIdx = cfg.index;
+
+		tuneResult set;
+		set.intensity = cfg.intensity;
+		set.workSize = cfg.w_size;
+		set.stridedIndex = cfg.stridedIndex;
+		set.memChunk = cfg.memChunk;
+		return measure(dev, platformIndex, set);
+	}
+
+	struct tuneResult
+	{
+		size_t intensity = 0;
+		size_t workSize = 8;
+		int stridedIndex = 1;
+		int memChunk = 2;
+		double fHps = 0.0;
+	};
+
+	// Length of one timed run, every setting is measured twice
+	uint64_t iTuneMs = 2000;
+	// worksizes and strided_index values tune() compares
+	std::vector<size_t> vTuneWorkSizes = { 8, 16, 32, 64 };
+	std::vector<int> vTuneStridedIdx = { 0, 1, 2 };
+
+	/** find the fastest stable settings of a device
+	 *
+	 * Worksize and memory layout are compared at the estimated intensity, then the intensity
+	 * is moved in steps until the device runs out of memory, gets slower or reaches maxIntensity.
+	 *
+	 * @return settings with fHps == 0.0 if nothing worked
+	 */
+	tuneResult tune(const GpuContext& dev, int platformIndex, size_t estIntensity, size_t maxIntensity)
+	{
+		tuneResult best;
+
+		size_t maxWorkSize = 8;
+		if(clGetDeviceInfo(dev.DeviceID, CL_DEVICE_MAX_WORK_GROUP_SIZE, sizeof(size_t), &maxWorkSize, NULL) == CL_SUCCESS)
+			// some kernels spawn 8 times more threads than the worksize
+			maxWorkSize = std::max(maxWorkSize / 8, size_t(8));
+
+		// returns 0.0 for a failed setting, so the caller can tell a memory cliff from a slowdown
+		auto tryCfg = [&](tuneResult cfg) -> double
+		{
+			cfg.intensity -= cfg.intensity % cfg.workSize;
+			if(cfg.intensity == 0)
+				return 0.0;
+
+			cfg.fHps = measure(dev, platformIndex, cfg);
+			printer::inst()->print_msg(L0, "OpenCL device %u - intensity %u, worksize %u, strided_index %d, mem_chunk %d: %.1f H/s",
+				unsigned(dev.deviceIdx), unsigned(cfg.intensity), unsigned(cfg.workSize), cfg.stridedIndex, cfg.memChunk, cfg.fHps);
+			if(cfg.fHps > best.fHps)
+				best = cfg;
+			return cfg.fHps;
+		};
+
+		// the estimate can be too high for drivers that report more memory than they allocate
+		for(size_t intensity = estIntensity; best.fHps == 0.0 && intensity >= 8; intensity /= 2)
+		{
+			for(size_t workSize : vTuneWorkSizes)
+			{
+				if(workSize > maxWorkSize)
+					continue;
+				for(int stridedIndex : vTuneStridedIdx)
+				{
+					tuneResult cfg;
+					cfg.intensity = intensity;
+					cfg.workSize = workSize;
+					cfg.stridedIndex = stridedIndex;
+					tryCfg(cfg);
+				}
+			}
+		}
+
+		if(best.fHps == 0.0)
+			return best;
+
+		if(best.stridedIndex == 2)
+		{
+			for(int memChunk : { 0, 1, 3, 4, 5, 6 })
+			{
+				tuneResult cfg = best;
+				cfg.memChunk = memChunk;
+				tryCfg(cfg);
+			}
+		}
+
+		// steps of an eighth of the estimate
+		size_t step = std::max(estIntensity / 8, best.workSize);
+		step -= step % best.workSize;
+
+		tuneResult start = best;
+		for(size_t intensity = start.intensity + step; intensity <= maxIntensity; intensity += step)
+		{
+			tuneResult cfg = best;
+			cfg.intensity = intensity;
+			double fLast = best.fHps;
+			double fHps = tryCfg(cfg);
+			// out of memory or more threads than the memory bus can feed
+			if(fHps == 0.0 || fHps < fLast * 0.97)
+				break;
+		}
+
+		// fewer threads may thrash the TLB less, only worth a look if going up did not help
+		if(best.intensity == start.intensity && start.intensity > 2 * step)
+		{
+			for(size_t intensity = start.intensity - step; intensity > step; intensity -= step)
+			{
+				tuneResult cfg = best;
+				cfg.intensity = intensity;
+				double fLast = best.fHps;
+				if(tryCfg(cfg) <= fLast)
+					break;
+			}
+		}
+
+		return best;
+	}
+
 private:
 
+	/** run the real kernels with the given settings
+	 *
+	 * @return the lower hash rate of two timed runs, 0.0 if the settings do not work
+	 *         on the device, e.g. because the memory is not enough
+	 */
+	double measure(const GpuContext& dev, int platformIndex, const tuneResult& cfg)
+	{
+		GpuContext ctx;
+		ctx.deviceIdx = dev.deviceIdx;
+		ctx.rawIntensity = cfg.intensity;
+		ctx.workSize = cfg.workSize;
+		ctx.stridedIndex = cfg.stridedIndex;
+		ctx.memChunk = cfg.memChunk;
+		ctx.compMode = true;
+		ctx.Nonce = 0;
+
+		double fHps = 0.0;
+		if(InitOpenCL(&ctx, 1, platformIndex) == ERR_SUCCESS)
+		{
+			xmrstak_algo miner_algo = ::jconf::inst()->GetCurrentCoinSelection().GetDescription(1).GetMiningAlgo();
+			uint8_t work[76] = {};
+			const cl_uint* results;
+
+			// a zero target finds nothing, so there is nothing to verify
+			bool bOk = XMRSetJob(&ctx, work, sizeof(work), 0) == ERR_SUCCESS;
+
+			// one untimed round to get the clocks up
+			bOk = bOk && XMRRunJob(&ctx, results, miner_algo) == ERR_SUCCESS;
+			bOk = bOk && XMRFinishJob(&ctx, results) == ERR_SUCCESS;
+
+			for(int run = 0; run < 2 && bOk; ++run)
+			{
+				uint64_t iStart = get_timestamp_ms();
+				uint64_t iHashes = 0;
+				while(bOk && get_timestamp_ms() - iStart < iTuneMs)
+				{
+					bOk = XMRRunJob(&ctx, results, miner_algo) == ERR_SUCCESS;
+					iHashes += ctx.rawIntensity;
+				}
+				// only rounds that are done count
+				bOk = bOk && XMRFinishJob(&ctx, results) == ERR_SUCCESS;
+				uint64_t iTime = get_timestamp_ms() - iStart;
+
+				double fRunHps = iTime != 0 ? double(iHashes) * 1000.0 / double(iTime) : 0.0;
+				fHps = run == 0 ? fRunHps : std::min(fHps, fRunHps);
+			}
+
+			if(!bOk)
+				fHps = 0.0;
+		}
+		ReleaseOpenCL(&ctx, 1);
+		return fHps;
+	}
+
 	void generateThreadConfig(const int platformIndex)
 	{
 		// load the template of the backend config into a char variable
@@ -89,11 +271,19 @@ private:
 			cn_select_memory(::jconf::inst()->GetCurrentCoinSelection().GetDescription(1).GetMiningAlgoRoot())
 		);
 
+		// two threads per device for aeon, each gets half of the memory
+		const xmrstak_algo miningAlgo = ::jconf::inst()->GetCurrentCoinSelection().GetDescription(1).GetMiningAlgo();
+		const bool bTwoThreads = miningAlgo == cryptonight_lite || miningAlgo == cryptonight_aeon;
+
 		std::string conf;
 		std::string info = "";
 
-		for(auto& ctx : devVec)
+		// estimated intensity per device, zero if the memory is not enough
+		std::vector<size_t> vEstimate(devVec.size(), 0);
+		std::vector<size_t> vAvailableMem(devVec.size(), 0);
+		for(size_t i = 0; i < devVec.size(); ++i)
 		{
+			auto& ctx = devVec[i];
 			size_t minFreeMem = 128u * byteToMiB;
 			/* 1000 is a magic selected limit, the reason is that more than 2GiB memory
 			 * sowing down the memory performance because of TLB cache misses
@@ -149,28 +339,66 @@ private:
 				intensity = possibleIntensity;
 
 			}
-			if (intensity != 0)
+			if ( intensity != 0 && ctx.name.compare("Baffin") == 0 && availableMem < 2048 )
+			{
+					intensity = intensity / 2;
+			}
+			if(bTwoThreads)
+				intensity /= 2;
+			vEstimate[i] = intensity;
+			vAvailableMem[i] = availableMem;
+		}
+
+		// The estimate is only the starting point, the devices are tuned in parallel with their real kernels
+		printer::inst()->print_msg(L0, "Tuning intensity and worksize of %u GPU(s), this takes a few minutes...", unsigned(devVec.size()));
+		std::vector<tuneResult> vTuned(devVec.size());
+		std::vector<std::thread> vTuneThd;
+		for(size_t i = 0; i < devVec.size(); ++i)
+		{
+			// only one context is alive while tuning, so the second thread of aeon must not be counted on
+			size_t maxIntensity = bTwoThreads ? vEstimate[i] : vEstimate[i] + vEstimate[i] / 2;
+			if(vEstimate[i] != 0)
+				vTuneThd.emplace_back([&, i, maxIntensity]() { vTuned[i] = tune(devVec[i], platformIndex, vEstimate[i], maxIntensity); });
+		}
+		for(std::thread& thd : vTuneThd)
+			thd.join();
+
+		for(size_t i = 0; i < devVec.size(); ++i)
+		{
+			auto& ctx = devVec[i];
+			size_t availableMem = vAvailableMem[i];
+			tuneResult& tuned = vTuned[i];
+
+			if (vEstimate[i] != 0)
 			{
-				if ( ctx.name.compare("Baffin") == 0 && availableMem < 2048 )
+				std::string tunedInfo;
+				if(tuned.fHps > 0.0)
 				{
-						intensity = intensity / 2;
+					char hps[64];
+					snprintf(hps, sizeof(hps), "%.1f", tuned.fHps);
+					tunedInfo = std::string("  // tuned: ") + hps + " H/s\n";
 				}
-				//stak most always under-reports mem numbers even on dedicated gpu's on linux systems so adding 10% to compensate
-				intensity = intensity * 1.1;
-				conf += std::string("  // gpu: ") + ctx.name + " memory:" + std::to_string(availableMem / byteToMiB) + "\n";
-				conf += std::string("  // compute units: ") + std::to_string(ctx.computeUnits) + "\n";
-				// set 8 threads per block (this is a good value for the most gpus)
-				conf += std::string("  { \"index\" : ") + std::to_string(ctx.deviceIdx) + ",\n" +
-					"    \"intensity\" : " + std::to_string(intensity) + ", \"worksize\" : " + std::to_string(8) + ",\n" +
-					"    \"affine_to_cpu\" : false, \"strided_index\" : " + (ctx.isNVIDIA ? "0" : "1") + ", \"mem_chunk\" : 2,\n"
-					"    \"comp_mode\" : true\n" +
-					"  },\n";
-				if(::jconf::inst()->GetCurrentCoinSelection().GetDescription(1).GetMiningAlgo() == cryptonight_lite || ::jconf::inst()->GetCurrentCoinSelection().GetDescription(1).GetMiningAlgo() == cryptonight_aeon)
-					conf += std::string("  { \"index\" : ") + std::to_string(ctx.deviceIdx) + ",\n" +
-					"    \"intensity\" : " + std::to_string(intensity) + ", \"worksize\" : " + std::to_string(8) + ",\n" +
-					"    \"affine_to_cpu\" : false, \"strided_index\" : " + (ctx.isNVIDIA ? "0" : "1") + ", \"mem_chunk\" : 2,\n"
+				else
+				{
+					printer::inst()->print_msg(L0, "WARNING: gpu %s could not be tuned, using the estimated intensity.", ctx.name.c_str());
+					//stak most always under-reports mem numbers even on dedicated gpu's on linux systems so adding 10% to compensate
+					tuned = tuneResult();
+					tuned.intensity = vEstimate[i] * 1.1;
+					tuned.stridedIndex = ctx.isNVIDIA ? 0 : 1;
+				}
+
+				std::string threadConf = std::string("  { \"index\" : ") + std::to_string(ctx.deviceIdx) + ",\n" +
+					"    \"intensity\" : " + std::to_string(tuned.intensity) + ", \"worksize\" : " + std::to_string(tuned.workSize) + ",\n" +
+					"    \"affine_to_cpu\" : false, \"strided_index\" : " + std::to_string(tuned.stridedIndex) + ", \"mem_chunk\" : " + std::to_string(tuned.memChunk) + ",\n"
 					"    \"comp_mode\" : true\n" +
 					"  },\n";
+
+				conf += std::string("  // gpu: ") + ctx.name + " memory:" + std::to_string(availableMem / byteToMiB) + "\n";
+				conf += std::string("  // compute units: ") + std::to_string(ctx.computeUnits) + "\n";
+				conf += tunedInfo;
+				conf += threadConf;
+				if(bTwoThreads)
+					conf += threadConf;
 				info += std::string(" \"") + ctx.name + "\", \n";
 			}
 			else
@@ -23,6 +23,7 @@
 
 #include "minethd.hpp"
 #include "autoAdjust.hpp"
+#include "verifier.hpp"
 #include "amd_gpu/gpu.hpp"
 
 #include "xmrstak/backend/cpu/crypto/cryptonight_aesni.h"
@@ -30,12 +31,15 @@
 #include "xmrstak/misc/configEditor.hpp"
 #include "xmrstak/misc/console.hpp"
 #include "xmrstak/backend/cpu/minethd.hpp"
+#include "xmrstak/backend/scheduler.hpp"
+#include "xmrstak/backend/backend_devices.hpp"
 #include "xmrstak/jconf.hpp"
 #include "xmrstak/misc/executor.hpp"
 #include "xmrstak/misc/environment.hpp"
 #include "xmrstak/params.hpp"
 #include "xmrstak/backend/cpu/hwlocMemory.hpp"
 
+#include <algorithm>
 #include <assert.h>
 #include <cmath>
 #include <chrono>
@@ -54,9 +58,8 @@ minethd::minethd(miner_work& pWork, size_t iNo, GpuContext* ctx, const jconf::th
 	bQuit = 0;
 	iThreadNo = (uint8_t)iNo;
 	iJobNo = 0;
-	iHashCount = 0;
-	iTimestamp = 0;
 	pGpuCtx = ctx;
+	iDeviceIdx = uint32_t(ctx->deviceIdx);
 	this->affinity = cfg.cpu_aff;
 
 	std::unique_lock<std::mutex> lck(thd_aff_set);
@@ -71,6 +74,80 @@ minethd::minethd(miner_work& pWork, size_t iNo, GpuContext* ctx, const jconf::th
 			printer::inst()->print_msg(L1, "WARNING setting affinity failed.");
 }
 
+namespace
+{
+
+backend_devices oDevices;
+
+size_t api_start(uint32_t threadOffset, void* pWork)
+{
+	std::vector<iBackend*>* pvThreads = minethd::thread_starter(threadOffset, *static_cast<miner_work*>(pWork));
+	oDevices.set_threads(*pvThreads);
+	size_t n = pvThreads->size();
+	delete pvThreads;
+	return n;
+}
+
+size_t api_get_threads(void** ppThreads, size_t iMax) { return oDevices.get_threads(ppThreads, iMax); }
+int api_pause(uint32_t iDevice, int bPause) { return oDevices.pause(iDevice, bPause != 0); }
+int api_stop(uint32_t iDevice) { return oDevices.stop(iDevice); }
+size_t api_get_stats(xmrstak_device_stats* pStats, size_t iMax) { return oDevices.get_stats(pStats, iMax); }
+void api_release() { oDevices.clear(); }
+
+size_t api_enum_devices(xmrstak_device_info* pDevs, size_t iMax)
+{
+	int platformIndex = getAMDPlatformIdx();
+	if(platformIndex == -1)
+		return 0;
+
+	std::vector<GpuContext> devVec = getAMDDevices(platformIndex);
+	for(size_t i = 0; i < std::min(iMax, devVec.size()); i++)
+	{
+		pDevs[i] = xmrstak_device_info();
+		pDevs[i].iIndex = devVec[i].deviceIdx;
+		pDevs[i].iMemory = devVec[i].freeMem;
+		snprintf(pDevs[i].sName, sizeof(pDevs[i].sName), "%s", devVec[i].name.c_str());
+	}
+	return devVec.size();
+}
+
+// Runs the kernels with the settings of the device's first thread in amd.txt
+int api_bench(uint32_t iDevice, double* pHps)
+{
+	if(!configEditor::file_exist(params::inst().configFileAMD) || !jconf::inst()->parse_config())
+		return -1;
+
+	jconf::thd_cfg cfg;
+	for(size_t i = 0; i < jconf::inst()->GetThreadCount(); i++)
+	{
+		jconf::inst()->GetThreadConfig(i, cfg);
+		if(cfg.index != iDevice)
+			continue;
+
+		autoAdjust adjust;
+		*pHps = adjust.benchmark(cfg, jconf::inst()->GetPlatformIdx());
+		return *pHps > 0.0 ? 0 : -1;
+	}
+	return -1;
+}
+
+const xmrstak_backend_api oApi = {
+	XMRSTAK_BACKEND_ABI,
+	sizeof(xmrstak_backend_api),
+	XMRSTAK_CAP_ENUM | XMRSTAK_CAP_PAUSE | XMRSTAK_CAP_STOP | XMRSTAK_CAP_STATS | XMRSTAK_CAP_BENCH,
+	"amd",
+	api_start,
+	api_get_threads,
+	api_enum_devices,
+	api_pause,
+	api_stop,
+	api_get_stats,
+	api_bench,
+	api_release
+};
+
+} // namespace
+
 extern "C"  {
 #ifdef WIN32
 __declspec(dllexport) 
@@ -80,6 +157,17 @@ std::vector<iBackend*>* xmrstak_start_backend(uint32_t threadOffset, miner_work&
 	environment::inst(&env);
 	return amd::minethd::thread_starter(threadOffset, pWork);
 }
+
+#ifdef WIN32
+__declspec(dllexport)
+#endif
+const xmrstak_backend_api* xmrstak_get_backend_api(uint32_t iHostAbi, void* pEnv)
+{
+	if(iHostAbi != XMRSTAK_BACKEND_ABI)
+		return nullptr;
+	environment::inst(static_cast<environment*>(pEnv));
+	return &oApi;
+}
 } // extern "C"
 
 bool minethd::init_gpus()
@@ -101,7 +189,81 @@ bool minethd::init_gpus()
 		vGpuData[i].compMode = cfg.compMode;
 	}
 
-	return InitOpenCL(vGpuData.data(), n, jconf::inst()->GetPlatformIdx()) == ERR_SUCCESS;
+	if(params::inst().AMDPrecompile)
+	{
+		params::inst().AMDPrecompileOk = PrecompileOpenCL(vGpuData.data(), n, jconf::inst()->GetPlatformIdx()) == ERR_SUCCESS;
+		// no mining threads in this mode
+		return false;
+	}
+
+	if(InitOpenCL(vGpuData.data(), n, jconf::inst()->GetPlatformIdx()) != ERR_SUCCESS)
+		return false;
+
+	for(i = 0; i < n; i++)
+	{
+		if(!self_test(&vGpuData[i]))
+			return false;
+	}
+
+	WarmOpenCLCache(vGpuData.data(), n);
+	return true;
+}
+
+/*
+ * Runs one round on a blob longer than the 84 bytes pools usually send, so the padding
+ * of the whole keccak block is checked, and rehashes every nonce the GPU found on the CPU.
+ */
+bool minethd::self_test(GpuContext* ctx)
+{
+	xmrstak_algo algo = ::jconf::inst()->GetCurrentCoinSelection().GetDescription(1).GetMiningAlgo();
+
+	uint8_t bWorkBlob[100];
+	for(size_t i = 0; i < sizeof(bWorkBlob); i++)
+		bWorkBlob[i] = uint8_t(i * 7 + 1);
+
+	// About 32 hits per round, enough to never see none and far below the 0xFF the result buffer holds
+	uint64_t iTarget = ctx->rawIntensity > 32 ? ~uint64_t(0) / ctx->rawIntensity * 32 : ~uint64_t(0);
+	const cl_uint* results;
+
+	ctx->Nonce = 0;
+	if(XMRSetJob(ctx, bWorkBlob, sizeof(bWorkBlob), iTarget) != ERR_SUCCESS ||
+		XMRRunJob(ctx, results, algo) != ERR_SUCCESS ||
+		XMRFinishJob(ctx, results) != ERR_SUCCESS)
+	{
+		printer::inst()->print_msg(L0, "ERROR: GPU %d self test could not run a round.", (int)ctx->deviceIdx);
+		return false;
+	}
+
+	cryptonight_ctx* cpu_ctx = cpu::minethd::minethd_alloc_ctx();
+	if(cpu_ctx == nullptr)
+		return false;
+
+	cpu::minethd::cn_hash_fun hash_fun = cpu::minethd::func_selector(::jconf::inst()->HaveHardwareAes(), true /*bNoPrefetch*/, algo);
+	size_t iFound = std::min<cl_uint>(results[0xFF], 0xFF);
+	size_t iInvalid = 0;
+	for(size_t i = 0; i < iFound; i++)
+	{
+		uint8_t bResult[32];
+		*(uint32_t*)(bWorkBlob + 39) = results[i];
+		hash_fun(bWorkBlob, sizeof(bWorkBlob), bResult, cpu_ctx);
+		if(*((uint64_t*)(bResult + 24)) >= iTarget)
+			iInvalid++;
+	}
+	cryptonight_free_ctx(cpu_ctx);
+
+	if(iFound == 0)
+	{
+		printer::inst()->print_msg(L0, "ERROR: GPU %d self test failed, the round found no results.", (int)ctx->deviceIdx);
+		return false;
+	}
+
+	if(iInvalid != 0)
+	{
+		printer::inst()->print_msg(L0, "ERROR: GPU %d self test failed, %u of %u results do not match the CPU hash.",
+			(int)ctx->deviceIdx, (unsigned)iInvalid, (unsigned)iFound);
+		return false;
+	}
+	return true;
 }
 
 std::vector<GpuContext> minethd::vGpuData;
@@ -126,13 +288,17 @@ std::vector<iBackend*>* minethd::thread_starter(uint32_t threadOffset, miner_wor
 
 	if(!init_gpus())
 	{
-		printer::inst()->print_msg(L1, "WARNING: AMD device not found");
+		if(!params::inst().AMDPrecompile)
+			printer::inst()->print_msg(L1, "WARNING: AMD device not found");
 		return pvThreads;
 	}
 
 	size_t i, n = jconf::inst()->GetThreadCount();
 	pvThreads->reserve(n);
 
+	// One checker per two GPUs is plenty, candidates come at the share rate
+	verifier::inst().start((n + 1) / 2);
+
 	jconf::thd_cfg cfg;
 	for (i = 0; i < n; i++)
 	{
@@ -169,12 +335,10 @@ void minethd::work_main()
 	std::this_thread::yield();
 
 	uint64_t iCount = 0;
-	cryptonight_ctx* cpu_ctx;
-	cpu_ctx = cpu::minethd::minethd_alloc_ctx();
-	
+	scheduler::range_sizer oRange;
+
 	// start with root algorithm and switch later if fork version is reached
 	auto miner_algo = ::jconf::inst()->GetCurrentCoinSelection().GetDescription(1).GetMiningAlgoRoot();
-	cn_hash_fun hash_fun = cpu::minethd::func_selector(::jconf::inst()->HaveHardwareAes(), true /*bNoPrefetch*/, miner_algo);
 
 	uint8_t version = 0;
 	size_t lastPoolId = 0;
@@ -188,7 +352,7 @@ void minethd::work_main()
 				 * raison d'etre of this software it us sensible to just wait until we have something
 				 */
 
-				while (globalStates::inst().iGlobalJobNo.load(std::memory_order_relaxed) == iJobNo)
+				while (globalStates::inst().iGlobalJobNo.load(std::memory_order_relaxed) == iJobNo && bQuit == 0)
 					std::this_thread::sleep_for(std::chrono::milliseconds(100));
 
 				globalStates::inst().consume_work(oWork, iJobNo);
@@ -201,78 +365,106 @@ void minethd::work_main()
 			{
 				coinDescription coinDesc = ::jconf::inst()->GetCurrentCoinSelection().GetDescription(oWork.iPoolId);
 				if (new_version >= coinDesc.GetMiningForkVersion())
-				{
 					miner_algo = coinDesc.GetMiningAlgo();
-					hash_fun = cpu::minethd::func_selector(::jconf::inst()->HaveHardwareAes(), true /*bNoPrefetch*/, miner_algo);
-				}
 				else
-				{
 					miner_algo = coinDesc.GetMiningAlgoRoot();
-					hash_fun = cpu::minethd::func_selector(::jconf::inst()->HaveHardwareAes(), true /*bNoPrefetch*/, miner_algo);
-				}
 				lastPoolId = oWork.iPoolId;
 				version = new_version;
 			}
 
 			uint32_t h_per_round = pGpuCtx->rawIntensity;
-			size_t round_ctr = 0;
+			uint32_t nonce_left = 0;
 
 			assert(sizeof(job_result::sJobID) == sizeof(pool_job::sJobID));
 			uint64_t target = oWork.iTarget;
 
-			XMRSetJob(pGpuCtx, oWork.bWorkBlob, oWork.iWorkSize, target, miner_algo);
+			if(XMRSetJob(pGpuCtx, oWork.bWorkBlob, oWork.iWorkSize, target) != ERR_SUCCESS)
+			{
+				printer::inst()->print_msg(L0, "ERROR: GPU %d can't mine a job with a %u byte blob, waiting for the next job.",
+					(int)pGpuCtx->deviceIdx, (unsigned)oWork.iWorkSize);
+				while (globalStates::inst().iGlobalJobNo.load(std::memory_order_relaxed) == iJobNo && bQuit == 0)
+					std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+				globalStates::inst().consume_work(oWork, iJobNo);
+				continue;
+			}
 
 			if (oWork.bNiceHash)
 				pGpuCtx->Nonce = *(uint32_t*)(oWork.bWorkBlob + 39);
 
+			const cl_uint* results;
+
 			while (globalStates::inst().iGlobalJobNo.load(std::memory_order_relaxed) == iJobNo)
 			{
-				//Allocate a new nonce every 16 rounds
-				if ((round_ctr++ & 0xF) == 0)
+				// Allocate nonces for about scheduler::iRangeMs of work at the speed of this GPU
+				if (nonce_left == 0)
 				{
-					globalStates::inst().calc_start_nonce(pGpuCtx->Nonce, oWork.bNiceHash, h_per_round * 16);
+					nonce_left = oRange.next(iCount, get_timestamp_ms(), h_per_round);
+					globalStates::inst().calc_start_nonce(pGpuCtx->Nonce, oWork.bNiceHash, nonce_left);
 					// check if the job is still valid, there is a small possibility that the job is switched
 					if(globalStates::inst().iGlobalJobNo.load(std::memory_order_relaxed) != iJobNo)
 						break;
 				}
 
-				cl_uint results[0x100];
-				memset(results, 0, sizeof(cl_uint)*(0x100));
-
+				// Starts this round and hands back the results of the one before
 				XMRRunJob(pGpuCtx, results, miner_algo);
-
-				for (size_t i = 0; i < results[0xFF]; i++)
-				{
-					uint8_t	bWorkBlob[112];
-					uint8_t	bResult[32];
-
-					memcpy(bWorkBlob, oWork.bWorkBlob, oWork.iWorkSize);
-					memset(bResult, 0, sizeof(job_result::bResult));
-
-					*(uint32_t*)(bWorkBlob + 39) = results[i];
-
-					hash_fun(bWorkBlob, oWork.iWorkSize, bResult, cpu_ctx);
-					if ((*((uint64_t*)(bResult + 24))) < oWork.iTarget)
-						executor::inst()->push_event(ex_event(job_result(oWork.sJobID, results[i], bResult, iThreadNo, miner_algo), oWork.iPoolId));
-					else
-						executor::inst()->push_event(ex_event("AMD Invalid Result", pGpuCtx->deviceIdx, oWork.iPoolId));
-				}
+				verify_results(results, miner_algo);
+				nonce_left -= h_per_round;
 
 				iCount += pGpuCtx->rawIntensity;
 				uint64_t iStamp = get_timestamp_ms();
-				iHashCount.store(iCount, std::memory_order_relaxed);
-				iTimestamp.store(iStamp, std::memory_order_relaxed);
-				while (executor::inst()->isPause) {
+				set_hash_stats(iCount, iStamp);
+				iDeviceIdleUs.store(pGpuCtx->iIdleNs / 1000, std::memory_order_relaxed);
+				iDeviceStaleUs.store(pGpuCtx->iStaleNs / 1000, std::memory_order_relaxed);
+
+				// Stop before starting another round, the one in flight is collected below
+				if (bQuit != 0)
+					break;
+				while ((executor::inst()->isPause || bPause) && bQuit == 0) {
 					std::this_thread::sleep_for(std::chrono::milliseconds(50));
 					std::this_thread::yield();
-					if (bQuit != 0) {
-						return;
-					}
 				}
+				if (bQuit != 0)
+					break;
 				std::this_thread::yield();
 			}
+
+			// The last round of the job is still on the GPU. After a new block of its pool the results are worthless,
+			// it is dropped and the new job's first round queued right behind it. Otherwise they still count.
+			if (bQuit == 0 && globalStates::inst().get_clean_job(oWork.iPoolId) > iJobNo)
+				XMRDiscardJob(pGpuCtx);
+			else
+			{
+				XMRFinishJob(pGpuCtx, results);
+				verify_results(results, miner_algo);
+			}
+
 			globalStates::inst().consume_work(oWork, iJobNo);
 	}
+
+	// Candidates still in the verifier are part of this thread's last rounds
+	verifier::inst().drain();
+}
+
+void minethd::verify_results(const cl_uint* results, xmrstak_algo miner_algo)
+{
+	if (results[0xFF] == 0)
+		return;
+
+	// The CPU recheck runs in the verifier, the next round can start right away.
+	// Everything found in the round reaches the executor as one event.
+	verifier::job oJob;
+	memcpy(oJob.bWorkBlob, oWork.bWorkBlob, oWork.iWorkSize);
+	oJob.iWorkSize = oWork.iWorkSize;
+	oJob.iTarget = oWork.iTarget;
+	memcpy(oJob.sJobID, oWork.sJobID, sizeof(oJob.sJobID));
+	oJob.iPoolId = oWork.iPoolId;
+	oJob.iJobNo = iJobNo;
+	oJob.iThreadNo = iThreadNo;
+	oJob.iGpuIdx = pGpuCtx->deviceIdx;
+	oJob.algo = miner_algo;
+	oJob.vNonces.assign(results, results + std::min<cl_uint>(results[0xFF], 0xFF));
+	verifier::inst().push(std::move(oJob));
 }
 
 } // namespace amd
@@ -24,11 +24,11 @@ public:
 	static bool init_gpus();
 
 private:
-	typedef void (*cn_hash_fun)(const void*, size_t, void*, cryptonight_ctx*);
-
 	minethd(miner_work& pWork, size_t iNo, GpuContext* ctx, const jconf::thd_cfg cfg);
 
 	void work_main();
+	void verify_results(const cl_uint* results, xmrstak_algo miner_algo);
+	static bool self_test(GpuContext* ctx);
 
 	uint64_t iJobNo;
 
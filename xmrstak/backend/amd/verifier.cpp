@@ -0,0 +1,152 @@
+/*
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  * GNU General Public License for more details.
+  *
+  * You should have received a copy of the GNU General Public License
+  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+  *
+  * Additional permission under GNU GPL version 3 section 7
+  *
+  * If you modify this Program, or any covered work, by linking or combining
+  * it with OpenSSL (or a modified version of that library), containing parts
+  * covered by the terms of OpenSSL License and SSLeay License, the licensors
+  * of this Program grant you additional permission to convey the resulting work.
+  *
+  */
+
+#include "verifier.hpp"
+
+#include "xmrstak/backend/cpu/minethd.hpp"
+#include "xmrstak/jconf.hpp"
+#include "xmrstak/misc/console.hpp"
+#include "xmrstak/misc/executor.hpp"
+#include "xmrstak/net/msgstruct.hpp"
+
+#include <cstring>
+
+namespace xmrstak
+{
+namespace amd
+{
+
+constexpr size_t verifier::iMaxQueue;
+
+verifier& verifier::inst()
+{
+	// Never freed, the workers sleep on the queue for the life of the process
+	static verifier* pInst = new verifier;
+	return *pInst;
+}
+
+void verifier::start(size_t iThreads)
+{
+	std::unique_lock<std::mutex> lck(mtx);
+	while(iWorkers < iThreads)
+	{
+		std::thread(&verifier::work_main, this).detach();
+		iWorkers++;
+	}
+}
+
+void verifier::push(job&& oJob)
+{
+	std::unique_lock<std::mutex> lck(mtx);
+	cond_space.wait(lck, [this]() { return qJobs.size() < iMaxQueue || iWorkers == 0; });
+	// Every worker failed to get a scratchpad, nobody would ever take the job
+	if(iWorkers == 0)
+	{
+		lck.unlock();
+		printer::inst()->print_msg(L0, "ERROR: AMD verifier has no workers, dropped %u candidates of GPU %u.",
+			(unsigned)oJob.vNonces.size(), (unsigned)oJob.iGpuIdx);
+		return;
+	}
+	qJobs.push_back(std::move(oJob));
+	lck.unlock();
+	cond_job.notify_one();
+}
+
+void verifier::drain()
+{
+	std::unique_lock<std::mutex> lck(mtx);
+	cond_idle.wait(lck, [this]() { return (qJobs.empty() && iBusy == 0) || iWorkers == 0; });
+}
+
+void verifier::work_main()
+{
+	cryptonight_ctx* cpu_ctx = cpu::minethd::minethd_alloc_ctx();
+	if(cpu_ctx == nullptr)
+	{
+		printer::inst()->print_msg(L0, "ERROR: AMD verifier could not allocate a scratchpad.");
+		std::unique_lock<std::mutex> lck(mtx);
+		iWorkers--;
+		size_t iDropped = 0;
+		if(iWorkers == 0)
+		{
+			for(const job& oJob : qJobs)
+				iDropped += oJob.vNonces.size();
+			qJobs.clear();
+		}
+		lck.unlock();
+		cond_idle.notify_all();
+		cond_space.notify_all();
+		if(iDropped != 0)
+			printer::inst()->print_msg(L0, "ERROR: AMD verifier has no workers, dropped %u queued candidates.", (unsigned)iDropped);
+		return;
+	}
+
+	xmrstak_algo last_algo = invalid_algo;
+	cpu::minethd::cn_hash_fun hash_fun = nullptr;
+
+	while(true)
+	{
+		std::unique_lock<std::mutex> lck(mtx);
+		cond_job.wait(lck, [this]() { return !qJobs.empty(); });
+		job oJob = std::move(qJobs.front());
+		qJobs.pop_front();
+		iBusy++;
+		lck.unlock();
+		cond_space.notify_one();
+
+		if(oJob.algo != last_algo)
+		{
+			hash_fun = cpu::minethd::func_selector(::jconf::inst()->HaveHardwareAes(), true /*bNoPrefetch*/, oJob.algo);
+			last_algo = oJob.algo;
+		}
+
+		result_batch oBatch;
+		oBatch.iGpuIdx = oJob.iGpuIdx;
+		oBatch.sInvalidError = "AMD Invalid Result";
+		oBatch.vResults.reserve(oJob.vNonces.size());
+
+		for(uint32_t iNonce : oJob.vNonces)
+		{
+			uint8_t bResult[32] = {};
+			*(uint32_t*)(oJob.bWorkBlob + 39) = iNonce;
+
+			hash_fun(oJob.bWorkBlob, oJob.iWorkSize, bResult, cpu_ctx);
+			if ((*((uint64_t*)(bResult + 24))) < oJob.iTarget)
+				oBatch.vResults.emplace_back(oJob.sJobID, iNonce, bResult, oJob.iThreadNo, oJob.algo, oJob.iJobNo);
+			else
+				oBatch.iInvalid++;
+		}
+
+		executor::inst()->push_event(ex_event(std::move(oBatch), oJob.iPoolId));
+
+		lck.lock();
+		iBusy--;
+		bool bIdle = qJobs.empty() && iBusy == 0;
+		lck.unlock();
+		if(bIdle)
+			cond_idle.notify_all();
+	}
+}
+
+} // namespace amd
+} // namespace xmrstak
@@ -0,0 +1,68 @@
+#pragma once
+
+#include "xmrstak/backend/cryptonight.hpp"
+#include "xmrstak/backend/cpu/crypto/cryptonight.h"
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace xmrstak
+{
+namespace amd
+{
+
+/* Rechecks GPU candidates on the CPU so the GPU threads can start their next round right away.
+ * One instance is shared by all GPU threads, each worker has its own scratchpad.
+ */
+class verifier
+{
+public:
+	struct job
+	{
+		uint8_t bWorkBlob[112];
+		uint32_t iWorkSize;
+		uint64_t iTarget;
+		char sJobID[64];
+		size_t iPoolId;
+		uint64_t iJobNo;
+		uint32_t iThreadNo;
+		size_t iGpuIdx;
+		xmrstak_algo algo;
+		std::vector<uint32_t> vNonces;
+	};
+
+	static verifier& inst();
+
+	// Starts the workers the first time, later calls only add workers up to iThreads
+	void start(size_t iThreads);
+
+	// Blocks only while the queue is full, i.e. when the CPU can't keep up with the GPUs.
+	// Drops the candidates if no worker could allocate a scratchpad.
+	void push(job&& oJob);
+
+	// Waits until all candidates handed in so far are checked and queued at the executor
+	void drain();
+
+private:
+	verifier() {}
+
+	// Candidates are rare, this only fills up if the workers are starved of CPU
+	constexpr static size_t iMaxQueue = 64;
+
+	void work_main();
+
+	std::mutex mtx;
+	std::condition_variable cond_job;
+	std::condition_variable cond_space;
+	std::condition_variable cond_idle;
+	std::deque<job> qJobs;
+	size_t iBusy = 0;
+	size_t iWorkers = 0;
+};
+
+} // namespace amd
+} // namespace xmrstak
@@ -31,6 +31,7 @@
 #include "xmrstak/params.hpp"
 
 #include "cpu/minethd.hpp"
+#include "fake/minethd.hpp"
 #ifndef CONF_NO_CUDA
 #	include "nvidia/minethd.hpp"
 #endif
@@ -50,6 +51,19 @@
 namespace xmrstak
 {
 
+std::vector<const xmrstak_backend_api*>& BackendConnector::backends()
+{
+	static std::vector<const xmrstak_backend_api*> vApis;
+	return vApis;
+}
+
+void BackendConnector::release_backends()
+{
+	for(const xmrstak_backend_api* api : backends())
+		api->release();
+	backends().clear();
+}
+
 bool BackendConnector::self_test()
 {
 	return cpu::minethd::self_test();
@@ -65,6 +79,8 @@ std::vector<iBackend*>* BackendConnector::thread_starter(miner_work& pWork)
 	{
 		plugin nvidiaplugin("NVIDIA", "bittube-miner-cuda-backend");
 		std::vector<iBackend*>* nvidiaThreads = nvidiaplugin.startBackend(static_cast<uint32_t>(pvThreads->size()), pWork, environment::inst());
+		if(nvidiaplugin.pApi != nullptr && nvidiaThreads->size() != 0)
+			backends().push_back(nvidiaplugin.pApi);
 		pvThreads->insert(std::end(*pvThreads), std::begin(*nvidiaThreads), std::end(*nvidiaThreads));
 		if(nvidiaThreads->size() == 0)
 			printer::inst()->print_msg(L0, "WARNING: backend NVIDIA disabled.");
@@ -77,16 +93,30 @@ std::vector<iBackend*>* BackendConnector::thread_starter(miner_work& pWork)
 		const std::string backendName = xmrstak::params::inst().openCLVendor;
 		plugin amdplugin(backendName, "bittube-miner-opencl-backend");
 		std::vector<iBackend*>* amdThreads = amdplugin.startBackend(static_cast<uint32_t>(pvThreads->size()), pWork, environment::inst());
+		if(amdplugin.pApi != nullptr && amdThreads->size() != 0)
+			backends().push_back(amdplugin.pApi);
 		pvThreads->insert(std::end(*pvThreads), std::begin(*amdThreads), std::end(*amdThreads));
 		if(amdThreads->size() == 0)
 			printer::inst()->print_msg(L0, "WARNING: backend %s (OpenCL) disabled.", backendName.c_str());
 	}
 #endif
 
+	// Fake threads only sleep, they must not take cores from the CPU miners
+	size_t iGpuThreads = pvThreads->size();
+
+	if(params::inst().fakeDevices != 0)
+	{
+		plugin fakeplugin("fake", fake::get_backend_api());
+		std::vector<iBackend*>* fakeThreads = fakeplugin.startBackend(static_cast<uint32_t>(pvThreads->size()), pWork, environment::inst());
+		backends().push_back(fakeplugin.pApi);
+		pvThreads->insert(std::end(*pvThreads), std::begin(*fakeThreads), std::end(*fakeThreads));
+		delete fakeThreads;
+	}
+
 #ifndef CONF_NO_CPU
 	if(params::inst().useCPU)
 	{
-		auto cpuThreads = cpu::minethd::thread_starter(static_cast<uint32_t>(pvThreads->size()), pWork);
+		auto cpuThreads = cpu::minethd::thread_starter(static_cast<uint32_t>(pvThreads->size()), iGpuThreads, pWork);
 		pvThreads->insert(std::end(*pvThreads), std::begin(cpuThreads), std::end(cpuThreads));
 		if(cpuThreads.size() == 0)
 			printer::inst()->print_msg(L0, "WARNING: backend CPU disabled.");
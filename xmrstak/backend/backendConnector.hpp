@@ -2,6 +2,7 @@
 
 #include "iBackend.hpp"
 #include "miner_work.hpp"
+#include "plugin_api.hpp"
 
 #include <thread>
 #include <vector>
@@ -16,6 +17,11 @@ namespace xmrstak
 	{
 		static std::vector<iBackend*>* thread_starter(miner_work& pWork);
 		static bool self_test();
+
+		// Backends started by thread_starter that have the versioned plugin interface
+		static std::vector<const xmrstak_backend_api*>& backends();
+		// Makes the backends forget their threads and empties backends(), call before the threads are deleted
+		static void release_backends();
 	};
 
 } // namespace xmrstak
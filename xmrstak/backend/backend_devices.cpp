@@ -0,0 +1,125 @@
+/*
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  * GNU General Public License for more details.
+  *
+  * You should have received a copy of the GNU General Public License
+  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+  *
+  * Additional permission under GNU GPL version 3 section 7
+  *
+  * If you modify this Program, or any covered work, by linking or combining
+  * it with OpenSSL (or a modified version of that library), containing parts
+  * covered by the terms of OpenSSL License and SSLeay License, the licensors
+  * of this Program grant you additional permission to convey the resulting work.
+  *
+  */
+
+#include "backend_devices.hpp"
+
+#include <algorithm>
+
+namespace xmrstak
+{
+
+void backend_devices::set_threads(const std::vector<iBackend*>& vThds)
+{
+	std::unique_lock<std::mutex> lck(mtx);
+	vThreads = vThds;
+	vStopped.assign(vThreads.size(), false);
+}
+
+void backend_devices::clear()
+{
+	std::unique_lock<std::mutex> lck(mtx);
+	vThreads.clear();
+	vStopped.clear();
+}
+
+size_t backend_devices::get_threads(void** ppThreads, size_t iMax)
+{
+	std::unique_lock<std::mutex> lck(mtx);
+	for(size_t i = 0; i < std::min(iMax, vThreads.size()); i++)
+		ppThreads[i] = vThreads[i];
+	return vThreads.size();
+}
+
+int backend_devices::pause(uint32_t iDevice, bool bPause)
+{
+	std::unique_lock<std::mutex> lck(mtx);
+	int ret = -1;
+	for(iBackend* thd : vThreads)
+	{
+		if(thd->iDeviceIdx != iDevice)
+			continue;
+		thd->bPause = bPause;
+		ret = 0;
+	}
+	return ret;
+}
+
+int backend_devices::stop(uint32_t iDevice)
+{
+	std::unique_lock<std::mutex> lck(mtx);
+	int ret = -1;
+	// Ask all threads first, so the device's threads wind down in parallel
+	for(iBackend* thd : vThreads)
+	{
+		if(thd->iDeviceIdx == iDevice)
+			thd->request_quit();
+	}
+
+	for(size_t i = 0; i < vThreads.size(); i++)
+	{
+		if(vThreads[i]->iDeviceIdx != iDevice)
+			continue;
+		if(vThreads[i]->oWorkThd.joinable())
+			vThreads[i]->oWorkThd.join();
+		vStopped[i] = true;
+		ret = 0;
+	}
+	return ret;
+}
+
+size_t backend_devices::get_stats(xmrstak_device_stats* pStats, size_t iMax)
+{
+	std::unique_lock<std::mutex> lck(mtx);
+	std::vector<xmrstak_device_stats> vDevs;
+	for(size_t i = 0; i < vThreads.size(); i++)
+	{
+		iBackend* thd = vThreads[i];
+		auto it = std::find_if(vDevs.begin(), vDevs.end(),
+			[thd](const xmrstak_device_stats& dev) { return dev.iIndex == thd->iDeviceIdx; });
+		if(it == vDevs.end())
+		{
+			xmrstak_device_stats dev = {};
+			dev.iIndex = thd->iDeviceIdx;
+			dev.iState = XMRSTAK_DEV_STOPPED;
+			it = vDevs.insert(vDevs.end(), dev);
+		}
+
+		uint64_t iCount, iStamp;
+		thd->get_hash_stats(iCount, iStamp);
+		it->iThreads++;
+		it->iHashes += iCount;
+		it->iTimestampMs = std::max<uint64_t>(it->iTimestampMs, iStamp);
+		it->iIdleUs += thd->iDeviceIdleUs.load(std::memory_order_relaxed);
+		it->iStaleUs += thd->iDeviceStaleUs.load(std::memory_order_relaxed);
+
+		// A device counts as running while any of its threads mines
+		uint32_t iState = vStopped[i] ? XMRSTAK_DEV_STOPPED : (thd->bPause ? XMRSTAK_DEV_PAUSED : XMRSTAK_DEV_RUNNING);
+		it->iState = std::min(it->iState, iState);
+	}
+
+	for(size_t i = 0; i < std::min(iMax, vDevs.size()); i++)
+		pStats[i] = vDevs[i];
+	return vDevs.size();
+}
+
+} // namespace xmrstak
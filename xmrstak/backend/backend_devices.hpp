@@ -0,0 +1,33 @@
+#pragma once
+
+#include "iBackend.hpp"
+#include "plugin_api.hpp"
+
+#include <mutex>
+#include <vector>
+
+namespace xmrstak
+{
+
+/* Per device view of the threads a backend started, the shared part of the plugin API
+ * (see plugin_api.hpp). Each backend library keeps one instance.
+ */
+class backend_devices
+{
+public:
+	// Remembers the threads, the vector stays owned by the caller
+	void set_threads(const std::vector<iBackend*>& vThreads);
+	void clear();
+
+	size_t get_threads(void** ppThreads, size_t iMax);
+	int pause(uint32_t iDevice, bool bPause);
+	int stop(uint32_t iDevice);
+	size_t get_stats(xmrstak_device_stats* pStats, size_t iMax);
+
+private:
+	std::mutex mtx;
+	std::vector<iBackend*> vThreads;
+	std::vector<bool> vStopped;
+};
+
+} // namespace xmrstak
@@ -26,6 +26,7 @@
 #include "xmrstak/misc/console.hpp"
 #include "xmrstak/backend/iBackend.hpp"
 #include "xmrstak/backend/globalStates.hpp"
+#include "xmrstak/backend/scheduler.hpp"
 #include "xmrstak/misc/configEditor.hpp"
 #include "xmrstak/params.hpp"
 #include "jconf.hpp"
@@ -113,6 +114,7 @@ minethd::minethd(miner_work& pWork, size_t iNo, int iMultiway, bool no_prefetch,
 	iJobNo = 0;
 	bNoPrefetch = no_prefetch;
 	this->affinity = affinity;
+	this->iMultiway = iMultiway;
 
 	std::unique_lock<std::mutex> lck(thd_aff_set);
 	std::future<void> order_guard = order_fix.get_future();
@@ -331,7 +333,7 @@ bool minethd::self_test()
 	return bResult;
 }
 
-std::vector<iBackend*> minethd::thread_starter(uint32_t threadOffset, miner_work& pWork)
+std::vector<iBackend*> minethd::thread_starter(uint32_t threadOffset, size_t iGpuThreads, miner_work& pWork)
 {
 	std::vector<iBackend*> pvThreads;
 
@@ -351,6 +353,14 @@ std::vector<iBackend*> minethd::thread_starter(uint32_t threadOffset, miner_work
 	//Launch the requested number of single and double threads, to distribute
 	//load evenly we need to alternate single and double threads
 	size_t i, n = jconf::inst()->GetThreadCount();
+	// Leave the GPU threads cores to feed the devices
+	size_t iLimit = scheduler::cpu_thread_limit(n, iGpuThreads);
+	if(iLimit < n)
+	{
+		printer::inst()->print_msg(L0, "Starting %llu of %llu CPU threads, %llu cores are kept for %llu GPU threads.",
+			int_port(iLimit), int_port(n), int_port(scheduler::reserved_cores(iGpuThreads)), int_port(iGpuThreads));
+		n = iLimit;
+	}
 	pvThreads.reserve(n);
 
 	jconf::thd_cfg cfg;
@@ -376,6 +386,43 @@ std::vector<iBackend*> minethd::thread_starter(uint32_t threadOffset, miner_work
 	return pvThreads;
 }
 
+iBackend* minethd::thread_start(miner_work& pWork, size_t iNo, const jconf::thd_cfg& cfg)
+{
+	if(cfg.iCpuAff >= 0)
+		printer::inst()->print_msg(L1, "Starting %dx thread, affinity: %d.", cfg.iMultiway, (int)cfg.iCpuAff);
+	else
+		printer::inst()->print_msg(L1, "Starting %dx thread, no affinity.", cfg.iMultiway);
+
+	return new minethd(pWork, iNo, cfg.iMultiway, cfg.bNoPrefetch, cfg.iCpuAff);
+}
+
+bool minethd::apply_config(const jconf::thd_cfg& cfg)
+{
+	if(cfg.iMultiway != iMultiway || cfg.bNoPrefetch != bNoPrefetch)
+		return false;
+
+	if(cfg.iCpuAff == affinity)
+		return true;
+
+	// Affinity can be changed on the running thread, an unpinned thread needs a restart
+	if(cfg.iCpuAff < 0)
+		return false;
+
+	if(!thd_setaffinity(oWorkThd.native_handle(), cfg.iCpuAff))
+		printer::inst()->print_msg(L1, "WARNING setting affinity failed.");
+	else
+		printer::inst()->print_msg(L1, "Thread %u moved to cpu %d.", iThreadNo, (int)cfg.iCpuAff);
+	affinity = cfg.iCpuAff;
+	return true;
+}
+
+void minethd::get_config(jconf::thd_cfg& cfg) const
+{
+	cfg.iMultiway = iMultiway;
+	cfg.bNoPrefetch = bNoPrefetch;
+	cfg.iCpuAff = affinity;
+}
+
 minethd::cn_hash_fun minethd::func_selector(bool bHaveAes, bool bNoPrefetch, xmrstak_algo algo)
 {
 	// We have two independent flag bits in the functions
@@ -482,6 +529,7 @@ void minethd::work_main()
 
 	cryptonight_ctx* ctx;
 	uint64_t iCount = 0;
+	scheduler::range_sizer oRange;
 	uint64_t* piHashVal;
 	uint32_t* piNonce;
 	job_result result;
@@ -490,6 +538,7 @@ void minethd::work_main()
 	auto miner_algo = ::jconf::inst()->GetCurrentCoinSelection().GetDescription(1).GetMiningAlgoRoot();
 	cn_hash_fun hash_fun = func_selector(::jconf::inst()->HaveHardwareAes(), bNoPrefetch, miner_algo);
 	ctx = minethd_alloc_ctx();
+	iHugePages = (ctx != nullptr && ctx->ctx_info[0] != 0) ? 1 : 0;
 
 	piHashVal = (uint64_t*)(result.bResult + 24);
 	piNonce = (uint32_t*)(oWork.bWorkBlob + 39);
@@ -508,18 +557,18 @@ void minethd::work_main()
 				 * raison d'etre of this software it us sensible to just wait until we have something
 				 */
 
-				while (globalStates::inst().iGlobalJobNo.load(std::memory_order_relaxed) == iJobNo)
+				while (globalStates::inst().iGlobalJobNo.load(std::memory_order_relaxed) == iJobNo && bQuit == 0)
 					std::this_thread::sleep_for(std::chrono::milliseconds(100));
 
 				globalStates::inst().consume_work(oWork, iJobNo);
 				continue;
 			}
 
-			size_t nonce_ctr = 0;
-			constexpr size_t nonce_chunk = 4096; // Needs to be a power of 2
+			uint32_t nonce_left = 0;
 
 			assert(sizeof(job_result::sJobID) == sizeof(pool_job::sJobID));
 			memcpy(result.sJobID, oWork.sJobID, sizeof(job_result::sJobID));
+			result.iJobNo = iJobNo;
 
 			if (oWork.bNiceHash)
 				result.iNonce = *piNonce;
@@ -549,13 +598,16 @@ void minethd::work_main()
 				if ((iCount++ & 0xF) == 0) //Store stats every 16 hashes
 				{
 					uint64_t iStamp = get_timestamp_ms();
-					iHashCount.store(iCount, std::memory_order_relaxed);
-					iTimestamp.store(iStamp, std::memory_order_relaxed);
+					set_hash_stats(iCount, iStamp);
+					if (bQuit != 0)
+						break;
 				}
 
-				if ((nonce_ctr++ & (nonce_chunk - 1)) == 0)
+				// Allocate nonces for about scheduler::iRangeMs of work at the speed of this thread
+				if (nonce_left == 0)
 				{
-					globalStates::inst().calc_start_nonce(result.iNonce, oWork.bNiceHash, nonce_chunk);
+					nonce_left = oRange.next(iCount, get_timestamp_ms(), 1);
+					globalStates::inst().calc_start_nonce(result.iNonce, oWork.bNiceHash, nonce_left);
 					// check if the job is still valid, there is a small posibility that the job is switched
 					if(globalStates::inst().iGlobalJobNo.load(std::memory_order_relaxed) != iJobNo)
 						break;
@@ -568,6 +620,7 @@ void minethd::work_main()
 				if (*piHashVal < oWork.iTarget)
 					executor::inst()->push_event(ex_event(result, oWork.iPoolId));
 				result.iNonce++;
+				nonce_left--;
 
 				if (!executor::inst()->isPause) {
 					std::this_thread::yield();
@@ -857,6 +910,7 @@ void minethd::multiway_work_main()
 
 	cryptonight_ctx *ctx[MAX_N];
 	uint64_t iCount = 0;
+	scheduler::range_sizer oRange;
 	uint64_t *piHashVal[MAX_N];
 	uint32_t *piNonce[MAX_N];
 	uint8_t bHashOut[MAX_N * 32];
@@ -864,12 +918,16 @@ void minethd::multiway_work_main()
 	uint32_t iNonce;
 	job_result res;
 
+	int32_t huge_pages = 1;
 	for (size_t i = 0; i < N; i++)
 	{
 		ctx[i] = minethd_alloc_ctx();
+		if(ctx[i] == nullptr || ctx[i]->ctx_info[0] == 0)
+			huge_pages = 0;
 		piHashVal[i] = (uint64_t*)(bHashOut + 32 * i + 24);
 		piNonce[i] = (i == 0) ? (uint32_t*)(bWorkBlob + 39) : nullptr;
 	}
+	iHugePages = huge_pages;
 
 	if(!oWork.bStall)
 		prep_multiway_work<N>(bWorkBlob, piNonce);
@@ -891,7 +949,7 @@ void minethd::multiway_work_main()
 				either because of network latency, or a socket problem. Since we are
 				raison d'etre of this software it us sensible to just wait until we have something*/
 
-				while (globalStates::inst().iGlobalJobNo.load(std::memory_order_relaxed) == iJobNo)
+				while (globalStates::inst().iGlobalJobNo.load(std::memory_order_relaxed) == iJobNo && bQuit == 0)
 					std::this_thread::sleep_for(std::chrono::milliseconds(100));
 
 				globalStates::inst().consume_work(oWork, iJobNo);
@@ -899,8 +957,8 @@ void minethd::multiway_work_main()
 				continue;
 			}
 
-			constexpr uint32_t nonce_chunk = 4096;
-			int64_t nonce_ctr = 0;
+			// Always a multiple of N, so the lanes never run past the allocated range
+			uint32_t nonce_left = 0;
 
 			assert(sizeof(job_result::sJobID) == sizeof(pool_job::sJobID));
 
@@ -935,15 +993,15 @@ void minethd::multiway_work_main()
 				if ((iCount++ & 0x7) == 0)  //Store stats every 8*N hashes
 				{
 					uint64_t iStamp = get_timestamp_ms();
-					iHashCount.store(iCount * N, std::memory_order_relaxed);
-					iTimestamp.store(iStamp, std::memory_order_relaxed);
+					set_hash_stats(iCount * N, iStamp);
+					if (bQuit != 0)
+						break;
 				}
 
-				nonce_ctr -= N;
-				if (nonce_ctr <= 0)
+				if (nonce_left == 0)
 				{
-					globalStates::inst().calc_start_nonce(iNonce, oWork.bNiceHash, nonce_chunk);
-					nonce_ctr = nonce_chunk;
+					nonce_left = oRange.next(iCount * N, get_timestamp_ms(), N);
+					globalStates::inst().calc_start_nonce(iNonce, oWork.bNiceHash, nonce_left);
 					// check if the job is still valid, there is a small posibility that the job is switched
 					if(globalStates::inst().iGlobalJobNo.load(std::memory_order_relaxed) != iJobNo)
 						break;
@@ -951,15 +1009,34 @@ void minethd::multiway_work_main()
 
 				for (size_t i = 0; i < N; i++)
 					*piNonce[i] = iNonce++;
+				nonce_left -= N;
 
 				hash_fun_multi(bWorkBlob, oWork.iWorkSize, bHashOut, ctx);
 
+				// Lanes that hit the target together are submitted as one batch, a lone
+				// result keeps the plain event and skips the allocation
+				size_t iFound = 0;
 				for (size_t i = 0; i < N; i++)
+					iFound += *piHashVal[i] < oWork.iTarget ? 1 : 0;
+
+				if (iFound == 1)
+				{
+					for (size_t i = 0; i < N; i++)
+					{
+						if (*piHashVal[i] < oWork.iTarget)
+							executor::inst()->push_event(ex_event(job_result(oWork.sJobID, iNonce - N + i, bHashOut + 32 * i, iThreadNo, miner_algo, iJobNo), oWork.iPoolId));
+					}
+				}
+				else if (iFound != 0)
 				{
-					if (*piHashVal[i] < oWork.iTarget)
+					result_batch oBatch;
+					oBatch.vResults.reserve(iFound);
+					for (size_t i = 0; i < N; i++)
 					{
-						executor::inst()->push_event(ex_event(job_result(oWork.sJobID, iNonce - N + i, bHashOut + 32 * i, iThreadNo, miner_algo), oWork.iPoolId));
+						if (*piHashVal[i] < oWork.iTarget)
+							oBatch.vResults.emplace_back(oWork.sJobID, iNonce - N + i, bHashOut + 32 * i, iThreadNo, miner_algo, iJobNo);
 					}
+					executor::inst()->push_event(ex_event(std::move(oBatch), oWork.iPoolId));
 				}
 
 				if (!executor::inst()->isPause) {
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "xmrstak/jconf.hpp"
+#include "jconf.hpp"
 #include "crypto/cryptonight.h"
 #include "xmrstak/backend/miner_work.hpp"
 #include "xmrstak/backend/iBackend.hpp"
@@ -19,7 +20,8 @@ namespace cpu
 class minethd : public iBackend
 {
 public:
-	static std::vector<iBackend*> thread_starter(uint32_t threadOffset, miner_work& pWork);
+	// iGpuThreads counts only the real GPU threads, fake devices don't need a core
+	static std::vector<iBackend*> thread_starter(uint32_t threadOffset, size_t iGpuThreads, miner_work& pWork);
 	static bool self_test();
 
 	typedef void (*cn_hash_fun)(const void*, size_t, void*, cryptonight_ctx*);
@@ -29,6 +31,13 @@ public:
 
 	static cryptonight_ctx* minethd_alloc_ctx();
 
+	// Config reload: start one thread, or apply a changed entry to a running one.
+	// apply_config returns false if the thread has to be restarted for the change.
+	static iBackend* thread_start(miner_work& pWork, size_t iNo, const jconf::thd_cfg& cfg);
+	bool apply_config(const jconf::thd_cfg& cfg);
+	// Settings the thread is running with, differs from cpu.txt after a watchdog action
+	void get_config(jconf::thd_cfg& cfg) const;
+
 private:
 	typedef void (*cn_hash_fun_multi)(const void*, size_t, void*, cryptonight_ctx**);
 	static cn_hash_fun_multi func_multi_selector(size_t N, bool bHaveAes, bool bNoPrefetch, xmrstak_algo algo);
@@ -56,6 +65,7 @@ private:
 
 	int64_t affinity;
 
+	int iMultiway;
 	bool bNoPrefetch;
 };
 
@@ -0,0 +1,184 @@
+/*
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  * GNU General Public License for more details.
+  *
+  * You should have received a copy of the GNU General Public License
+  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+  *
+  * Additional permission under GNU GPL version 3 section 7
+  *
+  * If you modify this Program, or any covered work, by linking or combining
+  * it with OpenSSL (or a modified version of that library), containing parts
+  * covered by the terms of OpenSSL License and SSLeay License, the licensors
+  * of this Program grant you additional permission to convey the resulting work.
+  *
+  */
+
+#include "minethd.hpp"
+
+#include "xmrstak/backend/backend_devices.hpp"
+#include "xmrstak/backend/globalStates.hpp"
+#include "xmrstak/backend/scheduler.hpp"
+#include "xmrstak/misc/console.hpp"
+#include "xmrstak/misc/executor.hpp"
+#include "xmrstak/params.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+
+namespace xmrstak
+{
+namespace fake
+{
+
+constexpr double minethd::fDeviceHps;
+
+minethd::minethd(miner_work& pWork, size_t iNo, uint32_t iDevice)
+{
+	this->backendType = iBackend::FAKE;
+	oWork = pWork;
+	iThreadNo = (uint32_t)iNo;
+	iDeviceIdx = iDevice;
+
+	oWorkThd = std::thread(&minethd::work_main, this);
+}
+
+std::vector<iBackend*>* minethd::thread_starter(uint32_t threadOffset, miner_work& pWork)
+{
+	std::vector<iBackend*>* pvThreads = new std::vector<iBackend*>();
+
+	for(uint32_t i = 0; i < params::inst().fakeDevices; i++)
+	{
+		printer::inst()->print_msg(L1, "Starting fake GPU thread %u, %.0f H/s.", i, fDeviceHps);
+		pvThreads->push_back(new minethd(pWork, i + threadOffset, i));
+	}
+
+	return pvThreads;
+}
+
+void minethd::work_main()
+{
+	uint64_t iCount = 0;
+	scheduler::range_sizer oRange;
+	uint32_t iNonce = 0;
+	uint64_t iLastStamp = get_timestamp_ms();
+
+	while (bQuit == 0)
+	{
+		if (oWork.bStall)
+		{
+			while (globalStates::inst().iGlobalJobNo.load(std::memory_order_relaxed) == iJobNo && bQuit == 0)
+				std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+			globalStates::inst().consume_work(oWork, iJobNo);
+			continue;
+		}
+
+		if (oWork.bNiceHash)
+			iNonce = *(uint32_t*)(oWork.bWorkBlob + 39);
+
+		uint32_t nonce_left = 0;
+		while (globalStates::inst().iGlobalJobNo.load(std::memory_order_relaxed) == iJobNo && bQuit == 0)
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+			uint64_t iStamp = get_timestamp_ms();
+			uint64_t iHashes = uint64_t(fDeviceHps * double(iStamp - iLastStamp) / 1000.0);
+			iLastStamp = iStamp;
+			if (executor::inst()->isPause || bPause)
+				continue;
+
+			// Take nonces for the hashes of the last tick the way a GPU takes them for its rounds
+			while (iHashes != 0)
+			{
+				if (nonce_left == 0)
+				{
+					nonce_left = oRange.next(iCount, iStamp, 1);
+					globalStates::inst().calc_start_nonce(iNonce, oWork.bNiceHash, nonce_left);
+				}
+				uint32_t iStep = uint32_t(std::min<uint64_t>(iHashes, nonce_left));
+				nonce_left -= iStep;
+				iNonce += iStep;
+				iHashes -= iStep;
+				iCount += iStep;
+			}
+			set_hash_stats(iCount, iStamp);
+		}
+
+		globalStates::inst().consume_work(oWork, iJobNo);
+	}
+}
+
+namespace
+{
+
+backend_devices oDevices;
+
+size_t api_start(uint32_t threadOffset, void* pWork)
+{
+	std::vector<iBackend*>* pvThreads = minethd::thread_starter(threadOffset, *static_cast<miner_work*>(pWork));
+	oDevices.set_threads(*pvThreads);
+	size_t n = pvThreads->size();
+	delete pvThreads;
+	return n;
+}
+
+size_t api_get_threads(void** ppThreads, size_t iMax) { return oDevices.get_threads(ppThreads, iMax); }
+int api_pause(uint32_t iDevice, int bPause) { return oDevices.pause(iDevice, bPause != 0); }
+int api_stop(uint32_t iDevice) { return oDevices.stop(iDevice); }
+size_t api_get_stats(xmrstak_device_stats* pStats, size_t iMax) { return oDevices.get_stats(pStats, iMax); }
+void api_release() { oDevices.clear(); }
+
+size_t api_enum_devices(xmrstak_device_info* pDevs, size_t iMax)
+{
+	size_t n = params::inst().fakeDevices;
+	for(size_t i = 0; i < std::min(iMax, n); i++)
+	{
+		pDevs[i] = xmrstak_device_info();
+		pDevs[i].iIndex = uint32_t(i);
+		snprintf(pDevs[i].sName, sizeof(pDevs[i].sName), "fake GPU %u", unsigned(i));
+	}
+	return n;
+}
+
+int api_bench(uint32_t iDevice, double* pHps)
+{
+	if(iDevice >= params::inst().fakeDevices)
+		return -1;
+	*pHps = minethd::fDeviceHps;
+	return 0;
+}
+
+const xmrstak_backend_api oApi = {
+	XMRSTAK_BACKEND_ABI,
+	sizeof(xmrstak_backend_api),
+	XMRSTAK_CAP_ENUM | XMRSTAK_CAP_PAUSE | XMRSTAK_CAP_STOP | XMRSTAK_CAP_STATS | XMRSTAK_CAP_BENCH,
+	"fake",
+	api_start,
+	api_get_threads,
+	api_enum_devices,
+	api_pause,
+	api_stop,
+	api_get_stats,
+	api_bench,
+	api_release
+};
+
+} // namespace
+
+const xmrstak_backend_api* get_backend_api()
+{
+	return &oApi;
+}
+
+} // namespace fake
+} // namespace xmrstak
@@ -0,0 +1,38 @@
+#pragma once
+
+#include "xmrstak/backend/iBackend.hpp"
+#include "xmrstak/backend/miner_work.hpp"
+#include "xmrstak/backend/plugin_api.hpp"
+
+#include <vector>
+
+namespace xmrstak
+{
+namespace fake
+{
+
+/* Simulated GPUs for testing the executor without GPUs. The threads take jobs and nonce
+ * ranges like a real backend and report hashes at a fixed rate, but compute nothing and never
+ * find a result. Started in process through the plugin API, see plugin_api.hpp.
+ */
+class minethd : public iBackend
+{
+public:
+	static std::vector<iBackend*>* thread_starter(uint32_t threadOffset, miner_work& pWork);
+
+	// Hash rate every fake device reports
+	constexpr static double fDeviceHps = 1000.0;
+
+private:
+	minethd(miner_work& pWork, size_t iNo, uint32_t iDevice);
+
+	void work_main();
+
+	uint64_t iJobNo = 0;
+	miner_work oWork;
+};
+
+const xmrstak_backend_api* get_backend_api();
+
+} // namespace fake
+} // namespace xmrstak
@@ -43,16 +43,37 @@ void globalStates::consume_work( miner_work& threadWork, uint64_t& currentJobId)
 	jobLock.UnLock();
 }
 
+uint64_t globalStates::get_clean_job(size_t pool)
+{
+	jobLock.ReadLock();
+	auto it = mCleanJobNo.find(pool);
+	uint64_t iCleanJobNo = it != mCleanJobNo.end() ? it->second : 0;
+	jobLock.UnLock();
+	return iCleanJobNo;
+}
+
+void globalStates::set_clean_job(size_t pool)
+{
+	jobLock.WriteLock();
+	mCleanJobNo[pool] = iGlobalJobNo.load(std::memory_order_relaxed) + 1;
+	jobLock.UnLock();
+}
+
 void globalStates::switch_work(miner_work& pWork, pool_data& dat)
 {
 	jobLock.WriteLock();
 
+	size_t xid = dat.pool_id;
+
+	// Set under the same lock, a thread that sees the new job number also sees whether its old work still counts
+	if(dat.bNewBlock)
+		mCleanJobNo[xid] = iGlobalJobNo.load(std::memory_order_relaxed) + 1;
+
 	/* This notifies all threads that the job has changed.
 	* To avoid duplicated shared this must be done before the nonce is exchanged.
 	*/
 	iGlobalJobNo++;
 
-	size_t xid = dat.pool_id;
 	dat.pool_id = pool_id;
 	pool_id = xid;
 
@@ -7,6 +7,7 @@
 #include "xmrstak/cpputil/read_write_lock.h"
 
 #include <atomic>
+#include <map>
 
 namespace xmrstak
 {
@@ -34,6 +35,11 @@ struct globalStates
 
 	void consume_work( miner_work& threadWork, uint64_t& currentJobId);
 
+	// Work on the pool's jobs before the returned job number is worthless, the pool moved to a new block since
+	uint64_t get_clean_job(size_t pool);
+	// Called for a new block of a pool that is not mined on right now, see switch_work for the active one
+	void set_clean_job(size_t pool);
+
 	miner_work oGlobalWork;
 	std::atomic<uint64_t> iGlobalJobNo;
 	std::atomic<uint64_t> iConsumeCnt;
@@ -47,6 +53,8 @@ private:
 	}
 
 	::cpputil::RWLock jobLock;
+	// Per pool id, guarded by jobLock
+	std::map<size_t, uint64_t> mCleanJobNo;
 };
 
 } // namespace xmrstak
@@ -19,7 +19,8 @@ namespace xmrstak
 	struct iBackend
 	{
 
-		enum BackendType : uint32_t { UNKNOWN = 0u, CPU = 1u, AMD = 2u, NVIDIA = 3u };
+		enum BackendType : uint32_t { UNKNOWN = 0u, CPU = 1u, AMD = 2u, NVIDIA = 3u, FAKE = 4u };
+		constexpr static uint32_t iTypeCount = 5u;
 		
 		static const char* getName(const BackendType type)
 		{
@@ -27,7 +28,8 @@ namespace xmrstak
 				"unknown",
 				"cpu",
 				"amd",
-				"nvidia"
+				"nvidia",
+				"fake"
 			};
 
 			uint32_t i = static_cast<uint32_t>(type);
@@ -38,22 +40,75 @@ namespace xmrstak
 		}
 
 		void static_quit() {
-			bQuit = 1;
-			oWorkThd.join();
+			request_quit();
+			// Threads stopped through the plugin API are already joined
+			if(oWorkThd.joinable())
+				oWorkThd.join();
 		}
 
-		std::atomic<uint64_t> iHashCount;
-		std::atomic<uint64_t> iTimestamp;
+		// Tell the worker to stop after its current hash or GPU round, does not wait
+		inline void request_quit() { bQuit = true; }
+
+		/* Hash count and timestamp are always published together (sequence lock, the worker
+		 * thread is the only writer), so a reader never sees a count from one update and the
+		 * timestamp from another.
+		 */
+		inline void set_hash_stats(uint64_t count, uint64_t stamp)
+		{
+			uint32_t seq = iStatSeq.load(std::memory_order_relaxed);
+			iStatSeq.store(seq + 1, std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_release);
+			iHashCount.store(count, std::memory_order_relaxed);
+			iTimestamp.store(stamp, std::memory_order_relaxed);
+			iStatSeq.store(seq + 2, std::memory_order_release);
+		}
+
+		inline void get_hash_stats(uint64_t& count, uint64_t& stamp)
+		{
+			uint32_t seq;
+			do
+			{
+				seq = iStatSeq.load(std::memory_order_acquire);
+				count = iHashCount.load(std::memory_order_relaxed);
+				stamp = iTimestamp.load(std::memory_order_relaxed);
+				std::atomic_thread_fence(std::memory_order_acquire);
+			}
+			while((seq & 1) != 0 || seq != iStatSeq.load(std::memory_order_relaxed));
+		}
+
+		inline uint64_t get_hash_count() { return iHashCount.load(std::memory_order_relaxed); }
+
 		uint32_t iThreadNo;
 		BackendType backendType = UNKNOWN;
 
-		bool bQuit;
+		std::atomic<bool> bQuit;
 		std::thread oWorkThd;
 
-		iBackend() : iHashCount(0), iTimestamp(0)
+		// Device the thread mines on, as numbered by its backend
+		uint32_t iDeviceIdx = 0;
+		// Per device pause from the plugin API, the thread idles like on a global pause
+		std::atomic<bool> bPause;
+
+		// 1 if the thread's scratchpads are in large pages, 0 if not, -1 if it does not apply (GPU)
+		std::atomic<int32_t> iHugePages;
+
+		// Time the GPU sat idle between two rounds waiting for the host, in us (AMD only)
+		std::atomic<uint64_t> iDeviceIdleUs;
+		// Time the GPU spent on rounds dropped because a new block or pool replaced their job, in us (AMD only)
+		std::atomic<uint64_t> iDeviceStaleUs;
+
+		iBackend() : bQuit(false), bPause(false), iHugePages(-1), iDeviceIdleUs(0), iDeviceStaleUs(0), iStatSeq(0), iHashCount(0), iTimestamp(0)
 		{
-			bQuit = 0;
 		}
+
+	private:
+		// Backend objects are allocated next to each other, keep the counters that
+		// are written by the worker thread on their own cache line
+		char pad0[64];
+		std::atomic<uint32_t> iStatSeq;
+		std::atomic<uint64_t> iHashCount;
+		std::atomic<uint64_t> iTimestamp;
+		char pad1[64];
 	};
 
 } // namespace xmrstak
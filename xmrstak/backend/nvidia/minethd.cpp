@@ -27,6 +27,8 @@
 #include "xmrstak/backend/cpu/crypto/cryptonight_aesni.h"
 #include "xmrstak/backend/cpu/crypto/cryptonight.h"
 #include "xmrstak/backend/cpu/minethd.hpp"
+#include "xmrstak/backend/scheduler.hpp"
+#include "xmrstak/backend/backend_devices.hpp"
 #include "xmrstak/params.hpp"
 #include "xmrstak/misc/executor.hpp"
 #include "xmrstak/jconf.hpp"
@@ -40,6 +42,7 @@
 #include <chrono>
 #include <thread>
 #include <bitset>
+#include <cstdio>
 #include <vector>
 
 #ifndef USE_PRECOMPILED_HEADERS
@@ -73,6 +76,7 @@ minethd::minethd(miner_work& pWork, size_t iNo, const jconf::thd_cfg& cfg)
 	iJobNo = 0;
 
 	ctx.device_id = (int)cfg.id;
+	iDeviceIdx = uint32_t(cfg.id);
 	ctx.device_blocks = (int)cfg.blocks;
 	ctx.device_threads = (int)cfg.threads;
 	ctx.device_bfactor = (int)cfg.bfactor;
@@ -126,6 +130,75 @@ bool minethd::self_test()
 }
 
 
+namespace
+{
+
+backend_devices oDevices;
+
+size_t api_start(uint32_t threadOffset, void* pWork)
+{
+	std::vector<iBackend*>* pvThreads = minethd::thread_starter(threadOffset, *static_cast<miner_work*>(pWork));
+	oDevices.set_threads(*pvThreads);
+	size_t n = pvThreads->size();
+	delete pvThreads;
+	return n;
+}
+
+size_t api_get_threads(void** ppThreads, size_t iMax) { return oDevices.get_threads(ppThreads, iMax); }
+int api_pause(uint32_t iDevice, int bPause) { return oDevices.pause(iDevice, bPause != 0); }
+int api_stop(uint32_t iDevice) { return oDevices.stop(iDevice); }
+size_t api_get_stats(xmrstak_device_stats* pStats, size_t iMax) { return oDevices.get_stats(pStats, iMax); }
+void api_release() { oDevices.clear(); }
+
+size_t api_enum_devices(xmrstak_device_info* pDevs, size_t iMax)
+{
+	int deviceCount = 0;
+	if(cuda_get_devicecount(&deviceCount) != 1)
+		return 0;
+
+	size_t n = 0;
+	for(int i = 0; i < deviceCount; i++)
+	{
+		nvid_ctx ctx;
+		ctx.device_id = i;
+		// -1 lets the device info pick valid values
+		ctx.device_blocks = -1;
+		ctx.device_threads = -1;
+		ctx.device_bfactor = 0;
+		ctx.device_bsleep = 0;
+		if(cuda_get_deviceinfo(&ctx) != 0)
+			continue;
+
+		if(n < iMax)
+		{
+			pDevs[n] = xmrstak_device_info();
+			pDevs[n].iIndex = uint32_t(i);
+			pDevs[n].iMemory = ctx.total_device_memory;
+			snprintf(pDevs[n].sName, sizeof(pDevs[n].sName), "%s", ctx.name.c_str());
+		}
+		n++;
+	}
+	return n;
+}
+
+// No benchmark hook, the CUDA kernels have no standalone timing path yet
+const xmrstak_backend_api oApi = {
+	XMRSTAK_BACKEND_ABI,
+	sizeof(xmrstak_backend_api),
+	XMRSTAK_CAP_ENUM | XMRSTAK_CAP_PAUSE | XMRSTAK_CAP_STOP | XMRSTAK_CAP_STATS,
+	"nvidia",
+	api_start,
+	api_get_threads,
+	api_enum_devices,
+	api_pause,
+	api_stop,
+	api_get_stats,
+	nullptr,
+	api_release
+};
+
+} // namespace
+
 extern "C"
 {
 #ifdef WIN32
@@ -136,6 +209,17 @@ std::vector<iBackend*>* xmrstak_start_backend(uint32_t threadOffset, miner_work&
 	environment::inst(&env);
 	return nvidia::minethd::thread_starter(threadOffset, pWork);
 }
+
+#ifdef WIN32
+__declspec(dllexport)
+#endif
+const xmrstak_backend_api* xmrstak_get_backend_api(uint32_t iHostAbi, void* pEnv)
+{
+	if(iHostAbi != XMRSTAK_BACKEND_ABI)
+		return nullptr;
+	environment::inst(static_cast<environment*>(pEnv));
+	return &oApi;
+}
 } // extern "C"
 
 std::vector<iBackend*>* minethd::thread_starter(uint32_t threadOffset, miner_work& pWork)
@@ -212,6 +296,7 @@ void minethd::work_main()
 	thread_work_guard.wait();
 
 	uint64_t iCount = 0;
+	scheduler::range_sizer oRange;
 	cryptonight_ctx* cpu_ctx;
 	cpu_ctx = cpu::minethd::minethd_alloc_ctx();
 	
@@ -234,7 +319,7 @@ void minethd::work_main()
 				 * raison d'etre of this software it us sensible to just wait until we have something
 				 */
 
-				while (globalStates::inst().iGlobalJobNo.load(std::memory_order_relaxed) == iJobNo)
+				while (globalStates::inst().iGlobalJobNo.load(std::memory_order_relaxed) == iJobNo && bQuit == 0)
 					std::this_thread::sleep_for(std::chrono::milliseconds(100));
 
 				globalStates::inst().consume_work(oWork, iJobNo);
@@ -262,7 +347,7 @@ void minethd::work_main()
 			cryptonight_extra_cpu_set_data(&ctx, oWork.bWorkBlob, oWork.iWorkSize);
 
 			uint32_t h_per_round = ctx.device_blocks * ctx.device_threads;
-			size_t round_ctr = 0;
+			uint32_t nonce_left = 0;
 
 			assert(sizeof(job_result::sJobID) == sizeof(pool_job::sJobID));
 
@@ -271,10 +356,11 @@ void minethd::work_main()
 
 			while (globalStates::inst().iGlobalJobNo.load(std::memory_order_relaxed) == iJobNo)
 			{
-				//Allocate a new nonce every 16 rounds
-				if ((round_ctr++ & 0xF) == 0)
+				// Allocate nonces for about scheduler::iRangeMs of work at the speed of this GPU
+				if (nonce_left == 0)
 				{
-					globalStates::inst().calc_start_nonce(iNonce, oWork.bNiceHash, h_per_round * 16);
+					nonce_left = oRange.next(iCount, get_timestamp_ms(), h_per_round);
+					globalStates::inst().calc_start_nonce(iNonce, oWork.bNiceHash, nonce_left);
 					// check if the job is still valid, there is a small posibility that the job is switched
 					if(globalStates::inst().iGlobalJobNo.load(std::memory_order_relaxed) != iJobNo)
 						break;
@@ -289,6 +375,13 @@ void minethd::work_main()
 
 				cryptonight_extra_cpu_final(&ctx, iNonce, oWork.iTarget, &foundCount, foundNonce, miner_algo);
 
+				// Everything found in the round goes to the executor as one event
+				result_batch oBatch;
+				oBatch.iGpuIdx = ctx.device_id;
+				oBatch.sInvalidError = "NVIDIA Invalid Result";
+				if (foundCount != 0)
+					oBatch.vResults.reserve(foundCount);
+
 				for (size_t i = 0; i < foundCount; i++)
 				{
 
@@ -302,21 +395,28 @@ void minethd::work_main()
 
 					hash_fun(bWorkBlob, oWork.iWorkSize, bResult, cpu_ctx);
 					if ((*((uint64_t*)(bResult + 24))) < oWork.iTarget)
-						executor::inst()->push_event(ex_event(job_result(oWork.sJobID, foundNonce[i], bResult, iThreadNo, miner_algo), oWork.iPoolId));
+						oBatch.vResults.emplace_back(oWork.sJobID, foundNonce[i], bResult, iThreadNo, miner_algo, iJobNo);
 					else
-						executor::inst()->push_event(ex_event("NVIDIA Invalid Result", ctx.device_id, oWork.iPoolId));
+						oBatch.iInvalid++;
 				}
 
+				if (!oBatch.vResults.empty() || oBatch.iInvalid != 0)
+					executor::inst()->push_event(ex_event(std::move(oBatch), oWork.iPoolId));
+
 				iCount += h_per_round;
 				iNonce += h_per_round;
+				nonce_left -= h_per_round;
 
 				using namespace std::chrono;
 				uint64_t iStamp = get_timestamp_ms();
-				iHashCount.store(iCount, std::memory_order_relaxed);
-				iTimestamp.store(iStamp, std::memory_order_relaxed);
+				set_hash_stats(iCount, iStamp);
+
+				// Results of the round are queued above, stop before starting another one
+				if (bQuit != 0)
+					break;
 
 
-				while (executor::inst()->isPause) {
+				while (executor::inst()->isPause || bPause) {
 					std::this_thread::sleep_for(std::chrono::milliseconds(50));
 					std::this_thread::yield();
 					if (bQuit != 0) {
@@ -3,12 +3,13 @@
 #include "xmrstak/misc/environment.hpp"
 #include "xmrstak/params.hpp"
 
+#include <algorithm>
 #include <thread>
 #include <atomic>
 #include <vector>
 #include <string>
 #include "iBackend.hpp"
-#include <iostream>
+#include "plugin_api.hpp"
 
 #ifndef USE_PRECOMPILED_HEADERS
 #	ifdef WIN32
@@ -27,7 +28,12 @@ namespace xmrstak
 struct plugin
 {
 
-	plugin(const std::string backendName, const std::string libName) : fn_startBackend(nullptr), m_backendName(backendName)
+	// Backend linked into the miner, e.g. the fake test backend
+	plugin(const std::string backendName, const xmrstak_backend_api* api) : m_backendName(backendName), fn_startBackend(nullptr), pApi(api), libBackend(nullptr)
+	{
+	}
+
+	plugin(const std::string backendName, const std::string libName) : m_backendName(backendName), fn_startBackend(nullptr), pApi(nullptr)
 	{
 #ifdef WIN32
 		libBackend = LoadLibrary(TEXT((libName + ".dll").c_str()));
@@ -58,26 +64,46 @@ struct plugin
 		}
 #endif
 
-#ifdef WIN32
-		fn_startBackend = (startBackend_t) GetProcAddress(libBackend, "xmrstak_start_backend");
-		if (!fn_startBackend)
+		xmrstak_get_backend_api_t fn_getApi = (xmrstak_get_backend_api_t) getSymbol("xmrstak_get_backend_api");
+		if(fn_getApi != nullptr)
 		{
-			std::cerr << "WARNING: backend plugin " << libName << " contains no entry 'xmrstak_start_backend': " <<GetLastError()<< std::endl;
+			pApi = fn_getApi(XMRSTAK_BACKEND_ABI, &environment::inst());
+			if(pApi == nullptr || pApi->iAbiVersion != XMRSTAK_BACKEND_ABI || pApi->iSize < sizeof(xmrstak_backend_api))
+			{
+				std::cerr << "WARNING: backend plugin " << libName << " does not support interface version " << XMRSTAK_BACKEND_ABI << std::endl;
+				pApi = nullptr;
+			}
+			return;
 		}
+
+		// libraries from before the versioned interface
+		fn_startBackend = (startBackend_t) getSymbol("xmrstak_start_backend");
+		if(fn_startBackend == nullptr)
+			std::cerr << "WARNING: backend plugin " << libName << " contains no entry 'xmrstak_get_backend_api' or 'xmrstak_start_backend'" << std::endl;
+	}
+
+	void* getSymbol(const char* name)
+	{
+#ifdef WIN32
+		return (void*) GetProcAddress(libBackend, name);
 #else
-		// reset last error
-		dlerror();
-		fn_startBackend = (startBackend_t) dlsym(libBackend, "xmrstak_start_backend");
-		const char* dlsym_error = dlerror();
-		if(dlsym_error)
-		{
-			std::cerr << "WARNING: backend plugin " << libName << " contains no entry 'xmrstak_start_backend': " << dlsym_error << std::endl;
-		}
+		return dlsym(libBackend, name);
 #endif
 	}
 
 	std::vector<iBackend*>* startBackend(uint32_t threadOffset, miner_work& pWork, environment& env)
 	{
+		if(pApi != nullptr)
+		{
+			std::vector<void*> vThreads(pApi->start(threadOffset, &pWork));
+			vThreads.resize(std::min(vThreads.size(), pApi->get_threads(vThreads.data(), vThreads.size())));
+
+			std::vector<iBackend*>* pvThreads = new std::vector<iBackend*>();
+			for(void* thd : vThreads)
+				pvThreads->push_back(static_cast<iBackend*>(thd));
+			return pvThreads;
+		}
+
 		if(fn_startBackend == nullptr)
 		{
 			std::vector<iBackend*>* pvThreads = new std::vector<iBackend*>();
@@ -93,6 +119,8 @@ struct plugin
 	typedef std::vector<iBackend*>* (*startBackend_t)(uint32_t threadOffset, miner_work& pWork, environment& env);
 
 	startBackend_t fn_startBackend;
+	// Set if the library has the versioned interface, stays valid while the library is loaded
+	const xmrstak_backend_api* pApi;
 
 #ifdef WIN32
 	HINSTANCE libBackend;
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Interface between the miner and its backend libraries, version 2.
+ *
+ * A library exports xmrstak_get_backend_api() and hands back a table of plain C functions.
+ * The host's miner_work and environment and the started threads (xmrstak::iBackend) only cross
+ * the boundary as opaque pointers, so the library still has to be built from the same tree.
+ * Libraries without the export are started through the old xmrstak_start_backend().
+ */
+extern "C"
+{
+
+#define XMRSTAK_BACKEND_ABI 2u
+
+// Optional parts of the table, a missing bit means the function pointer is NULL
+enum xmrstak_backend_caps
+{
+	XMRSTAK_CAP_ENUM = 1u,
+	XMRSTAK_CAP_PAUSE = 2u,
+	XMRSTAK_CAP_STOP = 4u,
+	XMRSTAK_CAP_STATS = 8u,
+	XMRSTAK_CAP_BENCH = 16u
+};
+
+enum xmrstak_device_state
+{
+	XMRSTAK_DEV_RUNNING = 0,
+	XMRSTAK_DEV_PAUSED = 1,
+	XMRSTAK_DEV_STOPPED = 2
+};
+
+struct xmrstak_device_info
+{
+	uint32_t iIndex;   // as numbered by the backend, used by all calls below
+	uint64_t iMemory;  // in bytes, 0 if unknown
+	char sName[128];
+};
+
+struct xmrstak_device_stats
+{
+	uint32_t iIndex;
+	uint32_t iState;   // xmrstak_device_state
+	uint32_t iThreads;
+	uint64_t iHashes;  // sum over the threads of the device
+	uint64_t iTimestampMs; // newest hash count update of the threads
+	uint64_t iIdleUs;
+	uint64_t iStaleUs;
+};
+
+struct xmrstak_backend_api
+{
+	uint32_t iAbiVersion;
+	// sizeof(xmrstak_backend_api) the library was built with, later versions only append fields
+	uint32_t iSize;
+	uint32_t iCaps;
+	const char* sName;
+
+	// Starts the configured threads, pWork is a miner_work*, returns the number of threads
+	size_t (*start)(uint32_t iThreadOffset, void* pWork);
+	// Copies up to iMax started threads (iBackend*) to ppThreads, returns how many there are
+	size_t (*get_threads)(void** ppThreads, size_t iMax);
+
+	// Fills up to iMax devices the backend can use, returns how many there are
+	size_t (*enum_devices)(xmrstak_device_info* pDevs, size_t iMax);
+	// The calls below return 0 on success and -1 if no started thread uses the device
+	int (*pause)(uint32_t iDevice, int bPause);
+	// Stopped threads stay in the thread list with a frozen hash count, they can't be restarted
+	int (*stop)(uint32_t iDevice);
+	// One entry per device with started threads, returns how many there are
+	size_t (*get_stats)(xmrstak_device_stats* pStats, size_t iMax);
+	// Hash rate of the device on the current coin, blocks for a few seconds
+	int (*bench)(uint32_t iDevice, double* pHps);
+
+	// Forgets the started threads, called before the host deletes them
+	void (*release)(void);
+};
+
+// pEnv is the host's xmrstak::environment, returns NULL if the library can't serve iHostAbi
+typedef const xmrstak_backend_api* (*xmrstak_get_backend_api_t)(uint32_t iHostAbi, void* pEnv);
+
+} // extern "C"
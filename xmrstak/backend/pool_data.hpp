@@ -12,8 +12,10 @@ struct pool_data
 {
 	uint32_t iSavedNonce;
 	size_t   pool_id;
+	// in only, the new job builds on another block than the pool's job before
+	bool     bNewBlock;
 
-	pool_data() : iSavedNonce(0), pool_id(invalid_pool_id)
+	pool_data() : iSavedNonce(0), pool_id(invalid_pool_id), bNewBlock(false)
 	{
 	}
 };
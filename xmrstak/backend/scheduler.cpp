@@ -0,0 +1,87 @@
+/*
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  * GNU General Public License for more details.
+  *
+  * You should have received a copy of the GNU General Public License
+  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+  *
+  * Additional permission under GNU GPL version 3 section 7
+  *
+  * If you modify this Program, or any covered work, by linking or combining
+  * it with OpenSSL (or a modified version of that library), containing parts
+  * covered by the terms of OpenSSL License and SSLeay License, the licensors
+  * of this Program grant you additional permission to convey the resulting work.
+  *
+  */
+
+#include "scheduler.hpp"
+
+#include <algorithm>
+#include <thread>
+
+namespace xmrstak
+{
+
+constexpr uint64_t scheduler::iRangeMs;
+
+uint32_t scheduler::nonce_range(uint64_t iHashes, uint64_t iMs, uint32_t iGranule)
+{
+	if(iGranule == 0)
+		iGranule = 1;
+
+	// Too little data for a rate, e.g. right after a start or a job change
+	if(iMs < 1000 || iHashes == 0)
+		return iGranule;
+
+	uint64_t iRange = iHashes * iRangeMs / iMs;
+	iRange = (iRange + iGranule - 1) / iGranule * iGranule;
+
+	// NiceHash leaves 24 bit of nonce to the miner, a single range never takes more than a 16th of them
+	constexpr uint64_t iMaxRange = uint64_t(1) << 20;
+	if(iRange > iMaxRange)
+		iRange = iMaxRange / iGranule * iGranule;
+
+	return uint32_t(std::max<uint64_t>(iRange, iGranule));
+}
+
+uint32_t scheduler::range_sizer::next(uint64_t iHashes, uint64_t iNowMs, uint32_t iGranule)
+{
+	uint64_t iMs = iNowMs - iWindowStart;
+	uint32_t iRange = nonce_range(iHashes - iWindowHashes, iMs, iGranule);
+
+	// Short windows keep growing, otherwise a thread that asks often would never see a rate
+	if(iMs >= 1000)
+	{
+		iWindowHashes = iHashes;
+		iWindowStart = iNowMs;
+	}
+	return iRange;
+}
+
+size_t scheduler::reserved_cores(size_t iGpuThreads)
+{
+	// A GPU thread sleeps on the device most of the time, two of them share a core
+	return (iGpuThreads + 1) / 2;
+}
+
+size_t scheduler::cpu_thread_limit(size_t iConfigured, size_t iGpuThreads)
+{
+	size_t iCores = std::thread::hardware_concurrency();
+	if(iCores == 0 || iGpuThreads == 0)
+		return iConfigured;
+
+	size_t iReserved = reserved_cores(iGpuThreads);
+	if(iConfigured + iReserved <= iCores)
+		return iConfigured;
+
+	return iCores > iReserved ? iCores - iReserved : 0;
+}
+
+} // namespace xmrstak
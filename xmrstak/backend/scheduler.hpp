@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace xmrstak
+{
+
+/* Shares the machine between the backends.
+ * GPU threads feed their devices and recheck candidates on the host, the cores for that are taken
+ * from the CPU miner. Every thread takes nonce ranges sized to its own measured speed, so fast and
+ * slow devices go back to the global nonce counter at about the same rate.
+ */
+struct scheduler
+{
+	// Wall time one nonce range lasts
+	constexpr static uint64_t iRangeMs = 2000;
+
+	/** size of the next nonce range of a thread
+	 *
+	 * @param iHashes hashes done by the thread in the last iMs milliseconds
+	 * @param iGranule unit of work of the thread, e.g. one GPU round, the range is a multiple of it
+	 * @return at least one granule, a single one until the thread has run for a second
+	 */
+	static uint32_t nonce_range(uint64_t iHashes, uint64_t iMs, uint32_t iGranule);
+
+	// Speed of one thread over windows of at least a second, one instance per thread
+	struct range_sizer
+	{
+		// iHashes is the running hash count of the thread
+		uint32_t next(uint64_t iHashes, uint64_t iNowMs, uint32_t iGranule);
+
+		uint64_t iWindowHashes = 0;
+		uint64_t iWindowStart = 0;
+	};
+
+	// Host cores the GPU threads keep busy with feeding and result checks
+	static size_t reserved_cores(size_t iGpuThreads);
+
+	// How many of the iConfigured CPU miner threads fit next to iGpuThreads GPU threads
+	static size_t cpu_thread_limit(size_t iConfigured, size_t iGpuThreads);
+};
+
+} // namespace xmrstak
@@ -58,6 +58,7 @@
 #include "xmrstak/net/jpsock.hpp"
 
 int do_benchmark(int block_version, int wait_sec, int work_sec);
+int do_precompile();
 
 void help()
 {
@@ -84,14 +85,18 @@ void help()
 #ifndef CONF_NO_OPENCL
 	cout<<"  --noAMD                    disable the AMD miner backend"<<endl;
 	cout<<"  --noAMDCache               disable the AMD(OpenCL) cache for precompiled binaries"<<endl;
-	cout<<"  --openCLVendor VENDOR      use OpenCL driver of VENDOR and devices [AMD,NVIDIA]"<<endl;
+	cout<<"  --precompile               ONLY fill the AMD(OpenCL) cache with all kernel variants and exit"<<endl;
+	cout<<"  --openCLVendor VENDOR      use OpenCL driver of VENDOR and devices [AMD,NVIDIA,ANY]"<<endl;
 	cout<<"                             default: AMD"<<endl;
+	cout<<"  --openCLDevice TYPE        use OpenCL devices of TYPE [GPU,CPU,ALL]"<<endl;
+	cout<<"                             default: GPU"<<endl;
 	cout<<"  --amd FILE                 AMD backend miner config file"<<endl;
 #endif
 #ifndef CONF_NO_CUDA
 	cout<<"  --noNVIDIA                 disable the NVIDIA miner backend"<<endl;
 	cout<<"  --nvidia FILE              NVIDIA backend miner config file"<<endl;
 #endif
+	cout<<"  --fakeDevices COUNT        add COUNT simulated GPUs that report hashes but find nothing (testing)"<<endl;
 #ifndef CONF_NO_HTTPD
 	cout<<"  -i --httpd HTTP_PORT       HTTP interface port"<<endl;
 #endif
@@ -490,9 +495,27 @@ int parse_argv(int argc, char *argv[]) {
 			}
 			std::string vendor(argv[i]);
 			params::inst().openCLVendor = vendor;
-			if (vendor != "AMD" && vendor != "NVIDIA")
+			if (vendor != "AMD" && vendor != "NVIDIA" && vendor != "ANY")
 			{
-				printer::inst()->print_msg(L0, "'--openCLVendor' must be 'AMD' or 'NVIDIA'");
+				printer::inst()->print_msg(L0, "'--openCLVendor' must be 'AMD', 'NVIDIA' or 'ANY'");
+				win_exit();
+				return 1;
+			}
+		}
+		else if (opName.compare("--openCLDevice") == 0)
+		{
+			++i;
+			if (i >= argc)
+			{
+				printer::inst()->print_msg(L0, "No argument for parameter '--openCLDevice' given");
+				win_exit();
+				return 1;
+			}
+			std::string type(argv[i]);
+			params::inst().openCLDeviceType = type;
+			if (type != "GPU" && type != "CPU" && type != "ALL")
+			{
+				printer::inst()->print_msg(L0, "'--openCLDevice' must be 'GPU', 'CPU' or 'ALL'");
 				win_exit();
 				return 1;
 			}
@@ -501,6 +524,10 @@ int parse_argv(int argc, char *argv[]) {
 		{
 			params::inst().AMDCache = false;
 		}
+		else if (opName.compare("--precompile") == 0)
+		{
+			params::inst().AMDPrecompile = true;
+		}
 		else if (opName.compare("--noNVIDIA") == 0)
 		{
 			params::inst().useNVIDIA = false;
@@ -701,6 +728,25 @@ int parse_argv(int argc, char *argv[]) {
 			}
 			params::inst().benchmark_block_version = bversion;
 		}
+		else if(opName.compare("--fakeDevices") == 0)
+		{
+			++i;
+			if( i >= argc )
+			{
+				printer::inst()->print_msg(L0, "No argument for parameter '--fakeDevices' given");
+				win_exit();
+				return 1;
+			}
+			char* count_end = nullptr;
+			long int count = strtol(argv[i], &count_end, 10);
+
+			if(count < 0 || count > 64 || *count_end != '\0')
+			{
+				printer::inst()->print_msg(L0, "Fake device count must be in the range [0,64]");
+				return 1;
+			}
+			params::inst().fakeDevices = uint32_t(count);
+		}
 		else if(opName.compare("--benchwait") == 0)
 		{
 			++i;
@@ -786,6 +832,8 @@ int program_config(bool expertMode) {
 	else {
 		printer::inst()->open_logfile("./miner-log.txt");
 	}
+	printer::inst()->set_json_log(jconf::inst()->OutputJson());
+	printer::inst()->set_rate_limit(jconf::inst()->GetLogRateLimit());
 
 	if (!BackendConnector::self_test())
 	{
@@ -1035,22 +1083,29 @@ void parse_runtime_input(bool* running) {
 void delete_miner() {
 
 	try {
+		// First, the miner threads and the event loop still use the config
+		bool bStopped = executor::cls();
+
+		if (!bStopped) {
+			// Something is stuck past the deadline and may still print, read the config or push
+			// events. Leak every singleton and keep them registered, so nothing it touches is
+			// freed or silently replaced by a new instance.
+			printer::inst()->print_msg(L0, "Not all miner threads stopped, the old instance is left behind.");
+			return;
+		}
+
 		printer::cls();
 		jconf::cls();
-		executor::cls();
-
+		delete xmrstak::environment::inst().pglobalStates;
+		delete xmrstak::environment::inst().pJconfConfig;
+		delete xmrstak::environment::inst().pExecutor;
 		delete xmrstak::environment::inst().pPrinter;
+		delete xmrstak::environment::inst().pParams;
 		xmrstak::environment::inst().pPrinter = nullptr;
-		delete xmrstak::environment::inst().pglobalStates;
 		xmrstak::environment::inst().pglobalStates = nullptr;
-		delete xmrstak::environment::inst().pJconfConfig;
 		xmrstak::environment::inst().pJconfConfig = nullptr;
-		delete xmrstak::environment::inst().pExecutor;
 		xmrstak::environment::inst().pExecutor = nullptr;
-		delete xmrstak::environment::inst().pParams;
 		xmrstak::environment::inst().pParams = nullptr;
-
-		
 	}
 	catch (...) {
 		std::cout << "Error deleting current miner execution" << std::endl;
@@ -1264,7 +1319,7 @@ void restart_miner(bool expertMode, bool deleteMiner) {
 	printer::inst()->print_msg(L0, "--------------------------------------------------- \n");
 	printer::inst()->print_msg(L0, "Shutting down program, please wait... \n");
 
-	std::this_thread::sleep_for(std::chrono::milliseconds(1000));
+	uint64_t start = get_timestamp_ms();
 
 	if (deleteMiner) {
 		delete_miner();
@@ -1273,8 +1328,8 @@ void restart_miner(bool expertMode, bool deleteMiner) {
 	printer::inst()->print_msg(L0, "--------------------------------------------------- \n");
 	printer::inst()->print_msg(L0, "Restarting program, please wait... \n");
 
-	std::this_thread::sleep_for(std::chrono::milliseconds(1000));
 	int configRetValue = program_config(expertMode);
+	printer::inst()->print_msg(L0, "Restart took %llu ms.", (unsigned long long)(get_timestamp_ms() - start));
 
 	show_credits(expertMode);
 	if (!expertMode) {
@@ -1314,6 +1369,9 @@ int main(int argc, char *argv[]) {
 	int parseRetValue = parse_argv(argc, argv);
 	int configRetValue = program_config(expertMode);
 
+	if (xmrstak::params::inst().AMDPrecompile)
+		return do_precompile();
+
 	show_credits(expertMode);
 	if (!expertMode) {
 		show_manage_info();
@@ -1451,7 +1509,7 @@ int do_benchmark(int block_version, int wait_sec, int work_sec)
 	printer::inst()->print_msg(L0, "Wait %d sec until all backends are initialized",wait_sec);
 	std::this_thread::sleep_for(std::chrono::seconds(wait_sec));
 
-	/* AMD and NVIDIA is currently only supporting work sizes up to 84byte
+	/* NVIDIA is currently only supporting work sizes up to 84byte
 	 * \todo fix this issue
 	 */
 	xmrstak::miner_work benchWork = xmrstak::miner_work("", work, 84, 0, false, 0);
@@ -1465,8 +1523,10 @@ int do_benchmark(int block_version, int wait_sec, int work_sec)
 	double fTotalHps = 0.0;
 	for (uint32_t i = 0; i < pvThreads->size(); i++)
 	{
-		double fHps = pvThreads->at(i)->iHashCount;
-		fHps /= (pvThreads->at(i)->iTimestamp - iStartStamp) / 1000.0;
+		uint64_t iCount, iStamp;
+		pvThreads->at(i)->get_hash_stats(iCount, iStamp);
+		double fHps = iCount;
+		fHps /= (iStamp - iStartStamp) / 1000.0;
 
 		auto bType = static_cast<xmrstak::iBackend::BackendType>(pvThreads->at(i)->backendType);
 		std::string name(xmrstak::iBackend::getName(bType));
@@ -1478,3 +1538,32 @@ int do_benchmark(int block_version, int wait_sec, int work_sec)
 	printer::inst()->print_msg(L0, "Benchmark Total: %.1f H/S", fTotalHps);
 	return 0;
 }
+
+int do_precompile()
+{
+	using namespace xmrstak;
+
+#ifdef CONF_NO_OPENCL
+	printer::inst()->print_msg(L0, "'--precompile' needs the AMD(OpenCL) backend, this binary is built without it");
+	printer::inst()->flush();
+	return 1;
+#endif
+
+	if(!params::inst().AMDCache)
+	{
+		printer::inst()->print_msg(L0, "'--precompile' needs the AMD(OpenCL) cache, remove '--noAMDCache'");
+		win_exit();
+		return 1;
+	}
+
+	printer::inst()->print_str("!!!! Only filling the OpenCL binary cache and exiting. To mine, remove the '--precompile' option. !!!!\n");
+	params::inst().useCPU = false;
+	params::inst().useNVIDIA = false;
+
+	miner_work oWork = miner_work();
+	BackendConnector::thread_starter(oWork);
+
+	// print_msg only queues the line, the build result must reach the log before main returns
+	printer::inst()->flush();
+	return params::inst().AMDPrecompileOk ? 0 : 1;
+}
@@ -12,10 +12,30 @@ R"===(
  *                Both values are in seconds.
  * giveup_limit - Limit how many times we try to reconnect to the pool. Zero means no limit. Note that stak miners
  *                don't mine while the connection is lost, so your computer's power usage goes down to idle.
+ * pool_standby - How many of the next best pools are kept logged in as hot standby. When the active pool drops
+ *                the miner switches to the healthiest standby pool (lowest latency and reject rate) immediately
+ *                instead of waiting for a reconnect. Zero keeps only the active pool connected.
+ *
+ * pool_adaptive_weight - How much the measured pool health counts next to the pool_weight from pools.txt. Health
+ *                goes from 0 to 1 and is lowered by submit round trip time, TCP connect time, delay of new block
+ *                notifications compared to the other connected pools and the ratio of rejected or stale results.
+ *                Pool weights are scaled to 0 - 9.8, so with equal weights the healthiest pool wins.
+ *                The active pool gets a 10% bonus to avoid flapping between similar pools. Zero disables it.
+ * pool_pin     - Pool address (as written in pools.txt) that is always preferred while it is reachable,
+ *                regardless of weight and health. Empty string disables pinning.
+ * share_rate_limit - Most accepted shares per minute. When a fast miner finds more than that on a low difficulty
+ *                pool, only shares above a local difficulty floor are submitted. The floor follows the share
+ *                rate once a minute and never goes below the pool difficulty. Zero submits every share.
+ *                Pools credit shares at their own difficulty, prefer a fixed difficulty login (for example
+ *                wallet+50000) where the pool supports it.
  */
 "call_timeout" : 10,
 "retry_time" : 30,
 "giveup_limit" : 0,
+"pool_standby" : 1,
+"pool_adaptive_weight" : 2.0,
+"pool_pin" : "",
+"share_rate_limit" : 0,
 
 /*
  * Output control.
@@ -43,6 +63,25 @@ R"===(
  */
 "h_print_time" : 60,
 
+/*
+ * Thread watchdog
+ *
+ * Every mining thread learns its own normal hashrate. When a thread stays below watchdog_drop times that
+ * baseline for watchdog_time seconds (thermal throttling, a busy neighbour process, bad affinity or a
+ * stalled GPU) the watchdog logs an alert and takes the watchdog_action. Actions other than "log" only
+ * apply to CPU threads, GPU threads are always just logged.
+ *
+ * watchdog_drop   - Fraction of the baseline, 0.6 alerts below 60%. Zero disables the watchdog.
+ * watchdog_time   - How many seconds the hashrate has to stay low.
+ * watchdog_action - "log"     - Only log the alert.
+ *                   "repin"   - Move the thread to a CPU core that no other mining thread is pinned to.
+ *                   "lanes"   - Hash one block less at a time (low_power_mode), needs less cache.
+ *                   "restart" - Stop the thread and start it again with the same settings.
+ */
+"watchdog_drop" : 0.6,
+"watchdog_time" : 60,
+"watchdog_action" : "log",
+
 /*
  * Manual hardware AES override
  *
@@ -116,10 +155,18 @@ R"===(
 /*
  * Output file
  *
- * output_file  - This option will log all output to a file.
+ * output_file   - This option will log all output to a file.
+ * output_format - "text" writes the file like the console, "json" writes one JSON object per line
+ *                 ({"time":"...","level":N,"msg":"..."}, level is null for reports and banners).
+ * log_rate_limit - Most lines per second from the same message, more are dropped and counted. The
+ *                 count is logged with the next line that gets through. Zero disables the limit.
  *
+ * Lines are queued and written by a background thread, a slow terminal or disk never holds up mining.
+ * If the queue fills up anyway, new lines are dropped and counted the same way.
  */
 "output_file" : "",
+"output_format" : "text",
+"log_rate_limit" : 50,
 
 /*
  * Built-in web server
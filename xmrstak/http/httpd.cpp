@@ -1192,18 +1192,40 @@ bool httpd::parseCustomInfo (std::string keyIN, std::string valueIN) {
  *
  * TODO: error handling
  */
+static std::string read_whole_file(const std::string& name) {
+	std::ifstream file(name);
+	std::stringstream content;
+	content << file.rdbuf();
+	return content.str();
+}
+
 void httpd::updateConfigFiles () {
 	if ((httpd::miner_config != nullptr) && (httpd::miner_config->isNeedUpdate)) {
 		httpd::miner_config->isNeedUpdate = false;
-		executor::inst()->isPause = true;
+
+		// Pool and CPU thread changes are applied to the running miner,
+		// GPU and general config changes still need a restart
+		std::string configBefore = read_whole_file(CONFIG_FILE);
+		std::string nvidiaBefore = read_whole_file(NVIDIA_FILE);
+		std::string amdBefore = read_whole_file(AMD_FILE);
+
 		updateCPUFile();
 		updateGPUNvidiaFile();
 		updateGPUAMD();
 		updateConfigFile();
 		updatePoolFile();
-		
-		executor::inst()->needRestart = true;
-		
+
+		if (configBefore != read_whole_file(CONFIG_FILE) ||
+			nvidiaBefore != read_whole_file(NVIDIA_FILE) ||
+			amdBefore != read_whole_file(AMD_FILE)) {
+
+			httpd::miner_config->isMining = false;
+			executor::inst()->isPause = true;
+			executor::inst()->needRestart = true;
+		}
+		else {
+			executor::inst()->push_event(ex_event(EV_CONFIG_RELOAD));
+		}
 	}
 }
 
@@ -1328,6 +1350,47 @@ int httpd::starting_process_post (MHD_Connection* connection,
 /*
  * Description: Function called for every http request
  */
+// Serves a report the executor published on its last perf tick. Never waits for the
+// executor thread, and answers 304 if the client already has this version.
+static int send_report(MHD_Connection* connection, ex_event_name ev, const char* content_type)
+{
+	struct MHD_Response * rsp;
+	int ret;
+	std::string str, etag;
+
+	if(!executor::inst()->get_http_report(ev, str, etag))
+	{
+		str = "{\"status\": \"error\", \"description\": \"report not ready\"}";
+		rsp = MHD_create_response_from_buffer(str.size(), (void*)str.c_str(), MHD_RESPMEM_MUST_COPY);
+		MHD_add_response_header(rsp, "Content-Type", "application/json; charset=utf-8");
+		MHD_add_response_header(rsp, "Access-Control-Allow-Origin", CORS_ORIGIN.c_str());
+		MHD_add_response_header(rsp, "Retry-After", "1");
+		ret = MHD_queue_response(connection, MHD_HTTP_SERVICE_UNAVAILABLE, rsp);
+		MHD_destroy_response(rsp);
+		return ret;
+	}
+
+	const char* req_etag = MHD_lookup_connection_value(connection, MHD_HEADER_KIND, "If-None-Match");
+	if(req_etag != NULL && etag == req_etag)
+	{
+		rsp = MHD_create_response_from_buffer(0, nullptr, MHD_RESPMEM_PERSISTENT);
+		MHD_add_response_header(rsp, "ETag", etag.c_str());
+		MHD_add_response_header(rsp, "Access-Control-Allow-Origin", CORS_ORIGIN.c_str());
+		ret = MHD_queue_response(connection, MHD_HTTP_NOT_MODIFIED, rsp);
+		MHD_destroy_response(rsp);
+		return ret;
+	}
+
+	rsp = MHD_create_response_from_buffer(str.size(), (void*)str.c_str(), MHD_RESPMEM_MUST_COPY);
+	MHD_add_response_header(rsp, "Content-Type", content_type);
+	MHD_add_response_header(rsp, "ETag", etag.c_str());
+	MHD_add_response_header(rsp, "Cache-Control", "no-cache");
+	MHD_add_response_header(rsp, "Access-Control-Allow-Origin", CORS_ORIGIN.c_str());
+	ret = MHD_queue_response(connection, MHD_HTTP_OK, rsp);
+	MHD_destroy_response(rsp);
+	return ret;
+}
+
 int httpd::req_handler(void * cls,
 							  MHD_Connection* connection,
 							  const char* url,
@@ -1348,10 +1411,6 @@ int httpd::req_handler(void * cls,
 
 			retValue = starting_process_post(connection, method, upload_data, upload_data_size, ptr);
 
-			if (httpd::miner_config != nullptr) {
-				httpd::miner_config->isMining = false;
-			}
-
 			return retValue;
 		} else {
 			return MHD_NO;
@@ -1415,11 +1474,7 @@ int httpd::req_handler(void * cls,
 	{
 		if (httpd::miner_config != nullptr) {
 			if (httpd::miner_config->isMining) {
-				executor::inst()->get_http_report(EV_HTML_JSON, str);
-
-				rsp = MHD_create_response_from_buffer(str.size(), (void*)str.c_str(), MHD_RESPMEM_MUST_COPY);
-				MHD_add_response_header(rsp, "Content-Type", "application/json; charset=utf-8");
-				MHD_add_response_header(rsp, "Access-Control-Allow-Origin", CORS_ORIGIN.c_str());
+				return send_report(connection, EV_HTML_JSON, "application/json; charset=utf-8");
 			}
 			else {
 				str = "{\"status\": \"error\", \"description\": \"need to start mining\"}";
@@ -1438,6 +1493,19 @@ int httpd::req_handler(void * cls,
 			MHD_add_response_header(rsp, "Access-Control-Allow-Origin", CORS_ORIGIN.c_str());
 		}
 	}
+	else if (strcasecmp(url, "/metrics") == 0)
+	{
+		// Served from the last published snapshot, never waits for the executor
+		std::shared_ptr<const std::string> snap = executor::inst()->get_metrics_report();
+		if(snap)
+			str = *snap;
+		else
+			str = "# EOF\n";
+
+		rsp = MHD_create_response_from_buffer(str.size(), (void*)str.c_str(), MHD_RESPMEM_MUST_COPY);
+		MHD_add_response_header(rsp, "Content-Type", "application/openmetrics-text; version=1.0.0; charset=utf-8");
+		MHD_add_response_header(rsp, "Cache-Control", "no-cache");
+	}
 	else if (strcasecmp(url, "/start") == 0) {
 		executor::inst()->isPause = false;
 		str = "{\"status\": \"ok\"}";
@@ -1504,10 +1572,7 @@ int httpd::req_handler(void * cls,
 	{	
 		if (httpd::miner_config != nullptr) {
 			if (httpd::miner_config->isMining) {
-				executor::inst()->get_http_report(EV_HTML_HASHRATE, str);
-
-				rsp = MHD_create_response_from_buffer(str.size(), (void*)str.c_str(), MHD_RESPMEM_MUST_COPY);
-				MHD_add_response_header(rsp, "Content-Type", "text/html; charset=utf-8");
+				return send_report(connection, EV_HTML_HASHRATE, "text/html; charset=utf-8");
 			}
 			else {
 				redirectHome = true;
@@ -1521,10 +1586,7 @@ int httpd::req_handler(void * cls,
 	{
 		if (httpd::miner_config != nullptr) {
 			if (httpd::miner_config->isMining) {
-				executor::inst()->get_http_report(EV_HTML_CONNSTAT, str);
-
-				rsp = MHD_create_response_from_buffer(str.size(), (void*)str.c_str(), MHD_RESPMEM_MUST_COPY);
-				MHD_add_response_header(rsp, "Content-Type", "text/html; charset=utf-8");
+				return send_report(connection, EV_HTML_CONNSTAT, "text/html; charset=utf-8");
 			}
 			else {
 				redirectHome = true;
@@ -1538,10 +1600,7 @@ int httpd::req_handler(void * cls,
 	{
 		if (httpd::miner_config != nullptr) {
 			if (httpd::miner_config->isMining) {
-				executor::inst()->get_http_report(EV_HTML_RESULTS, str);
-
-				rsp = MHD_create_response_from_buffer(str.size(), (void*)str.c_str(), MHD_RESPMEM_MUST_COPY);
-				MHD_add_response_header(rsp, "Content-Type", "text/html; charset=utf-8");
+				return send_report(connection, EV_HTML_RESULTS, "text/html; charset=utf-8");
 			}
 			else {
 				redirectHome = true;
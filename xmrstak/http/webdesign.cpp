@@ -232,6 +232,7 @@ extern const char sHtmlResultBodyHigh [] =
 		"<tr><th>Good results</th><td>%u / %u (%.1f %%)</td></tr>"
 		"<tr><th>Avg result time</th><td>%.1f sec</td></tr>"
 		"<tr><th>Pool-side hashes</th><td>%u</td></tr>"
+		"<tr><th>Stale avoided</th><td>%u</td></tr>"
 	"</table>"
 	"<h4>Top 10 best results found</h4>"
 	"<table>"
@@ -277,6 +278,7 @@ extern const char sJsonApiFormat [] =
 		"\"shares_total\":%llu,"
 		"\"avg_time\":%.1f,"
 		"\"hashes_total\":%llu,"
+		"\"stale_avoided\":%llu,"
 		"\"best\":[%llu,%llu,%llu,%llu,%llu,%llu,%llu,%llu,%llu,%llu],"
 		"\"error_log\":[%s]"
 	"},"
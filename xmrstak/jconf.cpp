@@ -36,6 +36,7 @@
 #include <vector>
 #include <numeric>
 #include <algorithm>
+#include <memory>
 
 #ifdef _WIN32
 #define strcasecmp _stricmp
@@ -51,8 +52,8 @@ using namespace rapidjson;
  * This enum needs to match index in oConfigValues, otherwise we will get a runtime error
  */
 enum configEnum {
-	aPoolList, sCurrency, bTlsSecureAlgo, iCallTimeout, iNetRetry, iGiveUpLimit, iVerboseLevel, bPrintMotd, iAutohashTime, 
-	bDaemonMode, sOutputFile, iHttpdPort, sHttpLogin, sHttpPass, bPreferIpv4, bAesOverride, sUseSlowMem 
+	aPoolList, sCurrency, bTlsSecureAlgo, iCallTimeout, iNetRetry, iGiveUpLimit, iPoolStandby, fPoolAdaptiveWeight, sPoolPin, iShareRateLimit, iVerboseLevel, bPrintMotd, iAutohashTime, 
+	fWatchdogDrop, iWatchdogTime, sWatchdogAction, bDaemonMode, sOutputFile, sOutputFormat, iLogRateLimit, iHttpdPort, sHttpLogin, sHttpPass, bPreferIpv4, bAesOverride, sUseSlowMem 
 };
 
 struct configVal {
@@ -70,11 +71,20 @@ configVal oConfigValues[] = {
 	{ iCallTimeout, "call_timeout", kNumberType },
 	{ iNetRetry, "retry_time", kNumberType },
 	{ iGiveUpLimit, "giveup_limit", kNumberType },
+	{ iPoolStandby, "pool_standby", kNumberType },
+	{ fPoolAdaptiveWeight, "pool_adaptive_weight", kNumberType },
+	{ sPoolPin, "pool_pin", kStringType },
+	{ iShareRateLimit, "share_rate_limit", kNumberType },
 	{ iVerboseLevel, "verbose_level", kNumberType },
 	{ bPrintMotd, "print_motd", kTrueType },
 	{ iAutohashTime, "h_print_time", kNumberType },
+	{ fWatchdogDrop, "watchdog_drop", kNumberType },
+	{ iWatchdogTime, "watchdog_time", kNumberType },
+	{ sWatchdogAction, "watchdog_action", kStringType },
 	{ bDaemonMode, "daemon_mode", kTrueType },
 	{ sOutputFile, "output_file", kStringType },
+	{ sOutputFormat, "output_format", kStringType },
+	{ iLogRateLimit, "log_rate_limit", kNumberType },
 	{ iHttpdPort, "httpd_port", kNumberType },
 	{ sHttpLogin, "http_login", kStringType },
 	{ sHttpPass, "http_pass", kStringType },
@@ -131,10 +141,23 @@ inline bool checkType(Type have, Type want)
 		return false;
 }
 
+/*
+ * The pool list is replaced as a whole on a config reload, readers hold on
+ * to the copy they loaded.
+ */
+struct pool_list
+{
+	Document jsonDoc;
+	const Value* aPools;
+	const Value* sCurrency;
+	size_t wt_max;
+	size_t wt_min;
+};
+
 struct jconf::opaque_private
 {
 	Document jsonDoc;
-	Document jsonDocPools;
+	std::shared_ptr<const pool_list> pPools;
 	const Value* configValues[iConfigCnt]; //Compile time constant
 
 	opaque_private()
@@ -156,20 +179,22 @@ void jconf::static_delete() {
 
 uint64_t jconf::GetPoolCount()
 {
-	if(prv->configValues[aPoolList]->IsArray())
-		return prv->configValues[aPoolList]->Size();
+	std::shared_ptr<const pool_list> pl = std::atomic_load(&prv->pPools);
+	if(pl && pl->aPools->IsArray())
+		return pl->aPools->Size();
 	else
 		return 0;
 }
 
 bool jconf::GetPoolConfig(size_t id, pool_cfg& cfg)
 {
-	if(id >= GetPoolCount())
+	std::shared_ptr<const pool_list> pl = std::atomic_load(&prv->pPools);
+	if(!pl || id >= pl->aPools->Size())
 		return false;
 
 	typedef const Value* cval;
 	cval jaddr, jlogin, jrigid, jpasswd, jnicehash, jtls, jtlsfp, jwt;
-	const Value& oThdConf = prv->configValues[aPoolList]->GetArray()[id];
+	const Value& oThdConf = pl->aPools->GetArray()[id];
 
 	/* We already checked presence and types */
 	jaddr = GetObjectMember(oThdConf, "pool_address");
@@ -190,11 +215,11 @@ bool jconf::GetPoolConfig(size_t id, pool_cfg& cfg)
 	cfg.tls_fingerprint = jtlsfp->GetString();
 	cfg.raw_weight = jwt->GetUint64();
 
-	size_t dlt = wt_max - wt_min;
+	size_t dlt = pl->wt_max - pl->wt_min;
 	if(dlt != 0)
 	{
 		/* Normalise weights between 0 and 9.8 */
-		cfg.weight = double(cfg.raw_weight - wt_min) * 9.8;
+		cfg.weight = double(cfg.raw_weight - pl->wt_min) * 9.8;
 		cfg.weight /= dlt;
 	}
 	else /* Special case - user selected same weights for everything */
@@ -227,6 +252,26 @@ uint64_t jconf::GetGiveUpLimit()
 	return prv->configValues[iGiveUpLimit]->GetUint64();
 }
 
+uint64_t jconf::GetPoolStandby()
+{
+	return prv->configValues[iPoolStandby]->GetUint64();
+}
+
+double jconf::GetPoolAdaptiveWeight()
+{
+	return prv->configValues[fPoolAdaptiveWeight]->GetDouble();
+}
+
+const char* jconf::GetPoolPin()
+{
+	return prv->configValues[sPoolPin]->GetString();
+}
+
+uint64_t jconf::GetShareRateLimit()
+{
+	return prv->configValues[iShareRateLimit]->GetUint64();
+}
+
 uint64_t jconf::GetVerboseLevel()
 {
 	return prv->configValues[iVerboseLevel]->GetUint64();
@@ -296,6 +341,42 @@ bool jconf::check_cpu_features()
 	return bHaveSse2;
 }
 
+bool jconf::OutputJson()
+{
+	return strcasecmp(prv->configValues[sOutputFormat]->GetString(), "json") == 0;
+}
+
+uint64_t jconf::GetLogRateLimit()
+{
+	return prv->configValues[iLogRateLimit]->GetUint64();
+}
+
+double jconf::GetWatchdogDrop()
+{
+	return prv->configValues[fWatchdogDrop]->GetDouble();
+}
+
+uint64_t jconf::GetWatchdogTime()
+{
+	return prv->configValues[iWatchdogTime]->GetUint64();
+}
+
+jconf::watchdog_cfg jconf::GetWatchdogAction()
+{
+	const char* opt = prv->configValues[sWatchdogAction]->GetString();
+
+	if(strcasecmp(opt, "log") == 0)
+		return wd_log;
+	else if(strcasecmp(opt, "repin") == 0)
+		return wd_repin;
+	else if(strcasecmp(opt, "lanes") == 0)
+		return wd_lanes;
+	else if(strcasecmp(opt, "restart") == 0)
+		return wd_restart;
+	else
+		return wd_unknown;
+}
+
 jconf::slow_mem_cfg jconf::GetSlowMemSetting()
 {
 	const char* opt = prv->configValues[sUseSlowMem]->GetString();
@@ -317,7 +398,7 @@ std::string jconf::GetMiningCoin()
 	if(xmrstak::params::inst().currency.length() > 0)
 		return xmrstak::params::inst().currency;
 	else
-		return prv->configValues[sCurrency]->GetString();
+		return std::atomic_load(&prv->pPools)->sCurrency->GetString();
 }
 
 void jconf::GetAlgoList(std::string& list)
@@ -368,7 +449,7 @@ const char* jconf::GetDefaultPool(const char* needle)
 	return default_example;
 }
 
-bool jconf::parse_file(const char* sFilename, bool main_conf)
+static bool read_config_file(const char* sFilename, Document& root)
 {
 	FILE * pFile;
 	char * buffer;
@@ -422,8 +503,6 @@ bool jconf::parse_file(const char* sFilename, bool main_conf)
 	buffer[flen] = '}';
 	buffer[flen + 1] = '\0';
 
-	Document& root = main_conf ? prv->jsonDoc : prv->jsonDocPools;
-
 	root.Parse<kParseCommentsFlag|kParseTrailingCommasFlag>(buffer, flen+2);
 	free(buffer);
 
@@ -440,75 +519,65 @@ bool jconf::parse_file(const char* sFilename, bool main_conf)
 		return false;
 	}
 
-	if(main_conf)
-	{
-		for(size_t i = 2; i < iConfigCnt; i++)
-		{
-			if(oConfigValues[i].iName != i)
-			{
-				printer::inst()->print_msg(L0, "Code error. oConfigValues are not in order.");
-				return false;
-			}
+	return true;
+}
 
-			prv->configValues[i] = GetObjectMember(root, oConfigValues[i].sName);
+static const Value* get_config_value(const char* sFilename, const Document& root, size_t i)
+{
+	if(oConfigValues[i].iName != i)
+	{
+		printer::inst()->print_msg(L0, "Code error. oConfigValues are not in order.");
+		return nullptr;
+	}
 
-			if(prv->configValues[i] == nullptr)
-			{
-				printer::inst()->print_msg(L0, "Invalid config file '%s'. Missing value \"%s\".", sFilename, oConfigValues[i].sName);
-				return false;
-			}
+	const Value* val = GetObjectMember(root, oConfigValues[i].sName);
 
-			if(!checkType(prv->configValues[i]->GetType(), oConfigValues[i].iType))
-			{
-				printer::inst()->print_msg(L0, "Invalid config file '%s'. Value \"%s\" has unexpected type.", sFilename, oConfigValues[i].sName);
-				return false;
-			}
-		}
+	if(val == nullptr)
+	{
+		printer::inst()->print_msg(L0, "Invalid config file '%s'. Missing value \"%s\".", sFilename, oConfigValues[i].sName);
+		return nullptr;
 	}
-	else
+
+	if(!checkType(val->GetType(), oConfigValues[i].iType))
 	{
-		for(size_t i = 0; i < 2; i++)
-		{
-			if(oConfigValues[i].iName != i)
-			{
-				printer::inst()->print_msg(L0, "Code error. oConfigValues are not in order.");
-				return false;
-			}
+		printer::inst()->print_msg(L0, "Invalid config file '%s'. Value \"%s\" has unexpected type.", sFilename, oConfigValues[i].sName);
+		return nullptr;
+	}
 
-			prv->configValues[i] = GetObjectMember(root, oConfigValues[i].sName);
+	return val;
+}
 
-			if(prv->configValues[i] == nullptr)
-			{
-				printer::inst()->print_msg(L0, "Invalid config file '%s'. Missing value \"%s\".", sFilename, oConfigValues[i].sName);
-				return false;
-			}
+bool jconf::parse_file(const char* sFilename)
+{
+	if(!read_config_file(sFilename, prv->jsonDoc))
+		return false;
 
-			if(!checkType(prv->configValues[i]->GetType(), oConfigValues[i].iType))
-			{
-				printer::inst()->print_msg(L0, "Invalid config file '%s'. Value \"%s\" has unexpected type.", sFilename, oConfigValues[i].sName);
-				return false;
-			}
-		}
+	// The first two values live in the pools file
+	for(size_t i = 2; i < iConfigCnt; i++)
+	{
+		if((prv->configValues[i] = get_config_value(sFilename, prv->jsonDoc, i)) == nullptr)
+			return false;
 	}
 
 	return true;
 }
 
-bool jconf::parse_config(const char* sFilename, const char* sFilenamePools)
+/*
+ * The new list is parsed and checked on the side and only published once it is
+ * complete, so other threads never see a half parsed document.
+ */
+bool jconf::parse_pools(const char* sFilenamePools)
 {
-	if(!check_cpu_features())
-	{
-		printer::inst()->print_msg(L0, "CPU support of SSE2 is required.");
-		return false;
-	}
+	std::shared_ptr<pool_list> pl = std::make_shared<pool_list>();
 
-	if(!parse_file(sFilename, true))
+	if(!read_config_file(sFilenamePools, pl->jsonDoc))
 		return false;
 
-	if(!parse_file(sFilenamePools, false))
+	if((pl->aPools = get_config_value(sFilenamePools, pl->jsonDoc, aPoolList)) == nullptr ||
+		(pl->sCurrency = get_config_value(sFilenamePools, pl->jsonDoc, sCurrency)) == nullptr)
 		return false;
 
-	size_t pool_cnt = prv->configValues[aPoolList]->Size();
+	size_t pool_cnt = pl->aPools->Size();
 	if(pool_cnt == 0)
 	{
 		printer::inst()->print_msg(L0, "Invalid config file. pool_list must not be empty.");
@@ -524,7 +593,7 @@ bool jconf::parse_config(const char* sFilename, const char* sFilenamePools)
 	constexpr size_t pvcnt = sizeof(aPoolValues)/sizeof(aPoolValues[0]);
 	for(uint32_t i=0; i < pool_cnt; i++)
 	{
-		const Value& oThdConf = prv->configValues[aPoolList]->GetArray()[i];
+		const Value& oThdConf = pl->aPools->GetArray()[i];
 		
 		if(!oThdConf.IsObject())
 		{
@@ -559,15 +628,35 @@ bool jconf::parse_config(const char* sFilename, const char* sFilenamePools)
 		pool_weights.emplace_back(wt);
 	}
 
-	wt_max = *std::max_element(pool_weights.begin(), pool_weights.end());
-	wt_min = *std::min_element(pool_weights.begin(), pool_weights.end());
+	pl->wt_max = *std::max_element(pool_weights.begin(), pool_weights.end());
+	pl->wt_min = *std::min_element(pool_weights.begin(), pool_weights.end());
+
+	std::atomic_store(&prv->pPools, std::shared_ptr<const pool_list>(std::move(pl)));
+	return true;
+}
+
+bool jconf::parse_config(const char* sFilename, const char* sFilenamePools)
+{
+	if(!check_cpu_features())
+	{
+		printer::inst()->print_msg(L0, "CPU support of SSE2 is required.");
+		return false;
+	}
+
+	if(!parse_file(sFilename))
+		return false;
+
+	if(!parse_pools(sFilenamePools))
+		return false;
 
 	if(!prv->configValues[iCallTimeout]->IsUint64() ||
 		!prv->configValues[iNetRetry]->IsUint64() ||
-		!prv->configValues[iGiveUpLimit]->IsUint64())
+		!prv->configValues[iGiveUpLimit]->IsUint64() ||
+		!prv->configValues[iPoolStandby]->IsUint64() ||
+		!prv->configValues[iShareRateLimit]->IsUint64())
 	{
 		printer::inst()->print_msg(L0,
-			"Invalid config file. call_timeout, retry_time and giveup_limit need to be positive integers.");
+			"Invalid config file. call_timeout, retry_time, giveup_limit, pool_standby and share_rate_limit need to be positive integers.");
 		return false;
 	}
 
@@ -578,6 +667,13 @@ bool jconf::parse_config(const char* sFilename, const char* sFilenamePools)
 		return false;
 	}
 
+	if(prv->configValues[fPoolAdaptiveWeight]->GetDouble() < 0.0)
+	{
+		printer::inst()->print_msg(L0,
+			"Invalid config file. pool_adaptive_weight can't be negative.");
+		return false;
+	}
+
 	if(!prv->configValues[iVerboseLevel]->IsUint64() || !prv->configValues[iAutohashTime]->IsUint64())
 	{
 		printer::inst()->print_msg(L0,
@@ -585,6 +681,36 @@ bool jconf::parse_config(const char* sFilename, const char* sFilenamePools)
 		return false;
 	}
 
+	if(prv->configValues[fWatchdogDrop]->GetDouble() < 0.0 || prv->configValues[fWatchdogDrop]->GetDouble() >= 1.0 ||
+		!prv->configValues[iWatchdogTime]->IsUint64())
+	{
+		printer::inst()->print_msg(L0,
+			"Invalid config file. watchdog_drop has to be in the range 0 to 1 and watchdog_time a positive integer.");
+		return false;
+	}
+
+	const char* format = prv->configValues[sOutputFormat]->GetString();
+	if(strcasecmp(format, "text") != 0 && strcasecmp(format, "json") != 0)
+	{
+		printer::inst()->print_msg(L0,
+			"Invalid config file. output_format must be \"text\" or \"json\"");
+		return false;
+	}
+
+	if(!prv->configValues[iLogRateLimit]->IsUint64())
+	{
+		printer::inst()->print_msg(L0,
+			"Invalid config file. log_rate_limit needs to be a positive integer.");
+		return false;
+	}
+
+	if(GetWatchdogAction() == wd_unknown)
+	{
+		printer::inst()->print_msg(L0,
+			"Invalid config file. watchdog_action must be \"log\", \"repin\", \"lanes\" or \"restart\"");
+		return false;
+	}
+
 	if(!prv->configValues[iHttpdPort]->IsUint() || prv->configValues[iHttpdPort]->GetUint() > 0xFFFF)
 	{
 		printer::inst()->print_msg(L0,
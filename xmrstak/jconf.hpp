@@ -36,22 +36,22 @@ public:
 	}
 
 	bool parse_config(const char* sFilename, const char* sFilenamePools);
+	// Reads and checks the pool list file, also used to reload it at runtime
+	bool parse_pools(const char* sFilenamePools);
 
+	// Copies, a config reload may free the pool list at any time
 	struct pool_cfg {
-		const char* sPoolAddr;
-		const char* sWalletAddr;
-		const char* sRigId;
-		const char* sPasswd;
+		std::string sPoolAddr;
+		std::string sWalletAddr;
+		std::string sRigId;
+		std::string sPasswd;
 		bool nicehash;
 		bool tls;
-		const char* tls_fingerprint;
+		std::string tls_fingerprint;
 		size_t raw_weight;
 		double weight;
 	};
 
-	size_t wt_max;
-	size_t wt_min;
-
 	uint64_t GetPoolCount();
 	bool GetPoolConfig(size_t id, pool_cfg& cfg);
 
@@ -63,6 +63,14 @@ public:
 		unknown_value
 	};
 
+	enum watchdog_cfg {
+		wd_log,
+		wd_repin,
+		wd_lanes,
+		wd_restart,
+		wd_unknown
+	};
+
 	bool TlsSecureAlgos();
 
 	inline xmrstak::coin_selection GetCurrentCoinSelection() const { return currentCoin; }
@@ -77,11 +85,21 @@ public:
 	bool PrintMotd();
 	uint64_t GetAutohashTime();
 
+	double GetWatchdogDrop();
+	uint64_t GetWatchdogTime();
+	watchdog_cfg GetWatchdogAction();
+
 	const char* GetOutputFile();
+	bool OutputJson();
+	uint64_t GetLogRateLimit();
 
 	uint64_t GetCallTimeout();
 	uint64_t GetNetRetry();
 	uint64_t GetGiveUpLimit();
+	uint64_t GetPoolStandby();
+	double GetPoolAdaptiveWeight();
+	const char* GetPoolPin();
+	uint64_t GetShareRateLimit();
 
 	uint16_t GetHttpdPort();
 	const char* GetHttpUsername();
@@ -100,7 +118,7 @@ public:
 private:
 	jconf();
 
-	bool parse_file(const char* sFilename, bool main_conf);
+	bool parse_file(const char* sFilename);
 
 	bool check_cpu_features();
 	struct opaque_private;
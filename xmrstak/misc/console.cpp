@@ -28,6 +28,8 @@
 #include <string.h>
 #include <stdarg.h>
 #include <cstdlib>
+#include <chrono>
+#include <string>
 
 #ifdef _WIN32
 #include <windows.h>
@@ -152,60 +154,301 @@ inline void comp_localtime(const time_t* ctime, tm* stime)
 #endif // __WIN32
 }
 
-printer::printer()
+/* Slot of the bounded multi producer queue (D. Vyukov's design). iSeq tells who owns
+ * the slot: equal to the position a producer may fill it, one above once it is filled.
+ */
+struct printer::log_line
+{
+	std::atomic<size_t> iSeq;
+	time_t iTime;
+	verbosity iLevel;
+	bool bMsg; // print_msg line, gets the time stamp prefix when written
+	size_t iLen;
+	char sText[256];
+	std::string sLong; // Only used for text that does not fit into sText
+};
+
+constexpr size_t printer::iQueueSize;
+constexpr size_t printer::iRateSites;
+
+printer::printer() : vLines(new log_line[iQueueSize]), iEnqueuePos(0), iDequeuePos(0), iDropped(0), iSuppressed(0),
+	bDrainQuit(false), verbose_level(LINF), b_flush_stdout(false), b_json_log(false), rate_limit(50)
 {
-	verbose_level = LINF;
 	logfile = nullptr;
+	for(size_t i = 0; i < iQueueSize; i++)
+		vLines[i].iSeq.store(i, std::memory_order_relaxed);
+	for(size_t i = 0; i < iRateSites; i++)
+	{
+		vRateSites[i].fmt.store(nullptr, std::memory_order_relaxed);
+		vRateSites[i].iSecond.store(0, std::memory_order_relaxed);
+		vRateSites[i].iCount.store(0, std::memory_order_relaxed);
+	}
+
 	// Windows doesn't do line buffering, so it needs to enable full buffering and manually flush the buffer
 	setvbuf(stdout, NULL, _IOFBF, BUFSIZ);
+
+	oDrainThd = std::thread(&printer::drain_thd, this);
+}
+
+printer::~printer()
+{
+	std::unique_lock<std::mutex> lck(drain_mutex);
+	bDrainQuit = true;
+	drain_cond.notify_one();
+	lck.unlock();
+	oDrainThd.join();
+
+	static_delete();
+}
+
+void printer::static_delete()
+{
+	flush();
+
+	std::unique_lock<std::mutex> lck(print_mutex);
+	if (logfile != nullptr) {
+		fclose(logfile);
+		logfile = nullptr;
+	}
 }
 
 bool printer::open_logfile(const char* file)
 {
+	std::unique_lock<std::mutex> lck(print_mutex);
+	if(logfile != nullptr)
+		fclose(logfile);
 	logfile = fopen(file, "ab+");
 	return logfile != nullptr;
 }
 
+bool printer::push_line(verbosity verbose, bool msg, const char* str, size_t len)
+{
+	size_t pos = iEnqueuePos.load(std::memory_order_relaxed);
+	log_line* line;
+	while(true)
+	{
+		line = &vLines[pos & (iQueueSize - 1)];
+		size_t seq = line->iSeq.load(std::memory_order_acquire);
+		intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+		if(diff == 0)
+		{
+			if(iEnqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+				break;
+		}
+		else if(diff < 0)
+		{
+			// Full, the writer can't keep up. Never wait for it, a mining thread may be calling.
+			iDropped.fetch_add(1, std::memory_order_relaxed);
+			return false;
+		}
+		else
+			pos = iEnqueuePos.load(std::memory_order_relaxed);
+	}
+
+	line->iTime = time(nullptr);
+	line->iLevel = verbose;
+	line->bMsg = msg;
+	line->iLen = len;
+	if(len < sizeof(line->sText))
+		memcpy(line->sText, str, len);
+	else
+		line->sLong.assign(str, len);
+	line->iSeq.store(pos + 1, std::memory_order_release);
+
+	drain_cond.notify_one();
+	return true;
+}
+
+bool printer::rate_limited(const char* fmt, uint64_t now)
+{
+	size_t limit = rate_limit.load(std::memory_order_relaxed);
+	if(limit == 0)
+		return false;
+
+	rate_site& site = vRateSites[(reinterpret_cast<uintptr_t>(fmt) >> 4) % iRateSites];
+	if(site.fmt.load(std::memory_order_relaxed) != fmt || site.iSecond.load(std::memory_order_relaxed) != now)
+	{
+		site.fmt.store(fmt, std::memory_order_relaxed);
+		site.iSecond.store(now, std::memory_order_relaxed);
+		site.iCount.store(0, std::memory_order_relaxed);
+	}
+
+	if(site.iCount.fetch_add(1, std::memory_order_relaxed) < limit)
+		return false;
+
+	iSuppressed.fetch_add(1, std::memory_order_relaxed);
+	return true;
+}
+
 void printer::print_msg(verbosity verbose, const char* fmt, ...)
 {
 	if(verbose > verbose_level)
 		return;
 
-	char buf[1024];
-	size_t bpos;
-	tm stime;
+	if(rate_limited(fmt, time(nullptr)))
+		return;
 
-	time_t now = time(nullptr);
-	comp_localtime(&now, &stime);
-	strftime(buf, sizeof(buf), "[%F %T] : ", &stime);
-	bpos = strlen(buf);
+	char buf[1024];
 
 	va_list args;
 	va_start(args, fmt);
-	vsnprintf(buf+bpos, sizeof(buf)-bpos, fmt, args);
+	int len = vsnprintf(buf, sizeof(buf), fmt, args);
 	va_end(args);
-	bpos = strlen(buf);
 
-	if(bpos+2 >= sizeof(buf))
+	if(len < 0)
 		return;
+	if(size_t(len) >= sizeof(buf))
+		len = sizeof(buf) - 1;
 
-	buf[bpos] = '\n';
-	buf[bpos+1] = '\0';
-
-	print_str(buf);
+	push_line(verbose, true, buf, len);
 }
 
 void printer::print_str(const char* str)
 {
-	std::unique_lock<std::mutex> lck(print_mutex);
-	fputs(str, stdout);
+	push_line(L0, false, str, strlen(str));
+}
 
-	fflush(stdout);
+void printer::flush()
+{
+	size_t target = iEnqueuePos.load(std::memory_order_relaxed);
 
-	if(logfile != nullptr)
+	std::unique_lock<std::mutex> lck(drain_mutex);
+	drain_cond.notify_one();
+	flush_cond.wait_for(lck, std::chrono::seconds(1), [&] {
+		return iDequeuePos.load(std::memory_order_acquire) >= target || bDrainQuit;
+	});
+}
+
+namespace
+{
+void append_json_string(std::string& out, const char* str, size_t len)
+{
+	out.append(1, '"');
+	for(size_t i = 0; i < len; i++)
+	{
+		unsigned char c = str[i];
+		if(c == '"' || c == '\\')
+			out.append(1, '\\').append(1, c);
+		else if(c == '\n')
+			out.append("\\n");
+		else if(c == '\t')
+			out.append("\\t");
+		else if(c < 0x20)
+		{
+			char buf[8];
+			snprintf(buf, sizeof(buf), "\\u%04x", c);
+			out.append(buf);
+		}
+		else
+			out.append(1, c);
+	}
+	out.append(1, '"');
+}
+
+void format_line(std::string& con, std::string& file, bool json, time_t stamp, verbosity level, bool msg, const char* str, size_t len)
+{
+	char tbuf[64];
+	tm stime;
+	comp_localtime(&stamp, &stime);
+
+	if(msg)
+	{
+		strftime(tbuf, sizeof(tbuf), "[%F %T] : ", &stime);
+		con.append(tbuf).append(str, len).append(1, '\n');
+	}
+	else
+		con.append(str, len);
+
+	if(!json)
 	{
-		fputs(str, logfile);
-		fflush(logfile);
+		if(msg)
+			file.append(tbuf).append(str, len).append(1, '\n');
+		else
+			file.append(str, len);
+		return;
+	}
+
+	// Plain text blocks (reports, banners) have no level
+	strftime(tbuf, sizeof(tbuf), "%FT%T", &stime);
+	file.append("{\"time\":\"").append(tbuf).append("\",\"level\":");
+	if(msg)
+		file.append(std::to_string(size_t(level)));
+	else
+		file.append("null");
+	file.append(",\"msg\":");
+	append_json_string(file, str, len);
+	file.append("}\n");
+}
+} // namespace
+
+/*
+ * Takes everything that is queued in one go, so a burst of lines costs one write
+ * and one flush per stream instead of one per line.
+ */
+void printer::drain_thd()
+{
+	std::string con, file;
+	char buf[128];
+
+	while(true)
+	{
+		bool json = b_json_log.load(std::memory_order_relaxed);
+		size_t pos = iDequeuePos.load(std::memory_order_relaxed);
+		size_t start = pos;
+
+		con.clear();
+		file.clear();
+		while(pos - start < iQueueSize)
+		{
+			log_line& line = vLines[pos & (iQueueSize - 1)];
+			if(line.iSeq.load(std::memory_order_acquire) != pos + 1)
+				break;
+
+			if(line.iLen < sizeof(line.sText))
+				format_line(con, file, json, line.iTime, line.iLevel, line.bMsg, line.sText, line.iLen);
+			else
+			{
+				format_line(con, file, json, line.iTime, line.iLevel, line.bMsg, line.sLong.data(), line.iLen);
+				std::string().swap(line.sLong);
+			}
+
+			line.iSeq.store(pos + iQueueSize, std::memory_order_release);
+			pos++;
+		}
+
+		size_t dropped = iDropped.exchange(0, std::memory_order_relaxed);
+		size_t suppressed = iSuppressed.exchange(0, std::memory_order_relaxed);
+		if(dropped != 0 || suppressed != 0)
+		{
+			int len = snprintf(buf, sizeof(buf), "Logging: %llu lines dropped (queue full), %llu suppressed (rate limit).",
+				int_port(dropped), int_port(suppressed));
+			format_line(con, file, json, time(nullptr), L0, true, buf, len);
+		}
+
+		if(!con.empty())
+		{
+			std::unique_lock<std::mutex> lck(print_mutex);
+			fwrite(con.data(), 1, con.size(), stdout);
+			fflush(stdout);
+
+			if(logfile != nullptr)
+			{
+				fwrite(file.data(), 1, file.size(), logfile);
+				fflush(logfile);
+			}
+		}
+
+		std::unique_lock<std::mutex> lck(drain_mutex);
+		iDequeuePos.store(pos, std::memory_order_release);
+		flush_cond.notify_all();
+
+		if(pos != start)
+			continue;
+		if(bDrainQuit)
+			break;
+
+		// Producers notify without the lock, so a wake up can be missed, the timeout bounds that
+		drain_cond.wait_for(lck, std::chrono::milliseconds(50));
 	}
 }
 
@@ -218,14 +461,17 @@ void win_exit(int code)
 	if(envSize == 0)
 	{
 		printer::inst()->print_str("Press any key to exit.");
+		printer::inst()->flush();
 		get_key();
 	}
+	printer::inst()->flush();
 	std::exit(code);
 }
 
 #else
 void win_exit(int code)
 { 
+	printer::inst()->flush();
 	std::exit(code);
 }
 #endif // _WIN32
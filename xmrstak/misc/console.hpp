@@ -2,7 +2,15 @@
 
 #include "xmrstak/misc/environment.hpp"
 
+#include <atomic>
+#include <condition_variable>
+#include <memory>
 #include <mutex>
+#include <string>
+#include <thread>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
 
 
 enum out_colours { K_RED, K_GREEN, K_BLUE, K_YELLOW, K_CYAN, K_MAGENTA, K_WHITE, K_NONE };
@@ -44,22 +52,63 @@ public:
 
 	inline void set_verbose_level(size_t level) { verbose_level = (verbosity)level; }
 	inline void set_flush_stdout(bool status) { b_flush_stdout = status; }
-	inline void static_delete() {
-		if (logfile != nullptr) {
-			delete logfile;
-			logfile = nullptr;
-		}
-	}
+	// Write the log file as JSON lines, the console stays plain text
+	inline void set_json_log(bool status) { b_json_log = status; }
+	// Most lines per second from one print_msg call site, zero means no limit
+	inline void set_rate_limit(size_t lines) { rate_limit = lines; }
+	void static_delete();
+
+	/* Both only queue the text, a background thread writes it out in batches.
+	 * They never block: when the queue is full the line is dropped and counted.
+	 */
 	void print_msg(verbosity verbose, const char* fmt, ...);
 	void print_str(const char* str);
 	bool open_logfile(const char* file);
 
+	// Waits (up to a second) until everything queued so far is written
+	void flush();
+
+	~printer();
+
 private:
 	printer();
 
+	struct log_line;
+	bool push_line(verbosity verbose, bool msg, const char* str, size_t len);
+	bool rate_limited(const char* fmt, uint64_t now);
+	void drain_thd();
+
+	// Power of 2, one line per slot
+	constexpr static size_t iQueueSize = 1024;
+	std::unique_ptr<log_line[]> vLines;
+	std::atomic<size_t> iEnqueuePos;
+	std::atomic<size_t> iDequeuePos;
+	std::atomic<size_t> iDropped;
+	std::atomic<size_t> iSuppressed;
+
+	// Per call site rate limit, keyed by the format string pointer. Sites that
+	// hash to the same slot take it over from each other, good enough for a guard.
+	struct rate_site
+	{
+		std::atomic<const char*> fmt;
+		std::atomic<uint64_t> iSecond;
+		std::atomic<size_t> iCount;
+	};
+	constexpr static size_t iRateSites = 64;
+	rate_site vRateSites[iRateSites];
+
+	std::thread oDrainThd;
+	std::mutex drain_mutex;
+	std::condition_variable drain_cond;
+	std::condition_variable flush_cond;
+	std::atomic<bool> bDrainQuit;
+
+	// Held by the drain thread while it writes, and when the log file changes
 	std::mutex print_mutex;
-	verbosity verbose_level;
+	std::atomic<verbosity> verbose_level;
 	bool b_flush_stdout;
+	std::atomic<bool> b_json_log;
+	std::atomic<size_t> rate_limit;
 	FILE* logfile;
 };
 
@@ -30,6 +30,10 @@
 #include "xmrstak/backend/globalStates.hpp"
 #include "xmrstak/backend/backendConnector.hpp"
 #include "xmrstak/backend/iBackend.hpp"
+#include "xmrstak/backend/scheduler.hpp"
+#ifndef CONF_NO_CPU
+#include "xmrstak/backend/cpu/minethd.hpp"
+#endif
 
 #include "xmrstak/jconf.hpp"
 #include "xmrstak/misc/console.hpp"
@@ -51,42 +55,141 @@
 #endif // _WIN32
 
 
-void executor::static_delete() {
-	if (telem != nullptr) {
-		
-		delete telem;
-		telem = nullptr;
+namespace
+{
+/* Joins all worker threads at the same time, so a slow GPU round on one device does not
+ * hold up the others. A thread that is not done at the deadline is left running, its
+ * entry in the returned vector is false and the caller must not free the backend.
+ */
+std::vector<bool> join_backends(std::vector<xmrstak::iBackend*>& threads, uint64_t iDeadline)
+{
+	struct join_state
+	{
+		std::mutex mtx;
+		std::condition_variable cond;
+		std::vector<bool> done;
+		size_t left = 0;
+	};
+	auto state = std::make_shared<join_state>();
+	state->done.resize(threads.size(), true);
+
+	for(size_t i = 0; i < threads.size(); i++)
+	{
+		xmrstak::iBackend* thd = threads[i];
+		if(thd == nullptr || !thd->oWorkThd.joinable())
+			continue;
+
+		state->done[i] = false;
+		state->left++;
+		std::thread([state, thd, i]() {
+			thd->oWorkThd.join();
+			std::unique_lock<std::mutex> lck(state->mtx);
+			state->done[i] = true;
+			state->left--;
+			state->cond.notify_all();
+		}).detach();
 	}
 
+	std::unique_lock<std::mutex> lck(state->mtx);
+	while(state->left != 0)
+	{
+		uint64_t now = get_timestamp_ms();
+		if(now >= iDeadline)
+			break;
+		state->cond.wait_for(lck, std::chrono::milliseconds(iDeadline - now));
+	}
+	return state->done;
+}
+} // namespace
+
+/* Stops the miner threads, lets the event loop submit what they found and closes the
+ * pool connections. Everything waits on the same deadline of iShutdownTimeout.
+ */
+bool executor::static_delete()
+{
+	uint64_t start = get_timestamp_ms();
+	iShutdownDeadline = start + iShutdownTimeout;
+	bool bClean = true;
+
+	// Broadcast first, every thread finishes its current round in parallel
+	std::vector<bool> vJoined;
 	if (pvThreads != nullptr) {
-		for (int i = 0; i < pvThreads->size(); ++i) {
-			if (pvThreads->at(i) != nullptr) {
-				pvThreads->at(i)->static_quit();
-				delete pvThreads->at(i);
+		for (xmrstak::iBackend* thd : *pvThreads) {
+			if (thd != nullptr)
+				thd->request_quit();
+		}
+		vJoined = join_backends(*pvThreads, iShutdownDeadline);
+	}
+
+	// Wake the event loop in case it waits for an event, it flushes pending results on its way out
+	std::unique_lock<std::mutex> lck(main_mutex);
+	needRestart = true;
+	push_event(ex_event(EV_SHUTDOWN));
+	while (bMainRunning)
+	{
+		uint64_t now = get_timestamp_ms();
+		if (now >= iShutdownDeadline)
+			break;
+		main_cond.wait_for(lck, std::chrono::milliseconds(iShutdownDeadline - now));
+	}
+	bool bMainDone = !bMainRunning;
+	lck.unlock();
+
+	// The event loop still reads the threads, the vector and the pools, free none of them
+	if (!bMainDone) {
+		printer::inst()->print_msg(L0, "Shutdown: event loop did not stop in time, leaving it behind.");
+		return false;
+	}
+
+	// Threads replaced at runtime still post results through the executor until they stop
+	std::unique_lock<std::mutex> rlck(pRetired->mtx);
+	while (pRetired->left != 0)
+	{
+		uint64_t now = get_timestamp_ms();
+		if (now >= iShutdownDeadline)
+			break;
+		pRetired->cond.wait_for(rlck, std::chrono::milliseconds(iShutdownDeadline - now));
+	}
+	if (pRetired->left != 0) {
+		printer::inst()->print_msg(L0, "Shutdown: %u replaced threads did not stop in time, leaving them behind.", (unsigned)pRetired->left);
+		bClean = false;
+	}
+	rlck.unlock();
+
+	xmrstak::BackendConnector::release_backends();
+	if (pvThreads != nullptr) {
+		for (size_t i = 0; i < pvThreads->size(); ++i) {
+			if (!vJoined[i]) {
+				printer::inst()->print_msg(L0, "Shutdown: thread %u did not stop in time, leaving it behind.", (unsigned)i);
+				bClean = false;
 			}
+			else if (pvThreads->at(i) != nullptr)
+				delete pvThreads->at(i);
+		}
+		// Threads still running reference the vector through the executor, keep it then
+		if (bClean) {
+			delete pvThreads;
+			pvThreads = nullptr;
 		}
-		pvThreads->clear();
-		delete pvThreads;
-		pvThreads = nullptr;
-	}
-
-	if (pHttpString != nullptr) {
-		delete pHttpString;
-		pHttpString = nullptr;
-	}
-
-	//-------------------------------------------------------------------------------------------------
-	// FIXME: check what happens with sockets error and release jsock memory on restarting program
-	//if (pools.size() > 0) {
-		//for (auto & i : pools) {
-			//if (i.get_thread() != nullptr) 
-			//if(i.get_thread()->joinable()){
-				//i.get_thread()->join();
-			//}
-		//}
-		//pools.clear();
-	//}
-	//-------------------------------------------------------------------------------------------------
+	}
+
+	// Quiet close, joins the receive thread without posting a socket error
+	for (jpsock& pool : pools)
+		pool.disconnect(true);
+	pools.clear();
+
+	if (telem != nullptr) {
+		delete telem;
+		telem = nullptr;
+	}
+
+	if (wdog != nullptr) {
+		delete wdog;
+		wdog = nullptr;
+	}
+
+	printer::inst()->print_msg(L0, "Miner stopped in %llu ms.", (unsigned long long)(get_timestamp_ms() - start));
+	return bClean;
 }
 
 executor::executor()
@@ -151,7 +254,7 @@ bool executor::get_live_pools(std::vector<jpsock*>& eval_pools, bool is_dev)
 	size_t over_limit = 0;
 	for(jpsock& pool : pools)
 	{
-		if(pool.is_dev_pool() != is_dev)
+		if(pool.is_dev_pool() != is_dev || !pool.is_enabled())
 			continue;
 
 		// Only eval live pools
@@ -194,6 +297,30 @@ bool executor::get_live_pools(std::vector<jpsock*>& eval_pools, bool is_dev)
 	return true;
 }
 
+/*
+ * Pool weight from pools.txt plus the measured pool health scaled by pool_adaptive_weight.
+ * The active pool gets a bonus on the health part so that we don't flap between similar pools.
+ */
+double executor::get_pool_score(jpsock* pool, bool gross_weight)
+{
+	constexpr double fActiveBonus = 1.1;
+
+	double fScore = pool->get_pool_weight(gross_weight);
+	if(pool->is_dev_pool())
+		return fScore;
+
+	double fHealth = pool->get_pool_health();
+	if(pool->get_pool_id() == current_pool_id)
+		fHealth *= fActiveBonus;
+	fScore += jconf::inst()->GetPoolAdaptiveWeight() * fHealth;
+
+	// Outweighs everything else, including the running and logged in bonus
+	if(pool->get_pool_id() == pinned_pool_id)
+		fScore += 100.0;
+
+	return fScore;
+}
+
 /*
  * This event is called by the timer and whenever something relevant happens.
  * The job here is to decide if we want to connect, disconnect, or switch jobs (or do nothing)
@@ -235,7 +362,7 @@ void executor::eval_pool_choice()
 		return;
 	}
 
-	std::sort(eval_pools.begin(), eval_pools.end(), [](jpsock* a, jpsock* b) { return b->get_pool_weight(true) < a->get_pool_weight(true); });
+	std::sort(eval_pools.begin(), eval_pools.end(), [this](jpsock* a, jpsock* b) { return get_pool_score(b, true) < get_pool_score(a, true); });
 	jpsock* goal = eval_pools[0];
 
 	if(goal->get_pool_id() != xmrstak::globalStates::inst().pool_id)
@@ -255,33 +382,15 @@ void executor::eval_pool_choice()
 
 		if(goal->is_logged_in())
 		{
-			pool_job oPoolJob;
-			if(!goal->get_current_job(oPoolJob))
-			{
+			if(!switch_to_pool(goal))
 				goal->disconnect();
-				return;
-			}
-
-			size_t prev_pool_id = current_pool_id;
-			current_pool_id = goal->get_pool_id();
-			on_pool_have_job(current_pool_id, oPoolJob);
-
-			jpsock* prev_pool = pick_pool_by_id(prev_pool_id);
-			if(prev_pool == nullptr || (!prev_pool->is_dev_pool() && !goal->is_dev_pool()))
-				reset_stats();
-
-			if(goal->is_dev_pool() && (prev_pool != nullptr && !prev_pool->is_dev_pool()))
-				last_usr_pool_id = prev_pool_id;
-			else
-				last_usr_pool_id = invalid_pool_id;
-
 			return;
 		}
 	}
 	else
 	{
 		/* All is good - but check if we can do better */
-		std::sort(eval_pools.begin(), eval_pools.end(), [](jpsock* a, jpsock* b) { return b->get_pool_weight(false) < a->get_pool_weight(false); }); 
+		std::sort(eval_pools.begin(), eval_pools.end(), [this](jpsock* a, jpsock* b) { return get_pool_score(b, false) < get_pool_score(a, false); });
 		jpsock* goal2 = eval_pools[0];
 
 		if(goal->get_pool_id() != goal2->get_pool_id())
@@ -299,9 +408,31 @@ void executor::eval_pool_choice()
 
 	if(!dev_time)
 	{
+		// Keep the next best pools logged in as hot standby, so that a failover doesn't need to wait for a connect
+		std::vector<jpsock*> standby_pools;
+		size_t standby_cnt = jconf::inst()->GetPoolStandby();
+		std::sort(eval_pools.begin(), eval_pools.end(), [this](jpsock* a, jpsock* b) { return get_pool_score(b, false) < get_pool_score(a, false); });
+		for(jpsock* pool : eval_pools)
+		{
+			if(standby_pools.size() >= standby_cnt)
+				break;
+			if(pool->get_pool_id() == goal->get_pool_id())
+				continue;
+
+			standby_pools.emplace_back(pool);
+			if(!pool->is_running() && pool->can_connect())
+			{
+				printer::inst()->print_msg(L1, "Connecting to %s pool as hot standby ...", pool->get_pool_addr());
+				std::string error;
+				if(!pool->connect(error))
+					log_socket_error(pool, std::move(error));
+			}
+		}
+
 		for(jpsock& pool : pools)
 		{
-			if(goal->is_logged_in() && pool.is_logged_in() && pool.get_pool_id() != goal->get_pool_id())
+			bool is_standby = std::find(standby_pools.begin(), standby_pools.end(), &pool) != standby_pools.end();
+			if(goal->is_logged_in() && pool.is_logged_in() && pool.get_pool_id() != goal->get_pool_id() && !is_standby)
 				pool.disconnect(true);
 
 			if(pool.is_dev_pool() && pool.is_logged_in())
@@ -310,6 +441,383 @@ void executor::eval_pool_choice()
 	}
 }
 
+bool executor::switch_to_pool(jpsock* goal)
+{
+	pool_job oPoolJob;
+	if(!goal->get_current_job(oPoolJob))
+		return false;
+
+	size_t prev_pool_id = current_pool_id;
+	current_pool_id = goal->get_pool_id();
+	on_pool_have_job(current_pool_id, oPoolJob);
+
+	jpsock* prev_pool = pick_pool_by_id(prev_pool_id);
+	if(prev_pool == nullptr || (!prev_pool->is_dev_pool() && !goal->is_dev_pool()))
+		reset_stats();
+
+	if(goal->is_dev_pool() && (prev_pool != nullptr && !prev_pool->is_dev_pool()))
+		last_usr_pool_id = prev_pool_id;
+	else
+		last_usr_pool_id = invalid_pool_id;
+
+	return true;
+}
+
+/*
+ * Called when the active pool drops. Pick the healthiest logged in user pool
+ * that already has a job, so the miners don't idle until the next evaluation.
+ */
+void executor::failover_pool()
+{
+	jpsock* goal = nullptr;
+	for(jpsock& pool : pools)
+	{
+		if(pool.is_dev_pool() || !pool.is_logged_in() || !pool.is_enabled())
+			continue;
+
+		if(goal == nullptr || get_pool_score(&pool, false) > get_pool_score(goal, false))
+			goal = &pool;
+	}
+
+	if(goal == nullptr)
+		return;
+
+	if(switch_to_pool(goal))
+		printer::inst()->print_msg(L1, "Failed over to standby pool %s (health %.2f).", goal->get_pool_addr(), goal->get_pool_health());
+}
+
+/*
+ * Applies changes to pools.txt and cpu.txt without restarting the miner. Anything that
+ * changes the algorithm, and with it the scratchpad size, still needs a full restart.
+ */
+void executor::on_config_reload()
+{
+	auto& params = xmrstak::params::inst();
+	std::string coin = jconf::inst()->GetMiningCoin();
+
+	if(!jconf::inst()->parse_pools(params.configFilePools.c_str()))
+	{
+		printer::inst()->print_msg(L0, "Config reload failed, keeping the current pools.");
+		return;
+	}
+
+	if(coin != jconf::inst()->GetMiningCoin())
+	{
+		printer::inst()->print_msg(L0, "Currency changed, restarting the miner.");
+		isPause = true;
+		needRestart = true;
+		return;
+	}
+
+	reload_pools();
+
+#ifndef CONF_NO_CPU
+	if(params.useCPU)
+		reload_cpu_threads();
+#endif
+
+	printer::inst()->print_msg(L1, "Config reloaded.");
+	// Queue behind the socket errors of the pools we just dropped
+	push_event(ex_event(EV_EVAL_POOL_CHOICE));
+}
+
+/*
+ * Pools are matched by address and TLS. Matching pools keep their connection unless the
+ * login details changed, new pools are appended and removed ones are disabled.
+ */
+void executor::reload_pools()
+{
+	auto& params = xmrstak::params::inst();
+	std::vector<jpsock*> listed;
+	size_t next_id = 0;
+
+	for(jpsock& pool : pools)
+		next_id = std::max(next_id, pool.get_pool_id() + 1);
+
+	size_t pc = jconf::inst()->GetPoolCount();
+	for(size_t i = 0; i < pc; i++)
+	{
+		jconf::pool_cfg cfg;
+		jconf::inst()->GetPoolConfig(i, cfg);
+
+		jpsock* live = nullptr;
+		for(jpsock& pool : pools)
+		{
+			if(!pool.is_dev_pool() && pool.is_tls() == cfg.tls && cfg.sPoolAddr == pool.get_pool_addr())
+				live = &pool;
+		}
+
+		if(live == nullptr)
+		{
+			pools.emplace_back(next_id++, cfg.sPoolAddr.c_str(), cfg.sWalletAddr.c_str(), cfg.sRigId.c_str(), cfg.sPasswd.c_str(), cfg.weight, false, cfg.tls, cfg.tls_fingerprint.c_str(), cfg.nicehash);
+			listed.emplace_back(&pools.back());
+			printer::inst()->print_msg(L1, "Pool %s added.", cfg.sPoolAddr.c_str());
+			continue;
+		}
+
+		listed.emplace_back(live);
+		if(!live->is_enabled())
+		{
+			live->set_enabled(true);
+			printer::inst()->print_msg(L1, "Pool %s enabled again.", cfg.sPoolAddr.c_str());
+		}
+
+		// The command line pool overrides its pools.txt entry
+		if(!params.poolURL.empty() && params.poolURL == cfg.sPoolAddr)
+			continue;
+
+		if(live->update_config(cfg.sWalletAddr.c_str(), cfg.sRigId.c_str(), cfg.sPasswd.c_str(), cfg.weight, cfg.tls_fingerprint.c_str(), cfg.nicehash))
+			printer::inst()->print_msg(L1, "Pool %s login changed, reconnecting.", cfg.sPoolAddr.c_str());
+	}
+
+	for(jpsock& pool : pools)
+	{
+		if(pool.is_dev_pool() || !pool.is_enabled())
+			continue;
+		if(std::find(listed.begin(), listed.end(), &pool) != listed.end())
+			continue;
+		if(!params.poolURL.empty() && params.poolURL == pool.get_pool_addr())
+			continue;
+
+		printer::inst()->print_msg(L1, "Pool %s removed.", pool.get_pool_addr());
+		pool.set_enabled(false);
+		if(pool.is_running())
+			pool.disconnect(true);
+	}
+
+	update_pinned_pool();
+}
+
+#ifndef CONF_NO_CPU
+/*
+ * CPU threads are always at the end of pvThreads and are matched to cpu.txt by position.
+ * Affinity changes are applied in place, other changes restart only that thread.
+ * Threads that are not touched keep their scratchpads.
+ */
+void executor::reload_cpu_threads()
+{
+	using namespace xmrstak;
+
+	if(!cpu::jconf::inst()->parse_config())
+	{
+		printer::inst()->print_msg(L0, "Config reload failed, keeping the current CPU threads.");
+		return;
+	}
+
+	size_t first = 0, gpus = 0;
+	for(; first < pvThreads->size() && pvThreads->at(first)->backendType != iBackend::CPU; first++)
+	{
+		// Fake devices only sleep and don't need a core
+		if(pvThreads->at(first)->backendType != iBackend::FAKE)
+			gpus++;
+	}
+
+	size_t running = pvThreads->size() - first;
+	size_t wanted = scheduler::cpu_thread_limit(cpu::jconf::inst()->GetThreadCount(), gpus);
+	miner_work oWork = miner_work();
+	cpu::jconf::thd_cfg cfg;
+
+	for(size_t i = 0; i < std::min(running, wanted); i++)
+	{
+		cpu::jconf::inst()->GetThreadConfig(i, cfg);
+		cpu::minethd* thd = static_cast<cpu::minethd*>(pvThreads->at(first + i));
+		if(thd->apply_config(cfg))
+			continue;
+
+		retire_thread(thd);
+		pvThreads->at(first + i) = cpu::minethd::thread_start(oWork, first + i, cfg);
+		telem->reset_thread(first + i);
+		wdog->reset_thread(first + i);
+	}
+
+	while(running > wanted)
+	{
+		retire_thread(pvThreads->back());
+		pvThreads->pop_back();
+		running--;
+		printer::inst()->print_msg(L1, "Stopped CPU thread %llu.", int_port(first + running));
+	}
+
+	for(size_t i = running; i < wanted; i++)
+	{
+		cpu::jconf::inst()->GetThreadConfig(i, cfg);
+		pvThreads->push_back(cpu::minethd::thread_start(oWork, first + i, cfg));
+	}
+
+	telem->set_thread_count(pvThreads->size());
+	wdog->set_thread_count(pvThreads->size());
+	globalStates::inst().iThreadCount = pvThreads->size();
+}
+
+/*
+ * Runs the configured watchdog action on a CPU thread. Moving it to another core
+ * happens in place, fewer lanes or a restart replace the thread.
+ */
+void executor::watchdog_action(size_t thd_id, jconf::watchdog_cfg action)
+{
+	using namespace xmrstak;
+
+	cpu::minethd* thd = static_cast<cpu::minethd*>(pvThreads->at(thd_id));
+	cpu::jconf::thd_cfg cfg;
+	thd->get_config(cfg);
+
+	switch(action)
+	{
+	case jconf::wd_repin:
+	{
+		// Lowest core that no mining thread is pinned to
+		std::vector<bool> used(std::thread::hardware_concurrency(), false);
+		for(iBackend* other : *pvThreads)
+		{
+			if(other->backendType != iBackend::CPU)
+				continue;
+
+			cpu::jconf::thd_cfg other_cfg;
+			static_cast<cpu::minethd*>(other)->get_config(other_cfg);
+			if(other_cfg.iCpuAff >= 0 && size_t(other_cfg.iCpuAff) < used.size())
+				used[other_cfg.iCpuAff] = true;
+		}
+
+		auto it = std::find(used.begin(), used.end(), false);
+		if(it == used.end())
+		{
+			printer::inst()->print_msg(L1, "WATCHDOG thread=%u action=repin result=no_free_core", (unsigned)thd_id);
+			return;
+		}
+
+		cfg.iCpuAff = it - used.begin();
+		thd->apply_config(cfg);
+		wdog->reset_thread(thd_id);
+		return;
+	}
+
+	case jconf::wd_lanes:
+		if(cfg.iMultiway <= 1)
+		{
+			printer::inst()->print_msg(L1, "WATCHDOG thread=%u action=lanes result=single_lane", (unsigned)thd_id);
+			return;
+		}
+		cfg.iMultiway--;
+		break;
+
+	default:
+		break;
+	}
+
+	miner_work oWork = miner_work();
+	retire_thread(thd);
+	pvThreads->at(thd_id) = cpu::minethd::thread_start(oWork, thd_id, cfg);
+	telem->reset_thread(thd_id);
+	wdog->reset_thread(thd_id);
+}
+
+/*
+ * Takes a CPU thread out of service without blocking the event loop, the join waits
+ * for the thread's current hash round. static_delete waits for these threads as well.
+ */
+void executor::retire_thread(xmrstak::iBackend* thd)
+{
+	thd->request_quit();
+
+	std::shared_ptr<retire_state> state = pRetired;
+	std::unique_lock<std::mutex> lck(state->mtx);
+	state->left++;
+	lck.unlock();
+
+	std::thread([state, thd]() {
+		if(thd->oWorkThd.joinable())
+			thd->oWorkThd.join();
+		delete thd;
+		std::unique_lock<std::mutex> lck(state->mtx);
+		state->left--;
+		state->cond.notify_all();
+	}).detach();
+}
+#else
+void executor::reload_cpu_threads() {}
+void executor::watchdog_action(size_t thd_id, jconf::watchdog_cfg action) {}
+#endif
+
+/*
+ * Once a second every thread is compared with its own baseline, see watchdog.hpp.
+ * Only CPU threads can be acted on, a slow or stalled GPU is logged.
+ */
+void executor::check_watchdog()
+{
+	double fDrop = jconf::inst()->GetWatchdogDrop();
+	if(fDrop <= 0.0)
+		return;
+
+	const char* action_names[] = { "log", "repin", "lanes", "restart" };
+	uint64_t iNow = get_timestamp_ms();
+	uint64_t iHoldSec = jconf::inst()->GetWatchdogTime();
+
+	// Without work the threads idle on purpose, don't count that as a drop
+	if(isPause || xmrstak::globalStates::inst().oGlobalWork.bStall)
+	{
+		wdog->clear_low();
+		iWatchdogIdleEnd = iNow;
+		return;
+	}
+
+	// The 10s rates still cover the idle time
+	if(iNow - iWatchdogIdleEnd < 10000)
+		return;
+
+	std::vector<size_t> vTripped;
+	for(size_t i = 0; i < pvThreads->size(); i++)
+	{
+		if(wdog->update(i, telem->calc_telemetry_data(10000, i), iNow, fDrop, iHoldSec * 1000))
+			vTripped.push_back(i);
+	}
+
+	if(vTripped.empty())
+		return;
+
+	// All threads slow at once points at the host or the work, not at a single thread,
+	// moving or restarting threads would not help
+	bool bAllLow = pvThreads->size() > 1 && wdog->low_count() == pvThreads->size();
+	if(bAllLow)
+		printer::inst()->print_msg(L1, "WATCHDOG all %u threads are slow at the same time, only logging.", (unsigned)pvThreads->size());
+
+	for(size_t i : vTripped)
+	{
+		double fHps = telem->calc_telemetry_data(10000, i);
+		xmrstak::iBackend* thd = pvThreads->at(i);
+		jconf::watchdog_cfg action = jconf::inst()->GetWatchdogAction();
+		if(thd->backendType != xmrstak::iBackend::CPU || bAllLow)
+			action = jconf::wd_log;
+
+		double fBaseline = wdog->get_baseline(i);
+		if(!std::isnormal(fHps))
+			fHps = 0.0;
+
+		printer::inst()->print_msg(L1, "WATCHDOG thread=%u backend=%s hps=%.1f baseline=%.1f ratio=%.2f held_s=%llu action=%s",
+			(unsigned)i, xmrstak::iBackend::getName(thd->backendType), fHps, fBaseline, fHps / fBaseline,
+			int_port(iHoldSec), action_names[action]);
+
+		if(action != jconf::wd_log)
+			watchdog_action(i, action);
+	}
+}
+
+void executor::update_pinned_pool()
+{
+	const char* pin = jconf::inst()->GetPoolPin();
+	pinned_pool_id = invalid_pool_id;
+	if(pin[0] == '\0')
+		return;
+
+	for(jpsock& pool : pools)
+	{
+		if(!pool.is_dev_pool() && pool.is_enabled() && strcmp(pool.get_pool_addr(), pin) == 0)
+			pinned_pool_id = pool.get_pool_id();
+	}
+
+	if(pinned_pool_id == invalid_pool_id)
+		printer::inst()->print_msg(L0, "WARNING: pool_pin %s doesn't match any pool address, ignoring it.", pin);
+}
+
 void executor::log_socket_error(jpsock* pool, std::string&& sError)
 {
 	std::string pool_name;
@@ -341,9 +849,10 @@ void executor::log_result_error(std::string&& sError)
 		sError.clear();
 }
 
-void executor::log_result_ok(uint64_t iActualDiff)
+void executor::log_result_ok(uint64_t iActualDiff, uint64_t iJobNo)
 {
-	iPoolHashes += iPoolDiff;
+	iPoolHashes += iJobNo >= iJobDiffNo ? iJobDiff : iPrevJobDiff;
+	iShareWindowCount++;
 
 	size_t ln = iTopDiff.size() - 1;
 	if(iActualDiff > iTopDiff[ln])
@@ -355,6 +864,52 @@ void executor::log_result_ok(uint64_t iActualDiff)
 	vMineResults[0].increment();
 }
 
+/*
+ * Keeps the accepted share rate under share_rate_limit per minute. Once a minute the floor
+ * is scaled by the measured rate over 80% of the limit, by at most 4x up and 2x down, and it
+ * is dropped once it would be at or below the pool difficulty. It applies from the next job.
+ */
+void executor::adjust_local_diff()
+{
+	uint64_t limit = jconf::inst()->GetShareRateLimit();
+	size_t now = get_timestamp();
+
+	if(limit == 0 || iPoolDiff == 0)
+	{
+		iLocalDiff = 0;
+		iShareWindowStart = now;
+		iShareWindowCount = 0;
+		return;
+	}
+
+	if(now - iShareWindowStart < 60)
+		return;
+
+	double fRate = double(iShareWindowCount) * 60.0 / double(now - iShareWindowStart);
+	iShareWindowStart = now;
+	iShareWindowCount = 0;
+
+	double fGoal = double(limit) * 0.8;
+	double fDiff = double(std::max(iLocalDiff, iPoolDiff));
+	if(fRate > double(limit))
+		fDiff *= std::min(fRate / fGoal, 4.0);
+	else if(iLocalDiff != 0 && fRate < double(limit) * 0.5)
+		fDiff *= std::max(fRate / fGoal, 0.5);
+	else
+		return;
+
+	uint64_t iNewDiff = fDiff > double(iPoolDiff) ? uint64_t(fDiff) : 0;
+	if(iNewDiff == iLocalDiff)
+		return;
+
+	iLocalDiff = iNewDiff;
+	if(iLocalDiff != 0)
+		printer::inst()->print_msg(L2, "Local difficulty floor now %llu (pool %llu, %.1f shares/min).",
+			int_port(iLocalDiff), int_port(iPoolDiff), fRate);
+	else
+		printer::inst()->print_msg(L2, "Local difficulty floor removed (%.1f shares/min).", fRate);
+}
+
 jpsock* executor::pick_pool_by_id(size_t pool_id)
 {
 	if(pool_id == invalid_pool_id)
@@ -376,7 +931,11 @@ void executor::on_sock_ready(size_t pool_id)
 	else
 		printer::inst()->print_msg(L1, "Pool %s connected. Logging in...", pool->get_pool_addr());
 
-	if(!pool->cmd_login())
+	size_t t_start = get_timestamp_ms();
+	bool bLogin = pool->cmd_login();
+	pool->log_call_time(get_timestamp_ms() - t_start);
+
+	if(!bLogin)
 	{
 		if(pool->have_call_error() && !pool->is_dev_pool())
 		{
@@ -396,7 +955,10 @@ void executor::on_sock_error(size_t pool_id, std::string&& sError, bool silent)
 	pool->disconnect();
 
 	if(pool_id == current_pool_id)
+	{
 		current_pool_id = invalid_pool_id;
+		failover_pool();
+	}
 
 	if(silent)
 		return;
@@ -407,21 +969,85 @@ void executor::on_sock_error(size_t pool_id, std::string&& sError, bool silent)
 		printer::inst()->print_msg(L1, "Dev pool socket error - mining on user pool...");
 }
 
+// Cryptonote block header: major version, minor version and timestamp
+// (all varints) followed by the 32 byte hash of the previous block
+static const uint8_t* get_prev_block_hash(const pool_job& oPoolJob)
+{
+	uint32_t pos = 0;
+	for(size_t i = 0; i < 3; i++)
+	{
+		while(pos < oPoolJob.iWorkLen && (oPoolJob.bWorkBlob[pos] & 0x80) != 0)
+			pos++;
+		pos++;
+	}
+
+	if(pos + 32 > oPoolJob.iWorkLen)
+		return nullptr;
+	return oPoolJob.bWorkBlob + pos;
+}
+
+/*
+ * Measure how late each pool announces a new block compared to the first pool that did.
+ * Called for the first job of each new block from every user pool, not only the active one.
+ */
+void executor::log_block_notify(jpsock* pool, const uint8_t* prev_hash)
+{
+	size_t now = get_timestamp_ms();
+	for(block_notify& blk : vBlockNotify)
+	{
+		if(memcmp(blk.bHash, prev_hash, sizeof(blk.bHash)) == 0)
+		{
+			pool->log_notify_lag(now - blk.iTime);
+			return;
+		}
+	}
+
+	block_notify& blk = vBlockNotify[iBlockNotifyPos++ % vBlockNotify.size()];
+	memcpy(blk.bHash, prev_hash, sizeof(blk.bHash));
+	blk.iTime = now;
+	pool->log_notify_lag(0);
+}
+
 void executor::on_pool_have_job(size_t pool_id, pool_job& oPoolJob)
 {
+	jpsock* pool = pick_pool_by_id(pool_id);
+
+	// A job for a new block invalidates the pool's older jobs, a re-target on the same block does not
+	const uint8_t* prev_hash = get_prev_block_hash(oPoolJob);
+	bool bNewBlock = prev_hash != nullptr && pool->is_new_block(prev_hash);
+	if(bNewBlock && !pool->is_dev_pool())
+		log_block_notify(pool, prev_hash);
+
 	if(pool_id != current_pool_id)
+	{
+		// Standby pools stay logged in, results found for them earlier only go stale with their own blocks
+		if(bNewBlock)
+			xmrstak::globalStates::inst().set_clean_job(pool_id);
 		return;
+	}
 
-	jpsock* pool = pick_pool_by_id(pool_id);
+	// Shares the miners find below the local floor are never even queued
+	uint64_t iTarget = oPoolJob.iTarget;
+	if(iLocalDiff != 0 && !pool->is_dev_pool())
+		iTarget = std::min(iTarget, jpsock::diff_to_t64(iLocalDiff));
 
-	xmrstak::miner_work oWork(oPoolJob.sJobID, oPoolJob.bWorkBlob, oPoolJob.iWorkLen, oPoolJob.iTarget, pool->is_nicehash(), pool_id);
+	xmrstak::miner_work oWork(oPoolJob.sJobID, oPoolJob.bWorkBlob, oPoolJob.iWorkLen, iTarget, pool->is_nicehash(), pool_id);
 
 	xmrstak::pool_data dat;
 	dat.iSavedNonce = oPoolJob.iSavedNonce;
 	dat.pool_id = pool_id;
+	dat.bNewBlock = bNewBlock;
 
 	xmrstak::globalStates::inst().switch_work(oWork, dat);
 
+	uint64_t iDiff = jpsock::t64_to_diff(iTarget);
+	if(iDiff != iJobDiff)
+	{
+		iPrevJobDiff = iJobDiff;
+		iJobDiff = iDiff;
+		iJobDiffNo = xmrstak::globalStates::inst().iGlobalJobNo.load(std::memory_order_relaxed);
+	}
+
 	if(dat.pool_id != pool_id)
 	{
 		jpsock* prev_pool;
@@ -456,66 +1082,123 @@ void executor::on_pool_have_job(size_t pool_id, pool_job& oPoolJob)
 }
 
 void executor::on_miner_result(size_t pool_id, job_result& oResult)
+{
+	submit_results(pool_id, &oResult, 1);
+}
+
+void executor::on_miner_results(size_t pool_id, result_batch& oBatch)
+{
+	for(size_t i = 0; i < oBatch.iInvalid; i++)
+		log_result_error(std::string(oBatch.sInvalidError) + " GPU ID " + std::to_string(oBatch.iGpuIdx));
+
+	if(!oBatch.vResults.empty())
+		submit_results(pool_id, oBatch.vResults.data(), oBatch.vResults.size());
+}
+
+void executor::submit_results(size_t pool_id, job_result* pResults, size_t iCount)
 {
 	jpsock* pool = pick_pool_by_id(pool_id);
 
-	const char* backend_name = xmrstak::iBackend::getName(pvThreads->at(oResult.iThreadId)->backendType);
-	uint64_t backend_hashcount, total_hashcount = 0;
+	std::vector<jpsock::submit_req> vReq;
+	vReq.reserve(iCount);
+	uint64_t iCleanJobNo = xmrstak::globalStates::inst().get_clean_job(pool_id);
+	for(size_t i = 0; i < iCount; i++)
+	{
+		job_result& oResult = pResults[i];
+		if(oResult.iJobNo < iCleanJobNo)
+		{
+			// The pool would reject it anyway, don't waste a round trip on it
+			iStaleAvoided++;
+			pool->log_stale();
+			printer::inst()->print_msg(L3, "Stale result dropped, job %s was superseded.", oResult.sJobID);
+			continue;
+		}
+
+		// The thread may have been stopped by a config reload since it found the result
+		jpsock::submit_req req = { &oResult, xmrstak::iBackend::getName(xmrstak::iBackend::CPU), 0 };
+		if(oResult.iThreadId < pvThreads->size())
+		{
+			req.backend_name = xmrstak::iBackend::getName(pvThreads->at(oResult.iThreadId)->backendType);
+			req.backend_hashcount = pvThreads->at(oResult.iThreadId)->get_hash_count();
+		}
+		vReq.push_back(req);
+	}
 
-	backend_hashcount = pvThreads->at(oResult.iThreadId)->iHashCount.load(std::memory_order_relaxed);
+	if(vReq.empty())
+		return;
+
+	uint64_t total_hashcount = 0;
 	for(size_t i = 0; i < pvThreads->size(); i++)
-		total_hashcount += pvThreads->at(i)->iHashCount.load(std::memory_order_relaxed);
+		total_hashcount += pvThreads->at(i)->get_hash_count();
 
+	std::vector<jpsock::submit_rsp> vRsp;
 	if(pool->is_dev_pool())
 	{
 		//Ignore errors silently
 		if(pool->is_running() && pool->is_logged_in())
-			pool->cmd_submit(oResult.sJobID, oResult.iNonce, oResult.bResult, backend_name, 
-			backend_hashcount, total_hashcount, oResult.algorithm
-		);
+			pool->cmd_submit(vReq, total_hashcount, vRsp);
 		return;
 	}
 
 	if (!pool->is_running() || !pool->is_logged_in())
 	{
-		log_result_error("[NETWORK ERROR]");
+		for(size_t i = 0; i < vReq.size(); i++)
+			log_result_error("[NETWORK ERROR]");
 		return;
 	}
 
+	// On shutdown the replies are only waited for until the deadline
+	uint64_t iTimeoutMs = 0;
+	if(iSubmitDeadline != 0)
+	{
+		uint64_t now = get_timestamp_ms();
+		iTimeoutMs = std::min<uint64_t>(jconf::inst()->GetCallTimeout() * 1000, iSubmitDeadline > now ? iSubmitDeadline - now : 1);
+	}
+
+	// All submits go out at once and share one round trip, so the batch is one ping sample
 	size_t t_start = get_timestamp_ms();
-	bool bResult = pool->cmd_submit(oResult.sJobID, oResult.iNonce, oResult.bResult, 
-		backend_name, backend_hashcount, total_hashcount, oResult.algorithm
-	);
+	pool->cmd_submit(vReq, total_hashcount, vRsp, iTimeoutMs);
 	size_t t_len = get_timestamp_ms() - t_start;
 
 	if(t_len > 0xFFFF)
 		t_len = 0xFFFF;
+
 	iPoolCallTimes.push_back((uint16_t)t_len);
+	iPoolSubmits += vReq.size();
+	pool->log_call_time(t_len);
 
-	if(bResult)
-	{
-		uint64_t* targets = (uint64_t*)oResult.bResult;
-		log_result_ok(jpsock::t64_to_diff(targets[3]));
-		printer::inst()->print_msg(L3, "Result accepted by the pool.");
-	}
-	else
+	bool bDisconnect = false;
+	for(size_t i = 0; i < vReq.size(); i++)
 	{
-		if(!pool->have_sock_error())
+		if(!vRsp[i].bDone)
 		{
-			printer::inst()->print_msg(L3, "Result rejected by the pool.");
+			log_result_error("[NETWORK ERROR]");
+			continue;
+		}
 
-			std::string error = pool->get_call_error();
+		if(vRsp[i].bAccepted)
+		{
+			pool->log_result(true);
+			uint64_t* targets = (uint64_t*)vReq[i].pResult->bResult;
+			log_result_ok(jpsock::t64_to_diff(targets[3]), vReq[i].pResult->iJobNo);
+			printer::inst()->print_msg(L3, "Result accepted by the pool.");
+		}
+		else
+		{
+			printer::inst()->print_msg(L3, "Result rejected by the pool.");
+			pool->log_result(false);
 
-			if(strncasecmp(error.c_str(), "Unauthenticated", 15) == 0)
-			{
-				printer::inst()->print_msg(L2, "Your miner was unable to find a share in time. Either the pool difficulty is too high, or the pool timeout is too low.");
-				pool->disconnect();
-			}
+			if(strncasecmp(vRsp[i].sError.c_str(), "Unauthenticated", 15) == 0)
+				bDisconnect = true;
 
-			log_result_error(std::move(error));
+			log_result_error(std::move(vRsp[i].sError));
 		}
-		else
-			log_result_error("[NETWORK ERROR]");
+	}
+
+	if(bDisconnect)
+	{
+		printer::inst()->print_msg(L2, "Your miner was unable to find a share in time. Either the pool difficulty is too high, or the pool timeout is too low.");
+		pool->disconnect();
 	}
 }
 
@@ -554,6 +1237,7 @@ void executor::ex_main()
 	}
 
 	telem = new xmrstak::telemetry(pvThreads->size());
+	wdog = new xmrstak::watchdog(pvThreads->size());
 
 	set_timestamp();
 	size_t pc = jconf::inst()->GetPoolCount();
@@ -578,15 +1262,15 @@ void executor::ex_main()
 			auto& params = xmrstak::params::inst();
 			already_have_cli_pool = true;
 			
-			const char* wallet = params.poolUsername.empty() ? cfg.sWalletAddr : params.poolUsername.c_str();
-			const char* rigid = params.userSetRigid ? params.poolRigid.c_str() : cfg.sRigId;
-			const char* pwd = params.userSetPwd ? params.poolPasswd.c_str() : cfg.sPasswd;
+			const char* wallet = params.poolUsername.empty() ? cfg.sWalletAddr.c_str() : params.poolUsername.c_str();
+			const char* rigid = params.userSetRigid ? params.poolRigid.c_str() : cfg.sRigId.c_str();
+			const char* pwd = params.userSetPwd ? params.poolPasswd.c_str() : cfg.sPasswd.c_str();
 			bool nicehash = cfg.nicehash || params.nicehashMode;
 			
-			pools.emplace_back(i+1, cfg.sPoolAddr, wallet, rigid, pwd, 9.9, false, params.poolUseTls, cfg.tls_fingerprint, nicehash);
+			pools.emplace_back(i+1, cfg.sPoolAddr.c_str(), wallet, rigid, pwd, 9.9, false, params.poolUseTls, cfg.tls_fingerprint.c_str(), nicehash);
 		}
 		else
-			pools.emplace_back(i+1, cfg.sPoolAddr, cfg.sWalletAddr, cfg.sRigId, cfg.sPasswd, cfg.weight, false, cfg.tls, cfg.tls_fingerprint, cfg.nicehash);
+			pools.emplace_back(i+1, cfg.sPoolAddr.c_str(), cfg.sWalletAddr.c_str(), cfg.sRigId.c_str(), cfg.sPasswd.c_str(), cfg.weight, false, cfg.tls, cfg.tls_fingerprint.c_str(), cfg.nicehash);
 	}
 
 	if(!xmrstak::params::inst().poolURL.empty() && !already_have_cli_pool)
@@ -636,6 +1320,8 @@ void executor::ex_main()
 		break;
 	}
 
+	update_pinned_pool();
+
 	ex_event ev;
 	std::thread clock_thd(&executor::ex_clock_thd, this);
 
@@ -644,6 +1330,7 @@ void executor::ex_main()
 	// Place the default success result at position 0, it needs to
 	// be here even if our first result is a failure
 	vMineResults.emplace_back();
+	publish_http_reports();
 
 	// If the user requested it, start the autohash printer
 	if(jconf::inst()->GetVerboseLevel() >= 4)
@@ -680,12 +1367,18 @@ void executor::ex_main()
 
 			case EV_POOL_HAVE_JOB:
 				on_pool_have_job(ev.iPoolId, ev.oPoolJob);
+				if (ev.iPoolId == current_pool_id && ev.oPoolJob.iRecvTime != 0)
+					oJobSwitchHist.add(get_timestamp_ms() - ev.oPoolJob.iRecvTime);
 				break;
 
 			case EV_MINER_HAVE_RESULT:
 				on_miner_result(ev.iPoolId, ev.oJobResult);
 				break;
 
+			case EV_MINER_HAVE_RESULTS:
+				on_miner_results(ev.iPoolId, ev.oResults);
+				break;
+
 			case EV_EVAL_POOL_CHOICE:
 				eval_pool_choice();
 				break;
@@ -696,8 +1389,11 @@ void executor::ex_main()
 
 			case EV_PERF_TICK:
 				for (i = 0; i < pvThreads->size(); i++)
-					telem->push_perf_value(i, pvThreads->at(i)->iHashCount.load(std::memory_order_relaxed),
-						pvThreads->at(i)->iTimestamp.load(std::memory_order_relaxed));
+				{
+					uint64_t iCount, iStamp;
+					pvThreads->at(i)->get_hash_stats(iCount, iStamp);
+					telem->push_perf_value(i, iCount, iStamp);
+				}
 
 				if ((cnt++ & 0xF) == 0) //Every 16 ticks
 				{
@@ -722,6 +1418,15 @@ void executor::ex_main()
 					if (normal && fHighestHps < fHps)
 						fHighestHps = fHps;
 				}
+
+				if ((cnt & 1) == 0) //Once a second
+				{
+					if (bHttpPolled.exchange(false, std::memory_order_relaxed))
+						publish_http_reports();
+					publish_metrics();
+					check_watchdog();
+					adjust_local_diff();
+				}
 				break;
 
 			case EV_USR_HASHRATE:
@@ -730,11 +1435,8 @@ void executor::ex_main()
 				print_report(ev.iName);
 				break;
 
-			case EV_HTML_HASHRATE:
-			case EV_HTML_RESULTS:
-			case EV_HTML_CONNSTAT:
-			case EV_HTML_JSON:
-				http_report(ev.iName);
+			case EV_CONFIG_RELOAD:
+				on_config_reload();
 				break;
 
 			case EV_HASHRATE_LOOP:
@@ -742,6 +1444,10 @@ void executor::ex_main()
 				push_timed_event(ex_event(EV_HASHRATE_LOOP), jconf::inst()->GetAutohashTime());
 				break;
 
+			case EV_SHUTDOWN:
+				// Only wakes us up, needRestart is already set
+				break;
+
 			case EV_INVALID_VAL:
 			default:
 				assert(false);
@@ -749,6 +1455,50 @@ void executor::ex_main()
 			}
 		}
 	}
+
+	clock_thd.join();
+	flush_results();
+
+	std::unique_lock<std::mutex> lck(main_mutex);
+	bMainRunning = false;
+	main_cond.notify_all();
+}
+
+/* Submits the results still queued when the loop stopped, the miner threads are gone by
+ * now so nothing new arrives. Other events are dropped. Gives up at the shutdown deadline.
+ */
+void executor::flush_results()
+{
+	ex_event ev;
+	size_t iFlushed = 0, iDropped = 0;
+	iSubmitDeadline = iShutdownDeadline;
+	while (oEventQ.try_pop(ev))
+	{
+		if (ev.iName == EV_MINER_HAVE_RESULT)
+		{
+			if (get_timestamp_ms() < iShutdownDeadline)
+			{
+				on_miner_result(ev.iPoolId, ev.oJobResult);
+				iFlushed++;
+			}
+			else
+				iDropped++;
+		}
+		else if (ev.iName == EV_MINER_HAVE_RESULTS)
+		{
+			if (get_timestamp_ms() < iShutdownDeadline)
+			{
+				on_miner_results(ev.iPoolId, ev.oResults);
+				iFlushed += ev.oResults.vResults.size();
+			}
+			else
+				iDropped += ev.oResults.vResults.size();
+		}
+	}
+
+	if (iFlushed != 0 || iDropped != 0)
+		printer::inst()->print_msg(L1, "Shutdown: submitted %llu pending results, dropped %llu.",
+			(unsigned long long)iFlushed, (unsigned long long)iDropped);
 }
 
 inline const char* hps_format(double h, char* buf, size_t l)
@@ -834,7 +1584,7 @@ void executor::hashrate_report(std::string& out)
 	char num[32];
 	double fTotal[3] = { 0.0, 0.0, 0.0};
 
-	for( uint32_t b = 0; b < 4u; ++b)
+	for( uint32_t b = 0; b < xmrstak::iBackend::iTypeCount; ++b)
 	{
 		std::vector<xmrstak::iBackend*> backEnds;
 		std::copy_if(pvThreads->begin(), pvThreads->end(), std::back_inserter(backEnds),
@@ -959,17 +1709,21 @@ void executor::result_report(std::string& out)
 
 	snprintf(num, sizeof(num), " (%.1f %%)\n", 100.0 * iGoodRes / iTotalRes);
 
-	out.append("Difficulty       : ").append(std::to_string(iPoolDiff)).append(1, '\n');
+	out.append("Difficulty       : ").append(std::to_string(iPoolDiff));
+	if(iLocalDiff != 0)
+		out.append(" (local floor ").append(std::to_string(iLocalDiff)).append(1, ')');
+	out.append(1, '\n');
 	out.append("Good results     : ").append(std::to_string(iGoodRes)).append(" / ").
 		append(std::to_string(iTotalRes)).append(num);
 
-	if(iPoolCallTimes.size() != 0)
+	if(iPoolSubmits != 0)
 	{
-		// Here we use iPoolCallTimes since it also gets reset when we disconnect
-		snprintf(num, sizeof(num), "%.1f sec\n", dConnSec / iPoolCallTimes.size());
+		// Here we use iPoolSubmits since it also gets reset when we disconnect
+		snprintf(num, sizeof(num), "%.1f sec\n", dConnSec / iPoolSubmits);
 		out.append("Avg result time  : ").append(num);
 	}
-	out.append("Pool-side hashes : ").append(std::to_string(iPoolHashes)).append(2, '\n');
+	out.append("Pool-side hashes : ").append(std::to_string(iPoolHashes)).append(1, '\n');
+	out.append("Stale avoided    : ").append(std::to_string(iStaleAvoided)).append(2, '\n');
 	out.append("Top 10 best results found:\n");
 
 	for(size_t i=0; i < 10; i += 2)
@@ -1022,6 +1776,20 @@ void executor::connection_report(std::string& out)
 	else
 		out.append("Pool ping time  : (n/a)\n");
 
+	if(pool != nullptr)
+	{
+		snprintf(num, sizeof(num), "Pool health     : %.2f%s\n", pool->get_pool_health(),
+			pool->get_pool_id() == pinned_pool_id ? " (pinned)" : "");
+		out.append(num);
+	}
+
+	if(pool != nullptr && pool->get_tls_handshakes() > 0)
+	{
+		snprintf(num, sizeof(num), "TLS resumed     : %llu / %llu handshakes, last took %llu ms\n",
+			int_port(pool->get_tls_resumed()), int_port(pool->get_tls_handshakes()), int_port(pool->get_tls_handshake_ms()));
+		out.append(num);
+	}
+
 	out.append("\nNetwork error log:\n");
 	size_t ln = vSocketLog.size();
 	if(ln > 0)
@@ -1153,15 +1921,15 @@ void executor::http_result_report(std::string& out)
 		fGoodResPrc = 100.0 * iGoodRes / iTotalRes;
 
 	double fAvgResTime = 0.0;
-	if(iPoolCallTimes.size() > 0)
+	if(iPoolSubmits > 0)
 	{
 		using namespace std::chrono;
 		fAvgResTime = ((double)duration_cast<seconds>(system_clock::now() - tPoolConnTime).count())
-			/ iPoolCallTimes.size();
+			/ iPoolSubmits;
 	}
 
 	snprintf(buffer, sizeof(buffer), sHtmlResultBodyHigh,
-		iPoolDiff, iGoodRes, iTotalRes, fGoodResPrc, fAvgResTime, iPoolHashes,
+		iPoolDiff, iGoodRes, iTotalRes, fGoodResPrc, fAvgResTime, iPoolHashes, iStaleAvoided,
 		int_port(iTopDiff[0]), int_port(iTopDiff[1]), int_port(iTopDiff[2]), int_port(iTopDiff[3]),
 		int_port(iTopDiff[4]), int_port(iTopDiff[5]), int_port(iTopDiff[6]), int_port(iTopDiff[7]),
 		int_port(iTopDiff[8]), int_port(iTopDiff[9]));
@@ -1288,8 +2056,8 @@ void executor::http_json_report(std::string& out)
 	}
 
 	double fAvgResTime = 0.0;
-	if(iPoolCallTimes.size() > 0)
-		fAvgResTime = double(iConnSec) / iPoolCallTimes.size();
+	if(iPoolSubmits > 0)
+		fAvgResTime = double(iConnSec) / iPoolSubmits;
 
 	//--------------------------------------------------------------------------------------------------------
 	//TODO: do tests and force results errors
@@ -1351,7 +2119,7 @@ void executor::http_json_report(std::string& out)
 
 	int bb_len = snprintf(bigbuf.get(), bb_size, sJsonApiFormat,
 		get_version_str().c_str(), hr_thds.c_str(), hr_buffer, a,
-		int_port(iPoolDiff), int_port(iGoodRes), int_port(iTotalRes), fAvgResTime, int_port(iPoolHashes),
+		int_port(iPoolDiff), int_port(iGoodRes), int_port(iTotalRes), fAvgResTime, int_port(iPoolHashes), int_port(iStaleAvoided),
 		int_port(iTopDiff[0]), int_port(iTopDiff[1]), int_port(iTopDiff[2]), int_port(iTopDiff[3]), int_port(iTopDiff[4]),
 		int_port(iTopDiff[5]), int_port(iTopDiff[6]), int_port(iTopDiff[7]), int_port(iTopDiff[8]), int_port(iTopDiff[9]),
 		res_error.c_str(), pool != nullptr ? pool->get_pool_addr() : "not connected", int_port(iConnSec), int_port(iPoolPing), cn_error.c_str());
@@ -1359,50 +2127,213 @@ void executor::http_json_report(std::string& out)
 	out = std::string(bigbuf.get(), bigbuf.get() + bb_len);
 }
 
-void executor::http_report(ex_event_name ev)
+void executor::metrics_report(std::string& out)
 {
-	assert(pHttpString != nullptr);
+	using namespace xmrstak;
+	const size_t nthd = pvThreads->size();
+	const size_t windows[3] = { 10000, 60000, 900000 };
+	const char* window_names[3] = { "10s", "60s", "15m" };
 
-	switch(ev)
+	out.reserve(4096 + nthd * 512);
+
+	metrics::family(out, "bittube_build", "info", "Miner version.");
+	metrics::sample(out, "bittube_build_info", metrics::label("version", get_version_str()), uint64_t(1));
+
+	// Thread totals per backend type, indexed by iBackend::BackendType
+	double fBackendHps[iBackend::iTypeCount][3] = { };
+	bool bBackendSeen[iBackend::iTypeCount] = { };
+
+	metrics::family(out, "bittube_thread_hashrate", "gauge", "Hash rate of a mining thread in H/s, averaged over the window.");
+	for(size_t i = 0; i < nthd; i++)
 	{
-	case EV_HTML_HASHRATE:
-		http_hashrate_report(*pHttpString);
-		break;
+		iBackend* thd = pvThreads->at(i);
+		size_t type = thd->backendType < iBackend::iTypeCount ? size_t(thd->backendType) : 0;
+		bBackendSeen[type] = true;
 
-	case EV_HTML_RESULTS:
-		http_result_report(*pHttpString);
-		break;
+		std::string lbl = metrics::label("thread", std::to_string(i)) + "," + metrics::label("backend", iBackend::getName(thd->backendType));
+		for(size_t w = 0; w < 3; w++)
+		{
+			double fHps = telem->calc_telemetry_data(windows[w], i);
+			if(std::isnormal(fHps))
+				fBackendHps[type][w] += fHps;
+			metrics::sample(out, "bittube_thread_hashrate", lbl + "," + metrics::label("window", window_names[w]), fHps);
+		}
+	}
 
-	case EV_HTML_CONNSTAT:
-		http_connection_report(*pHttpString);
-		break;
+	metrics::family(out, "bittube_backend_hashrate", "gauge", "Hash rate of all threads of a backend in H/s, averaged over the window.");
+	for(size_t type = 0; type < iBackend::iTypeCount; type++)
+	{
+		if(!bBackendSeen[type])
+			continue;
+		std::string lbl = metrics::label("backend", iBackend::getName(iBackend::BackendType(type)));
+		for(size_t w = 0; w < 3; w++)
+			metrics::sample(out, "bittube_backend_hashrate", lbl + "," + metrics::label("window", window_names[w]), fBackendHps[type][w]);
+	}
 
-	case EV_HTML_JSON:
-		http_json_report(*pHttpString);
-		break;
+	metrics::family(out, "bittube_hashrate_highest", "gauge", "Highest total 10s hash rate seen in H/s.");
+	metrics::sample(out, "bittube_hashrate_highest", "", fHighestHps);
 
-	default:
-		assert(false);
-		break;
+	metrics::family(out, "bittube_thread_hashes", "counter", "Hashes computed by a mining thread.");
+	for(size_t i = 0; i < nthd; i++)
+		metrics::sample(out, "bittube_thread_hashes_total", metrics::label("thread", std::to_string(i)), uint64_t(pvThreads->at(i)->get_hash_count()));
+
+	metrics::family(out, "bittube_thread_huge_pages", "gauge", "1 if the thread's scratchpads are backed by large pages.");
+	for(size_t i = 0; i < nthd; i++)
+	{
+		int32_t huge_pages = pvThreads->at(i)->iHugePages.load(std::memory_order_relaxed);
+		if(huge_pages >= 0)
+			metrics::sample(out, "bittube_thread_huge_pages", metrics::label("thread", std::to_string(i)), uint64_t(huge_pages));
+	}
+
+	metrics::family(out, "bittube_thread_device_idle_seconds", "counter", "Time the GPU of an OpenCL thread waited for the host between two rounds.");
+	for(size_t i = 0; i < nthd; i++)
+	{
+		if(pvThreads->at(i)->backendType == iBackend::AMD)
+			metrics::sample(out, "bittube_thread_device_idle_seconds_total", metrics::label("thread", std::to_string(i)),
+				double(pvThreads->at(i)->iDeviceIdleUs.load(std::memory_order_relaxed)) / 1e6);
+	}
+
+	metrics::family(out, "bittube_thread_device_stale_seconds", "counter", "Time the GPU of an OpenCL thread spent on rounds dropped because a new block or pool replaced their job.");
+	for(size_t i = 0; i < nthd; i++)
+	{
+		if(pvThreads->at(i)->backendType == iBackend::AMD)
+			metrics::sample(out, "bittube_thread_device_stale_seconds_total", metrics::label("thread", std::to_string(i)),
+				double(pvThreads->at(i)->iDeviceStaleUs.load(std::memory_order_relaxed)) / 1e6);
+	}
+
+	// Per device view of the backends with the versioned plugin interface
+	std::vector<xmrstak_device_stats> vDevStats;
+	metrics::family(out, "bittube_device_running", "gauge", "1 if the device mines, 0 if it was paused or stopped through the backend.");
+	for(const xmrstak_backend_api* api : BackendConnector::backends())
+	{
+		if((api->iCaps & XMRSTAK_CAP_STATS) == 0)
+			continue;
+		vDevStats.resize(api->get_stats(nullptr, 0));
+		vDevStats.resize(std::min(vDevStats.size(), api->get_stats(vDevStats.data(), vDevStats.size())));
+		for(const xmrstak_device_stats& dev : vDevStats)
+			metrics::sample(out, "bittube_device_running", metrics::label("backend", api->sName) + "," + metrics::label("device", std::to_string(dev.iIndex)),
+				uint64_t(dev.iState == XMRSTAK_DEV_RUNNING ? 1 : 0));
 	}
 
-	httpReady.set_value();
+	size_t iTotalRes = 0;
+	for(size_t i = 1; i < vMineResults.size(); i++)
+		iTotalRes += vMineResults[i].count;
+
+	metrics::family(out, "bittube_shares_accepted", "counter", "Shares accepted by the pools.");
+	metrics::sample(out, "bittube_shares_accepted_total", "", uint64_t(vMineResults[0].count));
+	metrics::family(out, "bittube_shares_rejected", "counter", "Shares rejected by the pools or lost to network errors.");
+	metrics::sample(out, "bittube_shares_rejected_total", "", uint64_t(iTotalRes));
+	metrics::family(out, "bittube_shares_stale", "counter", "Shares dropped locally because their job was superseded.");
+	metrics::sample(out, "bittube_shares_stale_total", "", uint64_t(iStaleAvoided));
+
+	metrics::family(out, "bittube_pool_difficulty", "gauge", "Current difficulty of the active user pool.");
+	metrics::sample(out, "bittube_pool_difficulty", "", uint64_t(iPoolDiff));
+	metrics::family(out, "bittube_local_difficulty", "gauge", "Local share difficulty floor, 0 if shares are filtered at the pool difficulty.");
+	metrics::sample(out, "bittube_local_difficulty", "", uint64_t(iLocalDiff));
+
+	metrics::family(out, "bittube_pool_up", "gauge", "1 if the pool is connected and logged in.");
+	for(jpsock& pool : pools)
+	{
+		if(pool.is_dev_pool())
+			continue;
+		metrics::sample(out, "bittube_pool_up", metrics::label("pool", pool.get_pool_addr()),
+			uint64_t(pool.is_running() && pool.is_logged_in() ? 1 : 0));
+	}
+
+	metrics::family(out, "bittube_pool_active", "gauge", "1 for the pool the miners are working for.");
+	for(jpsock& pool : pools)
+	{
+		if(pool.is_dev_pool())
+			continue;
+		metrics::sample(out, "bittube_pool_active", metrics::label("pool", pool.get_pool_addr()),
+			uint64_t(pool.get_pool_id() == current_pool_id ? 1 : 0));
+	}
+
+	metrics::family(out, "bittube_pool_health", "gauge", "Measured pool health used for pool selection, 0 to 1.");
+	for(jpsock& pool : pools)
+	{
+		if(pool.is_dev_pool())
+			continue;
+		metrics::sample(out, "bittube_pool_health", metrics::label("pool", pool.get_pool_addr()), pool.get_pool_health());
+	}
+
+	metrics::family(out, "bittube_pool_shares", "counter", "Shares per pool and outcome.");
+	for(jpsock& pool : pools)
+	{
+		if(pool.is_dev_pool())
+			continue;
+		std::string lbl = metrics::label("pool", pool.get_pool_addr()) + ",";
+		metrics::sample(out, "bittube_pool_shares_total", lbl + metrics::label("result", "accepted"), uint64_t(pool.get_accepted_cnt()));
+		metrics::sample(out, "bittube_pool_shares_total", lbl + metrics::label("result", "rejected"), uint64_t(pool.get_rejected_cnt()));
+		metrics::sample(out, "bittube_pool_shares_total", lbl + metrics::label("result", "stale"), uint64_t(pool.get_stale_cnt()));
+	}
+
+	metrics::family(out, "bittube_pool_rtt_seconds", "histogram", "Round trip time of pool login and submit calls.");
+	for(jpsock& pool : pools)
+	{
+		if(pool.is_dev_pool())
+			continue;
+		pool.get_call_hist().render(out, "bittube_pool_rtt_seconds", metrics::label("pool", pool.get_pool_addr()));
+	}
+
+	metrics::family(out, "bittube_job_switch_latency_seconds", "histogram", "Time from a job arriving from the pool until it is handed to the miners.");
+	oJobSwitchHist.render(out, "bittube_job_switch_latency_seconds", "");
+
+	metrics::family(out, "bittube_event_queue_depth", "gauge", "Events waiting for the executor thread.");
+	metrics::sample(out, "bittube_event_queue_depth", "", uint64_t(oEventQ.size()));
+
+	out.append("# EOF\n");
+}
+
+void executor::publish_metrics()
+{
+	std::shared_ptr<std::string> snap = std::make_shared<std::string>();
+	metrics_report(*snap);
+	std::atomic_store(&pMetrics, std::shared_ptr<const std::string>(std::move(snap)));
+}
+
+// FNV-1a, only used to tell report versions apart
+static std::string make_etag(const std::string& body)
+{
+	uint64_t hash = 0xcbf29ce484222325ull;
+	for(unsigned char c : body)
+	{
+		hash ^= c;
+		hash *= 0x100000001b3ull;
+	}
+
+	char buf[24];
+	snprintf(buf, sizeof(buf), "\"%016llx\"", (unsigned long long)hash);
+	return buf;
 }
 
-void executor::get_http_report(ex_event_name ev_id, std::string& data)
+void executor::publish_http_reports()
 {
-	std::lock_guard<std::mutex> lck(httpMutex);
+	std::shared_ptr<http_snapshot> snap = std::make_shared<http_snapshot>();
+
+	http_hashrate_report((*snap)[EV_HTML_HASHRATE - EV_HTML_HASHRATE].sBody);
+	http_result_report((*snap)[EV_HTML_RESULTS - EV_HTML_HASHRATE].sBody);
+	http_connection_report((*snap)[EV_HTML_CONNSTAT - EV_HTML_HASHRATE].sBody);
+	http_json_report((*snap)[EV_HTML_JSON - EV_HTML_HASHRATE].sBody);
 
-	assert(pHttpString == nullptr);
+	for(http_page& page : *snap)
+		page.sEtag = make_etag(page.sBody);
+
+	std::atomic_store(&pHttpReports, std::shared_ptr<const http_snapshot>(std::move(snap)));
+}
+
+bool executor::get_http_report(ex_event_name ev_id, std::string& data, std::string& etag)
+{
 	assert(ev_id == EV_HTML_HASHRATE || ev_id == EV_HTML_RESULTS
 		|| ev_id == EV_HTML_CONNSTAT || ev_id == EV_HTML_JSON);
 
-	pHttpString = &data;
-	httpReady = std::promise<void>();
-	std::future<void> ready = httpReady.get_future();
-
-	push_event(ex_event(ev_id));
+	bHttpPolled.store(true, std::memory_order_relaxed);
+	std::shared_ptr<const http_snapshot> snap = std::atomic_load(&pHttpReports);
+	if(!snap)
+		return false;
 
-	ready.wait();
-	pHttpString = nullptr;
+	const http_page& page = (*snap)[ev_id - EV_HTML_HASHRATE];
+	data = page.sBody;
+	etag = page.sEtag;
+	return true;
 }
@@ -2,16 +2,21 @@
 
 #include "thdq.hpp"
 #include "telemetry.hpp"
+#include "watchdog.hpp"
 #include "xmrstak/backend/iBackend.hpp"
+#include "xmrstak/jconf.hpp"
 #include "xmrstak/misc/environment.hpp"
+#include "xmrstak/misc/metrics.hpp"
 #include "xmrstak/net/msgstruct.hpp"
 #include "xmrstak/donate-level.hpp"
 
 #include <atomic>
 #include <array>
+#include <mutex>
+#include <condition_variable>
 #include <list>
 #include <vector>
-#include <future>
+#include <memory>
 #include <chrono>
 
 class jpsock;
@@ -36,24 +41,37 @@ public:
 		return env.pExecutor;
 	};
 	
-	static inline void cls()
+	// Returns false if the executor thread is still busy and the instance must not be freed
+	static inline bool cls()
 	{
 		auto& env = xmrstak::environment::inst();
 		if (env.pExecutor != nullptr) {
-			env.pExecutor->static_delete();
+			return env.pExecutor->static_delete();
 		}
+		return true;
 	};
 
-	void static_delete();
+	bool static_delete();
 
 	bool isPause = true;
 	bool needRestart = false;
 
-	void ex_start(bool daemon) { daemon ? ex_main() : std::thread(&executor::ex_main, this).detach(); }
+	void ex_start(bool daemon)
+	{
+		bMainRunning = true;
+		daemon ? ex_main() : std::thread(&executor::ex_main, this).detach();
+	}
+
+	// Copy of the last published web report and its ETag, safe to call from any thread.
+	// Returns false if the executor has not published any reports yet.
+	bool get_http_report(ex_event_name ev_id, std::string& data, std::string& etag);
 
-	void get_http_report(ex_event_name ev_id, std::string& data);
+	// Latest OpenMetrics snapshot, safe to call from any thread, may be empty before the first tick
+	inline std::shared_ptr<const std::string> get_metrics_report() { return std::atomic_load(&pMetrics); }
 
 	inline void push_event(ex_event&& ev) { oEventQ.push(std::move(ev)); }
+	// Takes the oldest queued event, only for callers that do not run ex_main (tests)
+	inline bool try_pop_event(ex_event& ev) { return oEventQ.try_pop(ev); }
 	void push_timed_event(ex_event&& ev, size_t sec);
 
 private:
@@ -70,6 +88,9 @@ private:
 	// In milliseconds, has to divide a second (1000ms) into an integer number
 	constexpr static size_t iTickTime = 500;
 
+	// In milliseconds, how long a shutdown waits for the miner threads and the event loop
+	constexpr static size_t iShutdownTimeout = 5000;
+
 	// Dev donation time period in seconds. 100 minutes by default.
 	// We will divide up this period according to the config setting
 	constexpr static size_t iDevDonatePeriod = 100 * 60;
@@ -90,11 +111,13 @@ private:
 	std::mutex timed_event_mutex;
 	thdq<ex_event> oEventQ;
 
-	xmrstak::telemetry* telem;
-	std::vector<xmrstak::iBackend*>* pvThreads;
+	xmrstak::telemetry* telem = nullptr;
+	xmrstak::watchdog* wdog = nullptr;
+	std::vector<xmrstak::iBackend*>* pvThreads = nullptr;
 
 	size_t current_pool_id = invalid_pool_id;
 	size_t last_usr_pool_id = invalid_pool_id;
+	size_t pinned_pool_id = invalid_pool_id;
 	size_t dev_timestamp;
 
 	std::list<jpsock> pools;
@@ -104,9 +127,18 @@ private:
 	executor();
 
 	void ex_main();
+	void flush_results();
 
 	void ex_clock_thd();
 
+	// Set while ex_main runs, static_delete waits on it before tearing down the pools
+	std::mutex main_mutex;
+	std::condition_variable main_cond;
+	bool bMainRunning = false;
+	uint64_t iShutdownDeadline = 0;
+	// Set by flush_results, submits must not wait past it. Only used on the executor thread.
+	uint64_t iSubmitDeadline = 0;
+
 	constexpr static size_t motd_max_length = 512;
 	bool motd_filter_console(std::string& motd);
 	bool motd_filter_web(std::string& motd);
@@ -120,12 +152,28 @@ private:
 	void http_connection_report(std::string& out);
 	void http_json_report(std::string& out);
 
-	void http_report(ex_event_name ev);
 	void print_report(ex_event_name ev);
 
-	std::string* pHttpString = nullptr;
-	std::promise<void> httpReady;
-	std::mutex httpMutex;
+	void metrics_report(std::string& out);
+	void publish_metrics();
+
+	// Rebuilt on the executor thread once a second and swapped in whole,
+	// so scrapes never wait for the event loop
+	std::shared_ptr<const std::string> pMetrics;
+	// Time from a job arriving on the socket until the miners have it
+	xmrstak::ms_histogram<8> oJobSwitchHist {1, 2, 5, 10, 25, 50, 100, 250};
+
+	struct http_page
+	{
+		std::string sBody;
+		std::string sEtag;
+	};
+	// Indexed by ev - EV_HTML_HASHRATE, rendered once a second while the pages are polled and swapped in whole
+	typedef std::array<http_page, 4> http_snapshot;
+	std::shared_ptr<const http_snapshot> pHttpReports;
+	// Set by the HTTP thread, the first request after a quiet spell gets the last snapshot
+	std::atomic<bool> bHttpPolled{false};
+	void publish_http_reports();
 
 	struct sck_error_log
 	{
@@ -180,30 +228,82 @@ private:
 	size_t iPoolHashes = 0;
 	uint64_t iPoolDiff = 0;
 
+	// Local difficulty floor over the pool difficulty, zero while not needed, see adjust_local_diff
+	uint64_t iLocalDiff = 0;
+	size_t iShareWindowStart = 0;
+	size_t iShareWindowCount = 0;
+	void adjust_local_diff();
+
+	// Difficulty the miners were given for the current and the previous job, a result is
+	// credited with the one of its job
+	uint64_t iJobDiff = 0;
+	uint64_t iJobDiffNo = 0;
+	uint64_t iPrevJobDiff = 0;
+
 	// Set it to 16 bit so that we can just let it grow
 	// Maximum realistic growth rate - 5MB / month
 	std::vector<uint16_t> iPoolCallTimes;
+	// Results sent to the pool, a batch of them is only one entry in iPoolCallTimes
+	size_t iPoolSubmits = 0;
 
 	//Those stats are reset if we disconnect
 	inline void reset_stats()
 	{
 		iPoolCallTimes.clear();
+		iPoolSubmits = 0;
 		tPoolConnTime = std::chrono::system_clock::now();
 		iPoolHashes = 0;
 	}
 
 	double fHighestHps = 0.0;
 
+	// Results found on jobs before the last new block of their pool are stale and are
+	// dropped instead of submitted, see globalStates::get_clean_job
+	size_t iStaleAvoided = 0;
+
+	// First announcement of the last few blocks by any pool
+	struct block_notify
+	{
+		uint8_t bHash[32];
+		size_t iTime;
+	};
+	std::array<block_notify, 4> vBlockNotify { { } };
+	size_t iBlockNotifyPos = 0;
+
 	void log_socket_error(jpsock* pool, std::string&& sError);
 	void log_result_error(std::string&& sError);
-	void log_result_ok(uint64_t iActualDiff);
+	void log_result_ok(uint64_t iActualDiff, uint64_t iJobNo);
 
 	void on_sock_ready(size_t pool_id);
 	void on_sock_error(size_t pool_id, std::string&& sError, bool silent);
 	void on_pool_have_job(size_t pool_id, pool_job& oPoolJob);
 	void on_miner_result(size_t pool_id, job_result& oResult);
+	void on_miner_results(size_t pool_id, result_batch& oBatch);
+	void submit_results(size_t pool_id, job_result* pResults, size_t iCount);
 	bool get_live_pools(std::vector<jpsock*>& eval_pools, bool is_dev);
 	void eval_pool_choice();
+	bool switch_to_pool(jpsock* goal);
+	void failover_pool();
+	void update_pinned_pool();
+	void on_config_reload();
+	void reload_pools();
+	void reload_cpu_threads();
+	void check_watchdog();
+	// When the miners last had no work or were paused, see check_watchdog
+	uint64_t iWatchdogIdleEnd = 0;
+	void watchdog_action(size_t thd_id, ::jconf::watchdog_cfg action);
+	void retire_thread(xmrstak::iBackend* thd);
+
+	// CPU threads replaced at runtime, a helper thread joins and frees each of them
+	struct retire_state
+	{
+		std::mutex mtx;
+		std::condition_variable cond;
+		size_t left = 0;
+	};
+	std::shared_ptr<retire_state> pRetired = std::make_shared<retire_state>();
+	double get_pool_score(jpsock* pool, bool gross_weight);
+	void log_block_notify(jpsock* pool, const uint8_t* prev_hash);
 
 	inline size_t sec_to_ticks(size_t sec) { return sec * (1000 / iTickTime); }
 };
@@ -0,0 +1,122 @@
+#pragma once
+
+#include <array>
+#include <string>
+#include <cmath>
+#include <cstdio>
+#include <cstdint>
+#include <initializer_list>
+
+namespace xmrstak
+{
+
+/* Millisecond latency histogram with fixed bucket bounds, rendered in the
+ * OpenMetrics text format (cumulative buckets, le in seconds).
+ * Not thread safe, each histogram has a single writer.
+ */
+template<size_t N>
+struct ms_histogram
+{
+	ms_histogram(std::initializer_list<size_t> bounds)
+	{
+		size_t i = 0;
+		for(size_t b : bounds)
+		{
+			if(i < N)
+				iBound[i++] = b;
+		}
+	}
+
+	void add(size_t ms)
+	{
+		size_t i = 0;
+		while(i < N && ms > iBound[i])
+			i++;
+		iCount[i]++;
+		iSumMs += ms;
+	}
+
+	void render(std::string& out, const char* name, const std::string& labels) const
+	{
+		char buf[64];
+		uint64_t cumulative = 0;
+		std::string sep = labels.empty() ? "" : ",";
+
+		for(size_t i = 0; i <= N; i++)
+		{
+			cumulative += iCount[i];
+			if(i < N)
+				snprintf(buf, sizeof(buf), "%g", double(iBound[i]) / 1000.0);
+			else
+				snprintf(buf, sizeof(buf), "+Inf");
+
+			out.append(name).append("_bucket{").append(labels).append(sep);
+			out.append("le=\"").append(buf).append("\"} ").append(std::to_string(cumulative)).append(1, '\n');
+		}
+
+		out.append(name).append("_count");
+		if(!labels.empty())
+			out.append(1, '{').append(labels).append(1, '}');
+		out.append(1, ' ').append(std::to_string(cumulative)).append(1, '\n');
+
+		snprintf(buf, sizeof(buf), "%.3f", double(iSumMs) / 1000.0);
+		out.append(name).append("_sum");
+		if(!labels.empty())
+			out.append(1, '{').append(labels).append(1, '}');
+		out.append(1, ' ').append(buf).append(1, '\n');
+	}
+
+	std::array<size_t, N> iBound {{ }};
+	std::array<uint64_t, N + 1> iCount {{ }}; // Last one is +Inf
+	uint64_t iSumMs = 0;
+};
+
+namespace metrics
+{
+	inline void family(std::string& out, const char* name, const char* type, const char* help)
+	{
+		out.append("# TYPE ").append(name).append(1, ' ').append(type).append(1, '\n');
+		out.append("# HELP ").append(name).append(1, ' ').append(help).append(1, '\n');
+	}
+
+	inline std::string label(const char* key, const std::string& value)
+	{
+		std::string ret(key);
+		ret.append("=\"");
+		for(char c : value)
+		{
+			if(c == '\\' || c == '"')
+				ret.append(1, '\\').append(1, c);
+			else if(c == '\n')
+				ret.append("\\n");
+			else
+				ret.append(1, c);
+		}
+		ret.append(1, '"');
+		return ret;
+	}
+
+	inline void sample(std::string& out, const char* name, const std::string& labels, double value)
+	{
+		char buf[64];
+		if(std::isnan(value))
+			snprintf(buf, sizeof(buf), "NaN");
+		else
+			snprintf(buf, sizeof(buf), "%.10g", value);
+
+		out.append(name);
+		if(!labels.empty())
+			out.append(1, '{').append(labels).append(1, '}');
+		out.append(1, ' ').append(buf).append(1, '\n');
+	}
+
+	inline void sample(std::string& out, const char* name, const std::string& labels, uint64_t value)
+	{
+		out.append(name);
+		if(!labels.empty())
+			out.append(1, '{').append(labels).append(1, '}');
+		out.append(1, ' ').append(std::to_string(value)).append(1, '\n');
+	}
+} // namespace metrics
+
+} // namespace xmrstak
@@ -31,66 +31,83 @@
 namespace xmrstak
 {
 
-telemetry::telemetry(size_t iThd)
+telemetry::telemetry(size_t iThd) : vThdData(iThd)
 {
-	ppHashCounts = new uint64_t*[iThd];
-	ppTimestamps = new uint64_t*[iThd];
-	iBucketTop = new uint32_t[iThd];
+	for (thd_data& thd : vThdData)
+		thd.vSamples.resize(iBucketSize, perf_sample{0, 0});
+}
 
-	for (size_t i = 0; i < iThd; i++)
-	{
-		ppHashCounts[i] = new uint64_t[iBucketSize];
-		ppTimestamps[i] = new uint64_t[iBucketSize];
-		iBucketTop[i] = 0;
-		memset(ppHashCounts[i], 0, sizeof(uint64_t) * iBucketSize);
-		memset(ppTimestamps[i], 0, sizeof(uint64_t) * iBucketSize);
-	}
+void telemetry::set_thread_count(size_t iThd)
+{
+	size_t iOld = vThdData.size();
+	vThdData.resize(iThd);
+	for (size_t i = iOld; i < iThd; i++)
+		vThdData[i].vSamples.resize(iBucketSize, perf_sample{0, 0});
 }
 
-double telemetry::calc_telemetry_data(size_t iLastMillisec, size_t iThread)
+void telemetry::reset_thread(size_t iThd)
 {
-	uint64_t iTimeNow = get_timestamp_ms();
+	vThdData[iThd] = thd_data();
+	vThdData[iThd].vSamples.resize(iBucketSize, perf_sample{0, 0});
+}
 
-	uint64_t iEarliestHashCnt = 0;
-	uint64_t iEarliestStamp = 0;
-	uint64_t iLatestStamp = 0;
-	uint64_t iLatestHashCnt = 0;
-	bool bHaveFullSet = false;
+/*
+ * Each window keeps a cursor on its oldest sample. Cursors only move forward, so a
+ * report costs O(1) per thread and window instead of a walk through the whole bucket.
+ */
+double telemetry::calc_telemetry_data(size_t iLastMillisec, size_t iThread)
+{
+	thd_data& thd = vThdData[iThread];
+	if (thd.iHead == 0)
+		return nan("");
 
-	//Start at 1, buckettop points to next empty
-	for (size_t i = 1; i < iBucketSize; i++)
+	window_cursor* cur = nullptr;
+	for (window_cursor& wnd : thd.vWindows)
 	{
-		size_t idx = (iBucketTop[iThread] - i) & iBucketMask; //overflow expected here
-
-		if (ppTimestamps[iThread][idx] == 0)
-			break; //That means we don't have the data yet
-
-		if (iLatestStamp == 0)
+		if (wnd.iLastMillisec == iLastMillisec)
 		{
-			iLatestStamp = ppTimestamps[iThread][idx];
-			iLatestHashCnt = ppHashCounts[iThread][idx];
+			cur = &wnd;
+			break;
 		}
+	}
 
-		if (iTimeNow - ppTimestamps[iThread][idx] > iLastMillisec)
-		{
-			bHaveFullSet = true;
-			break; //We are out of the requested time period
-		}
+	if (cur == nullptr)
+	{
+		thd.vWindows.push_back(window_cursor{iLastMillisec, 0});
+		cur = &thd.vWindows.back();
+	}
+
+	uint64_t iOldest = thd.iHead > iBucketSize ? thd.iHead - iBucketSize : 0;
+	if (cur->iTail < iOldest)
+		cur->iTail = iOldest;
 
-		iEarliestStamp = ppTimestamps[iThread][idx];
-		iEarliestHashCnt = ppHashCounts[iThread][idx];
+	uint64_t iTimeNow = get_timestamp_ms();
+	while (cur->iTail < thd.iHead)
+	{
+		const perf_sample& smp = thd.vSamples[cur->iTail & iBucketMask];
+		if (smp.iTimestamp != 0 && iTimeNow - smp.iTimestamp <= iLastMillisec)
+			break;
+		cur->iTail++;
 	}
 
-	if (!bHaveFullSet || iEarliestStamp == 0 || iLatestStamp == 0)
+	//We need a sample from before the window, otherwise we don't have the data yet
+	if (cur->iTail == thd.iHead || cur->iTail == iOldest)
+		return nan("");
+
+	const perf_sample& before = thd.vSamples[(cur->iTail - 1) & iBucketMask];
+	const perf_sample& earliest = thd.vSamples[cur->iTail & iBucketMask];
+	const perf_sample& latest = thd.vSamples[(thd.iHead - 1) & iBucketMask];
+
+	if (before.iTimestamp == 0)
 		return nan("");
 
 	//Don't think that can happen, but just in case
-	if (iLatestStamp - iEarliestStamp == 0)
+	if (latest.iTimestamp - earliest.iTimestamp == 0)
 		return nan("");
 
 	double fHashes, fTime;
-	fHashes = static_cast<double>(iLatestHashCnt - iEarliestHashCnt);
-	fTime = static_cast<double>(iLatestStamp - iEarliestStamp);
+	fHashes = static_cast<double>(latest.iHashCount - earliest.iHashCount);
+	fTime = static_cast<double>(latest.iTimestamp - earliest.iTimestamp);
 	fTime /= 1000.0;
 
 	return fHashes / fTime;
@@ -98,11 +115,9 @@ double telemetry::calc_telemetry_data(size_t iLastMillisec, size_t iThread)
 
 void telemetry::push_perf_value(size_t iThd, uint64_t iHashCount, uint64_t iTimestamp)
 {
-	size_t iTop = iBucketTop[iThd];
-	ppHashCounts[iThd][iTop] = iHashCount;
-	ppTimestamps[iThd][iTop] = iTimestamp;
-
-	iBucketTop[iThd] = (iTop + 1) & iBucketMask;
+	thd_data& thd = vThdData[iThd];
+	thd.vSamples[thd.iHead & iBucketMask] = perf_sample{iHashCount, iTimestamp};
+	thd.iHead++;
 }
 
 } // namespace xmrstak
@@ -2,6 +2,7 @@
 
 #include <cstdint>
 #include <cstring>
+#include <vector>
 
 namespace xmrstak
 {
@@ -13,12 +14,35 @@ public:
 	void push_perf_value(size_t iThd, uint64_t iHashCount, uint64_t iTimestamp);
 	double calc_telemetry_data(size_t iLastMillisec, size_t iThread);
 
+	// Used when a config reload starts, stops or restarts mining threads
+	void set_thread_count(size_t iThd);
+	void reset_thread(size_t iThd);
+
 private:
 	constexpr static size_t iBucketSize = 2 << 11; //Power of 2 to simplify calculations
 	constexpr static size_t iBucketMask = iBucketSize - 1;
-	uint32_t* iBucketTop;
-	uint64_t** ppHashCounts;
-	uint64_t** ppTimestamps;
+
+	struct perf_sample
+	{
+		uint64_t iHashCount;
+		uint64_t iTimestamp;
+	};
+
+	// Oldest sample inside a time window, only moves forward
+	struct window_cursor
+	{
+		size_t iLastMillisec;
+		uint64_t iTail;
+	};
+
+	struct thd_data
+	{
+		std::vector<perf_sample> vSamples;
+		std::vector<window_cursor> vWindows;
+		uint64_t iHead = 0; // Number of samples pushed so far
+	};
+
+	std::vector<thd_data> vThdData;
 };
 
 } // namespace xmrstak
@@ -27,6 +27,16 @@ public:
 		queue_.pop();
 	}
 
+	bool try_pop(T& item)
+	{
+		std::unique_lock<std::mutex> mlock(mutex_);
+		if (queue_.empty())
+			return false;
+		item = std::move(queue_.front());
+		queue_.pop();
+		return true;
+	}
+
 	void push(const T& item)
 	{
 		std::unique_lock<std::mutex> mlock(mutex_);
@@ -48,6 +58,12 @@ public:
 		}
 	}
 
+	size_t size()
+	{
+		std::unique_lock<std::mutex> mlock(mutex_);
+		return queue_.size();
+	}
+
 private:
 	std::queue<T> queue_;
 	std::mutex mutex_;
@@ -0,0 +1,106 @@
+/*
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  * GNU General Public License for more details.
+  *
+  * You should have received a copy of the GNU General Public License
+  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+  *
+  * Additional permission under GNU GPL version 3 section 7
+  *
+  * If you modify this Program, or any covered work, by linking or combining
+  * it with OpenSSL (or a modified version of that library), containing parts
+  * covered by the terms of OpenSSL License and SSLeay License, the licensors
+  * of this Program grant you additional permission to convey the resulting work.
+  *
+  */
+
+#include "watchdog.hpp"
+
+#include <cmath>
+
+namespace xmrstak
+{
+
+constexpr size_t watchdog::iWarmup;
+constexpr double watchdog::fAlpha;
+
+watchdog::watchdog(size_t iThd) : vThdData(iThd)
+{
+}
+
+void watchdog::set_thread_count(size_t iThd)
+{
+	vThdData.resize(iThd);
+}
+
+void watchdog::reset_thread(size_t iThd)
+{
+	vThdData[iThd] = thd_data();
+}
+
+void watchdog::clear_low()
+{
+	for(thd_data& thd : vThdData)
+		thd.iLowSince = 0;
+}
+
+size_t watchdog::low_count() const
+{
+	size_t iLow = 0;
+	for(const thd_data& thd : vThdData)
+	{
+		if(thd.iLowSince != 0)
+			iLow++;
+	}
+	return iLow;
+}
+
+bool watchdog::update(size_t iThd, double fHps, uint64_t iNowMs, double fDrop, uint64_t iHoldMs)
+{
+	thd_data& thd = vThdData[iThd];
+
+	// No rate yet (startup, restarted thread) only counts once we know what is normal,
+	// after that it means the thread stopped reporting hashes
+	if(!std::isnormal(fHps))
+	{
+		if(thd.iSamples < iWarmup)
+			return false;
+		fHps = 0.0;
+	}
+
+	if(thd.iSamples < iWarmup)
+	{
+		thd.iSamples++;
+		thd.fBaseline += (fHps - thd.fBaseline) / thd.iSamples;
+		return false;
+	}
+
+	if(fHps >= thd.fBaseline * fDrop)
+	{
+		// Low samples stay out of the baseline, otherwise a slow drop would drag it down with it
+		thd.fBaseline += (fHps - thd.fBaseline) * fAlpha;
+		thd.iLowSince = 0;
+		return false;
+	}
+
+	if(thd.iLowSince == 0)
+	{
+		thd.iLowSince = iNowMs;
+		return false;
+	}
+
+	if(iNowMs - thd.iLowSince < iHoldMs)
+		return false;
+
+	thd.iLowSince = iNowMs;
+	return true;
+}
+
+} // namespace xmrstak
@@ -0,0 +1,73 @@
+/*
+  * This program is free software: you can redistribute it and/or modify
+  * it under the terms of the GNU General Public License as published by
+  * the Free Software Foundation, either version 3 of the License, or
+  * any later version.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+  * GNU General Public License for more details.
+  *
+  * You should have received a copy of the GNU General Public License
+  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+  *
+  * Additional permission under GNU GPL version 3 section 7
+  *
+  * If you modify this Program, or any covered work, by linking or combining
+  * it with OpenSSL (or a modified version of that library), containing parts
+  * covered by the terms of OpenSSL License and SSLeay License, the licensors
+  * of this Program grant you additional permission to convey the resulting work.
+  *
+  */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace xmrstak
+{
+
+/* Finds threads that run well below their own normal hashrate for some time.
+ * Fed with one hashrate per thread and second by the executor thread, not thread safe.
+ */
+class watchdog
+{
+public:
+	watchdog(size_t iThd);
+
+	// Returns true when the thread has been below fDrop times its baseline for iHoldMs.
+	// After that it stays quiet for another iHoldMs even if the thread does not recover.
+	bool update(size_t iThd, double fHps, uint64_t iNowMs, double fDrop, uint64_t iHoldMs);
+
+	inline double get_baseline(size_t iThd) const { return vThdData[iThd].fBaseline; }
+
+	// Used when the thread count changes or a thread was restarted or reconfigured,
+	// the baseline is learned again from scratch
+	void set_thread_count(size_t iThd);
+	void reset_thread(size_t iThd);
+
+	// Ends all running low periods, e.g. when work resumes after the miners had none
+	void clear_low();
+	// Threads that are in a low period right now
+	size_t low_count() const;
+
+private:
+	// Samples averaged before the baseline is trusted
+	constexpr static size_t iWarmup = 30;
+	// Weight of a new sample once warm, about five minutes of memory at one sample a second
+	constexpr static double fAlpha = 1.0 / 300.0;
+
+	struct thd_data
+	{
+		double fBaseline = 0.0;
+		size_t iSamples = 0;
+		uint64_t iLowSince = 0; // Zero while the thread is within its baseline
+	};
+
+	std::vector<thd_data> vThdData;
+};
+
+} // namespace xmrstak
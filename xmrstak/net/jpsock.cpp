@@ -78,6 +78,13 @@ struct jpsock::opaque_private
 	MemDocument jsonDoc;
 	call_rsp oCallRsp;
 
+	// Submit batch in flight, replies with ids from iBatchFirstId on go here. Id 1 is
+	// left to the single calls (login).
+	std::vector<submit_rsp>* pBatchRsp = nullptr;
+	uint64_t iBatchFirstId = 0;
+	size_t iBatchLeft = 0;
+	uint64_t iNextCallId = 2;
+
 	opaque_private(uint8_t* bCallMem, uint8_t* bRecvMem, uint8_t* bParseMem) :
 		callAllocator(bCallMem, jpsock::iJsonMemSize),
 		recvAllocator(bRecvMem, jpsock::iJsonMemSize),
@@ -95,8 +102,9 @@ struct jpsock::opq_json_val
 };
 
 jpsock::jpsock(size_t id, const char* sAddr, const char* sLogin, const char* sRigId, const char* sPassword, double pool_weight, bool dev_pool, bool tls, const char* tls_fp, bool nicehash) :
-	net_addr(sAddr), usr_login(sLogin), usr_rigid(sRigId), usr_pass(sPassword), tls_fp(tls_fp), pool_id(id), pool_weight(pool_weight), pool(dev_pool), nicehash(nicehash),
-	connect_time(0), connect_attempts(0), disconnect_time(0), quiet_close(false)
+	net_addr(sAddr), usr_login(sLogin), usr_rigid(sRigId), usr_pass(sPassword), tls_fp(tls_fp), pool_id(id), pool_weight(pool_weight), pool(dev_pool), nicehash(nicehash), tls(tls),
+	connect_time(0), connect_attempts(0), disconnect_time(0), quiet_close(false), iConnectMs(0),
+	iTlsHandshakes(0), iTlsResumed(0), iTlsHandshakeMs(0)
 {
 	sock_init();
 
@@ -125,6 +133,8 @@ jpsock::jpsock(size_t id, const char* sAddr, const char* sLogin, const char* sRi
 
 jpsock::~jpsock()
 {
+	delete sck;
+	sck = nullptr;
 	delete prv;
 	prv = nullptr;
 
@@ -199,7 +209,7 @@ void jpsock::jpsock_thread()
 	executor::inst()->push_event(ex_event(std::move(sSocketError), quiet_close, pool_id));
 
 	std::unique_lock<std::mutex> mlock(call_mutex);
-	bool bWait = prv->oCallRsp.pCallData != nullptr;
+	bool bWait = prv->oCallRsp.pCallData != nullptr || prv->pBatchRsp != nullptr;
 
 	// If a call is waiting, wait a little bit before blowing it out of the water
 	if(bWait)
@@ -219,6 +229,11 @@ void jpsock::jpsock_thread()
 		prv->oCallRsp.iMessageId = 0;
 		bCallWaiting = true;
 	}
+	if(prv->pBatchRsp != nullptr)
+	{
+		prv->pBatchRsp = nullptr;
+		bCallWaiting = true;
+	}
 	mlock.unlock();
 
 	if(bCallWaiting)
@@ -238,8 +253,10 @@ void jpsock::jpsock_thread()
 
 bool jpsock::jpsock_thd_main()
 {
+	size_t t_start = get_timestamp_ms();
 	if(!sck->connect())
 		return false;
+	iConnectMs = get_timestamp_ms() - t_start;
 
 	executor::inst()->push_event(ex_event(EV_SOCK_READY, pool_id));
 
@@ -383,6 +400,22 @@ bool jpsock::process_line(char* line, size_t len)
 		}
 
 		std::unique_lock<std::mutex> mlock(call_mutex);
+		if (prv->pBatchRsp != nullptr && iCallId >= prv->iBatchFirstId && iCallId - prv->iBatchFirstId < prv->pBatchRsp->size())
+		{
+			submit_rsp& rsp = (*prv->pBatchRsp)[iCallId - prv->iBatchFirstId];
+			if(!rsp.bDone)
+			{
+				rsp.bDone = true;
+				rsp.bAccepted = sError == nullptr;
+				if(sError != nullptr)
+					rsp.sError.assign(sError, iErrorLen);
+				prv->iBatchLeft--;
+			}
+			mlock.unlock();
+			call_cond.notify_one();
+			return true;
+		}
+
 		if (prv->oCallRsp.pCallData == nullptr)
 		{
 			/*Server sent us a call reply without us making a call*/
@@ -456,6 +489,7 @@ bool jpsock::process_pool_job(const opq_json_val* params, const uint64_t message
 		return set_socket_error("PARSE error: Job error 3");
 
 	pool_job oPoolJob;
+	oPoolJob.iRecvTime = get_timestamp_ms();
 
 	const uint32_t iWorkLen = blob->GetStringLength() / 2;
 	oPoolJob.iWorkLen = iWorkLen;
@@ -515,6 +549,64 @@ bool jpsock::process_pool_job(const opq_json_val* params, const uint64_t message
 	return true;
 }
 
+// Moving average, the first sample sets it, each later one has 1/8 weight.
+// A zero average is a valid value, e.g. a pool that announces every block first.
+static inline void update_average(double& avg, bool& have_sample, size_t sample)
+{
+	if(!have_sample)
+		avg = double(sample);
+	else
+		avg += (double(sample) - avg) / 8.0;
+	have_sample = true;
+}
+
+void jpsock::log_call_time(size_t call_ms)
+{
+	update_average(fAvgCallMs, bHaveCallMs, call_ms);
+	oCallHist.add(call_ms);
+}
+
+void jpsock::log_notify_lag(size_t lag_ms)
+{
+	update_average(fAvgNotifyLagMs, bHaveNotifyLag, lag_ms);
+}
+
+void jpsock::log_stale()
+{
+	iStaleCnt++;
+}
+
+bool jpsock::is_new_block(const uint8_t* prev_hash)
+{
+	if(memcmp(bBlockHash, prev_hash, sizeof(bBlockHash)) == 0)
+		return false;
+	memcpy(bBlockHash, prev_hash, sizeof(bBlockHash));
+	return true;
+}
+
+void jpsock::log_result(bool accepted)
+{
+	if(accepted)
+		iAcceptedCnt++;
+	else
+		iRejectedCnt++;
+}
+
+/*
+ * Health is 1.0 for a perfect pool. Each of call time, connect time and new block
+ * notification lag halves it at one second, and it goes down linearly with the
+ * fraction of rejected or stale results.
+ */
+double jpsock::get_pool_health()
+{
+	double fBad = double(iRejectedCnt + iStaleCnt) / double(iAcceptedCnt + iRejectedCnt + iStaleCnt + 1);
+	double fHealth = 1.0 - fBad;
+	fHealth *= 1000.0 / (1000.0 + fAvgCallMs);
+	fHealth *= 1000.0 / (1000.0 + double(iConnectMs.load()));
+	fHealth *= 1000.0 / (1000.0 + fAvgNotifyLagMs);
+	return fHealth;
+}
+
 bool jpsock::connect(std::string& sConnectError)
 {
 	ext_algo = ext_backend = ext_hashcount = ext_motd = false;
@@ -538,6 +630,28 @@ bool jpsock::connect(std::string& sConnectError)
 	return false;
 }
 
+/*
+ * Applies a reloaded pools.txt entry. The weight is taken over right away, changed
+ * login details drop the connection so that the next connect logs in with them.
+ */
+bool jpsock::update_config(const char* sLogin, const char* sRigId, const char* sPassword, double weight, const char* sTlsFp, bool nicehash_mode)
+{
+	pool_weight = weight;
+
+	if(usr_login == sLogin && usr_rigid == sRigId && usr_pass == sPassword && tls_fp == sTlsFp && nicehash == nicehash_mode)
+		return false;
+
+	// The receive thread reads the login details, it is gone after this
+	disconnect(true);
+
+	usr_login = sLogin;
+	usr_rigid = sRigId;
+	usr_pass = sPassword;
+	tls_fp = sTlsFp;
+	nicehash = nicehash_mode;
+	return true;
+}
+
 void jpsock::disconnect(bool quiet)
 {
 	quiet_close = quiet;
@@ -679,7 +793,7 @@ bool jpsock::cmd_login()
 	return true;
 }
 
-bool jpsock::cmd_submit(const char* sJobId, uint32_t iNonce, const uint8_t* bResult, const char* backend_name, uint64_t backend_hashcount, uint64_t total_hashcount, xmrstak_algo algo)
+void jpsock::format_submit(std::string& out, uint64_t iCallId, const submit_req& req, uint64_t total_hashcount)
 {
 	char cmd_buffer[1024];
 	char sNonce[9];
@@ -690,15 +804,15 @@ bool jpsock::cmd_submit(const char* sJobId, uint32_t iNonce, const uint8_t* bRes
 	char sHashcount[128] = {0};
 
 	if(ext_backend)
-		snprintf(sBackend, sizeof(sBackend), ",\"backend\":\"%s\"", backend_name);
+		snprintf(sBackend, sizeof(sBackend), ",\"backend\":\"%s\"", req.backend_name);
 
 	if(ext_hashcount)
-		snprintf(sHashcount, sizeof(sHashcount), ",\"hashcount\":%llu,\"hashcount_total\":%llu", int_port(backend_hashcount), int_port(total_hashcount));
+		snprintf(sHashcount, sizeof(sHashcount), ",\"hashcount\":%llu,\"hashcount_total\":%llu", int_port(req.backend_hashcount), int_port(total_hashcount));
 
 	if(ext_algo)
 	{
 		const char* algo_name;
-		switch(algo)
+		switch(req.pResult->algorithm)
 		{
 		case cryptonight:
 			algo_name = "cryptonight";
@@ -738,18 +852,68 @@ bool jpsock::cmd_submit(const char* sJobId, uint32_t iNonce, const uint8_t* bRes
 		snprintf(sAlgo, sizeof(sAlgo), ",\"algo\":\"%s\"", algo_name);
 	}
 
-	bin2hex((unsigned char*)&iNonce, 4, sNonce);
+	bin2hex((unsigned char*)&req.pResult->iNonce, 4, sNonce);
 	sNonce[8] = '\0';
 
-	bin2hex(bResult, 32, sResult);
+	bin2hex(req.pResult->bResult, 32, sResult);
 	sResult[64] = '\0';
 
-	snprintf(cmd_buffer, sizeof(cmd_buffer), "{\"method\":\"submit\",\"params\":{\"id\":\"%s\",\"job_id\":\"%s\",\"nonce\":\"%s\",\"result\":\"%s\"%s%s%s},\"id\":1}\n",
-		sMinerId, sJobId, sNonce, sResult, sBackend, sHashcount, sAlgo);
+	snprintf(cmd_buffer, sizeof(cmd_buffer), "{\"method\":\"submit\",\"params\":{\"id\":\"%s\",\"job_id\":\"%s\",\"nonce\":\"%s\",\"result\":\"%s\"%s%s%s},\"id\":%llu}\n",
+		sMinerId, req.pResult->sJobID, sNonce, sResult, sBackend, sHashcount, sAlgo, int_port(iCallId));
+	out.append(cmd_buffer);
+}
 
-	uint64_t messageId = 0;
-	opq_json_val oResult(nullptr);
-	return cmd_ret_wait(cmd_buffer, oResult, messageId);
+bool jpsock::cmd_submit(const std::vector<submit_req>& vReq, uint64_t total_hashcount, std::vector<submit_rsp>& vRsp, uint64_t iTimeoutMs)
+{
+	vRsp.clear();
+	vRsp.resize(vReq.size());
+	if(vReq.empty())
+		return true;
+
+	uint64_t iFirstId = prv->iNextCallId;
+	prv->iNextCallId += vReq.size();
+
+	std::string sPackets;
+	for(size_t i = 0; i < vReq.size(); i++)
+		format_submit(sPackets, iFirstId + i, vReq[i], total_hashcount);
+
+	std::unique_lock<std::mutex> mlock(call_mutex);
+	prv->pBatchRsp = &vRsp;
+	prv->iBatchFirstId = iFirstId;
+	prv->iBatchLeft = vReq.size();
+	mlock.unlock();
+
+	if(!sck->send(sPackets.c_str()))
+	{
+		mlock.lock();
+		prv->pBatchRsp = nullptr;
+		mlock.unlock();
+		disconnect(); //This will join the other thread;
+		return false;
+	}
+
+	if(iTimeoutMs == 0)
+		iTimeoutMs = jconf::inst()->GetCallTimeout() * 1000;
+
+	// The receive thread clears pBatchRsp when the connection goes down
+	mlock.lock();
+	bool bResult = call_cond.wait_for(mlock, std::chrono::milliseconds(iTimeoutMs),
+		[&]() { return prv->pBatchRsp == nullptr || prv->iBatchLeft == 0; });
+	bool bAborted = prv->pBatchRsp == nullptr;
+	prv->pBatchRsp = nullptr;
+	mlock.unlock();
+
+	if(bHaveSocketError || bAborted)
+		return false;
+
+	if(!bResult)
+	{
+		set_socket_error("CALL error: Timeout while waiting for a reply");
+		disconnect();
+		return false;
+	}
+
+	return true;
 }
 
 void jpsock::save_nonce(uint32_t nonce)
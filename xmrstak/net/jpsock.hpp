@@ -3,6 +3,7 @@
 #include "xmrstak/backend/iBackend.hpp"
 #include "msgstruct.hpp"
 #include "xmrstak/jconf.hpp"
+#include "xmrstak/misc/metrics.hpp"
 
 #include <mutex>
 #include <atomic>
@@ -35,7 +36,26 @@ public:
 	void disconnect(bool quiet = false);
 
 	bool cmd_login();
-	bool cmd_submit(const char* sJobId, uint32_t iNonce, const uint8_t* bResult, const char* backend_name, uint64_t backend_hashcount, uint64_t total_hashcount, xmrstak_algo algo);
+
+	struct submit_req
+	{
+		const job_result* pResult;
+		const char* backend_name;
+		uint64_t backend_hashcount;
+	};
+
+	// bDone is false if the connection failed before the pool answered this one
+	struct submit_rsp
+	{
+		bool bDone = false;
+		bool bAccepted = false;
+		std::string sError;
+	};
+
+	// Pipelined: all submits go out in one send, then the replies are matched by call id.
+	// Returns false on a socket error or timeout, vRsp then tells which ones were answered.
+	// iTimeoutMs of 0 waits call_timeout for the replies
+	bool cmd_submit(const std::vector<submit_req>& vReq, uint64_t total_hashcount, std::vector<submit_rsp>& vRsp, uint64_t iTimeoutMs = 0);
 
 	static bool hex2bin(const char* in, unsigned int len, unsigned char* out);
 	static void bin2hex(const unsigned char* in, unsigned int len, char* out);
@@ -59,6 +79,12 @@ public:
 	inline const char* get_pool_addr() { return net_addr.c_str(); }
 	inline const char* get_tls_fp() { return tls_fp.c_str(); }
 	inline bool is_nicehash() { return nicehash; }
+	inline bool is_tls() { return tls; }
+
+	// Pools removed from pools.txt by a config reload stay in the list, but are never connected
+	inline bool is_enabled() { return bEnabled; }
+	inline void set_enabled(bool enabled) { bEnabled = enabled; }
+	bool update_config(const char* sLogin, const char* sRigId, const char* sPassword, double weight, const char* sTlsFp, bool nicehash_mode);
 
 	bool get_pool_motd(std::string& strin);
 
@@ -72,6 +98,25 @@ public:
 
 	inline uint64_t get_current_diff() { return iJobDiff; }
 
+	// Pool health statistics, only used from the executor thread
+	void log_call_time(size_t call_ms);
+	void log_result(bool accepted);
+	void log_stale();
+	void log_notify_lag(size_t lag_ms);
+	bool is_new_block(const uint8_t* prev_hash);
+	double get_pool_health();
+	inline size_t get_avg_call_time() { return size_t(fAvgCallMs); }
+	inline const xmrstak::ms_histogram<9>& get_call_hist() { return oCallHist; }
+	inline size_t get_accepted_cnt() { return iAcceptedCnt; }
+	inline size_t get_rejected_cnt() { return iRejectedCnt; }
+	inline size_t get_stale_cnt() { return iStaleCnt; }
+
+	// TLS handshake statistics, written by the receive thread
+	inline void log_tls_handshake(bool resumed, size_t ms) { iTlsHandshakes++; if(resumed) iTlsResumed++; iTlsHandshakeMs = ms; }
+	inline size_t get_tls_handshakes() { return iTlsHandshakes; }
+	inline size_t get_tls_resumed() { return iTlsResumed; }
+	inline size_t get_tls_handshake_ms() { return iTlsHandshakeMs; }
+
 	void save_nonce(uint32_t nonce);
 	bool get_current_job(pool_job& job);
 
@@ -94,6 +139,8 @@ private:
 	double pool_weight;
 	bool pool;
 	bool nicehash;
+	bool tls;
+	bool bEnabled = true;
 
 	bool ext_algo = false;
 	bool ext_backend = false;
@@ -128,6 +175,7 @@ private:
 	bool process_line(char* line, size_t len);
 	bool process_pool_job(const opq_json_val* params, const uint64_t messageId);
 	bool cmd_ret_wait(const char* sPacket, opq_json_val& poResult, uint64_t& messageId);
+	void format_submit(std::string& out, uint64_t iCallId, const submit_req& req, uint64_t total_hashcount);
 
 	char sMinerId[64];
 	std::atomic<uint64_t> iJobDiff;
@@ -147,5 +195,19 @@ private:
 
 	uint64_t iMessageCnt = 0;
 	uint64_t iLastMessageId = 0;
+
+	double fAvgCallMs = 0.0;
+	double fAvgNotifyLagMs = 0.0;
+	bool bHaveCallMs = false;
+	bool bHaveNotifyLag = false;
+	xmrstak::ms_histogram<9> oCallHist {25, 50, 100, 250, 500, 1000, 2500, 5000, 10000};
+	size_t iAcceptedCnt = 0;
+	size_t iRejectedCnt = 0;
+	size_t iStaleCnt = 0;
+	uint8_t bBlockHash[32] = {};
+	std::atomic<size_t> iConnectMs;
+	std::atomic<size_t> iTlsHandshakes;
+	std::atomic<size_t> iTlsResumed;
+	std::atomic<size_t> iTlsHandshakeMs;
 };
 
@@ -3,6 +3,7 @@
 #include "xmrstak/backend/cryptonight.hpp"
 
 #include <string>
+#include <vector>
 #include <string.h>
 #include <assert.h>
 
@@ -16,10 +17,12 @@ struct pool_job
 	uint64_t	iTarget;
 	uint32_t	iWorkLen;
 	uint32_t	iSavedNonce;
+	// get_timestamp_ms() when the job arrived from the pool
+	uint64_t	iRecvTime;
 
-	pool_job() : iWorkLen(0), iSavedNonce(0) {}
+	pool_job() : iWorkLen(0), iSavedNonce(0), iRecvTime(0) {}
 	pool_job(const char* sJobID, uint64_t iTarget, const uint8_t* bWorkBlob, uint32_t iWorkLen) :
-		iTarget(iTarget), iWorkLen(iWorkLen), iSavedNonce(0)
+		iTarget(iTarget), iWorkLen(iWorkLen), iSavedNonce(0), iRecvTime(0)
 	{
 		assert(iWorkLen <= sizeof(pool_job::bWorkBlob));
 		memcpy(this->sJobID, sJobID, sizeof(pool_job::sJobID));
@@ -34,15 +37,35 @@ struct job_result
 	uint32_t	iNonce;
 	uint32_t	iThreadId;
 	xmrstak_algo algorithm = invalid_algo;
+	// globalStates::iGlobalJobNo of the work this result was found on
+	uint64_t	iJobNo = 0;
 
 	job_result() {}
-	job_result(const char* sJobID, uint32_t iNonce, const uint8_t* bResult, uint32_t iThreadId, xmrstak_algo algo) : iNonce(iNonce), iThreadId(iThreadId), algorithm(algo)
+	job_result(const char* sJobID, uint32_t iNonce, const uint8_t* bResult, uint32_t iThreadId, xmrstak_algo algo, uint64_t iJobNo) :
+		iNonce(iNonce), iThreadId(iThreadId), algorithm(algo), iJobNo(iJobNo)
 	{
 		memcpy(this->sJobID, sJobID, sizeof(job_result::sJobID));
 		memcpy(this->bResult, bResult, sizeof(job_result::bResult));
 	}
 };
 
+// All results of one GPU round or one multiway CPU hash, pushed as a single event
+struct result_batch
+{
+	std::vector<job_result> vResults;
+	// Results that failed the CPU recheck (GPU only), they are only counted
+	size_t iInvalid = 0;
+	size_t iGpuIdx = 0;
+	const char* sInvalidError = nullptr;
+
+	result_batch() {}
+	result_batch(result_batch&& from) = default;
+	result_batch& operator=(result_batch&& from) = default;
+
+	result_batch(result_batch const&) = delete;
+	result_batch& operator=(result_batch const&) = delete;
+};
+
 struct sock_err
 {
 	std::string sSocketError;
@@ -77,7 +100,8 @@ struct gpu_res_err
 enum ex_event_name { EV_INVALID_VAL, EV_SOCK_READY, EV_SOCK_ERROR, EV_GPU_RES_ERROR,
 	EV_POOL_HAVE_JOB, EV_MINER_HAVE_RESULT, EV_PERF_TICK, EV_EVAL_POOL_CHOICE, 
 	EV_USR_HASHRATE, EV_USR_RESULTS, EV_USR_CONNSTAT, EV_HASHRATE_LOOP, 
-	EV_HTML_HASHRATE, EV_HTML_RESULTS, EV_HTML_CONNSTAT, EV_HTML_JSON };
+	EV_HTML_HASHRATE, EV_HTML_RESULTS, EV_HTML_CONNSTAT, EV_HTML_JSON, EV_CONFIG_RELOAD, EV_SHUTDOWN,
+	EV_MINER_HAVE_RESULTS };
 
 /*
    This is how I learned to stop worrying and love c++11 =).
@@ -100,12 +124,14 @@ struct ex_event
 		job_result oJobResult;
 		sock_err oSocketError;
 		gpu_res_err oGpuError;
+		result_batch oResults;
 	};
 
 	ex_event() { iName = EV_INVALID_VAL; iPoolId = 0;}
 	ex_event(const char* gpu_err, size_t gpu_idx, size_t id) : iName(EV_GPU_RES_ERROR), iPoolId(id), oGpuError(gpu_err, gpu_idx) {}
 	ex_event(std::string&& err, bool silent, size_t id) : iName(EV_SOCK_ERROR), iPoolId(id), oSocketError(std::move(err), silent) { }
 	ex_event(job_result dat, size_t id) : iName(EV_MINER_HAVE_RESULT), iPoolId(id), oJobResult(dat) {}
+	ex_event(result_batch&& dat, size_t id) : iName(EV_MINER_HAVE_RESULTS), iPoolId(id), oResults(std::move(dat)) {}
 	ex_event(pool_job dat, size_t id) : iName(EV_POOL_HAVE_JOB), iPoolId(id), oPoolJob(dat) {}
 	ex_event(ex_event_name ev, size_t id = 0) : iName(ev), iPoolId(id) {}
 
@@ -123,6 +149,9 @@ struct ex_event
 		case EV_SOCK_ERROR:
 			new (&oSocketError) sock_err(std::move(from.oSocketError));
 			break;
+		case EV_MINER_HAVE_RESULTS:
+			new (&oResults) result_batch(std::move(from.oResults));
+			break;
 		case EV_MINER_HAVE_RESULT:
 			oJobResult = from.oJobResult;
 			break;
@@ -142,6 +171,8 @@ struct ex_event
 
 		if(iName == EV_SOCK_ERROR)
 			oSocketError.~sock_err();
+		else if(iName == EV_MINER_HAVE_RESULTS)
+			oResults.~result_batch();
 
 		iName = from.iName;
 		iPoolId = from.iPoolId;
@@ -152,6 +183,9 @@ struct ex_event
 			new (&oSocketError) sock_err();
 			oSocketError = std::move(from.oSocketError);
 			break;
+		case EV_MINER_HAVE_RESULTS:
+			new (&oResults) result_batch(std::move(from.oResults));
+			break;
 		case EV_MINER_HAVE_RESULT:
 			oJobResult = from.oJobResult;
 			break;
@@ -171,6 +205,8 @@ struct ex_event
 	{
 		if(iName == EV_SOCK_ERROR)
 			oSocketError.~sock_err();
+		else if(iName == EV_MINER_HAVE_RESULTS)
+			oResults.~result_batch();
 	}
 };
 
@@ -27,6 +27,11 @@
 #include "xmrstak/misc/console.hpp"
 #include "xmrstak/misc/executor.hpp"
 
+#include <algorithm>
+#include <map>
+#include <mutex>
+#include <vector>
+
 #ifndef CONF_NO_TLS
 #include <openssl/ssl.h>
 #include <openssl/err.h>
@@ -37,106 +42,324 @@
 #endif
 #endif
 
-plain_socket::plain_socket(jpsock* err_callback) : pCallback(err_callback)
+/*
+ * Address resolution and connect racing (RFC 8305 "happy eyeballs").
+ *
+ * Resolved addresses are cached per host for iDnsCacheTime seconds, getaddrinfo gives us no
+ * record TTL, so this is an upper bound. A stale entry is still used if the DNS server fails.
+ * Connects to all addresses are started iConnectDelay ms apart, alternating between IPv4 and
+ * IPv6, and the first one to complete wins. Addresses that failed recently are tried last.
+ */
+namespace
 {
-	hSocket = INVALID_SOCKET;
-	pSockAddr = nullptr;
-}
 
-bool plain_socket::set_hostname(const char* sAddr)
+constexpr size_t iDnsCacheTime = 300;
+constexpr size_t iAddrFailTime = 300;
+constexpr size_t iConnectDelay = 250;
+
+struct sock_addr
 {
-	char sAddrMb[256];
-	char *sTmp, *sPort;
+	sockaddr_storage addr;
+	socklen_t len;
 
-	sock_closed = false;
-	size_t ln = strlen(sAddr);
-	if (ln >= sizeof(sAddrMb))
-		return pCallback->set_socket_error("CONNECT error: Pool address overflow.");
+	inline std::string key() const { return std::string((const char*)&addr, len); }
+};
+
+struct dns_entry
+{
+	std::vector<sock_addr> addrs;
+	size_t expire;
+};
 
-	memcpy(sAddrMb, sAddr, ln);
-	sAddrMb[ln] = '\0';
+std::mutex dns_mutex;
+std::map<std::string, dns_entry> dns_cache;
+std::map<std::string, size_t> addr_failures;
 
-	if ((sTmp = strstr(sAddrMb, "//")) != nullptr)
+bool resolve_address(jpsock* pCallback, const std::string& host, const std::string& port, std::vector<sock_addr>& addrs)
+{
+	std::string dns_key = host + ":" + port;
+	std::unique_lock<std::mutex> lck(dns_mutex);
+	auto it = dns_cache.find(dns_key);
+	if(it != dns_cache.end() && it->second.expire > get_timestamp())
 	{
-		sTmp += 2;
-		memmove(sAddrMb, sTmp, strlen(sTmp) + 1);
+		addrs = it->second.addrs;
+		return true;
 	}
-
-	if ((sPort = strchr(sAddrMb, ':')) == nullptr)
-		return pCallback->set_socket_error("CONNECT error: Pool port number not specified, please use format <hostname>:<port>.");
-
-	sPort[0] = '\0';
-	sPort++;
+	lck.unlock();
 
 	addrinfo hints = { 0 };
 	hints.ai_family = AF_UNSPEC;
 	hints.ai_socktype = SOCK_STREAM;
 	hints.ai_protocol = IPPROTO_TCP;
 
-	pAddrRoot = nullptr;
+	addrinfo *pAddrRoot = nullptr;
 	int err;
-	if ((err = getaddrinfo(sAddrMb, sPort, &hints, &pAddrRoot)) != 0)
+	if ((err = getaddrinfo(host.c_str(), port.c_str(), &hints, &pAddrRoot)) != 0)
+	{
+		lck.lock();
+		it = dns_cache.find(dns_key);
+		if(it != dns_cache.end())
+		{
+			addrs = it->second.addrs;
+			return true;
+		}
 		return pCallback->set_socket_error_strerr("CONNECT error: GetAddrInfo: ", err);
+	}
 
-	addrinfo *ptr = pAddrRoot;
-	std::vector<addrinfo*> ipv4;
-	std::vector<addrinfo*> ipv6;
-
-	while (ptr != nullptr)
+	for(addrinfo *ptr = pAddrRoot; ptr != nullptr; ptr = ptr->ai_next)
 	{
-		if (ptr->ai_family == AF_INET)
-			ipv4.push_back(ptr);
-		if (ptr->ai_family == AF_INET6)
-			ipv6.push_back(ptr);
-		ptr = ptr->ai_next;
+		if ((ptr->ai_family != AF_INET && ptr->ai_family != AF_INET6) || ptr->ai_addrlen > sizeof(sockaddr_storage))
+			continue;
+
+		sock_addr sa;
+		memcpy(&sa.addr, ptr->ai_addr, ptr->ai_addrlen);
+		sa.len = (socklen_t)ptr->ai_addrlen;
+		addrs.push_back(sa);
 	}
+	freeaddrinfo(pAddrRoot);
 
-	if (ipv4.empty() && ipv6.empty())
-	{
-		freeaddrinfo(pAddrRoot);
-		pAddrRoot = nullptr;
+	if (addrs.empty())
 		return pCallback->set_socket_error("CONNECT error: I found some DNS records but no IPv4 or IPv6 addresses.");
+
+	lck.lock();
+	dns_entry& entry = dns_cache[dns_key];
+	entry.addrs = addrs;
+	entry.expire = get_timestamp() + iDnsCacheTime;
+	return true;
+}
+
+// Shuffled, preferred family first, families interleaved, recently failed addresses last
+void order_addresses(std::vector<sock_addr>& addrs)
+{
+	std::vector<sock_addr> ipv4, ipv6;
+	for(sock_addr& sa : addrs)
+		(sa.addr.ss_family == AF_INET ? ipv4 : ipv6).push_back(sa);
+
+	for(size_t i = ipv4.size(); i > 1; i--)
+		std::swap(ipv4[i - 1], ipv4[rand() % i]);
+	for(size_t i = ipv6.size(); i > 1; i--)
+		std::swap(ipv6[i - 1], ipv6[rand() % i]);
+
+	std::vector<sock_addr>& first = jconf::inst()->PreferIpv4() ? ipv4 : ipv6;
+	std::vector<sock_addr>& second = jconf::inst()->PreferIpv4() ? ipv6 : ipv4;
+
+	addrs.clear();
+	for(size_t i = 0; i < first.size() || i < second.size(); i++)
+	{
+		if(i < first.size())
+			addrs.push_back(first[i]);
+		if(i < second.size())
+			addrs.push_back(second[i]);
 	}
-	else if (!ipv4.empty() && ipv6.empty())
-		pSockAddr = ipv4[rand() % ipv4.size()];
-	else if (ipv4.empty() && !ipv6.empty())
-		pSockAddr = ipv6[rand() % ipv6.size()];
-	else if (!ipv4.empty() && !ipv6.empty())
+
+	size_t now = get_timestamp();
+	std::lock_guard<std::mutex> lck(dns_mutex);
+	std::stable_partition(addrs.begin(), addrs.end(), [now](const sock_addr& sa) {
+		auto it = addr_failures.find(sa.key());
+		return it == addr_failures.end() || it->second + iAddrFailTime < now;
+	});
+}
+
+void log_addr_failure(const sock_addr& sa, bool failed)
+{
+	std::lock_guard<std::mutex> lck(dns_mutex);
+	if(failed)
+		addr_failures[sa.key()] = get_timestamp();
+	else
+		addr_failures.erase(sa.key());
+}
+
+} // namespace
+
+bool base_socket::parse_address(jpsock* pCallback, const char* sAddr)
+{
+	std::string addr(sAddr);
+
+	size_t pos = addr.find("//");
+	if (pos != std::string::npos)
+		addr.erase(0, pos + 2);
+
+	if ((pos = addr.find(':')) == std::string::npos)
+		return pCallback->set_socket_error("CONNECT error: Pool port number not specified, please use format <hostname>:<port>.");
+
+	sHost = addr.substr(0, pos);
+	sPort = addr.substr(pos + 1);
+	return true;
+}
+
+SOCKET base_socket::connect_race(jpsock* pCallback)
+{
+	std::vector<sock_addr> addrs;
+	if(!resolve_address(pCallback, sHost, sPort, addrs))
+		return INVALID_SOCKET;
+	order_addresses(addrs);
+
+	struct attempt
 	{
-		if(jconf::inst()->PreferIpv4())
-			pSockAddr = ipv4[rand() % ipv4.size()];
-		else
-			pSockAddr = ipv6[rand() % ipv6.size()];
+		SOCKET sck;
+		size_t addr;
+	};
+	std::vector<attempt> attempts;
+	SOCKET hWinner = INVALID_SOCKET;
+	int iLastError = 0;
+	bool bTimeout = false;
+	size_t next = 0;
+	size_t t_next = get_timestamp_ms();
+	size_t t_deadline = t_next + jconf::inst()->GetCallTimeout() * 1000;
+
+	while(hWinner == INVALID_SOCKET && !sock_closed)
+	{
+		size_t now = get_timestamp_ms();
+		if(now >= t_deadline)
+		{
+			// Blackholed addresses end up here
+			for(attempt& a : attempts)
+				log_addr_failure(addrs[a.addr], true);
+			bTimeout = true;
+			break;
+		}
+
+		// Start the next attempt if the previous ones didn't finish in time
+		if(next < addrs.size() && (attempts.empty() || now >= t_next))
+		{
+			const sock_addr& sa = addrs[next];
+			SOCKET s = socket(sa.addr.ss_family, SOCK_STREAM, IPPROTO_TCP);
+			if(s != INVALID_SOCKET && sock_set_nonblocking(s, true))
+			{
+				if(::connect(s, (const sockaddr*)&sa.addr, sa.len) == 0)
+					hWinner = s;
+				else if(sock_connect_pending())
+					attempts.push_back({s, next});
+				else
+				{
+					iLastError = sock_last_error();
+					sock_close(s);
+					log_addr_failure(sa, true);
+				}
+			}
+			else
+			{
+				iLastError = sock_last_error();
+				if(s != INVALID_SOCKET)
+					sock_close(s);
+			}
+
+			if(hWinner != INVALID_SOCKET)
+			{
+				log_addr_failure(sa, false);
+				break;
+			}
+
+			next++;
+			t_next = now + iConnectDelay;
+			continue;
+		}
+
+		if(attempts.empty())
+			break;
+
+		fd_set wfds, efds;
+		FD_ZERO(&wfds);
+		FD_ZERO(&efds);
+		SOCKET max_fd = 0;
+		for(attempt& a : attempts)
+		{
+			FD_SET(a.sck, &wfds);
+			FD_SET(a.sck, &efds);
+			max_fd = std::max(max_fd, a.sck);
+		}
+
+		size_t wait = t_deadline - now;
+		if(next < addrs.size())
+			wait = std::min(wait, t_next - now);
+		wait = std::min<size_t>(wait, iConnectDelay);
+
+		timeval tv;
+		tv.tv_sec = 0;
+		tv.tv_usec = long(wait * 1000);
+		if(select(int(max_fd + 1), nullptr, &wfds, &efds, &tv) <= 0)
+			continue;
+
+		for(size_t i = 0; i < attempts.size();)
+		{
+			attempt& a = attempts[i];
+			if(!FD_ISSET(a.sck, &wfds) && !FD_ISSET(a.sck, &efds))
+			{
+				i++;
+				continue;
+			}
+
+			int err = 0;
+			socklen_t len = sizeof(err);
+			if(getsockopt(a.sck, SOL_SOCKET, SO_ERROR, (char*)&err, &len) != 0)
+				err = sock_last_error();
+
+			if(err == 0 && FD_ISSET(a.sck, &wfds))
+			{
+				hWinner = a.sck;
+				log_addr_failure(addrs[a.addr], false);
+				attempts.erase(attempts.begin() + i);
+				break;
+			}
+
+			iLastError = err;
+			sock_close(a.sck);
+			log_addr_failure(addrs[a.addr], true);
+			attempts.erase(attempts.begin() + i);
+		}
 	}
 
-	hSocket = socket(pSockAddr->ai_family, pSockAddr->ai_socktype, pSockAddr->ai_protocol);
+	for(attempt& a : attempts)
+		sock_close(a.sck);
 
-	if (hSocket == INVALID_SOCKET)
+	if(hWinner == INVALID_SOCKET)
 	{
-		freeaddrinfo(pAddrRoot);
-		pAddrRoot = nullptr;
-		return pCallback->set_socket_error_strerr("CONNECT error: Socket creation failed ");
+		if(sock_closed)
+			pCallback->set_socket_error("CONNECT error: Socket closed.");
+		else if(bTimeout)
+			pCallback->set_socket_error("CONNECT error: Connection timed out.");
+		else
+		{
+			sock_set_errno(iLastError);
+			pCallback->set_socket_error_strerr("CONNECT error: ");
+		}
+		return INVALID_SOCKET;
 	}
 
+	sock_set_nonblocking(hWinner, false);
+
 	int flag = 1;
 	/* If it fails, it fails, we won't loose too much sleep over it */
-	setsockopt(hSocket, IPPROTO_TCP, TCP_NODELAY, (char *) &flag, sizeof(int));
+	setsockopt(hWinner, IPPROTO_TCP, TCP_NODELAY, (char *) &flag, sizeof(int));
 
-	return true;
+	return hWinner;
 }
 
-bool plain_socket::connect()
+plain_socket::plain_socket(jpsock* err_callback) : pCallback(err_callback)
+{
+	hSocket = INVALID_SOCKET;
+}
+
+bool plain_socket::set_hostname(const char* sAddr)
 {
 	sock_closed = false;
-	int ret = ::connect(hSocket, pSockAddr->ai_addr, (int)pSockAddr->ai_addrlen);
+	return parse_address(pCallback, sAddr);
+}
 
-	freeaddrinfo(pAddrRoot);
-	pAddrRoot = nullptr;
+bool plain_socket::connect()
+{
+	SOCKET s = connect_race(pCallback);
+	if (s == INVALID_SOCKET)
+		return false;
 
-	if (ret != 0)
-		return pCallback->set_socket_error_strerr("CONNECT error: ");
-	else
-		return true;
+	hSocket = s;
+	if(sock_closed)
+	{
+		// close() was called while we were connecting
+		close(false);
+		return pCallback->set_socket_error("CONNECT error: Socket closed.");
+	}
+	return true;
 }
 
 int plain_socket::recv(char* buf, unsigned int len)
@@ -175,9 +398,9 @@ bool plain_socket::send(const char* buf)
 
 void plain_socket::close(bool free)
 {
+	sock_closed = true;
 	if(hSocket != INVALID_SOCKET)
 	{
-		sock_closed = true;
 		sock_close(hSocket);
 		hSocket = INVALID_SOCKET;
 	}
@@ -209,51 +432,118 @@ void tls_socket::print_error()
 	BIO_free(err_bio);
 }
 
-void tls_socket::init_ctx()
+/*
+ * All pools share one SSL_CTX. Sessions (and TLS 1.3 tickets) are kept per pool address
+ * so a reconnect can skip the full handshake. The session holds the peer certificate,
+ * so the fingerprint check works the same for resumed connections.
+ */
+namespace
 {
+
+std::mutex tls_mutex;
+SSL_CTX* tls_ctx = nullptr;
+std::map<std::string, SSL_SESSION*> tls_sessions;
+
+void forget_session(const std::string& pool_addr)
+{
+	std::lock_guard<std::mutex> lck(tls_mutex);
+	auto it = tls_sessions.find(pool_addr);
+	if(it != tls_sessions.end())
+	{
+		SSL_SESSION_free(it->second);
+		tls_sessions.erase(it);
+	}
+}
+
+int new_session_cb(SSL* ssl, SSL_SESSION* sess)
+{
+	jpsock* pool = (jpsock*)SSL_get_app_data(ssl);
+	if(pool == nullptr)
+		return 0;
+
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L
+	/* OpenSSL marks the live session as not resumable when the connection ends with an error,
+	 * e.g. the pool dropping the TCP connection. That doesn't make the ticket bad, so keep a copy.
+	 * Failed handshakes and fingerprint checks remove the session in connect().
+	 */
+	SSL_SESSION* copy = SSL_SESSION_dup(sess);
+	if(copy == nullptr)
+		return 0;
+#else
+	SSL_SESSION* copy = sess;
+#endif
+
+	std::lock_guard<std::mutex> lck(tls_mutex);
+	SSL_SESSION*& cached = tls_sessions[pool->get_pool_addr()];
+	if(cached != nullptr)
+		SSL_SESSION_free(cached);
+	cached = copy;
+
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L
+	return 0;
+#else
+	// We keep the reference
+	return 1;
+#endif
+}
+
+} // namespace
+
+bool tls_socket::init_ctx()
+{
+	std::lock_guard<std::mutex> lck(tls_mutex);
+	if(tls_ctx != nullptr)
+		return true;
+
 	const SSL_METHOD* method = SSLv23_method();
 
 	if(method == nullptr)
-		return;
+		return false;
 
-	ctx = SSL_CTX_new(method);
-	if(ctx == nullptr)
-		return;
+	tls_ctx = SSL_CTX_new(method);
+	if(tls_ctx == nullptr)
+		return false;
 
 	if(jconf::inst()->TlsSecureAlgos())
 	{
-		SSL_CTX_set_options(ctx, SSL_OP_NO_SSLv2 | SSL_OP_NO_SSLv3 | SSL_OP_NO_TLSv1);
+		SSL_CTX_set_options(tls_ctx, SSL_OP_NO_SSLv2 | SSL_OP_NO_SSLv3 | SSL_OP_NO_TLSv1);
 	}
+
+	SSL_CTX_set_session_cache_mode(tls_ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+	SSL_CTX_sess_set_new_cb(tls_ctx, new_session_cb);
+	return true;
 }
 
 bool tls_socket::set_hostname(const char* sAddr)
 {
 	sock_closed = false;
-	if(ctx == nullptr)
-	{
-		init_ctx();
-		if(ctx == nullptr)
-		{
-			print_error();
-			return false;
-		}
-	}
-
-	if((bio = BIO_new_ssl_connect(ctx)) == nullptr)
+	if(!init_ctx())
 	{
 		print_error();
 		return false;
 	}
 
-	int flag = 1;
-	/* If it fails, it fails, we won't loose too much sleep over it */
-	setsockopt(BIO_get_fd(bio, nullptr), IPPROTO_TCP, TCP_NODELAY, (char *) &flag, sizeof(int));
+	return parse_address(pCallback, sAddr);
+}
+
+bool tls_socket::connect()
+{
+	// TCP connect is shared with plain sockets, OpenSSL only does the handshake on top of it
+	SOCKET s = connect_race(pCallback);
+	if(s == INVALID_SOCKET)
+		return false;
 
-	if(BIO_set_conn_hostname(bio, sAddr) != 1)
+	BIO* sbio = BIO_new_socket(int(s), BIO_CLOSE);
+	if(sbio == nullptr || (bio = BIO_new_ssl(tls_ctx, 1)) == nullptr)
 	{
+		if(sbio != nullptr)
+			BIO_free(sbio);
+		else
+			sock_close(s);
 		print_error();
 		return false;
 	}
+	bio = BIO_push(bio, sbio);
 
 	BIO_get_ssl(bio, &ssl);
 	if(ssl == nullptr)
@@ -262,6 +552,11 @@ bool tls_socket::set_hostname(const char* sAddr)
 		return false;
 	}
 
+	// SNI is only defined for host names, not for IP literals
+	in6_addr tmp_addr;
+	if(inet_pton(AF_INET, sHost.c_str(), &tmp_addr) != 1 && inet_pton(AF_INET6, sHost.c_str(), &tmp_addr) != 1)
+		SSL_set_tlsext_host_name(ssl, sHost.c_str());
+
 	if(jconf::inst()->TlsSecureAlgos())
 	{
 		if(SSL_set_cipher_list(ssl, "HIGH:!aNULL:!PSK:!SRP:!MD5:!RC4:!SHA1") != 1)
@@ -271,23 +566,28 @@ bool tls_socket::set_hostname(const char* sAddr)
 		}
 	}
 
-	return true;
-}
-
-bool tls_socket::connect()
-{
-	sock_closed = false;
-	if(BIO_do_connect(bio) != 1)
+	if(sock_closed)
 	{
-		print_error();
+		pCallback->set_socket_error("CONNECT error: Socket closed.");
 		return false;
 	}
 
+	SSL_set_app_data(ssl, pCallback);
+	{
+		std::lock_guard<std::mutex> lck(tls_mutex);
+		auto it = tls_sessions.find(pCallback->get_pool_addr());
+		if(it != tls_sessions.end())
+			SSL_set_session(ssl, it->second);
+	}
+
+	size_t t_start = get_timestamp_ms();
 	if(BIO_do_handshake(bio) != 1)
 	{
+		forget_session(pCallback->get_pool_addr());
 		print_error();
 		return false;
 	}
+	pCallback->log_tls_handshake(SSL_session_reused(ssl) != 0, get_timestamp_ms() - t_start);
 
 	/* Step 1: verify a server certificate was presented during the negotiation */
 	X509* cert = SSL_get_peer_certificate(ssl);
@@ -344,6 +644,7 @@ bool tls_socket::connect()
 		}
 
 		pCallback->set_socket_error("FINGERPRINT FAILED CHECK");
+		forget_session(pCallback->get_pool_addr());
 		BIO_free_all(b64);
 		X509_free(cert);
 		return false;
@@ -377,10 +678,10 @@ bool tls_socket::send(const char* buf)
 
 void tls_socket::close(bool free)
 {
+	sock_closed = true;
 	if(bio == nullptr || ssl == nullptr)
 		return;
 
-	sock_closed = true;
 	if(!free)
 	{
 		sock_close(BIO_get_fd(bio, nullptr));
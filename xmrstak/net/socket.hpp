@@ -1,6 +1,7 @@
 #pragma once
 
 #include <atomic>
+#include <string>
 #include "socks.hpp"
 
 class jpsock;
@@ -8,6 +9,8 @@ class jpsock;
 class base_socket
 {
 public:
+	virtual ~base_socket() {}
+
 	virtual bool set_hostname(const char* sAddr) = 0;
 	virtual bool connect() = 0;
 	virtual int recv(char* buf, unsigned int len) = 0;
@@ -15,7 +18,14 @@ public:
 	virtual void close(bool free) = 0;
 
 protected:
+	// Split <hostname>:<port> into sHost and sPort, no network access
+	bool parse_address(jpsock* pCallback, const char* sAddr);
+	// Connect to the resolved addresses of sHost, see socket.cpp
+	SOCKET connect_race(jpsock* pCallback);
+
 	std::atomic<bool> sock_closed;
+	std::string sHost;
+	std::string sPort;
 };
 
 class plain_socket : public base_socket
@@ -31,8 +41,6 @@ public:
 
 private:
 	jpsock* pCallback;
-	addrinfo *pSockAddr;
-	addrinfo *pAddrRoot;
 	SOCKET hSocket;
 };
 
@@ -52,12 +60,11 @@ public:
 	void close(bool free);
 
 private:
-	void init_ctx();
+	static bool init_ctx();
 	void print_error();
 
 	jpsock* pCallback;
 
-	SSL_CTX* ctx = nullptr;
 	BIO* bio = nullptr;
 	SSL* ssl = nullptr;
 };
@@ -40,6 +40,28 @@ inline const char* sock_strerror(char* buf, size_t len)
 	return buf;
 }
 
+inline bool sock_set_nonblocking(SOCKET s, bool nonblocking)
+{
+	u_long mode = nonblocking ? 1 : 0;
+	return ioctlsocket(s, FIONBIO, &mode) == 0;
+}
+
+inline bool sock_connect_pending()
+{
+	int err = WSAGetLastError();
+	return err == WSAEWOULDBLOCK || err == WSAEINPROGRESS;
+}
+
+inline int sock_last_error()
+{
+	return WSAGetLastError();
+}
+
+inline void sock_set_errno(int err)
+{
+	WSASetLastError(err);
+}
+
 inline const char* sock_gai_strerror(int err, char* buf, size_t len)
 {
 	buf[0] = '\0';
@@ -64,6 +86,7 @@ inline const char* sock_gai_strerror(int err, char* buf, size_t len)
 #include <string.h>
 #include <netinet/in.h> /* Needed for IPPROTO_TCP */
 #include <netinet/tcp.h>
+#include <fcntl.h>
 
 inline void sock_init() {}
 typedef int SOCKET;
@@ -90,6 +113,30 @@ inline const char* sock_strerror(char* buf, size_t len)
 #endif
 }
 
+inline bool sock_set_nonblocking(SOCKET s, bool nonblocking)
+{
+	int flags = fcntl(s, F_GETFL, 0);
+	if(flags == -1)
+		return false;
+	flags = nonblocking ? (flags | O_NONBLOCK) : (flags & ~O_NONBLOCK);
+	return fcntl(s, F_SETFL, flags) == 0;
+}
+
+inline bool sock_connect_pending()
+{
+	return errno == EINPROGRESS;
+}
+
+inline int sock_last_error()
+{
+	return errno;
+}
+
+inline void sock_set_errno(int err)
+{
+	errno = err;
+}
+
 inline const char* sock_gai_strerror(int err, char* buf, size_t len)
 {
 	buf[0] = '\0';
@@ -22,11 +22,18 @@ struct params
 	std::string binaryName;
 	bool useAMD;
 	bool AMDCache;
+	// only fill the OpenCL binary cache and exit, the result is set by the AMD backend
+	bool AMDPrecompile = false;
+	bool AMDPrecompileOk = false;
 	bool useNVIDIA;
 	bool useCPU;
+	// number of simulated GPUs of the fake test backend
+	uint32_t fakeDevices = 0;
 	int realCPUCount = -1;
 	// user selected OpenCL vendor
 	std::string openCLVendor;
+	// user selected OpenCL device type (GPU, CPU or ALL)
+	std::string openCLDeviceType;
 
 	bool poolUseTls = false;
 	std::string poolURL;
@@ -66,6 +73,7 @@ struct params
 		useNVIDIA(true),
 		useCPU(true),
 		openCLVendor("AMD"),
+		openCLDeviceType("GPU"),
 		configFile("config.txt"),
 		configFilePools("pools.txt"),
 		configFileAMD("amd.txt"),